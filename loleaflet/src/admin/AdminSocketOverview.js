@@ -12,11 +12,13 @@ var AdminSocketOverview = AdminSocketBase.extend({
 		this.socket.send('total_mem');
 		this.socket.send('active_docs_count');
 		this.socket.send('active_users_count');
+		this.socket.send('prespawn');
+		this.socket.send('client_queues');
 	},
 
 	onSocketOpen: function() {
 		this.socket.send('documents');
-		this.socket.send('subscribe document addview rmview rmdoc');
+		this.socket.send('subscribe document addview rmview rmdoc prespawn');
 
 		this._getBasicStats();
 		var socketOverview = this;
@@ -74,6 +76,8 @@ var AdminSocketOverview = AdminSocketBase.extend({
 				var sUrl = docProps[1];
 				var sViews = docProps[2];
 				var sMem = docProps[3];
+				var sUnique = docProps[4];
+				var sShared = docProps[5];
 				if (sUrl === '0') {
 					continue;
 				}
@@ -94,6 +98,12 @@ var AdminSocketOverview = AdminSocketBase.extend({
 				var memEle = document.createElement('td');
 				memEle.innerHTML = sMem;
 				rowContainer.appendChild(memEle);
+				var uniqueEle = document.createElement('td');
+				uniqueEle.innerHTML = sUnique;
+				rowContainer.appendChild(uniqueEle);
+				var sharedEle = document.createElement('td');
+				sharedEle.innerHTML = sShared;
+				rowContainer.appendChild(sharedEle);
 			}
 		}
 		else if (textMsg.startsWith('addview')) {
@@ -116,6 +126,8 @@ var AdminSocketOverview = AdminSocketBase.extend({
 			var sPid = docProps[0];
 			var sUrl = docProps[1];
 			var sMem = docProps[2];
+			var sUnique = docProps[3];
+			var sShared = docProps[4];
 			var docEle = document.getElementById('doc' + sPid);
 			if (docEle) {
 				tableContainer.removeChild(docEle);
@@ -140,6 +152,12 @@ var AdminSocketOverview = AdminSocketBase.extend({
 			var memEle = document.createElement('td');
 			memEle.innerHTML = sMem;
 			rowContainer.appendChild(memEle);
+			var uniqueEle = document.createElement('td');
+			uniqueEle.innerHTML = sUnique;
+			rowContainer.appendChild(uniqueEle);
+			var sharedEle = document.createElement('td');
+			sharedEle.innerHTML = sShared;
+			rowContainer.appendChild(sharedEle);
 
 			var totalUsersEle = document.getElementById('active_docs_count');
 			totalUsersEle.innerHTML = parseInt(totalUsersEle.innerHTML) + 1;
@@ -150,10 +168,43 @@ var AdminSocketOverview = AdminSocketBase.extend({
 		{
 			textMsg = textMsg.split(' ');
 			var sCommand = textMsg[0];
+			// total_mem is followed by PSS, USS and shared; show PSS.
 			var nData = parseInt(textMsg[1]);
 
 			document.getElementById(sCommand).innerHTML = nData;
 		}
+		else if (textMsg.startsWith('prespawn')) {
+			// Hits, misses, empty children, and their target.
+			var poolStats = textMsg.substring('prespawn'.length).trim().split(' ');
+			document.getElementById('prespawn').innerHTML =
+				parseInt(poolStats[0]) + ' / ' + parseInt(poolStats[1]);
+		}
+		else if (textMsg.startsWith('client_queues')) {
+			// Clients dropped for reading too slowly, then session,queued,max,coalesced of each.
+			var clients = textMsg.substring('client_queues'.length).trim().split(' ');
+			var queuedBytes = 0;
+			var clientContainer = document.getElementById('clientlist');
+			while (clientContainer.firstChild) {
+				clientContainer.removeChild(clientContainer.firstChild);
+			}
+			for (var i = 1; i < clients.length; i++) {
+				var clientProps = clients[i].split(',');
+				if (clientProps.length !== 4) {
+					continue;
+				}
+				queuedBytes += parseInt(clientProps[1]);
+
+				var clientRow = document.createElement('tr');
+				for (var j = 0; j < clientProps.length; j++) {
+					var cellEle = document.createElement('td');
+					cellEle.innerHTML = clientProps[j];
+					clientRow.appendChild(cellEle);
+				}
+				clientContainer.appendChild(clientRow);
+			}
+			document.getElementById('client_queues').innerHTML =
+				Math.round(queuedBytes / 1024) + ' / ' + parseInt(clients[0]);
+		}
 		else if (textMsg.startsWith('rmdoc')) {
 			textMsg = textMsg.substring('rmdoc'.length);
 			var docProps = textMsg.trim().split(' ');
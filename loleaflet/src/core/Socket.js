@@ -4,7 +4,7 @@
 
 /* global _ vex */
 L.Socket = L.Class.extend({
-	ProtocolVersionNumber: '0.1',
+	ProtocolVersionNumber: '0.4',
 
 	initialize: function (map) {
 		this._map = map;
@@ -66,6 +66,9 @@ L.Socket = L.Class.extend({
 		if (this._map._docPassword) {
 			msg += ' password=' + this._map._docPassword;
 		}
+		if (this._map.options.tileEncoder) {
+			msg += ' tileencoder=' + this._map.options.tileEncoder;
+		}
 		if (this._map.options.renderingOptions) {
 			var options = {
 				'rendering': this._map.options.renderingOptions
@@ -82,6 +85,49 @@ L.Socket = L.Class.extend({
 		this._msgQueue = [];
 	},
 
+	// Handles the messages the server sent together, in order.
+	_onBatch: function (data, textMsg, offset) {
+		var sizes = textMsg.substring(13).split(',');
+		for (var i = 0; i < sizes.length; i++) {
+			var size = parseInt(sizes[i]);
+			this._onMessage({data: data.slice(offset, offset + size)});
+			offset += size;
+		}
+	},
+
+	// Returns the text form of a tile message in binary form, see protocol.txt.
+	_decodeTileHeader: function (data) {
+		var view = new DataView(data);
+		var type = view.getUint8(0);
+		var extraSize = view.getUint16(2, true);
+		var fields = ['part', 'width', 'height', 'tileposx', 'tileposy', 'tilewidth', 'tileheight'];
+		var msg = ['tile', 'tile:', 'delta:', 'solidtile:'][type - 1];
+		for (var i = 0; i < fields.length; i++) {
+			msg += ' ' + fields[i] + '=' + view.getInt32(4 + 4 * i, true);
+		}
+		if (extraSize > 0) {
+			msg += ' ' + String.fromCharCode.apply(null, new Uint8Array(data, 64, extraSize));
+		}
+		var version = view.getInt32(32, true);
+		if (version > 0) {
+			msg += ' ver=' + version;
+		}
+		if (type === 3) {
+			msg += ' oldver=' + view.getInt32(36, true) +
+				' deltax=' + view.getInt32(40, true) +
+				' deltay=' + view.getInt32(44, true) +
+				' deltawidth=' + view.getInt32(48, true) +
+				' deltaheight=' + view.getInt32(52, true);
+		}
+		else if (type === 4) {
+			msg += ' color=';
+			for (i = 56; i < 60; i++) {
+				msg += ('0' + view.getUint8(i).toString(16)).slice(-2);
+			}
+		}
+		return msg;
+	},
+
 	_onMessage: function (e) {
 		var imgBytes, index, textMsg;
 
@@ -90,12 +136,27 @@ L.Socket = L.Class.extend({
 		}
 		else if (typeof (e.data) === 'object') {
 			imgBytes = new Uint8Array(e.data);
-			index = 0;
-			// search for the first newline which marks the end of the message
-			while (index < imgBytes.length && imgBytes[index] !== 10) {
-				index++;
+			if (imgBytes.length >= 64 && imgBytes[0] >= 1 && imgBytes[0] <= 4) {
+				// A tile message in binary form, the image follows the extra parameters.
+				textMsg = this._decodeTileHeader(e.data);
+				index = 63 + (imgBytes[2] | imgBytes[3] << 8);
+				if (textMsg.startsWith('solidtile:')) {
+					imgBytes = undefined;
+				}
+			}
+			else {
+				index = 0;
+				// search for the first newline which marks the end of the message
+				while (index < imgBytes.length && imgBytes[index] !== 10) {
+					index++;
+				}
+				textMsg = String.fromCharCode.apply(null, imgBytes.subarray(0, index));
+
+				if (textMsg.startsWith('batch: sizes=')) {
+					this._onBatch(e.data, textMsg, index + 1);
+					return;
+				}
 			}
-			textMsg = String.fromCharCode.apply(null, imgBytes.subarray(0, index));
 		}
 
 		var command = this.parseServerCmd(textMsg);
@@ -142,7 +203,7 @@ L.Socket = L.Class.extend({
 				return;
 			}
 		}
-		else if (!textMsg.startsWith('tile:') && !textMsg.startsWith('renderfont:')) {
+		else if (!textMsg.startsWith('tile:') && !textMsg.startsWith('delta:') && !textMsg.startsWith('renderfont:')) {
 			// log the tile msg separately as we need the tile coordinates
 			L.Log.log(textMsg, L.INCOMING);
 			if (imgBytes !== undefined) {
@@ -312,6 +373,32 @@ L.Socket = L.Class.extend({
 			else if (tokens[i].substring(0, 5) === 'font=') {
 				command.font = window.decodeURIComponent(tokens[i].substring(5));
 			}
+			else if (tokens[i].substring(0, 6) === 'color=') {
+				command.color = tokens[i].substring(6);
+			}
+			else if (tokens[i].substring(0, 4) === 'ver=') {
+				command.ver = parseInt(tokens[i].substring(4));
+			}
+			else if (tokens[i].substring(0, 7) === 'oldver=') {
+				command.oldVer = parseInt(tokens[i].substring(7));
+			}
+			else if (tokens[i].substring(0, 7) === 'pushed=') {
+				command.pushed = tokens[i].substring(7).split(',').map(function (value) {
+					return parseInt(value);
+				});
+			}
+			else if (tokens[i].substring(0, 7) === 'deltax=') {
+				command.deltaX = parseInt(tokens[i].substring(7));
+			}
+			else if (tokens[i].substring(0, 7) === 'deltay=') {
+				command.deltaY = parseInt(tokens[i].substring(7));
+			}
+			else if (tokens[i].substring(0, 11) === 'deltawidth=') {
+				command.deltaWidth = parseInt(tokens[i].substring(11));
+			}
+			else if (tokens[i].substring(0, 12) === 'deltaheight=') {
+				command.deltaHeight = parseInt(tokens[i].substring(12));
+			}
 		}
 		if (command.tileWidth && command.tileHeight && this._map._docLayer) {
 			var defaultZoom = this._map.options.zoom;
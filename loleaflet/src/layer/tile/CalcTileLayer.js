@@ -33,6 +33,7 @@ L.CalcTileLayer = L.TileLayer.extend({
 
 		var tilePositionsX = '';
 		var tilePositionsY = '';
+		var oldVersions = '';
 		var needsNewTiles = false;
 
 		for (var key in this._tiles) {
@@ -48,7 +49,11 @@ L.CalcTileLayer = L.TileLayer.extend({
 					this._tiles[key]._invalidCount = 1;
 				}
 				if (visibleArea.intersects(bounds)) {
-					if (!this._transientInvalidationKeys[key]) {
+					if (this._isPushedTile(command, tileTopLeft)) {
+						// the server sends it without being asked
+						this._transientInvalidationKeys[key] = true;
+					}
+					else if (!this._transientInvalidationKeys[key]) {
 						if (tilePositionsX !== '') {
 							tilePositionsX += ',';
 						}
@@ -57,6 +62,11 @@ L.CalcTileLayer = L.TileLayer.extend({
 							tilePositionsY += ',';
 						}
 						tilePositionsY += tileTopLeft.y;
+						if (oldVersions !== '') {
+							oldVersions += ',';
+						}
+						// the version we hold, so that only the changes are sent back
+						oldVersions += this._tiles[key]._ver || 0;
 						needsNewTiles = true;
 						this._transientInvalidationKeys[key] = true;
 					}
@@ -78,7 +88,8 @@ L.CalcTileLayer = L.TileLayer.extend({
 				'tileposx=' + tilePositionsX + ' ' +
 				'tileposy=' + tilePositionsY + ' ' +
 				'tilewidth=' + this._tileWidthTwips + ' ' +
-				'tileheight=' + this._tileHeightTwips;
+				'tileheight=' + this._tileHeightTwips + ' ' +
+				'oldver=' + oldVersions;
 
 			this._map._socket.sendMessage(message, '');
 		}
@@ -158,7 +158,7 @@ L.TileLayer = L.GridLayer.extend({
 			map.on('zoomend', this._onCellCursorShift, this);
 		}
 		map.on('zoomend', this._updateClientZoom, this);
-		map.on('resize zoomend', this._invalidateClientVisibleArea, this);
+		map.on('resize zoomend moveend', this._invalidateClientVisibleArea, this);
 		map.on('dragstart', this._onDragStart, this);
 		map.on('requestloksession', this._onRequestLOKSession, this);
 		map.on('error', this._mapOnError, this);
@@ -327,6 +327,12 @@ L.TileLayer = L.GridLayer.extend({
 		else if (textMsg.startsWith('tile:')) {
 			this._onTileMsg(textMsg, img);
 		}
+		else if (textMsg.startsWith('delta:')) {
+			this._onDeltaMsg(textMsg, img);
+		}
+		else if (textMsg.startsWith('solidtile:')) {
+			this._onSolidTileMsg(textMsg);
+		}
 		else if (textMsg.startsWith('unocommandresult:')) {
 			this._onUnoCommandResultMsg(textMsg);
 		}
@@ -724,6 +730,9 @@ L.TileLayer = L.GridLayer.extend({
 				}
 			}
 			tile.el.src = img;
+			tile._ver = command.ver;
+			tile._deltas = [];
+			tile._canvas = null;
 		}
 		else if (command.preFetch === 'true') {
 			this._tileCache[key] = img;
@@ -732,6 +741,101 @@ L.TileLayer = L.GridLayer.extend({
 
 	},
 
+	// A tile of a single colour, sent without an image.
+	_onSolidTileMsg: function (textMsg) {
+		var command = this._map._socket.parseServerCmd(textMsg);
+		var id = command.color + ' ' + command.width + 'x' + command.height;
+		if (!this._solidTiles) {
+			this._solidTiles = {};
+		}
+		if (!this._solidTiles[id]) {
+			var rgba = parseInt(command.color, 16);
+			var canvas = document.createElement('canvas');
+			canvas.width = command.width;
+			canvas.height = command.height;
+			var context = canvas.getContext('2d');
+			context.fillStyle = 'rgba(' + (rgba >>> 24) + ',' + (rgba >>> 16 & 0xff) + ',' +
+				(rgba >>> 8 & 0xff) + ',' + (rgba & 0xff) / 255 + ')';
+			context.fillRect(0, 0, canvas.width, canvas.height);
+			this._solidTiles[id] = canvas.toDataURL('image/png');
+		}
+		this._onTileMsg(textMsg, this._solidTiles[id]);
+	},
+
+	// A tile we hold changed: img only covers the changed rectangle,
+	// to be painted over the version of the tile we have.
+	_onDeltaMsg: function (textMsg, img) {
+		var command = this._map._socket.parseServerCmd(textMsg);
+		var coords = this._twipsToCoords(command);
+		coords.z = command.zoom;
+		coords.part = command.part;
+		var key = this._tileCoordsToKey(coords);
+		var tile = this._tiles[key];
+		L.Log.log(textMsg, L.INCOMING, key);
+		if (!tile) {
+			return;
+		}
+
+		if (tile._ver !== command.oldVer) {
+			// we no longer have what the delta applies to
+			tile._ver = undefined;
+			this._map._socket.sendMessage('tile ' +
+				'part=' + command.part + ' ' +
+				'width=' + command.width + ' ' +
+				'height=' + command.height + ' ' +
+				'tileposx=' + command.x + ' ' +
+				'tileposy=' + command.y + ' ' +
+				'tilewidth=' + command.tileWidth + ' ' +
+				'tileheight=' + command.tileHeight);
+			return;
+		}
+
+		if (tile._invalidCount > 0) {
+			tile._invalidCount -= 1;
+		}
+		tile._ver = command.ver;
+		if (command.deltaWidth > 0 && command.deltaHeight > 0) {
+			// deltas are applied in order, each once the previous one is painted
+			tile._deltas = tile._deltas || [];
+			tile._deltas.push({x: command.deltaX, y: command.deltaY, src: img});
+			if (tile._deltas.length === 1) {
+				this._applyDelta(tile);
+			}
+		}
+	},
+
+	_applyDelta: function (tile) {
+		var delta = tile._deltas[0];
+		var patch = new Image();
+		patch.onload = L.bind(function () {
+			if (tile._deltas[0] !== delta) {
+				// a full tile arrived meanwhile
+				return;
+			}
+			if (!tile._canvas && !tile.el.complete) {
+				// the tile itself is still loading
+				setTimeout(patch.onload, 10);
+				return;
+			}
+			// keep the composited tile, so that the next delta needn't wait for it to load
+			if (!tile._canvas) {
+				tile._canvas = document.createElement('canvas');
+				tile._canvas.width = tile.el.naturalWidth;
+				tile._canvas.height = tile.el.naturalHeight;
+				tile._canvas.getContext('2d').drawImage(tile.el, 0, 0);
+			}
+			var context = tile._canvas.getContext('2d');
+			context.clearRect(delta.x, delta.y, patch.width, patch.height);
+			context.drawImage(patch, delta.x, delta.y);
+			tile.el.src = tile._canvas.toDataURL('image/png');
+			tile._deltas.shift();
+			if (tile._deltas.length > 0) {
+				this._applyDelta(tile);
+			}
+		}, this);
+		patch.src = delta.src;
+	},
+
 	_tileOnLoad: function (done, tile) {
 		done(null, tile);
 	},
@@ -770,11 +874,7 @@ L.TileLayer = L.GridLayer.extend({
 	},
 
 	_postMouseEvent: function(type, x, y, count, buttons, modifier) {
-		if (this._clientZoom) {
-			// the zoom level has changed
-			this._map._socket.sendMessage('clientzoom ' + this._clientZoom);
-			this._clientZoom = null;
-		}
+		this._sendClientView();
 		this._map._socket.sendMessage('mouse type=' + type +
 				' x=' + x + ' y=' + y + ' count=' + count +
 				' buttons=' + buttons + ' modifier=' + modifier);
@@ -785,21 +885,7 @@ L.TileLayer = L.GridLayer.extend({
 	},
 
 	_postKeyboardEvent: function(type, charcode, keycode) {
-		if (this._clientZoom) {
-			// the zoom level has changed
-			this._map._socket.sendMessage('clientzoom ' + this._clientZoom);
-			this._clientZoom = null;
-		}
-		if (this._clientVisibleArea) {
-			// Visible area is dirty, update it on the server.
-			var visibleArea = this._map._container.getBoundingClientRect();
-			var pos = this._pixelsToTwips(new L.Point(visibleArea.left, visibleArea.top));
-			var size = this._pixelsToTwips(new L.Point(visibleArea.width, visibleArea.height));
-			var payload = 'clientvisiblearea x=' + Math.round(pos.x) + ' y=' + Math.round(pos.y) +
-				' width=' + Math.round(size.x) + ' height=' + Math.round(size.y);
-			this._map._socket.sendMessage(payload);
-			this._clientVisibleArea = false;
-		}
+		this._sendClientView();
 		this._map._socket.sendMessage('key type=' + type +
 				' char=' + charcode + ' key=' + keycode);
 	},
@@ -1313,6 +1399,41 @@ L.TileLayer = L.GridLayer.extend({
 
 	_invalidateClientVisibleArea: function() {
 		this._clientVisibleArea = true;
+		// the server pushes the invalidated tiles of the visible area, keep it up to date
+		if (this._map && this._map._socket) {
+			this._sendClientView();
+		}
+	},
+
+	_sendClientView: function () {
+		if (this._clientZoom) {
+			// the zoom level has changed
+			this._map._socket.sendMessage('clientzoom ' + this._clientZoom);
+			this._clientZoom = null;
+		}
+		if (this._clientVisibleArea) {
+			// Visible area is dirty, update it on the server.
+			var bounds = this._map.getBounds();
+			var topLeft = this._latLngToTwips(bounds.getNorthWest());
+			var bottomRight = this._latLngToTwips(bounds.getSouthEast());
+			var payload = 'clientvisiblearea x=' + Math.round(topLeft.x) + ' y=' + Math.round(topLeft.y) +
+				' width=' + Math.round(bottomRight.x - topLeft.x) + ' height=' + Math.round(bottomRight.y - topLeft.y);
+			this._map._socket.sendMessage(payload);
+			this._clientVisibleArea = false;
+		}
+	},
+
+	// Whether the server pushes the tile at tileTopLeft after the invalidation command.
+	_isPushedTile: function (command, tileTopLeft) {
+		if (!command.pushed || command.pushed.length !== 6 ||
+			command.pushed[4] !== this._tileWidthTwips || command.pushed[5] !== this._tileHeightTwips) {
+			// nothing pushed, or for a zoom level we have left already
+			return false;
+		}
+		var pushedTopLeft = new L.Point(command.pushed[0], command.pushed[1]);
+		var pushedBounds = new L.Bounds(pushedTopLeft, pushedTopLeft.add(new L.Point(command.pushed[2], command.pushed[3])));
+		var tileBounds = new L.Bounds(tileTopLeft, tileTopLeft.add(new L.Point(this._tileWidthTwips, this._tileHeightTwips)));
+		return pushedBounds.intersects(tileBounds);
 	}
 });
 
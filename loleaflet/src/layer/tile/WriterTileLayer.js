@@ -25,6 +25,7 @@ L.WriterTileLayer = L.TileLayer.extend({
 
 		var tilePositionsX = '';
 		var tilePositionsY = '';
+		var oldVersions = '';
 		var needsNewTiles = false;
 
 		for (var key in this._tiles) {
@@ -40,7 +41,11 @@ L.WriterTileLayer = L.TileLayer.extend({
 					this._tiles[key]._invalidCount = 1;
 				}
 				if (visibleArea.intersects(bounds)) {
-					if (!this._transientInvalidationKeys[key]) {
+					if (this._isPushedTile(command, tileTopLeft)) {
+						// the server sends it without being asked
+						this._transientInvalidationKeys[key] = true;
+					}
+					else if (!this._transientInvalidationKeys[key]) {
 						if (tilePositionsX !== '') {
 							tilePositionsX += ',';
 						}
@@ -49,6 +54,11 @@ L.WriterTileLayer = L.TileLayer.extend({
 							tilePositionsY += ',';
 						}
 						tilePositionsY += tileTopLeft.y;
+						if (oldVersions !== '') {
+							oldVersions += ',';
+						}
+						// the version we hold, so that only the changes are sent back
+						oldVersions += this._tiles[key]._ver || 0;
 						needsNewTiles = true;
 						this._transientInvalidationKeys[key] = true;
 					}
@@ -73,7 +83,8 @@ L.WriterTileLayer = L.TileLayer.extend({
 				'tileposx=' + tilePositionsX + ' ' +
 				'tileposy=' + tilePositionsY + ' ' +
 				'tilewidth=' + this._tileWidthTwips + ' ' +
-				'tileheight=' + this._tileHeightTwips;
+				'tileheight=' + this._tileHeightTwips + ' ' +
+				'oldver=' + oldVersions;
 
 			this._map._socket.sendMessage(message, '');
 		}
@@ -24,6 +24,7 @@
 #include "Common.hpp"
 #include "LOOLProtocol.hpp"
 #include "LOOLWSD.hpp"
+#include "ReceiveBuffer.hpp"
 #include "Util.hpp"
 
 using namespace LOOLProtocol;
@@ -73,13 +74,12 @@ public:
             int flags = 0;
             int n = 0;
             ws->setReceiveTimeout(0);
+            ReceiveBuffer buffer;
             do
             {
-                char buffer[200000]; //FIXME: Dynamic?
-
                 if (ws->poll(waitTime, Socket::SELECT_READ))
                 {
-                    n = ws->receiveFrame(buffer, sizeof(buffer), flags);
+                    n = receiveMessage(*ws, buffer, flags);
 
                     if ((flags & WebSocket::FRAME_OP_BITMASK) == WebSocket::FRAME_OP_PING)
                     {
@@ -88,7 +88,7 @@ public:
                         // However Firefox (probably) or Node.js (possibly) doesn't
                         // like that and closes the socket when we do.
                         // Echoing the payload as a normal frame works with Firefox.
-                        ws->sendFrame(buffer, n /*, WebSocket::FRAME_OP_PONG*/);
+                        ws->sendFrame(buffer.data(), n /*, WebSocket::FRAME_OP_PONG*/);
                     }
                     else if ((flags & WebSocket::FRAME_OP_BITMASK) == WebSocket::FRAME_OP_PONG)
                     {
@@ -105,7 +105,7 @@ public:
                     else
                     {
                         assert(n > 0);
-                        const std::string firstLine = getFirstLine(buffer, n);
+                        const std::string firstLine = getFirstLine(buffer.data(), n);
                         StringTokenizer tokens(firstLine, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
                         Log::trace() << "Recv: " << firstLine << Log::end;
 
@@ -120,31 +120,9 @@ public:
 
                         if (tokens[0] == "stats")
                         {
-                            //TODO: Collect stats and reply back to admin.
-                            // We need to ask Broker to give us some numbers on docs/clients/etc.
-                            // But we can also collect some memory info using system calls.
-
-                            std::string statsResponse;
-
-                            const auto cmd = "pstree -a -c -h -A -p " + std::to_string(getpid());
-                            FILE* fp = popen(cmd.c_str(), "r");
-                            if (fp == nullptr)
-                            {
-                                statsResponse = "error: failed to collect stats.";
-                                ws->sendFrame(statsResponse.data(), statsResponse.size());
-                                continue;
-                            }
-
-                            char treeBuffer[1024];
-                            while (fgets(treeBuffer, sizeof(treeBuffer)-1, fp) != nullptr)
-                            {
-                                statsResponse += treeBuffer;
-                                statsResponse += "</ BR>\n";
-                            }
-
-                            pclose(fp);
-
-                            ws->sendFrame(statsResponse.data(), statsResponse.size());
+                            // From the model's samples, spawning no processes.
+                            std::string responseFrame = "stats " + model.query("stats");
+                            ws->sendFrame(responseFrame.data(), responseFrame.size());
                         }
                         else if (tokens[0] == "subscribe" && tokens.count() > 1)
                         {
@@ -168,12 +146,12 @@ public:
                         }
                         else if (tokens[0] == "total_mem")
                         {
-                            Poco::Process::PID nBrokerPid = _admin->getBrokerPid();
-                            unsigned totalMem = Util::getMemoryUsage(nBrokerPid);
-                            totalMem += model.getTotalMemoryUsage();
-                            totalMem += Util::getMemoryUsage(Poco::Process::id());
-
-                            std::string responseFrame = "total_mem " + std::to_string(totalMem);
+                            std::string responseFrame = "total_mem " + model.getTotalMemoryUsage();
+                            ws->sendFrame(responseFrame.data(), responseFrame.size());
+                        }
+                        else if (tokens[0] == "client_queues")
+                        {
+                            std::string responseFrame = "client_queues " + _admin->getClientQueues();
                             ws->sendFrame(responseFrame.data(), responseFrame.size());
                         }
                         else if (tokens[0] == "active_users_count")
@@ -181,7 +159,8 @@ public:
                             std::string responseFrame = tokens[0] + " " + model.query(tokens[0]);
                             ws->sendFrame(responseFrame.data(), responseFrame.size());
                         }
-                        else if (tokens[0] == "active_docs_count")
+                        else if (tokens[0] == "active_docs_count" ||
+                                 tokens[0] == "prespawn")
                         {
                             std::string responseFrame = tokens[0] + " " + model.query(tokens[0]);
                             ws->sendFrame(responseFrame.data(), responseFrame.size());
@@ -266,13 +245,18 @@ private:
 };
 
 /// An admin command processor.
-Admin::Admin(const Poco::Process::PID brokerPid, const int brokerPipe, const int notifyPipe) :
+Admin::Admin(const Poco::Process::PID brokerPid, const int brokerPipe, const int notifyPipe,
+             const std::weak_ptr<ClientReactor>& reactor) :
     _srv(new AdminRequestHandlerFactory(this), ServerSocket(ADMIN_PORT_NUMBER), new HTTPServerParams),
-    _model(AdminModel())
+    _model(),
+    _reactor(reactor)
 {
     Admin::BrokerPid = brokerPid;
     Admin::BrokerPipe = brokerPipe;
     Admin::NotifyPipe = notifyPipe;
+
+    _model.addProcess(brokerPid);
+    _model.addProcess(Poco::Process::id());
 }
 
 Admin::~Admin()
@@ -318,6 +302,23 @@ AdminModel& Admin::getModel()
     return _model;
 }
 
+std::string Admin::getClientQueues() const
+{
+    const auto reactor = _reactor.lock();
+    if (!reactor)
+        return "0";
+
+    std::string result = std::to_string(reactor->getOverflowCount());
+    for (const auto& client : reactor->getClientStats())
+    {
+        result += ' ' + client.sessionName + ',' + std::to_string(client.outbound.queuedBytes) +
+                  ',' + std::to_string(client.outbound.maxQueuedBytes) +
+                  ',' + std::to_string(client.outbound.coalescedTiles);
+    }
+
+    return result;
+}
+
 //TODO: Clean up with something more elegant.
 Poco::Process::PID Admin::BrokerPid;
 int Admin::BrokerPipe;
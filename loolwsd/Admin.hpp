@@ -10,11 +10,14 @@
 #ifndef INCLUDED_ADMIN_HPP
 #define INCLUDED_ADMIN_HPP
 
+#include <memory>
+
 #include <Poco/Net/HTTPServer.h>
 #include <Poco/Runnable.h>
 #include <Poco/Types.h>
 
 #include "AdminModel.hpp"
+#include "ClientReactor.hpp"
 
 const std::string FIFO_NOTIFY = "loolnotify.fifo";
 
@@ -22,7 +25,8 @@ const std::string FIFO_NOTIFY = "loolnotify.fifo";
 class Admin : public Poco::Runnable
 {
 public:
-    Admin(const Poco::Process::PID brokerPid, const int brokerPipe, const int notifyPipe);
+    Admin(const Poco::Process::PID brokerPid, const int brokerPipe, const int notifyPipe,
+          const std::weak_ptr<ClientReactor>& reactor);
 
     ~Admin();
 
@@ -34,12 +38,19 @@ public:
 
     AdminModel& getModel();
 
+    /// The clients disconnected for reading too slowly so far, then the
+    /// session, queued bytes, most bytes queued and tiles coalesced of
+    /// each client, as sent to the console.
+    std::string getClientQueues() const;
+
 private:
     void handleInput(std::string& message);
 
 private:
     Poco::Net::HTTPServer _srv;
     AdminModel _model;
+    /// Queues the messages to the clients.
+    const std::weak_ptr<ClientReactor> _reactor;
 
     static Poco::Process::PID BrokerPid;
     static int BrokerPipe;
@@ -10,15 +10,18 @@
 #ifndef INCLUDED_ADMIN_MODEL_HPP
 #define INCLUDED_ADMIN_MODEL_HPP
 
+#include <algorithm>
 #include <memory>
 #include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <Poco/Net/WebSocket.h>
 #include <Poco/Process.h>
 #include <Poco/StringTokenizer.h>
 
+#include "MemoryCollector.hpp"
 #include "Util.hpp"
 
 class View
@@ -199,14 +202,17 @@ private:
 class AdminModel
 {
 public:
-    AdminModel()
+    AdminModel() :
+        _memory(std::chrono::seconds(5))
     {
         Log::info("AdminModel ctor.");
+        _memory.start();
     }
 
     ~AdminModel()
     {
         Log::info("AdminModel dtor.");
+        _memory.stop();
     }
 
     void update(const std::string& data)
@@ -217,10 +223,10 @@ public:
 
         if (tokens[0] == "document")
         {
-            addDocument(std::stoi(tokens[1]), tokens[2]);
-            unsigned mem = Util::getMemoryUsage(std::stoi(tokens[1]));
-            std::string response = data + std::to_string(mem);
-            notify(response);
+            const Poco::Process::PID pid = std::stoi(tokens[1]);
+            addDocument(pid, tokens[2]);
+            _memory.watch(pid);
+            notify(data + formatMemory(_memory.get(pid)));
             return;
         }
         else if (tokens[0] == "addview")
@@ -244,6 +250,21 @@ public:
         else if (tokens[0] == "rmdoc")
         {
             removeDocument(std::stoi(tokens[1]));
+            _memory.unwatch(std::stoi(tokens[1]));
+        }
+        else if (tokens[0] == "mem")
+        {
+            // The broker and kits aren't dumpable, they tell their own.
+            pid_t pid;
+            ProcessMemory memory;
+            if (ProcessMemory::parseReport(data, pid, memory))
+                _memory.report(pid, memory);
+            return;
+        }
+        else if (tokens[0] == "prespawn" && tokens.count() == 5)
+        {
+            // Hits, misses, empty children, and their target.
+            _prespawnStats = tokens[1] + " " + tokens[2] + " " + tokens[3] + " " + tokens[4];
         }
 
         notify(data);
@@ -265,23 +286,51 @@ public:
         {
             return std::to_string(_nActiveDocuments);
         }
+        else if (tokens[0] == "prespawn")
+        {
+            return _prespawnStats;
+        }
+        else if (tokens[0] == "stats")
+        {
+            return getProcesses();
+        }
 
         return std::string("");
     }
 
-    /// Returns memory consumed by all active loolkit processes
-    unsigned getTotalMemoryUsage()
+    /// Samples the memory of pid too, to count it in the total.
+    void addProcess(Poco::Process::PID pid)
     {
-        unsigned totalMem = 0;
+        _memory.watch(pid);
+        _processes.push_back(pid);
+    }
+
+    /// Returns the memory consumed by the processes added and all the
+    /// active loolkit ones, as last sampled: PSS, USS, and what of PSS is
+    /// shared.
+    std::string getTotalMemoryUsage()
+    {
+        ProcessMemory total;
+        for (const auto pid : _processes)
+        {
+            const ProcessMemory memory = _memory.get(pid);
+            total.pss += memory.pss;
+            total.uss += memory.uss;
+        }
+
         for (auto& it: _documents)
         {
             if (it.second.isExpired())
                 continue;
 
-            totalMem += Util::getMemoryUsage(it.second.getPid());
+            const ProcessMemory memory = _memory.get(it.second.getPid());
+            total.pss += memory.pss;
+            total.uss += memory.uss;
         }
 
-        return totalMem;
+        // Each shared page counts once in PSS.
+        total.shared = total.pss - std::min(total.uss, total.pss);
+        return formatMemory(total);
     }
 
     void subscribe(int nSessionId, std::shared_ptr<Poco::Net::WebSocket>& ws)
@@ -367,6 +416,36 @@ private:
         return nTotalViews;
     }
 
+    /// PSS, USS and shared memory, in KiB.
+    static std::string formatMemory(const ProcessMemory& memory)
+    {
+        return std::to_string(memory.pss) + " " +
+               std::to_string(memory.uss) + " " +
+               std::to_string(memory.shared);
+    }
+
+    /// The pid and memory of the processes added, then of the active
+    /// loolkit ones, as last sampled.
+    std::string getProcesses()
+    {
+        std::ostringstream oss;
+        for (const auto pid : _processes)
+        {
+            oss << pid << " " << formatMemory(_memory.get(pid)) << " \n ";
+        }
+
+        for (auto& it: _documents)
+        {
+            if (it.second.isExpired())
+                continue;
+
+            const Poco::Process::PID pid = it.second.getPid();
+            oss << pid << " " << formatMemory(_memory.get(pid)) << " \n ";
+        }
+
+        return oss.str();
+    }
+
     std::string getDocuments()
     {
         std::ostringstream oss;
@@ -378,7 +457,7 @@ private:
             std::string sPid = std::to_string(it.second.getPid());
             std::string sUrl = it.second.getUrl();
             std::string sViews = std::to_string(it.second.getActiveViews());
-            std::string sMem = std::to_string(Util::getMemoryUsage(it.second.getPid()));
+            std::string sMem = formatMemory(_memory.get(it.second.getPid()));
 
             oss << sPid << " "
                 << sUrl << " "
@@ -395,6 +474,13 @@ private:
 
     /// Number of active documents
     unsigned _nActiveDocuments = 0;
+
+    /// The pool of children spawned in advance, as the broker last told.
+    std::string _prespawnStats = "0 0 0 0";
+
+    /// Samples the memory of the kits, and of the processes added.
+    MemoryCollector _memory;
+    std::vector<Poco::Process::PID> _processes;
 };
 
 #endif
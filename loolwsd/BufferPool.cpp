@@ -0,0 +1,225 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+#include <utility>
+
+#include "BufferPool.hpp"
+
+namespace
+{
+    const size_t HugePageSize = 2 * 1024 * 1024;
+
+    /// Encoding buffers kept while unused; one per tile of a tilecombine is plenty.
+    const size_t MaxFreeOutputs = 32;
+
+    size_t roundUp(const size_t size, const size_t alignment)
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+}
+
+BufferPool::Pixmap::Pixmap(BufferPool* pool, unsigned char* data, const size_t size, const size_t capacity) :
+    _pool(pool),
+    _data(data),
+    _size(size),
+    _capacity(capacity)
+{
+}
+
+BufferPool::Pixmap::Pixmap(Pixmap&& other) :
+    _pool(other._pool),
+    _data(other._data),
+    _size(other._size),
+    _capacity(other._capacity)
+{
+    other._data = nullptr;
+}
+
+BufferPool::Pixmap& BufferPool::Pixmap::operator=(Pixmap&& other)
+{
+    if (this != &other)
+    {
+        release();
+        _pool = other._pool;
+        _data = other._data;
+        _size = other._size;
+        _capacity = other._capacity;
+        other._data = nullptr;
+    }
+
+    return *this;
+}
+
+BufferPool::Pixmap::~Pixmap()
+{
+    release();
+}
+
+void BufferPool::Pixmap::release()
+{
+    if (_data)
+    {
+        _pool->putPixmap(_data, _capacity);
+        _data = nullptr;
+    }
+}
+
+BufferPool::Output::Output(BufferPool* pool, std::vector<char>&& buffer) :
+    _pool(pool),
+    _buffer(std::move(buffer))
+{
+}
+
+BufferPool::Output::Output(Output&& other) :
+    _pool(other._pool),
+    _buffer(std::move(other._buffer))
+{
+    other._pool = nullptr;
+}
+
+BufferPool::Output::~Output()
+{
+    if (_pool)
+        _pool->putOutput(std::move(_buffer));
+}
+
+BufferPool::BufferPool(const size_t maxFreeBytes, const bool useHugePages) :
+    _maxFreeBytes(maxFreeBytes),
+    _useHugePages(useHugePages),
+    _stats()
+{
+}
+
+BufferPool::~BufferPool()
+{
+    // Pixmaps in use must not outlive the pool.
+    for (const auto& pixmap : _pixmaps)
+    {
+        munmap(pixmap.second, pixmap.first);
+    }
+}
+
+BufferPool::Pixmap BufferPool::getPixmap(const size_t size)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // Don't waste more than half of a recycled buffer.
+        const auto it = _pixmaps.lower_bound(size);
+        if (it != _pixmaps.end() && it->first / 2 <= size)
+        {
+            const size_t capacity = it->first;
+            unsigned char* data = it->second;
+            _pixmaps.erase(it);
+            _stats.freeBytes -= capacity;
+            ++_stats.pixmapHits;
+            return Pixmap(this, data, size, capacity);
+        }
+
+        ++_stats.pixmapMisses;
+    }
+
+    // Map outside the lock, this is the slow path.
+    size_t capacity = roundUp(size, sysconf(_SC_PAGESIZE));
+    if (isHuge(capacity))
+        capacity = roundUp(capacity, HugePageSize);
+
+    void* data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED)
+        throw std::bad_alloc();
+
+#ifdef MADV_HUGEPAGE
+    // Only advice; without transparent huge pages this is a no-op.
+    if (isHuge(capacity))
+        madvise(data, capacity, MADV_HUGEPAGE);
+#endif
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _stats.mappedBytes += capacity;
+    if (isHuge(capacity))
+        _stats.hugePageBytes += capacity;
+
+    return Pixmap(this, static_cast<unsigned char*>(data), size, capacity);
+}
+
+void BufferPool::putPixmap(unsigned char* data, const size_t capacity)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_stats.freeBytes + capacity <= _maxFreeBytes)
+    {
+        _pixmaps.emplace(capacity, data);
+        _stats.freeBytes += capacity;
+        return;
+    }
+
+    _stats.mappedBytes -= capacity;
+    if (isHuge(capacity))
+        _stats.hugePageBytes -= capacity;
+
+    lock.unlock();
+    munmap(data, capacity);
+}
+
+BufferPool::Output BufferPool::getOutput(const size_t capacity)
+{
+    std::vector<char> buffer;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_outputs.empty())
+        {
+            buffer = std::move(_outputs.back());
+            _outputs.pop_back();
+            _stats.freeBytes -= buffer.capacity();
+            ++_stats.outputHits;
+        }
+        else
+        {
+            ++_stats.outputMisses;
+        }
+    }
+
+    buffer.clear();
+    buffer.reserve(capacity);
+    return Output(this, std::move(buffer));
+}
+
+void BufferPool::putOutput(std::vector<char>&& buffer)
+{
+    // Outputs count against the same budget as pixmaps: that of a large
+    // tilecombine would otherwise be kept for the life of the kit.
+    std::unique_lock<std::mutex> lock(_mutex);
+    const size_t capacity = buffer.capacity();
+    if (_outputs.size() < MaxFreeOutputs && _stats.freeBytes + capacity <= _maxFreeBytes)
+    {
+        _outputs.push_back(std::move(buffer));
+        _stats.freeBytes += capacity;
+        return;
+    }
+
+    // Free it outside the lock.
+    lock.unlock();
+    std::vector<char>().swap(buffer);
+}
+
+bool BufferPool::isHuge(const size_t capacity) const
+{
+    return _useHugePages && capacity >= HugePageSize;
+}
+
+BufferPool::Stats BufferPool::getStats() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
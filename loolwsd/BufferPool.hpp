@@ -0,0 +1,119 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_BUFFERPOOL_HPP
+#define INCLUDED_BUFFERPOOL_HPP
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/// Reusable pixmap and encoding buffers for the render path.
+///
+/// A tile is 256 KB of pixels, a combined rendering several MB: large
+/// enough for malloc to map and unmap them (and the kernel to zero them)
+/// on every request. The pool keeps them mapped instead.
+class BufferPool
+{
+public:
+    struct Stats
+    {
+        size_t pixmapHits;
+        size_t pixmapMisses;
+        size_t outputHits;
+        size_t outputMisses;
+        /// Pixmap memory mapped, in use or free.
+        size_t mappedBytes;
+        /// Pixmap and output memory waiting in the pool.
+        size_t freeBytes;
+        /// Pixmap memory advised to be backed by huge pages.
+        size_t hugePageBytes;
+    };
+
+    /// Memory to render into; returned to the pool when destroyed.
+    /// The contents are undefined.
+    class Pixmap
+    {
+    public:
+        Pixmap(Pixmap&& other);
+        Pixmap& operator=(Pixmap&& other);
+        ~Pixmap();
+
+        Pixmap(const Pixmap&) = delete;
+        Pixmap& operator=(const Pixmap&) = delete;
+
+        unsigned char* data() const { return _data; }
+        size_t size() const { return _size; }
+
+    private:
+        friend class BufferPool;
+        Pixmap(BufferPool* pool, unsigned char* data, size_t size, size_t capacity);
+        void release();
+
+        BufferPool* _pool;
+        unsigned char* _data;
+        size_t _size;
+        size_t _capacity;
+    };
+
+    /// An empty buffer to encode into; returned to the pool when destroyed.
+    class Output
+    {
+    public:
+        Output(Output&& other);
+        ~Output();
+
+        Output(const Output&) = delete;
+        Output& operator=(const Output&) = delete;
+
+        std::vector<char>& get() { return _buffer; }
+
+    private:
+        friend class BufferPool;
+        Output(BufferPool* pool, std::vector<char>&& buffer);
+
+        BufferPool* _pool;
+        std::vector<char> _buffer;
+    };
+
+    /// maxFreeBytes bounds the pixmap and output memory kept while unused.
+    /// useHugePages advises transparent huge pages for pixmaps of 2 MB or more.
+    BufferPool(size_t maxFreeBytes, bool useHugePages);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    Pixmap getPixmap(size_t size);
+    Output getOutput(size_t capacity);
+
+    Stats getStats() const;
+
+    /// Set before the first pixmap is taken, as by --hugepages.
+    void setUseHugePages(bool useHugePages) { _useHugePages = useHugePages; }
+
+private:
+    void putPixmap(unsigned char* data, size_t capacity);
+    void putOutput(std::vector<char>&& buffer);
+    bool isHuge(size_t capacity) const;
+
+    const size_t _maxFreeBytes;
+    bool _useHugePages;
+
+    mutable std::mutex _mutex;
+    /// Free pixmaps by capacity.
+    std::multimap<size_t, unsigned char*> _pixmaps;
+    std::vector<std::vector<char>> _outputs;
+    Stats _stats;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
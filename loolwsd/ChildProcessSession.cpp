@@ -9,7 +9,12 @@
 
 #include <sys/prctl.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <sstream>
 
 #include <Poco/Exception.h>
 #include <Poco/JSON/Object.h>
@@ -22,11 +27,17 @@
 #include <Poco/StringTokenizer.h>
 #include <Poco/URI.h>
 
+#include "BufferPool.hpp"
 #include "ChildProcessSession.hpp"
 #include "Common.hpp"
 #include "LOKitHelper.hpp"
 #include "LOOLProtocol.hpp"
+#include "MessageBatch.hpp"
+#include "Pixel.hpp"
 #include "Rectangle.hpp"
+#include "TileEncoder.hpp"
+#include "TileHeader.hpp"
+#include "TileHistory.hpp"
 #include "Util.hpp"
 
 using namespace LOOLProtocol;
@@ -90,7 +101,7 @@ public:
         case LOK_CALLBACK_INVALIDATE_TILES:
             {
                 int curPart = _session.getLoKitDocument()->pClass->getPart(_session.getLoKitDocument());
-                _session.sendTextFrame("curpart: part=" + std::to_string(curPart));
+                send("curpart: part=" + std::to_string(curPart));
                 if (_session.getDocType() == "text")
                 {
                     curPart = 0;
@@ -118,67 +129,70 @@ public:
                         height = INT_MAX;
                     }
 
-                    _session.sendTextFrame("invalidatetiles:"
-                                       " part=" + std::to_string(curPart) +
-                                       " x=" + std::to_string(x) +
-                                       " y=" + std::to_string(y) +
-                                       " width=" + std::to_string(width) +
-                                       " height=" + std::to_string(height));
+                    send("invalidatetiles:"
+                         " part=" + std::to_string(curPart) +
+                         " x=" + std::to_string(x) +
+                         " y=" + std::to_string(y) +
+                         " width=" + std::to_string(width) +
+                         " height=" + std::to_string(height) +
+                         _session.queueTilesToPush(curPart, x, y, width, height));
                 }
                 else
                 {
-                    _session.sendTextFrame("invalidatetiles: " + rPayload);
+                    send("invalidatetiles: " + rPayload);
                 }
             }
             break;
         case LOK_CALLBACK_INVALIDATE_VISIBLE_CURSOR:
-            _session.sendTextFrame("invalidatecursor: " + rPayload);
+            send("invalidatecursor: " + rPayload);
             break;
         case LOK_CALLBACK_TEXT_SELECTION:
-            _session.sendTextFrame("textselection: " + rPayload);
+            send("textselection: " + rPayload);
             break;
         case LOK_CALLBACK_TEXT_SELECTION_START:
-            _session.sendTextFrame("textselectionstart: " + rPayload);
+            send("textselectionstart: " + rPayload);
             break;
         case LOK_CALLBACK_TEXT_SELECTION_END:
-            _session.sendTextFrame("textselectionend: " + rPayload);
+            send("textselectionend: " + rPayload);
             break;
         case LOK_CALLBACK_CURSOR_VISIBLE:
-            _session.sendTextFrame("cursorvisible: " + rPayload);
+            send("cursorvisible: " + rPayload);
             break;
         case LOK_CALLBACK_GRAPHIC_SELECTION:
-            _session.sendTextFrame("graphicselection: " + rPayload);
+            send("graphicselection: " + rPayload);
             break;
         case LOK_CALLBACK_CELL_CURSOR:
-            _session.sendTextFrame("cellcursor: " + rPayload);
+            send("cellcursor: " + rPayload);
             break;
         case LOK_CALLBACK_CELL_FORMULA:
-            _session.sendTextFrame("cellformula: " + rPayload);
+            send("cellformula: " + rPayload);
             break;
         case LOK_CALLBACK_MOUSE_POINTER:
-            _session.sendTextFrame("mousepointer: " + rPayload);
+            send("mousepointer: " + rPayload);
             break;
         case LOK_CALLBACK_HYPERLINK_CLICKED:
-            _session.sendTextFrame("hyperlinkclicked: " + rPayload);
+            send("hyperlinkclicked: " + rPayload);
             break;
         case LOK_CALLBACK_STATE_CHANGED:
-            _session.sendTextFrame("statechanged: " + rPayload);
+            send("statechanged: " + rPayload);
             break;
         case LOK_CALLBACK_SEARCH_NOT_FOUND:
-            _session.sendTextFrame("searchnotfound: " + rPayload);
+            send("searchnotfound: " + rPayload);
             break;
         case LOK_CALLBACK_SEARCH_RESULT_SELECTION:
-            _session.sendTextFrame("searchresultselection: " + rPayload);
+            send("searchresultselection: " + rPayload);
             break;
         case LOK_CALLBACK_DOCUMENT_SIZE_CHANGED:
+            // These go out directly, after what came before.
+            flush();
             _session.getStatus("", 0);
             _session.getPartPageRectangles("", 0);
             break;
         case LOK_CALLBACK_SET_PART:
-            _session.sendTextFrame("setpart: " + rPayload);
+            send("setpart: " + rPayload);
             break;
         case LOK_CALLBACK_UNO_COMMAND_RESULT:
-            _session.sendTextFrame("unocommandresult: " + rPayload);
+            send("unocommandresult: " + rPayload);
             break;
         case LOK_CALLBACK_ERROR:
             {
@@ -186,8 +200,8 @@ public:
                 Poco::Dynamic::Var var = parser.parse(rPayload);
                 Object::Ptr object = var.extract<Object::Ptr>();
 
-                _session.sendTextFrame("error: cmd=" + object->get("cmd").toString() +
-                        " kind=" + object->get("kind").toString() + " code=" + object->get("code").toString());
+                send("error: cmd=" + object->get("cmd").toString() +
+                     " kind=" + object->get("kind").toString() + " code=" + object->get("code").toString());
             }
             break;
         }
@@ -204,31 +218,64 @@ public:
 
         while (!_stop && !TerminationFlag)
         {
-            Notification::Ptr aNotification(_queue.waitDequeueNotification());
-            if (!_stop && !TerminationFlag && aNotification)
+            Notification::Ptr aNotification;
+            if (_batch.empty())
             {
-                CallbackNotification::Ptr aCallbackNotification = aNotification.cast<CallbackNotification>();
-                assert(aCallbackNotification);
+                aNotification = _queue.waitDequeueNotification();
+                if (!aNotification)
+                    break;
+            }
+            else
+            {
+                const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(_flushTime - std::chrono::steady_clock::now());
+                if (wait.count() > 0)
+                    aNotification = _queue.waitDequeueNotification(wait.count());
+            }
+
+            if (_stop || TerminationFlag)
+                break;
 
-                const auto nType = aCallbackNotification->_nType;
-                try
+            int nType = -1;
+            try
+            {
+                if (aNotification)
                 {
+                    CallbackNotification::Ptr aCallbackNotification = aNotification.cast<CallbackNotification>();
+                    assert(aCallbackNotification);
+
+                    nType = aCallbackNotification->_nType;
                     callback(nType, aCallbackNotification->_aPayload);
                 }
-                catch (const Exception& exc)
-                {
-                    Log::error() << "CallbackWorker::run: Exception while handling callback [" << LOKitHelper::kitCallbackTypeToString(nType) << "]: "
-                                 << exc.displayText()
-                                 << (exc.nested() ? " (" + exc.nested()->displayText() + ")" : "")
-                                 << Log::end;
-                }
-                catch (const std::exception& exc)
+
+                if (!_batch.empty() && std::chrono::steady_clock::now() >= _flushTime)
                 {
-                    Log::error("CallbackWorker::run: Exception while handling callback [" + LOKitHelper::kitCallbackTypeToString(nType) + "]: " + exc.what());
+                    // Send without the lock, the master may be slow to read it.
+                    std::string message;
+                    bool isTaken;
+                    {
+                        auto lock = _session.getLock();
+                        isTaken = takeBatch(message);
+                    }
+
+                    if (isTaken)
+                        _session.sendTextFrame(message);
                 }
+
+                // Render once a burst of invalidations is over and sent.
+                if (_batch.empty() && _queue.empty())
+                    _session.pushTiles();
+            }
+            catch (const Exception& exc)
+            {
+                Log::error() << "CallbackWorker::run: Exception while handling callback [" << LOKitHelper::kitCallbackTypeToString(nType) << "]: "
+                             << exc.displayText()
+                             << (exc.nested() ? " (" + exc.nested()->displayText() + ")" : "")
+                             << Log::end;
+            }
+            catch (const std::exception& exc)
+            {
+                Log::error("CallbackWorker::run: Exception while handling callback [" + LOKitHelper::kitCallbackTypeToString(nType) + "]: " + exc.what());
             }
-            else
-                break;
         }
 
         Log::debug("Thread [" + thread_name + "] finished.");
@@ -241,12 +288,83 @@ public:
     }
 
 private:
+    /// Sends message to the master, or holds it back with the rest of
+    /// the burst until the flush window is over.
+    void send(const std::string& message)
+    {
+        const int flushMS = ChildProcessSession::getCallbackFlushMS();
+        if (flushMS <= 0)
+        {
+            _session.sendTextFrame(message);
+            return;
+        }
+
+        if (_batch.empty())
+            _flushTime = std::chrono::steady_clock::now() + std::chrono::milliseconds(flushMS);
+
+        _batch.add(message);
+    }
+
+    /// Takes the messages held back, as one frame, unless there are none
+    /// or the session is disconnected. Call with the lock held.
+    bool takeBatch(std::string& message)
+    {
+        if (_batch.empty())
+            return false;
+
+        const size_t count = _batch.size();
+        message = _batch.take();
+        if (_session.isDisconnected())
+            return false;
+
+        if (count > 1)
+        {
+            Log::trace() << "CallbackWorker [" << _session.getViewId() << "] sending " << count
+                         << " messages at once, " << _batch.getDropped() << " superseded so far." << Log::end;
+        }
+
+        return true;
+    }
+
+    /// Sends the messages held back right away, from within a callback,
+    /// ahead of the replies sent with the lock held.
+    void flush()
+    {
+        std::string message;
+        if (takeBatch(message))
+            _session.sendTextFrame(message);
+    }
+
     NotificationQueue& _queue;
     ChildProcessSession& _session;
     volatile bool _stop;
+    /// Used by the callback thread only.
+    MessageBatch _batch;
+    std::chrono::steady_clock::time_point _flushTime;
 };
 
-std::recursive_mutex ChildProcessSession::Mutex;
+namespace
+{
+    /// Unpremultiplies a rendered pixel into red, green, blue and alpha.
+    void getColor(const uint32_t pixel, const LibreOfficeKitTileMode mode, uint8_t rgba[4])
+    {
+        if (mode == LOK_TILEMODE_BGRA)
+            Pixel::unpremultiplyRow(reinterpret_cast<const unsigned char*>(&pixel), rgba, 1);
+        else
+            std::memcpy(rgba, &pixel, 4);
+    }
+}
+
+TimedRecursiveMutex ChildProcessSession::Mutex;
+int ChildProcessSession::CallbackFlushMS = 5;
+bool ChildProcessSession::UseHugePages = false;
+
+// 64 tiles of 256x256 pixels take 16 MB.
+TileHistory ChildProcessSession::History(64, 16, (Util::rng::getNext() & 0x3fffffff) + 1);
+std::mutex ChildProcessSession::HistoryMutex;
+
+// Enough to keep the pixmaps of a few combined renderings mapped.
+BufferPool ChildProcessSession::Buffers(64 * 1024 * 1024, false);
 
 ChildProcessSession::ChildProcessSession(const std::string& id,
                                          std::shared_ptr<Poco::Net::WebSocket> ws,
@@ -262,6 +380,11 @@ ChildProcessSession::ChildProcessSession(const std::string& id,
     _clientPart(0),
     _onLoad(onLoad),
     _onUnload(onUnload),
+    _tilePixelWidth(0),
+    _tilePixelHeight(0),
+    _tileTwipWidth(0),
+    _tileTwipHeight(0),
+    _sentVersions(new TileVersions()),
     _callbackWorker(new CallbackWorker(_callbackQueue, *this))
 {
     Log::info("ChildProcessSession ctor [" + getName() + "].");
@@ -278,13 +401,29 @@ ChildProcessSession::~ChildProcessSession()
     // Wait for the callback worker to finish.
     _callbackWorker->stop();
     _callbackThread.join();
+
+    const BufferPool::Stats stats = Buffers.getStats();
+    Log::debug() << "Buffer pool: pixmaps " << stats.pixmapHits << " hits, " << stats.pixmapMisses
+                 << " misses, outputs " << stats.outputHits << " hits, " << stats.outputMisses
+                 << " misses, " << stats.mappedBytes / 1024 << " KB mapped (" << stats.freeBytes / 1024
+                 << " KB free, " << stats.hugePageBytes / 1024 << " KB huge pages)." << Log::end;
+
+    const TimedRecursiveMutex::Stats lockStats = Mutex.getStats();
+    if (lockStats.count > 0)
+    {
+        Log::debug() << "Document lock: " << lockStats.count << " times, held "
+                     << lockStats.totalHoldUs / lockStats.count / 1000. << " ms on average, "
+                     << lockStats.maxHoldUs / 1000. << " ms max; waited for "
+                     << lockStats.totalWaitUs / lockStats.count / 1000. << " ms on average, "
+                     << lockStats.maxWaitUs / 1000. << " ms max." << Log::end;
+    }
 }
 
 void ChildProcessSession::disconnect(const std::string& reason)
 {
     if (!isDisconnected())
     {
-        std::unique_lock<std::recursive_mutex> lock(Mutex);
+        std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
         if (_multiView)
             _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -309,7 +448,7 @@ bool ChildProcessSession::_handleInput(const char *buffer, int length)
 
         // Client is getting active again.
         // Send invalidation and other sync-up messages.
-        std::unique_lock<std::recursive_mutex> lock(Mutex);
+        std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
         if (_multiView)
             _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -331,24 +470,39 @@ bool ChildProcessSession::_handleInput(const char *buffer, int length)
     }
 
     _stats.updateLastActivityTime();
-    const std::string firstLine = getFirstLine(buffer, length);
-    StringTokenizer tokens(firstLine, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
 
-    if (tokens[0] == "canceltiles")
+    // Tile requests come from the master in binary form, parsed in place.
+    TileHeader tile;
+    if (TileHeader::isBinary(buffer, length) && tile.parse(buffer, length))
+    {
+        if (!_isDocLoaded)
+        {
+            sendTextFrame("error: cmd=tile kind=nodocloaded");
+            return false;
+        }
+
+        renderTile(tile);
+        return true;
+    }
+
+    const Tokenizer tokens(buffer, length);
+    const Command command = getCommand(tokens[0]);
+
+    if (command == Command::CANCELTILES)
     {
         // this command makes sense only on the command queue level, nothing
         // to do here
         return true;
     }
-    else if (tokens[0] == "commandvalues")
+    else if (command == Command::COMMANDVALUES)
     {
-        return getCommandValues(buffer, length, tokens);
+        return getCommandValues(buffer, length, *tokenize(buffer, length));
     }
-    else if (tokens[0] == "partpagerectangles")
+    else if (command == Command::PARTPAGERECTANGLES)
     {
         return getPartPageRectangles(buffer, length);
     }
-    else if (tokens[0] == "load")
+    else if (command == Command::LOAD)
     {
         if (_isDocLoaded)
         {
@@ -356,62 +510,62 @@ bool ChildProcessSession::_handleInput(const char *buffer, int length)
             return false;
         }
 
-        _isDocLoaded = loadDocument(buffer, length, tokens);
+        _isDocLoaded = loadDocument(buffer, length, *tokenize(buffer, length));
         return _isDocLoaded;
     }
     else if (!_isDocLoaded)
     {
-        sendTextFrame("error: cmd=" + tokens[0] + " kind=nodocloaded");
+        sendTextFrame("error: cmd=" + tokens[0].toString() + " kind=nodocloaded");
         return false;
     }
-    else if (tokens[0] == "renderfont")
+    else if (command == Command::RENDERFONT)
     {
-        sendFontRendering(buffer, length, tokens);
+        sendFontRendering(buffer, length, *tokenize(buffer, length));
     }
-    else if (tokens[0] == "setclientpart")
+    else if (command == Command::SETCLIENTPART)
     {
-        return setClientPart(buffer, length, tokens);
+        return setClientPart(buffer, length, *tokenize(buffer, length));
     }
-    else if (tokens[0] == "setpage")
+    else if (command == Command::SETPAGE)
     {
-        return setPage(buffer, length, tokens);
+        return setPage(buffer, length, *tokenize(buffer, length));
     }
-    else if (tokens[0] == "status")
+    else if (command == Command::STATUS)
     {
         return getStatus(buffer, length);
     }
-    else if (tokens[0] == "tile")
+    else if (command == Command::TILE)
     {
-        sendTile(buffer, length, tokens);
+        sendTile(buffer, length, *tokenize(buffer, length));
     }
-    else if (tokens[0] == "tilecombine")
+    else if (command == Command::TILECOMBINE)
     {
-        sendCombinedTiles(buffer, length, tokens);
+        sendCombinedTiles(buffer, length, *tokenize(buffer, length));
     }
     else
     {
         // All other commands are such that they always require a LibreOfficeKitDocument session,
         // i.e. need to be handled in a child process.
 
-        assert(tokens[0] == "clientzoom" ||
-               tokens[0] == "clientvisiblearea" ||
-               tokens[0] == "disconnect" ||
-               tokens[0] == "downloadas" ||
-               tokens[0] == "getchildid" ||
-               tokens[0] == "gettextselection" ||
-               tokens[0] == "paste" ||
-               tokens[0] == "insertfile" ||
-               tokens[0] == "key" ||
-               tokens[0] == "mouse" ||
-               tokens[0] == "uno" ||
-               tokens[0] == "selecttext" ||
-               tokens[0] == "selectgraphic" ||
-               tokens[0] == "resetselection" ||
-               tokens[0] == "saveas" ||
-               tokens[0] == "unload");
+        assert(command == Command::CLIENTZOOM ||
+               command == Command::CLIENTVISIBLEAREA ||
+               command == Command::DISCONNECT ||
+               command == Command::DOWNLOADAS ||
+               command == Command::GETCHILDID ||
+               command == Command::GETTEXTSELECTION ||
+               command == Command::PASTE ||
+               command == Command::INSERTFILE ||
+               command == Command::KEY ||
+               command == Command::MOUSE ||
+               command == Command::UNO ||
+               command == Command::SELECTTEXT ||
+               command == Command::SELECTGRAPHIC ||
+               command == Command::RESETSELECTION ||
+               command == Command::SAVEAS ||
+               command == Command::UNLOAD);
 
         {
-            std::unique_lock<std::recursive_mutex> lock(Mutex);
+            std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
             if (_multiView)
                 _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -422,68 +576,68 @@ bool ChildProcessSession::_handleInput(const char *buffer, int length)
             }
         }
 
-        if (tokens[0] == "clientzoom")
+        if (command == Command::CLIENTZOOM)
         {
-            return clientZoom(buffer, length, tokens);
+            return clientZoom(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "clientvisiblearea")
+        else if (command == Command::CLIENTVISIBLEAREA)
         {
-            return clientVisibleArea(buffer, length, tokens);
+            return clientVisibleArea(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "disconnect")
+        else if (command == Command::DISCONNECT)
         {
             // This was the last we would hear from the client on this socket.
-            return handleDisconnect(tokens);
+            return handleDisconnect(*tokenize(buffer, length));
         }
-        else if (tokens[0] == "downloadas")
+        else if (command == Command::DOWNLOADAS)
         {
-            return downloadAs(buffer, length, tokens);
+            return downloadAs(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "getchildid")
+        else if (command == Command::GETCHILDID)
         {
             return getChildId();
         }
-        else if (tokens[0] == "gettextselection")
+        else if (command == Command::GETTEXTSELECTION)
         {
-            return getTextSelection(buffer, length, tokens);
+            return getTextSelection(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "paste")
+        else if (command == Command::PASTE)
         {
-            return paste(buffer, length, tokens);
+            return paste(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "insertfile")
+        else if (command == Command::INSERTFILE)
         {
-            return insertFile(buffer, length, tokens);
+            return insertFile(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "key")
+        else if (command == Command::KEY)
         {
             return keyEvent(buffer, length, tokens);
         }
-        else if (tokens[0] == "mouse")
+        else if (command == Command::MOUSE)
         {
             return mouseEvent(buffer, length, tokens);
         }
-        else if (tokens[0] == "uno")
+        else if (command == Command::UNO)
         {
-            return unoCommand(buffer, length, tokens);
+            return unoCommand(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "selecttext")
+        else if (command == Command::SELECTTEXT)
         {
-            return selectText(buffer, length, tokens);
+            return selectText(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "selectgraphic")
+        else if (command == Command::SELECTGRAPHIC)
         {
-            return selectGraphic(buffer, length, tokens);
+            return selectGraphic(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "resetselection")
+        else if (command == Command::RESETSELECTION)
         {
-            return resetSelection(buffer, length, tokens);
+            return resetSelection(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "saveas")
+        else if (command == Command::SAVEAS)
         {
-            return saveAs(buffer, length, tokens);
+            return saveAs(buffer, length, *tokenize(buffer, length));
         }
-        else if (tokens[0] == "unload")
+        else if (command == Command::UNLOAD)
         {
             //FIXME: Implement.
             assert(!"Not implemented");
@@ -516,7 +670,7 @@ bool ChildProcessSession::loadDocument(const char * /*buffer*/, int /*length*/,
     if (!_loKitDocument)
         return false;
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _viewId = _loKitDocument->pClass->getView(_loKitDocument);
@@ -542,6 +696,19 @@ bool ChildProcessSession::loadDocument(const char * /*buffer*/, int /*length*/,
     if (!getStatus(nullptr, 0))
         return false;
 
+    // The client's choice takes precedence over the per document type configuration.
+    if (!_tileEncoderName.empty())
+    {
+        _tileEncoder = TileEncoder::create(_tileEncoderName);
+        if (!_tileEncoder)
+            Log::warn("Unknown tile encoder [" + _tileEncoderName + "] requested.");
+    }
+
+    if (!_tileEncoder)
+        _tileEncoder = TileEncoder::getForDocType(_docType);
+
+    Log::debug("Session " + getId() + " encodes tiles with " + _tileEncoder->getName());
+
     Log::info("Loaded session " + getId());
     return true;
 }
@@ -557,11 +724,6 @@ void ChildProcessSession::sendFontRendering(const char* /*buffer*/, int /*length
         return;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
-
-    if (_multiView)
-       _loKitDocument->pClass->setView(_loKitDocument, _viewId);
-
     URI::decode(font, decodedFont);
     std::string response = "renderfont: " + Poco::cat(std::string(" "), tokens.begin() + 1, tokens.end()) + "\n";
 
@@ -571,7 +733,16 @@ void ChildProcessSession::sendFontRendering(const char* /*buffer*/, int /*length
 
     Poco::Timestamp timestamp;
     int width, height;
-    unsigned char *pixmap = _loKitDocument->pClass->renderFont(_loKitDocument, decodedFont.c_str(), &width, &height);
+    unsigned char *pixmap;
+    {
+        std::unique_lock<TimedRecursiveMutex> lock(Mutex);
+
+        if (_multiView)
+           _loKitDocument->pClass->setView(_loKitDocument, _viewId);
+
+        pixmap = _loKitDocument->pClass->renderFont(_loKitDocument, decodedFont.c_str(), &width, &height);
+    }
+
     Log::trace("renderFont [" + font + "] rendered in " + std::to_string(timestamp.elapsed()/1000.) + "ms");
 
     if (pixmap != nullptr)
@@ -590,7 +761,7 @@ void ChildProcessSession::sendFontRendering(const char* /*buffer*/, int /*length
 
 bool ChildProcessSession::getStatus(const char* /*buffer*/, int /*length*/)
 {
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -617,7 +788,7 @@ bool ChildProcessSession::getCommandValues(const char* /*buffer*/, int /*length*
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -628,7 +799,7 @@ bool ChildProcessSession::getCommandValues(const char* /*buffer*/, int /*length*
 
 bool ChildProcessSession::getPartPageRectangles(const char* /*buffer*/, int /*length*/)
 {
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -637,62 +808,57 @@ bool ChildProcessSession::getPartPageRectangles(const char* /*buffer*/, int /*le
     return true;
 }
 
-void ChildProcessSession::sendTile(const char* /*buffer*/, int /*length*/, StringTokenizer& tokens)
+void ChildProcessSession::sendTile(const char* buffer, int length, StringTokenizer& /*tokens*/)
 {
-    int part, width, height, tilePosX, tilePosY, tileWidth, tileHeight;
-
-    if (tokens.count() < 8 ||
-        !getTokenInteger(tokens[1], "part", part) ||
-        !getTokenInteger(tokens[2], "width", width) ||
-        !getTokenInteger(tokens[3], "height", height) ||
-        !getTokenInteger(tokens[4], "tileposx", tilePosX) ||
-        !getTokenInteger(tokens[5], "tileposy", tilePosY) ||
-        !getTokenInteger(tokens[6], "tilewidth", tileWidth) ||
-        !getTokenInteger(tokens[7], "tileheight", tileHeight))
+    TileHeader tile;
+    if (!tile.parse(buffer, length) || tile.type != TileHeader::Type::Request)
     {
         sendTextFrame("error: cmd=tile kind=syntax");
         return;
     }
 
-    if (part < 0 ||
-        width <= 0 ||
-        height <= 0 ||
-        tilePosX < 0 ||
-        tilePosY < 0 ||
-        tileWidth <= 0 ||
-        tileHeight <= 0)
+    renderTile(tile);
+}
+
+void ChildProcessSession::renderTile(TileHeader& tile)
+{
+    if (tile.type != TileHeader::Type::Request || !tile.isValid())
     {
         sendTextFrame("error: cmd=tile kind=invalid");
         return;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    const int width = tile.width;
+    const int height = tile.height;
 
-    if (_multiView)
-        _loKitDocument->pClass->setView(_loKitDocument, _viewId);
+    BufferPool::Output outputBuffer = Buffers.getOutput(4 * width * height);
+    std::vector<char>& output = outputBuffer.get();
+    BufferPool::Pixmap pixmap = Buffers.getPixmap(4 * width * height);
 
-    const std::string response = "tile: " + Poco::cat(std::string(" "), tokens.begin() + 1, tokens.end()) + "\n";
+    Poco::Timestamp timestamp;
+    LibreOfficeKitTileMode mode;
+    {
+        std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
-    std::vector<char> output;
-    output.reserve(response.size() + (4 * width * height));
-    output.resize(response.size());
-    std::memcpy(output.data(), response.data(), response.size());
+        if (_multiView)
+            _loKitDocument->pClass->setView(_loKitDocument, _viewId);
 
-    std::vector<unsigned char> pixmap;
-    pixmap.resize(4 * width * height);
+        if (_docType != "text" && tile.part != _loKitDocument->pClass->getPart(_loKitDocument))
+        {
+            _loKitDocument->pClass->setPart(_loKitDocument, tile.part);
+        }
 
-    if (_docType != "text" && part != _loKitDocument->pClass->getPart(_loKitDocument))
-    {
-        _loKitDocument->pClass->setPart(_loKitDocument, part);
+        _loKitDocument->pClass->paintTile(_loKitDocument, pixmap.data(), width, height,
+                                          tile.tilePosX, tile.tilePosY, tile.tileWidth, tile.tileHeight);
+        mode = static_cast<LibreOfficeKitTileMode>(_loKitDocument->pClass->getTileMode(_loKitDocument));
     }
 
-    Poco::Timestamp timestamp;
-    _loKitDocument->pClass->paintTile(_loKitDocument, pixmap.data(), width, height, tilePosX, tilePosY, tileWidth, tileHeight);
-    Log::trace() << "paintTile at [" << tilePosX << ", " << tilePosY
+    Log::trace() << "paintTile at [" << tile.tilePosX << ", " << tile.tilePosY
                  << "] rendered in " << (timestamp.elapsed()/1000.) << " ms" << Log::end;
 
-    LibreOfficeKitTileMode mode = static_cast<LibreOfficeKitTileMode>(_loKitDocument->pClass->getTileMode(_loKitDocument));
-    if (!Util::encodeBufferToPNG(pixmap.data(), width, height, output, mode))
+    // Encode and send while other sessions can use the document.
+    std::unique_lock<std::mutex> sendLock(_tileSendMutex);
+    if (!appendTile(tile, pixmap.data(), mode, output))
     {
         sendTextFrame("error: cmd=tile kind=failure");
         return;
@@ -728,17 +894,23 @@ void ChildProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*length
         return;
     }
 
-    if (tokens.count() > 8)
-        getTokenString(tokens[8], "timestamp", reqTimestamp);
+    std::string oldVersions;
+    for (size_t i = 8; i < tokens.count(); ++i)
+    {
+        if (!getTokenString(tokens[i], "timestamp", reqTimestamp))
+            getTokenString(tokens[i], "oldver", oldVersions);
+    }
 
     Util::Rectangle renderArea;
 
     StringTokenizer positionXtokens(tilePositionsX, ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
     StringTokenizer positionYtokens(tilePositionsY, ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+    StringTokenizer oldVersionTokens(oldVersions, ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
 
     size_t numberOfPositions = positionYtokens.count();
     // check that number of positions for X and Y is the same
-    if (numberOfPositions != positionYtokens.count())
+    if (numberOfPositions != positionYtokens.count() ||
+        (!oldVersions.empty() && numberOfPositions != oldVersionTokens.count()))
     {
         sendTextFrame("error: cmd=tilecombine kind=invalid");
         return;
@@ -776,13 +948,6 @@ void ChildProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*length
         tiles.push_back(rectangle);
     }
 
-    if (_docType != "text" && part != _loKitDocument->pClass->getPart(_loKitDocument))
-    {
-        _loKitDocument->pClass->setPart(_loKitDocument, part);
-    }
-
-    LibreOfficeKitTileMode mode = static_cast<LibreOfficeKitTileMode>(_loKitDocument->pClass->getTileMode(_loKitDocument));
-
     int tilesByX = renderArea.getWidth() / tileWidth;
     int tilesByY = renderArea.getHeight() / tileHeight;
 
@@ -791,48 +956,222 @@ void ChildProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*length
 
     const size_t pixmapSize = 4 * pixmapWidth * pixmapHeight;
 
-    std::vector<unsigned char> pixmap(pixmapSize, 0);
+    // No need to clear it, paintTile() erases the buffer first.
+    BufferPool::Pixmap pixmap = Buffers.getPixmap(pixmapSize);
 
     Poco::Timestamp timestamp;
-    _loKitDocument->pClass->paintTile(_loKitDocument, pixmap.data(), pixmapWidth, pixmapHeight,
-                                      renderArea.getLeft(), renderArea.getTop(),
-                                      renderArea.getWidth(), renderArea.getHeight());
+    LibreOfficeKitTileMode mode;
+    {
+        std::unique_lock<TimedRecursiveMutex> lock(Mutex);
+
+        if (_multiView)
+            _loKitDocument->pClass->setView(_loKitDocument, _viewId);
+
+        if (_docType != "text" && part != _loKitDocument->pClass->getPart(_loKitDocument))
+        {
+            _loKitDocument->pClass->setPart(_loKitDocument, part);
+        }
+
+        _loKitDocument->pClass->paintTile(_loKitDocument, pixmap.data(), pixmapWidth, pixmapHeight,
+                                          renderArea.getLeft(), renderArea.getTop(),
+                                          renderArea.getWidth(), renderArea.getHeight());
+        mode = static_cast<LibreOfficeKitTileMode>(_loKitDocument->pClass->getTileMode(_loKitDocument));
+    }
 
     Log::debug() << "paintTile (Multiple) called, tile at [" << renderArea.getLeft() << ", " << renderArea.getTop() << "]"
                 << " (" << renderArea.getWidth() << ", " << renderArea.getHeight() << ") rendered in "
                 << double(timestamp.elapsed())/1000 <<  "ms" << Log::end;
 
-    for (Util::Rectangle& tileRect : tiles)
+    const std::string extra = (reqTimestamp.empty() ? std::string() : "timestamp=" + reqTimestamp);
+    BufferPool::Pixmap tilePixmap = Buffers.getPixmap(4 * pixelWidth * pixelHeight);
+
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+        Util::Rectangle& tileRect = tiles[i];
+        TileHeader tile;
+        tile.type = TileHeader::Type::Request;
+        tile.part = part;
+        tile.width = pixelWidth;
+        tile.height = pixelHeight;
+        tile.tilePosX = tileRect.getLeft();
+        tile.tilePosY = tileRect.getTop();
+        tile.tileWidth = tileWidth;
+        tile.tileHeight = tileHeight;
+        tile.extra = extra.data();
+        tile.extraSize = extra.size();
+        if (!oldVersions.empty())
+            stringToInteger(oldVersionTokens[i], tile.oldVersion);
+
+        BufferPool::Output outputBuffer = Buffers.getOutput(pixelWidth * pixelHeight * 4);
+        std::vector<char>& output = outputBuffer.get();
+
+        // Copy the tile out of the combined rendering, to keep it in the history.
+        const int positionX = (tileRect.getLeft() - renderArea.getLeft()) / tileWidth;
+        const int positionY = (tileRect.getTop() - renderArea.getTop())  / tileHeight;
+        for (int y = 0; y < pixelHeight; ++y)
+        {
+            const size_t offset = 4 * ((positionY * pixelHeight + y) * pixmapWidth + positionX * pixelWidth);
+            std::memcpy(tilePixmap.data() + 4 * y * pixelWidth, pixmap.data() + offset, 4 * pixelWidth);
+        }
+
+        std::unique_lock<std::mutex> sendLock(_tileSendMutex);
+        if (!appendTile(tile, tilePixmap.data(), mode, output))
+        {
+            sendTextFrame("error: cmd=tile kind=failure");
+            return;
+        }
+
+        sendBinaryFrame(output.data(), output.size());
+    }
+}
+
+bool ChildProcessSession::appendTile(TileHeader& tile, unsigned char* pixmap,
+                                     const LibreOfficeKitTileMode mode, std::vector<char>& output)
+{
+    const int width = tile.width;
+    const int height = tile.height;
+
+    // Blank and single-colour tiles are common, and need no image at all.
+    uint32_t pixel;
+    const bool isUniform = Pixel::isUniform(pixmap, width * height, pixel);
+
+    // Called without Mutex held, so that encoding doesn't block the document.
+    const std::string tileDesc = tile.getDescription();
+    std::unique_lock<std::mutex> lock(HistoryMutex);
+    if (tile.oldVersion == SentVersion)
+        tile.oldVersion = _sentVersions->get(tileDesc);
+
+    const TileHistory::Update update = History.update(tileDesc, pixmap, width, height,
+                                                      isUniform ? 0 : tile.oldVersion);
+    _sentVersions->set(tileDesc, update.version, History);
+    lock.unlock();
+
+    tile.version = update.version;
+    if (isUniform)
     {
-        std::string response = "tile: part=" + std::to_string(part) +
-                               " width=" + std::to_string(pixelWidth) +
-                               " height=" + std::to_string(pixelHeight) +
-                               " tileposx=" + std::to_string(tileRect.getLeft()) +
-                               " tileposy=" + std::to_string(tileRect.getTop()) +
-                               " tilewidth=" + std::to_string(tileWidth) +
-                               " tileheight=" + std::to_string(tileHeight);
+        tile.type = TileHeader::Type::Solid;
+        getColor(pixel, mode, tile.color);
+        tile.writeBinary(output);
+        return true;
+    }
 
-        if (reqTimestamp != "")
-            response += " timestamp=" + reqTimestamp;
+    if (update.isDelta)
+    {
+        tile.type = TileHeader::Type::Delta;
+        tile.deltaX = update.x;
+        tile.deltaY = update.y;
+        tile.deltaWidth = update.width;
+        tile.deltaHeight = update.height;
+    }
+    else
+    {
+        tile.type = TileHeader::Type::Tile;
+    }
 
-        response += "\n";
+    tile.writeBinary(output);
 
-        std::vector<char> output;
-        output.reserve(pixelWidth * pixelHeight * 4 + response.size());
-        output.resize(response.size());
+    if (!update.isDelta)
+        return _tileEncoder->encode(pixmap, 0, 0, width, height, width, height, output, mode);
 
-        std::copy(response.begin(), response.end(), output.begin());
+    // An unchanged tile needs no image at all.
+    if (update.width == 0)
+        return true;
+
+    return _tileEncoder->encode(pixmap, update.x, update.y, update.width, update.height, width, height, output, mode);
+}
 
-        int positionX = (tileRect.getLeft() - renderArea.getLeft()) / tileWidth;
-        int positionY = (tileRect.getTop() - renderArea.getTop())  / tileHeight;
+std::string ChildProcessSession::queueTilesToPush(const int part, const int x, const int y, const int width, const int height)
+{
+    const int viewPart = (_docType == "text" ? 0 : _clientPart);
+    if (part != viewPart || _tileTwipWidth <= 0 || _tileTwipHeight <= 0 ||
+        _tilePixelWidth <= 0 || _tilePixelHeight <= 0 || !_visibleArea.isValid())
+    {
+        return std::string();
+    }
 
-        if (!Util::encodeSubBufferToPNG(pixmap.data(), positionX * pixelWidth, positionY * pixelHeight, pixelWidth, pixelHeight, pixmapWidth, pixmapHeight, output, mode))
+    long docWidth = 0;
+    long docHeight = 0;
+    _loKitDocument->pClass->getDocumentSize(_loKitDocument, &docWidth, &docHeight);
+
+    // The invalidated area may be INT_MAX wide, so do the math in longs.
+    const long left = std::max({ 0L, static_cast<long>(x), static_cast<long>(_visibleArea.getLeft()) });
+    const long top = std::max({ 0L, static_cast<long>(y), static_cast<long>(_visibleArea.getTop()) });
+    const long right = std::min({ docWidth, static_cast<long>(x) + width, static_cast<long>(_visibleArea._x2) });
+    const long bottom = std::min({ docHeight, static_cast<long>(y) + height, static_cast<long>(_visibleArea._y2) });
+    if (left > right || top > bottom)
+        return std::string();
+
+    // The client invalidates the tiles touching the area, edges included.
+    const long firstColumn = std::max(0L, (left + _tileTwipWidth - 1) / _tileTwipWidth - 1);
+    const long firstRow = std::max(0L, (top + _tileTwipHeight - 1) / _tileTwipHeight - 1);
+    const long lastColumn = std::min(right / _tileTwipWidth, std::max(0L, docWidth - 1) / _tileTwipWidth);
+    const long lastRow = std::min(bottom / _tileTwipHeight, std::max(0L, docHeight - 1) / _tileTwipHeight);
+
+    // Beyond a screenful the client is zoomed out or the view is stale; let it ask.
+    const long count = (lastColumn - firstColumn + 1) * (lastRow - firstRow + 1);
+    if (count > MaxPushedTiles)
+        return std::string();
+
+    for (long row = firstRow; row <= lastRow; ++row)
+    {
+        for (long column = firstColumn; column <= lastColumn; ++column)
         {
-            sendTextFrame("error: cmd=tile kind=failure");
+            _tilesToPush.emplace(part, row * _tileTwipHeight, column * _tileTwipWidth);
+        }
+    }
+
+    return " pushed=" + std::to_string(left) + ',' + std::to_string(top) + ',' +
+           std::to_string(right - left) + ',' + std::to_string(bottom - top) + ',' +
+           std::to_string(_tileTwipWidth) + ',' + std::to_string(_tileTwipHeight);
+}
+
+void ChildProcessSession::pushTiles()
+{
+    std::set<std::tuple<int, int, int>> tiles;
+    int pixelWidth, pixelHeight, tileWidth, tileHeight;
+    {
+        std::unique_lock<TimedRecursiveMutex> lock(Mutex);
+        if (_tilesToPush.empty())
             return;
+
+        tiles.swap(_tilesToPush);
+        pixelWidth = _tilePixelWidth;
+        pixelHeight = _tilePixelHeight;
+        tileWidth = _tileTwipWidth;
+        tileHeight = _tileTwipHeight;
+    }
+
+    const std::string size = " width=" + std::to_string(pixelWidth) +
+                             " height=" + std::to_string(pixelHeight);
+    const std::string tileSize = " tilewidth=" + std::to_string(tileWidth) +
+                                 " tileheight=" + std::to_string(tileHeight);
+
+    // One tilecombine per part, as if the client had asked for it.
+    auto it = tiles.begin();
+    while (it != tiles.end())
+    {
+        const int part = std::get<0>(*it);
+        std::string positionsX;
+        std::string positionsY;
+        std::string oldVersions;
+        for (; it != tiles.end() && std::get<0>(*it) == part; ++it)
+        {
+            // Deltas are against what was sent to this client last, looked
+            // up once rendered: other clients may have had newer versions
+            // since, and its own requests may get it some meanwhile.
+            const std::string separator = (positionsX.empty() ? "" : ",");
+            positionsX += separator + std::to_string(std::get<2>(*it));
+            positionsY += separator + std::to_string(std::get<1>(*it));
+            oldVersions += separator + std::to_string(SentVersion);
         }
 
-        sendBinaryFrame(output.data(), output.size());
+        const std::string message = "tilecombine part=" + std::to_string(part) + size +
+                                    " tileposx=" + positionsX + " tileposy=" + positionsY + tileSize +
+                                    " oldver=" + oldVersions;
+        Log::debug("Pushing tiles: " + message);
+
+        StringTokenizer tokens(message, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+        sendCombinedTiles(message.data(), message.size(), tokens);
     }
 }
 
@@ -850,7 +1189,14 @@ bool ChildProcessSession::clientZoom(const char* /*buffer*/, int /*length*/, Str
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
+
+    // Queued tiles are of the old size, the client requests the new ones itself.
+    _tilesToPush.clear();
+    _tilePixelWidth = tilePixelWidth;
+    _tilePixelHeight = tilePixelHeight;
+    _tileTwipWidth = tileTwipWidth;
+    _tileTwipHeight = tileTwipHeight;
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -876,7 +1222,9 @@ bool ChildProcessSession::clientVisibleArea(const char* /*buffer*/, int /*length
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
+
+    _visibleArea = Util::Rectangle(x, y, width, height);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -910,7 +1258,7 @@ bool ChildProcessSession::downloadAs(const char* /*buffer*/, int /*length*/, Str
     const auto tmpDir = Util::createRandomDir(JailedDocumentRoot);
     const auto url = JailedDocumentRoot + tmpDir + "/" + name;
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     //TODO: Cleanup the file after downloading.
     _loKitDocument->pClass->saveAs(_loKitDocument, url.c_str(),
@@ -939,7 +1287,7 @@ bool ChildProcessSession::getTextSelection(const char* /*buffer*/, int /*length*
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -964,7 +1312,7 @@ bool ChildProcessSession::paste(const char* buffer, int length, StringTokenizer&
     const char* data = buffer + firstLine.size() + 1;
     size_t size = length - firstLine.size() - 1;
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -986,7 +1334,7 @@ bool ChildProcessSession::insertFile(const char* /*buffer*/, int /*length*/, Str
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (type == "graphic")
     {
@@ -1006,14 +1354,15 @@ bool ChildProcessSession::insertFile(const char* /*buffer*/, int /*length*/, Str
     return true;
 }
 
-bool ChildProcessSession::keyEvent(const char* /*buffer*/, int /*length*/, StringTokenizer& tokens)
+bool ChildProcessSession::keyEvent(const char* /*buffer*/, int /*length*/, const Tokenizer& tokens)
 {
+    static const std::pair<const char*, int> Types[] = {
+        { "input", LOK_KEYEVENT_KEYINPUT }, { "up", LOK_KEYEVENT_KEYUP } };
+
     int type, charcode, keycode;
 
     if (tokens.count() != 4 ||
-        !getTokenKeyword(tokens[1], "type",
-                         {{"input", LOK_KEYEVENT_KEYINPUT}, {"up", LOK_KEYEVENT_KEYUP}},
-                         type) ||
+        !Tokenizer::getKeyword(tokens[1], "type", Types, type) ||
         !getTokenInteger(tokens[2], "char", charcode) ||
         !getTokenInteger(tokens[3], "key", keycode))
     {
@@ -1027,7 +1376,7 @@ bool ChildProcessSession::keyEvent(const char* /*buffer*/, int /*length*/, Strin
     if (keycode == (KEY_CTRL | KEY_W))
         return true;
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -1037,8 +1386,13 @@ bool ChildProcessSession::keyEvent(const char* /*buffer*/, int /*length*/, Strin
     return true;
 }
 
-bool ChildProcessSession::mouseEvent(const char* /*buffer*/, int /*length*/, StringTokenizer& tokens)
+bool ChildProcessSession::mouseEvent(const char* /*buffer*/, int /*length*/, const Tokenizer& tokens)
 {
+    static const std::pair<const char*, int> Types[] = {
+        { "buttondown", LOK_MOUSEEVENT_MOUSEBUTTONDOWN },
+        { "buttonup", LOK_MOUSEEVENT_MOUSEBUTTONUP },
+        { "move", LOK_MOUSEEVENT_MOUSEMOVE } };
+
     int type, x, y, count;
     bool success = true;
 
@@ -1047,11 +1401,7 @@ bool ChildProcessSession::mouseEvent(const char* /*buffer*/, int /*length*/, Str
     int modifier = 0;
 
     if (tokens.count() < 5 ||
-        !getTokenKeyword(tokens[1], "type",
-                         {{"buttondown", LOK_MOUSEEVENT_MOUSEBUTTONDOWN},
-                          {"buttonup", LOK_MOUSEEVENT_MOUSEBUTTONUP},
-                          {"move", LOK_MOUSEEVENT_MOUSEMOVE}},
-                         type) ||
+        !Tokenizer::getKeyword(tokens[1], "type", Types, type) ||
         !getTokenInteger(tokens[2], "x", x) ||
         !getTokenInteger(tokens[3], "y", y) ||
         !getTokenInteger(tokens[4], "count", count))
@@ -1073,7 +1423,7 @@ bool ChildProcessSession::mouseEvent(const char* /*buffer*/, int /*length*/, Str
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -1091,7 +1441,7 @@ bool ChildProcessSession::unoCommand(const char* /*buffer*/, int /*length*/, Str
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -1115,14 +1465,15 @@ bool ChildProcessSession::unoCommand(const char* /*buffer*/, int /*length*/, Str
 
 bool ChildProcessSession::selectText(const char* /*buffer*/, int /*length*/, StringTokenizer& tokens)
 {
+    static const std::pair<const char*, int> Types[] = {
+        { "start", LOK_SETTEXTSELECTION_START },
+        { "end", LOK_SETTEXTSELECTION_END },
+        { "reset", LOK_SETTEXTSELECTION_RESET } };
+
     int type, x, y;
 
     if (tokens.count() != 4 ||
-        !getTokenKeyword(tokens[1], "type",
-                         {{"start", LOK_SETTEXTSELECTION_START},
-                          {"end", LOK_SETTEXTSELECTION_END},
-                          {"reset", LOK_SETTEXTSELECTION_RESET}},
-                         type) ||
+        !getTokenKeyword(tokens[1], "type", Types, type) ||
         !getTokenInteger(tokens[2], "x", x) ||
         !getTokenInteger(tokens[3], "y", y))
     {
@@ -1130,7 +1481,7 @@ bool ChildProcessSession::selectText(const char* /*buffer*/, int /*length*/, Str
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -1142,13 +1493,14 @@ bool ChildProcessSession::selectText(const char* /*buffer*/, int /*length*/, Str
 
 bool ChildProcessSession::selectGraphic(const char* /*buffer*/, int /*length*/, StringTokenizer& tokens)
 {
+    static const std::pair<const char*, int> Types[] = {
+        { "start", LOK_SETGRAPHICSELECTION_START },
+        { "end", LOK_SETGRAPHICSELECTION_END } };
+
     int type, x, y;
 
     if (tokens.count() != 4 ||
-        !getTokenKeyword(tokens[1], "type",
-                         {{"start", LOK_SETGRAPHICSELECTION_START},
-                          {"end", LOK_SETGRAPHICSELECTION_END}},
-                         type) ||
+        !getTokenKeyword(tokens[1], "type", Types, type) ||
         !getTokenInteger(tokens[2], "x", x) ||
         !getTokenInteger(tokens[3], "y", y))
     {
@@ -1156,7 +1508,7 @@ bool ChildProcessSession::selectGraphic(const char* /*buffer*/, int /*length*/,
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -1174,7 +1526,7 @@ bool ChildProcessSession::resetSelection(const char* /*buffer*/, int /*length*/,
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -1205,7 +1557,7 @@ bool ChildProcessSession::saveAs(const char* /*buffer*/, int /*length*/, StringT
         }
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -1243,7 +1595,7 @@ bool ChildProcessSession::setPage(const char* /*buffer*/, int /*length*/, String
         return false;
     }
 
-    std::unique_lock<std::recursive_mutex> lock(Mutex);
+    std::unique_lock<TimedRecursiveMutex> lock(Mutex);
 
     if (_multiView)
         _loKitDocument->pClass->setView(_loKitDocument, _viewId);
@@ -11,6 +11,8 @@
 #define INCLUDED_LOOLCHILDPROCESSSESSION_HPP
 
 #include <mutex>
+#include <set>
+#include <tuple>
 
 #define LOK_USE_UNSTABLE_API
 #include <LibreOfficeKit/LibreOfficeKit.h>
@@ -21,6 +23,15 @@
 
 #include "Common.hpp"
 #include "LOOLSession.hpp"
+#include "Rectangle.hpp"
+#include "TimedMutex.hpp"
+
+class BufferPool;
+class TileEncoder;
+class TileHistory;
+class TileVersions;
+struct TileHeader;
+class Tokenizer;
 
 // The client port number, which is changed via loolwsd args.
 // Except that it isn't. This is "static" so it is a *separate* variable
@@ -88,11 +99,33 @@ public:
 
     void loKitCallback(const int nType, const char* pPayload);
 
-    std::unique_lock<std::recursive_mutex> getLock() { return std::unique_lock<std::recursive_mutex>(Mutex); }
+    /// Queues the tiles of the invalidated area that the client sees, to be
+    /// rendered by pushTiles() without waiting for the client to ask.
+    /// Returns the " pushed=..." token telling the client which ones, or an
+    /// empty string if none. Call with the lock held.
+    std::string queueTilesToPush(int part, int x, int y, int width, int height);
+
+    /// Renders and sends the queued tiles. Call without the lock.
+    void pushTiles();
+
+    std::unique_lock<TimedRecursiveMutex> getLock() { return std::unique_lock<TimedRecursiveMutex>(Mutex); }
 
     const Statistics& getStatistics() const { return _stats; }
     bool isInactive() const { return _stats.getInactivityMS() >= InactivityThresholdMS; }
 
+    /// How long the callbacks of a burst are held back to go in one frame,
+    /// in all sessions of this process; 0 sends each right away.
+    static void setCallbackFlushMS(int ms) { CallbackFlushMS = ms; }
+    static int getCallbackFlushMS() { return CallbackFlushMS; }
+
+    /// Whether large pixmaps are advised to be backed by transparent huge pages.
+    static void setUseHugePages(bool useHugePages)
+    {
+        UseHugePages = useHugePages;
+        Buffers.setUseHugePages(useHugePages);
+    }
+    static bool getUseHugePages() { return UseHugePages; }
+
  protected:
     virtual bool loadDocument(const char *buffer, int length, Poco::StringTokenizer& tokens) override;
 
@@ -109,8 +142,8 @@ public:
     bool getTextSelection(const char *buffer, int length, Poco::StringTokenizer& tokens);
     bool paste(const char *buffer, int length, Poco::StringTokenizer& tokens);
     bool insertFile(const char *buffer, int length, Poco::StringTokenizer& tokens);
-    bool keyEvent(const char *buffer, int length, Poco::StringTokenizer& tokens);
-    bool mouseEvent(const char *buffer, int length, Poco::StringTokenizer& tokens);
+    bool keyEvent(const char *buffer, int length, const Tokenizer& tokens);
+    bool mouseEvent(const char *buffer, int length, const Tokenizer& tokens);
     bool unoCommand(const char *buffer, int length, Poco::StringTokenizer& tokens);
     bool selectText(const char *buffer, int length, Poco::StringTokenizer& tokens);
     bool selectGraphic(const char *buffer, int length, Poco::StringTokenizer& tokens);
@@ -123,6 +156,20 @@ private:
 
     virtual bool _handleInput(const char *buffer, int length) override;
 
+    /// Renders and sends the tile of a request.
+    void renderTile(TileHeader& tile);
+
+    /// Turns the request tile into its response, a tile (or a delta, when the
+    /// client holds tile.oldVersion and little changed, or a solid tile), and
+    /// appends it in binary form, with the image of the rendered pixmap, to output.
+    /// Call with _tileSendMutex held until output is sent.
+    bool appendTile(TileHeader& tile, unsigned char* pixmap,
+                    LibreOfficeKitTileMode mode, std::vector<char>& output);
+
+    /// The oldver of pushed tiles: whichever version was sent to the client
+    /// last, as found when the tile is sent.
+    static constexpr int SentVersion = -1;
+
 private:
     LibreOfficeKitDocument *_loKitDocument;
     std::string _docType;
@@ -135,6 +182,23 @@ private:
     std::function<void(const std::string&)> _onUnload;
     /// Statistics and activity tracking.
     Statistics _stats;
+    /// The client's tile size and visible area, from clientzoom and
+    /// clientvisiblearea; tiles are pushed only when both are known.
+    int _tilePixelWidth;
+    int _tilePixelHeight;
+    int _tileTwipWidth;
+    int _tileTwipHeight;
+    Util::Rectangle _visibleArea;
+    /// Invalidated visible tiles waiting for pushTiles(), as part and position in twips.
+    std::set<std::tuple<int, int, int>> _tilesToPush;
+    /// Compresses the tiles of this session, chosen on load.
+    std::shared_ptr<TileEncoder> _tileEncoder;
+    /// The tiles sent to the client of this session, for pushTiles().
+    /// Guarded by HistoryMutex.
+    std::unique_ptr<TileVersions> _sentVersions;
+    /// Held from giving a tile its version to sending it, so that the
+    /// client gets the tiles, and the deltas between them, in order.
+    std::mutex _tileSendMutex;
 
     std::unique_ptr<CallbackWorker> _callbackWorker;
     Poco::Thread _callbackThread;
@@ -142,9 +206,27 @@ private:
 
     /// Synchronize _loKitDocument acess.
     /// This should be owned by Document.
-    static std::recursive_mutex Mutex;
+    /// Only LOK calls should be made with it held; everything waits for it.
+    static TimedRecursiveMutex Mutex;
+
+    /// Recently rendered tiles of the document, for delta updates.
+    /// Guarded by HistoryMutex.
+    static TileHistory History;
+    static std::mutex HistoryMutex;
+
+    /// Pixmaps and encoding buffers of the render path.
+    static BufferPool Buffers;
+
+    /// Set by --callbackflushms.
+    static int CallbackFlushMS;
+
+    /// Set by --hugepages.
+    static bool UseHugePages;
 
     static constexpr auto InactivityThresholdMS = 120 * 1000;
+
+    /// About a screenful of 256 pixel tiles.
+    static constexpr long MaxPushedTiles = 100;
 };
 
 #endif
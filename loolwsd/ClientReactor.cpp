@@ -0,0 +1,412 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <sys/epoll.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <stdexcept>
+
+#include <Poco/Exception.h>
+
+#include "ClientReactor.hpp"
+#include "Common.hpp"
+#include "LOOLProtocol.hpp"
+#include "LOOLSession.hpp"
+#include "MessageQueue.hpp"
+#include "ReceiveBuffer.hpp"
+#include "Util.hpp"
+#include "WebSocketDecoder.hpp"
+
+using namespace LOOLProtocol;
+
+using Poco::Net::WebSocket;
+
+namespace
+{
+    /// Bytes read from a socket per wakeup.
+    const size_t ReceiveBufferSize = 64 * 1024;
+
+    const int MaxEvents = 64;
+
+    /// Messages handled before a worker moves on to the next session.
+    const size_t MessagesPerTurn = 16;
+}
+
+struct ClientReactor::Connection
+{
+    Connection(const std::shared_ptr<WebSocket>& webSocket, const std::shared_ptr<LOOLSession>& loolSession,
+               const std::shared_ptr<OutboundQueue>& outboundQueue) :
+        ws(webSocket),
+        session(loolSession),
+        name(loolSession->getName()),
+        fd(webSocket->impl()->sockfd()),
+        outbound(outboundQueue),
+        decoder(ReceiveBuffer::getMaxMessageSize()),
+        scheduled(false),
+        finished(false)
+    {
+    }
+
+    const std::shared_ptr<WebSocket> ws;
+    /// Released by the worker handling "eof".
+    std::shared_ptr<LOOLSession> session;
+    /// That of the session, for the stats.
+    const std::string name;
+    const int fd;
+    /// What the session sends, shared with it.
+    const std::shared_ptr<OutboundQueue> outbound;
+    /// Used by the polling thread only.
+    WebSocketDecoder decoder;
+    /// Messages for the session. A "canceltiles" drops the tile requests
+    /// still queued.
+    BasicTileQueue queue;
+    /// Whether it is queued for a worker or being processed; guarded by _mutex.
+    bool scheduled;
+    /// Set when the session wants no more input.
+    std::atomic<bool> finished;
+};
+
+ClientReactor::ClientReactor(const size_t workerCount, const size_t loadWorkerCount,
+                             const size_t outboundLimit, const OutboundQueue::Policy outboundPolicy) :
+    _epollFd(epoll_create1(EPOLL_CLOEXEC)),
+    _outboundLimit(outboundLimit),
+    _outboundPolicy(outboundPolicy),
+    _stop(false),
+    _overflowCount(0),
+    _buffer(ReceiveBufferSize),
+    _workers(workerCount, loadWorkerCount, "client")
+{
+    if (_epollFd < 0)
+        throw std::runtime_error("Failed to create the epoll instance.");
+
+    _pollThread = std::thread(&ClientReactor::pollSockets, this);
+
+    Log::info("ClientReactor started with " + std::to_string(workerCount) + " workers and " +
+              std::to_string(loadWorkerCount) + " load workers.");
+}
+
+ClientReactor::~ClientReactor()
+{
+    stop();
+    ::close(_epollFd);
+}
+
+void ClientReactor::add(const std::shared_ptr<WebSocket>& ws, const std::shared_ptr<LOOLSession>& session,
+                        std::unique_ptr<PerMessageDeflate::Inflater> inflater)
+{
+    // Only the queue knows when the socket is full. Once the connection is
+    // closed, changing what is polled just fails.
+    const int epollFd = _epollFd;
+    const int fd = ws->impl()->sockfd();
+    auto outbound = std::make_shared<OutboundQueue>(fd, _outboundLimit, _outboundPolicy,
+        [epollFd, fd](const bool pollWrite)
+        {
+            epoll_event event = {};
+            event.events = EPOLLIN | EPOLLRDHUP | (pollWrite ? EPOLLOUT : 0);
+            event.data.fd = fd;
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+        });
+
+    auto connection = std::make_shared<Connection>(ws, session, outbound);
+    connection->decoder.setInflater(std::move(inflater));
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _connections[connection->fd] = connection;
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN | EPOLLRDHUP;
+    event.data.fd = connection->fd;
+    if (epoll_ctl(_epollFd, EPOLL_CTL_ADD, connection->fd, &event) < 0)
+    {
+        Log::error("Failed to poll the socket of session " + session->getName() + ".");
+        std::unique_lock<std::mutex> lock(_mutex);
+        _connections.erase(connection->fd);
+        return;
+    }
+
+    // Polled before anything is queued, so EPOLLOUT can be asked for.
+    session->setOutboundQueue(outbound);
+    Log::debug("Polling the socket of session " + session->getName() + ".");
+}
+
+void ClientReactor::stop()
+{
+    if (_stop.exchange(true))
+        return;
+
+    if (_pollThread.joinable())
+        _pollThread.join();
+
+    _workers.stop();
+
+    const size_t queuedBytes = getQueuedBytes();
+    std::unique_lock<std::mutex> lock(_mutex);
+    Log::info("ClientReactor stopped, dropping " + std::to_string(_connections.size()) + " connections with " +
+              std::to_string(queuedBytes) + " bytes queued.");
+    _connections.clear();
+}
+
+std::vector<ClientReactor::ClientStats> ClientReactor::getClientStats() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    std::vector<ClientStats> stats;
+    stats.reserve(_connections.size());
+    for (const auto& pair : _connections)
+    {
+        stats.push_back({ pair.second->name, pair.second->outbound->getStats() });
+    }
+
+    return stats;
+}
+
+size_t ClientReactor::getQueuedBytes() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    size_t bytes = 0;
+    for (const auto& pair : _connections)
+    {
+        bytes += pair.second->outbound->getStats().queuedBytes;
+    }
+
+    return bytes;
+}
+
+void ClientReactor::pollSockets()
+{
+    static const std::string thread_name = "client_poll";
+
+    if (prctl(PR_SET_NAME, reinterpret_cast<unsigned long>(thread_name.c_str()), 0, 0, 0) != 0)
+        Log::error("Cannot set thread name to " + thread_name + ".");
+
+    Log::debug("Thread [" + thread_name + "] started.");
+
+    epoll_event events[MaxEvents];
+    while (!_stop && !TerminationFlag)
+    {
+        const int count = epoll_wait(_epollFd, events, MaxEvents, POLL_TIMEOUT_MS);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            Log::error("ClientReactor: epoll_wait failed.");
+            break;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            std::shared_ptr<Connection> connection;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                const auto it = _connections.find(events[i].data.fd);
+                if (it == _connections.end())
+                    continue;
+
+                connection = it->second;
+            }
+
+            // The queue asked for EPOLLOUT, the socket has room again.
+            bool open = true;
+            if (events[i].events & EPOLLOUT)
+                open = connection->outbound->flush();
+
+            try
+            {
+                if (open && (events[i].events & ~EPOLLOUT))
+                    open = readFrom(connection);
+            }
+            catch (const Poco::Exception& exc)
+            {
+                Log::error() << "ClientReactor: Exception while reading from session "
+                             << connection->session->getName() << ": " << exc.displayText()
+                             << (exc.nested() ? " (" + exc.nested()->displayText() + ")" : "")
+                             << Log::end;
+            }
+
+            if (!open)
+                close(connection);
+        }
+    }
+
+    Log::debug("Thread [" + thread_name + "] finished.");
+}
+
+bool ClientReactor::readFrom(const std::shared_ptr<Connection>& connection)
+{
+    // Level-triggered: whatever doesn't fit is read on the next wakeup.
+    const ssize_t size = recv(connection->fd, _buffer.data(), _buffer.size(), MSG_DONTWAIT);
+    if (size == 0)
+    {
+        Log::info("Client of session " + connection->session->getName() + " closed the connection.");
+        return false;
+    }
+    else if (size < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            return true;
+
+        Log::warn("Failed to read from the client of session " + connection->session->getName() + ".", true);
+        return false;
+    }
+
+    connection->decoder.append(_buffer.data(), size);
+
+    bool queued = false;
+    bool open = true;
+    std::vector<char> payload;
+    while (open)
+    {
+        const WebSocketDecoder::Result result = connection->decoder.decode(payload);
+        if (result == WebSocketDecoder::Result::NeedMore)
+        {
+            break;
+        }
+        else if (result == WebSocketDecoder::Result::Message)
+        {
+            const std::string firstLine = getFirstLine(payload.data(), payload.size());
+            if (firstLine == "eof")
+            {
+                Log::info("Received EOF. Finishing.");
+                open = false;
+            }
+            else if (firstLine.compare(0, 12, "nextmessage:") != 0)
+            {
+                // Messages arrive whole here, so nextmessage: announcements are moot.
+                connection->queue.put(std::string(payload.data(), payload.size()));
+                queued = true;
+            }
+        }
+        else if (result == WebSocketDecoder::Result::Ping)
+        {
+            // Echo back the ping payload as pong.
+            // Technically, we should send back a PONG control frame.
+            // However Firefox (probably) or Node.js (possibly) doesn't
+            // like that and closes the socket when we do.
+            // Echoing the payload as a normal frame works with Firefox.
+            connection->outbound->push(OutboundQueue::makeFrame(WebSocket::FRAME_FLAG_FIN | WebSocket::FRAME_OP_PONG,
+                                                                payload.data(), payload.size()));
+        }
+        else if (result == WebSocketDecoder::Result::Close)
+        {
+            open = false;
+        }
+        else if (result == WebSocketDecoder::Result::Error)
+        {
+            Log::warn("Invalid frame from the client of session " + connection->session->getName() + ".");
+            open = false;
+        }
+    }
+
+    if (queued)
+        schedule(connection);
+
+    return open;
+}
+
+void ClientReactor::close(const std::shared_ptr<Connection>& connection)
+{
+    epoll_ctl(_epollFd, EPOLL_CTL_DEL, connection->fd, nullptr);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _connections.erase(connection->fd);
+    }
+
+    const OutboundQueue::Stats stats = connection->outbound->getStats();
+    Log::debug() << "Client of session " << connection->session->getName() << " was sent "
+                 << stats.writtenBytes << " bytes, queued " << stats.maxQueuedBytes << " at most, "
+                 << stats.coalescedTiles << " tiles coalesced." << Log::end;
+    if (stats.overflowed)
+    {
+        ++_overflowCount;
+        Log::warn("Client of session " + connection->session->getName() + " was disconnected for reading too slowly.");
+    }
+
+    // Pending requests are moot, but the session is released in order.
+    connection->queue.clear();
+    connection->queue.put("eof");
+    schedule(connection);
+}
+
+void ClientReactor::schedule(const std::shared_ptr<Connection>& connection)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (connection->scheduled)
+            return;
+
+        connection->scheduled = true;
+    }
+
+    // No worker is on it, so the session is ours to ask.
+    const bool blocking = connection->session->mayBlock();
+    _workers.post([this, connection, blocking]() { process(connection, blocking); }, blocking);
+}
+
+void ClientReactor::process(const std::shared_ptr<Connection>& connection, const bool blocking)
+{
+    std::string message;
+    for (size_t i = 0; i < MessagesPerTurn; ++i)
+    {
+        if (!blocking && connection->session->mayBlock())
+        {
+            // Still scheduled, only on the other workers.
+            Log::debug("Session " + connection->session->getName() + " moves to a load worker.");
+            _workers.post([this, connection]() { process(connection, true); }, true);
+            return;
+        }
+
+        if (!connection->queue.try_get(message))
+            break;
+
+        if (message == "eof")
+        {
+            // Nothing is queued after it, so it is never scheduled again.
+            Log::info("Client connection of session " + connection->session->getName() + " finished.");
+            connection->session.reset();
+            return;
+        }
+
+        if (connection->finished)
+            continue;
+
+        bool keep = false;
+        try
+        {
+            keep = connection->session->handleInput(message.data(), message.size());
+            if (!keep)
+                Log::info("Socket handler flagged for finishing.");
+        }
+        catch (const std::exception& exc)
+        {
+            Log::error(std::string("ClientReactor::process: Exception: ") + exc.what());
+        }
+
+        if (!keep)
+        {
+            // The polling thread sees the connection close and queues "eof".
+            connection->finished = true;
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        connection->scheduled = false;
+    }
+
+    // Anything queued meanwhile wasn't scheduled, as we were on it.
+    if (!connection->queue.empty())
+        schedule(connection);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,114 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_CLIENTREACTOR_HPP
+#define INCLUDED_CLIENTREACTOR_HPP
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <Poco/Net/WebSocket.h>
+
+#include "OutboundQueue.hpp"
+#include "PerMessageDeflate.hpp"
+#include "WorkerPool.hpp"
+
+class LOOLSession;
+
+/// Owns the client WebSockets once the handshake is done.
+///
+/// One thread waits for input on all of them with epoll and decodes the
+/// frames as bytes arrive; a few workers run the sessions on the complete
+/// messages, one message of a session at a time and in order. The number
+/// of connections is bounded by file descriptors rather than threads.
+///
+/// Sessions that may block, waiting for a kit and the document to load,
+/// are run by workers of their own, so that a burst of documents opening
+/// doesn't hold up the input of those already open.
+///
+/// What the sessions send goes through an OutboundQueue per connection,
+/// which the polling thread writes out as the socket drains, so a slow
+/// client holds up no one else.
+class ClientReactor
+{
+public:
+    /// workerCount threads run the sessions' handlers, and loadWorkerCount
+    /// those of the sessions that may block. Up to outboundLimit bytes are
+    /// queued for a client before outboundPolicy applies.
+    ClientReactor(size_t workerCount, size_t loadWorkerCount,
+                  size_t outboundLimit, OutboundQueue::Policy outboundPolicy);
+    ~ClientReactor();
+
+    ClientReactor(const ClientReactor&) = delete;
+    ClientReactor& operator=(const ClientReactor&) = delete;
+
+    /// Reads ws and feeds its messages to session, until either closes.
+    /// inflater decompresses the messages if permessage-deflate is used.
+    void add(const std::shared_ptr<Poco::Net::WebSocket>& ws,
+             const std::shared_ptr<LOOLSession>& session,
+             std::unique_ptr<PerMessageDeflate::Inflater> inflater = nullptr);
+
+    /// Stops the threads; open connections are dropped.
+    void stop();
+
+    /// What is queued for the client of a session.
+    struct ClientStats
+    {
+        std::string sessionName;
+        OutboundQueue::Stats outbound;
+    };
+
+    /// Those of the open connections.
+    std::vector<ClientStats> getClientStats() const;
+
+    /// Bytes queued for all the clients.
+    size_t getQueuedBytes() const;
+
+    /// Clients disconnected so far for reading too slowly.
+    size_t getOverflowCount() const { return _overflowCount; }
+
+private:
+    struct Connection;
+
+    void pollSockets();
+
+    /// Reads what is available on connection and queues its messages.
+    /// Returns false once the connection is done with.
+    bool readFrom(const std::shared_ptr<Connection>& connection);
+    void close(const std::shared_ptr<Connection>& connection);
+    void schedule(const std::shared_ptr<Connection>& connection);
+    /// Handles the queued messages of connection, on a load worker if blocking.
+    void process(const std::shared_ptr<Connection>& connection, bool blocking);
+
+    const int _epollFd;
+    const size_t _outboundLimit;
+    const OutboundQueue::Policy _outboundPolicy;
+    std::atomic<bool> _stop;
+    std::atomic<size_t> _overflowCount;
+
+    mutable std::mutex _mutex;
+    /// Open connections by socket.
+    std::map<int, std::shared_ptr<Connection>> _connections;
+
+    /// Receive buffer of the polling thread.
+    std::vector<char> _buffer;
+
+    std::thread _pollThread;
+    /// Run the sessions with queued messages.
+    WorkerPool _workers;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
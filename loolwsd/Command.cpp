@@ -0,0 +1,237 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Command.hpp"
+
+namespace
+{
+    using LOOLProtocol::Command;
+    using LOOLProtocol::Message;
+
+    /// Indexed by Command.
+    constexpr const char* CommandNames[] =
+    {
+        "",
+        "canceltiles",
+        "clientvisiblearea",
+        "clientzoom",
+        "commandvalues",
+        "disconnect",
+        "downloadas",
+        "getchildid",
+        "gettextselection",
+        "insertfile",
+        "invalidatetiles",
+        "key",
+        "load",
+        "loolclient",
+        "mouse",
+        "partpagerectangles",
+        "paste",
+        "renderfont",
+        "requestloksession",
+        "resetselection",
+        "saveas",
+        "selectgraphic",
+        "selecttext",
+        "setclientpart",
+        "setpage",
+        "status",
+        "tile",
+        "tilecombine",
+        "unload",
+        "uno",
+    };
+
+    static_assert(sizeof(CommandNames) / sizeof(CommandNames[0]) == static_cast<size_t>(Command::UNO) + 1,
+                  "Every command needs its name.");
+
+    /// Indexed by Message.
+    constexpr const char* MessageNames[] =
+    {
+        "",
+        "batch:",
+        "cellcursor:",
+        "cellformula:",
+        "child",
+        "commandvalues:",
+        "curpart:",
+        "cursorvisible:",
+        "delta:",
+        "downloadas:",
+        "error:",
+        "getchildid:",
+        "graphicselection:",
+        "hyperlinkclicked:",
+        "invalidatecursor:",
+        "invalidatetiles:",
+        "mousepointer:",
+        "nextmessage:",
+        "partpagerectangles:",
+        "renderfont:",
+        "saveas:",
+        "searchnotfound:",
+        "searchresultselection:",
+        "setpart:",
+        "solidtile:",
+        "statechanged:",
+        "status:",
+        "statusindicatorfinish:",
+        "statusindicatorsetvalue:",
+        "statusindicatorstart:",
+        "textselection:",
+        "textselectioncontent:",
+        "textselectionend:",
+        "textselectionstart:",
+        "tile:",
+        "unocommandresult:",
+    };
+
+    static_assert(sizeof(MessageNames) / sizeof(MessageNames[0]) == static_cast<size_t>(Message::UNOCOMMANDRESULT) + 1,
+                  "Every message needs its name.");
+
+    /// FNV-1a, at compile time for the case labels.
+    constexpr uint32_t hash(const char* name, const uint32_t value = 2166136261u)
+    {
+        return *name == '\0' ? value : hash(name + 1, (value ^ static_cast<uint8_t>(*name)) * 16777619u);
+    }
+
+    uint32_t hash(const StringView name)
+    {
+        uint32_t value = 2166136261u;
+        for (size_t i = 0; i < name.size(); ++i)
+        {
+            value = (value ^ static_cast<uint8_t>(name[i])) * 16777619u;
+        }
+
+        return value;
+    }
+
+    constexpr uint32_t key(const Command command)
+    {
+        return hash(CommandNames[static_cast<size_t>(command)]);
+    }
+
+    constexpr uint32_t key(const Message message)
+    {
+        return hash(MessageNames[static_cast<size_t>(message)]);
+    }
+
+    /// Other names have the same hash too.
+    Command check(const StringView name, const Command command)
+    {
+        return name == CommandNames[static_cast<size_t>(command)] ? command : Command::UNKNOWN;
+    }
+
+    Message check(const StringView name, const Message message)
+    {
+        return name == MessageNames[static_cast<size_t>(message)] ? message : Message::UNKNOWN;
+    }
+}
+
+namespace LOOLProtocol
+{
+    // The hash is perfect over the names: were two of them to collide,
+    // their case labels would be duplicates, which don't compile.
+
+    Command getCommand(const StringView name)
+    {
+        switch (hash(name))
+        {
+        case key(Command::CANCELTILES): return check(name, Command::CANCELTILES);
+        case key(Command::CLIENTVISIBLEAREA): return check(name, Command::CLIENTVISIBLEAREA);
+        case key(Command::CLIENTZOOM): return check(name, Command::CLIENTZOOM);
+        case key(Command::COMMANDVALUES): return check(name, Command::COMMANDVALUES);
+        case key(Command::DISCONNECT): return check(name, Command::DISCONNECT);
+        case key(Command::DOWNLOADAS): return check(name, Command::DOWNLOADAS);
+        case key(Command::GETCHILDID): return check(name, Command::GETCHILDID);
+        case key(Command::GETTEXTSELECTION): return check(name, Command::GETTEXTSELECTION);
+        case key(Command::INSERTFILE): return check(name, Command::INSERTFILE);
+        case key(Command::INVALIDATETILES): return check(name, Command::INVALIDATETILES);
+        case key(Command::KEY): return check(name, Command::KEY);
+        case key(Command::LOAD): return check(name, Command::LOAD);
+        case key(Command::LOOLCLIENT): return check(name, Command::LOOLCLIENT);
+        case key(Command::MOUSE): return check(name, Command::MOUSE);
+        case key(Command::PARTPAGERECTANGLES): return check(name, Command::PARTPAGERECTANGLES);
+        case key(Command::PASTE): return check(name, Command::PASTE);
+        case key(Command::RENDERFONT): return check(name, Command::RENDERFONT);
+        case key(Command::REQUESTLOKSESSION): return check(name, Command::REQUESTLOKSESSION);
+        case key(Command::RESETSELECTION): return check(name, Command::RESETSELECTION);
+        case key(Command::SAVEAS): return check(name, Command::SAVEAS);
+        case key(Command::SELECTGRAPHIC): return check(name, Command::SELECTGRAPHIC);
+        case key(Command::SELECTTEXT): return check(name, Command::SELECTTEXT);
+        case key(Command::SETCLIENTPART): return check(name, Command::SETCLIENTPART);
+        case key(Command::SETPAGE): return check(name, Command::SETPAGE);
+        case key(Command::STATUS): return check(name, Command::STATUS);
+        case key(Command::TILE): return check(name, Command::TILE);
+        case key(Command::TILECOMBINE): return check(name, Command::TILECOMBINE);
+        case key(Command::UNLOAD): return check(name, Command::UNLOAD);
+        case key(Command::UNO): return check(name, Command::UNO);
+        default: return Command::UNKNOWN;
+        }
+    }
+
+    Message getMessage(const StringView name)
+    {
+        switch (hash(name))
+        {
+        case key(Message::BATCH): return check(name, Message::BATCH);
+        case key(Message::CELL_CURSOR): return check(name, Message::CELL_CURSOR);
+        case key(Message::CELL_FORMULA): return check(name, Message::CELL_FORMULA);
+        case key(Message::CHILD): return check(name, Message::CHILD);
+        case key(Message::COMMANDVALUES): return check(name, Message::COMMANDVALUES);
+        case key(Message::CURPART): return check(name, Message::CURPART);
+        case key(Message::CURSOR_VISIBLE): return check(name, Message::CURSOR_VISIBLE);
+        case key(Message::DELTA): return check(name, Message::DELTA);
+        case key(Message::DOWNLOADAS): return check(name, Message::DOWNLOADAS);
+        case key(Message::ERROR): return check(name, Message::ERROR);
+        case key(Message::GETCHILDID): return check(name, Message::GETCHILDID);
+        case key(Message::GRAPHIC_SELECTION): return check(name, Message::GRAPHIC_SELECTION);
+        case key(Message::HYPERLINK_CLICKED): return check(name, Message::HYPERLINK_CLICKED);
+        case key(Message::INVALIDATE_CURSOR): return check(name, Message::INVALIDATE_CURSOR);
+        case key(Message::INVALIDATE_TILES): return check(name, Message::INVALIDATE_TILES);
+        case key(Message::MOUSEPOINTER): return check(name, Message::MOUSEPOINTER);
+        case key(Message::NEXTMESSAGE): return check(name, Message::NEXTMESSAGE);
+        case key(Message::PARTPAGERECTANGLES): return check(name, Message::PARTPAGERECTANGLES);
+        case key(Message::RENDERFONT): return check(name, Message::RENDERFONT);
+        case key(Message::SAVEAS): return check(name, Message::SAVEAS);
+        case key(Message::SEARCH_NOT_FOUND): return check(name, Message::SEARCH_NOT_FOUND);
+        case key(Message::SEARCH_RESULT_SELECTION): return check(name, Message::SEARCH_RESULT_SELECTION);
+        case key(Message::SETPART): return check(name, Message::SETPART);
+        case key(Message::SOLIDTILE): return check(name, Message::SOLIDTILE);
+        case key(Message::STATE_CHANGED): return check(name, Message::STATE_CHANGED);
+        case key(Message::STATUS): return check(name, Message::STATUS);
+        case key(Message::STATUS_INDICATOR_FINISH): return check(name, Message::STATUS_INDICATOR_FINISH);
+        case key(Message::STATUS_INDICATOR_SETVALUE): return check(name, Message::STATUS_INDICATOR_SETVALUE);
+        case key(Message::STATUS_INDICATOR_START): return check(name, Message::STATUS_INDICATOR_START);
+        case key(Message::TEXT_SELECTION): return check(name, Message::TEXT_SELECTION);
+        case key(Message::TEXT_SELECTION_CONTENT): return check(name, Message::TEXT_SELECTION_CONTENT);
+        case key(Message::TEXT_SELECTION_END): return check(name, Message::TEXT_SELECTION_END);
+        case key(Message::TEXT_SELECTION_START): return check(name, Message::TEXT_SELECTION_START);
+        case key(Message::TILE): return check(name, Message::TILE);
+        case key(Message::UNOCOMMANDRESULT): return check(name, Message::UNOCOMMANDRESULT);
+        default: return Message::UNKNOWN;
+        }
+    }
+
+    const char* getName(const Command command)
+    {
+        return CommandNames[static_cast<size_t>(command)];
+    }
+
+    const char* getName(const Message message)
+    {
+        return MessageNames[static_cast<size_t>(message)];
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
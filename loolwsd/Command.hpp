@@ -0,0 +1,110 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_COMMAND_HPP
+#define INCLUDED_COMMAND_HPP
+
+#include "Tokenizer.hpp"
+
+namespace LOOLProtocol
+{
+    /// The first token of a command, from the client (see protocol.txt),
+    /// to switch on instead of comparing strings.
+    enum class Command
+    {
+        UNKNOWN,
+        CANCELTILES,
+        CLIENTVISIBLEAREA,
+        CLIENTZOOM,
+        COMMANDVALUES,
+        DISCONNECT,
+        DOWNLOADAS,
+        GETCHILDID,
+        GETTEXTSELECTION,
+        INSERTFILE,
+        INVALIDATETILES,
+        KEY,
+        LOAD,
+        LOOLCLIENT,
+        MOUSE,
+        PARTPAGERECTANGLES,
+        PASTE,
+        RENDERFONT,
+        REQUESTLOKSESSION,
+        RESETSELECTION,
+        SAVEAS,
+        SELECTGRAPHIC,
+        SELECTTEXT,
+        SETCLIENTPART,
+        SETPAGE,
+        STATUS,
+        TILE,
+        TILECOMBINE,
+        UNLOAD,
+        UNO,
+    };
+
+    /// The first token of a message, from the server or the kit.
+    enum class Message
+    {
+        UNKNOWN,
+        BATCH,
+        CELL_CURSOR,
+        CELL_FORMULA,
+        CHILD,
+        COMMANDVALUES,
+        CURPART,
+        CURSOR_VISIBLE,
+        DELTA,
+        DOWNLOADAS,
+        ERROR,
+        GETCHILDID,
+        GRAPHIC_SELECTION,
+        HYPERLINK_CLICKED,
+        INVALIDATE_CURSOR,
+        INVALIDATE_TILES,
+        MOUSEPOINTER,
+        NEXTMESSAGE,
+        PARTPAGERECTANGLES,
+        RENDERFONT,
+        SAVEAS,
+        SEARCH_NOT_FOUND,
+        SEARCH_RESULT_SELECTION,
+        SETPART,
+        SOLIDTILE,
+        STATE_CHANGED,
+        STATUS,
+        STATUS_INDICATOR_FINISH,
+        STATUS_INDICATOR_SETVALUE,
+        STATUS_INDICATOR_START,
+        TEXT_SELECTION,
+        TEXT_SELECTION_CONTENT,
+        TEXT_SELECTION_END,
+        TEXT_SELECTION_START,
+        TILE,
+        UNOCOMMANDRESULT,
+    };
+
+    /// The command named name, such as "tile", or UNKNOWN. Looked up by a
+    /// perfect hash, without allocating.
+    Command getCommand(StringView name);
+
+    /// The message named name, such as "tile:", or UNKNOWN.
+    Message getMessage(StringView name);
+
+    /// The name of command, "" for UNKNOWN.
+    const char* getName(Command command);
+
+    /// The name of message, "" for UNKNOWN.
+    const char* getName(Message message);
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
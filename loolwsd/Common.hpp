@@ -13,9 +13,13 @@
 
 #include <string>
 
-// The maximum number of client connections we can accept.
+// The maximum number of HTTP requests and kit connections we handle at once.
+// Client WebSockets are handed over to the ClientReactor and don't count.
 constexpr int MAX_SESSIONS = 1024;
 
+/// The largest message a client may send.
+constexpr int MAX_MESSAGE_SIZE = 100 * 1024 * 1024;
+
 constexpr int DEFAULT_CLIENT_PORT_NUMBER = 9980;
 constexpr int MASTER_PORT_NUMBER = 9981;
 constexpr int ADMIN_PORT_NUMBER = 9989;
@@ -24,13 +28,17 @@ constexpr int MAINTENANCE_INTERVAL = 1;
 constexpr int CHILD_TIMEOUT_SECS = 10;
 constexpr int POLL_TIMEOUT_MS = 1000;
 
+/// The abstract Unix domain socket the kits connect to the master on,
+/// when they can; MASTER_PORT_NUMBER otherwise. See UnixChannel.
+static const std::string MASTER_SOCKET_NAME = "loolwsd-" + std::to_string(MASTER_PORT_NUMBER);
+
 /// Pipe and Socket read buffer size.
 /// Should be large enough for ethernet packets
 /// which can be 1500 bytes long.
 constexpr int READ_BUFFER_SIZE = 2048;
-/// Size after which messages will be sent preceded with
-/// 'nextmessage' frame to let the receiver know in advance
-/// the size of larger coming message. All messages up to this
+/// Size after which messages to clients of protocol versions before 0.2
+/// are preceded with a 'nextmessage' frame to let the receiver know in
+/// advance the size of larger coming message. All messages up to this
 /// size are considered small messages.
 constexpr int SMALL_MESSAGE_SIZE = READ_BUFFER_SIZE / 2;
 
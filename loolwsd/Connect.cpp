@@ -34,6 +34,7 @@
 
 #include "Common.hpp"
 #include "LOOLProtocol.hpp"
+#include "ReceiveBuffer.hpp"
 #include "Util.hpp"
 
 using namespace LOOLProtocol;
@@ -72,22 +73,22 @@ public:
         int n;
         try
         {
+            ReceiveBuffer buffer;
             do
             {
-                char buffer[100000];
-                n = _ws.receiveFrame(buffer, sizeof(buffer), flags);
+                n = receiveMessage(_ws, buffer, flags);
                 if (n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE)
                 {
-                    std::cout << "Got " << n << " bytes: " << getAbbreviatedMessage(buffer, n) << std::endl;
+                    std::cout << "Got " << n << " bytes: " << getAbbreviatedMessage(buffer.data(), n) << std::endl;
 
-                    std::string firstLine = getFirstLine(buffer, n);
+                    std::string firstLine = getFirstLine(buffer.data(), n);
                     StringTokenizer tokens(firstLine, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
 
                     if (std::getenv("DISPLAY") != nullptr && tokens[0] == "tile:")
                     {
                         TemporaryFile pngFile;
                         std::ofstream pngStream(pngFile.path(), std::ios::binary);
-                        pngStream.write(buffer + firstLine.size() + 1, n - firstLine.size() - 1);
+                        pngStream.write(buffer.data() + firstLine.size() + 1, n - firstLine.size() - 1);
                         pngStream.close();
                         if (std::system((std::string("display ") + pngFile.path()).c_str()) == -1)
                         {
@@ -0,0 +1,178 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "ControlChannel.hpp"
+
+const size_t ControlChannel::HeaderSize;
+const size_t ControlChannel::MaxMessageSize;
+
+namespace
+{
+    // Both ends are on the same host, so integers go in its byte order.
+
+    template <typename T>
+    void append(std::vector<char>& output, const T value)
+    {
+        const char* bytes = reinterpret_cast<const char*>(&value);
+        output.insert(output.end(), bytes, bytes + sizeof(T));
+    }
+
+    template <typename T>
+    T read(const char* data)
+    {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    void appendString(std::vector<char>& output, const std::string& text)
+    {
+        const uint16_t size = static_cast<uint16_t>(std::min<size_t>(text.size(), 0xffff));
+        append(output, size);
+        output.insert(output.end(), text.data(), text.data() + size);
+    }
+
+    bool readString(const char*& data, const char* end, std::string& text)
+    {
+        if (end - data < 2)
+            return false;
+
+        const uint16_t size = read<uint16_t>(data);
+        data += 2;
+        if (end - data < size)
+            return false;
+
+        text.assign(data, size);
+        data += size;
+        return true;
+    }
+}
+
+ControlChannel::ControlChannel(const int fd) :
+    _fd(fd),
+    _buffer(MaxMessageSize)
+{
+}
+
+ControlChannel::~ControlChannel()
+{
+    ::close(_fd);
+}
+
+bool ControlChannel::createPair(int fds[2])
+{
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0)
+        return false;
+
+    // The kit's end is inherited over exec.
+    fcntl(fds[1], F_SETFD, 0);
+    return true;
+}
+
+bool ControlChannel::send(const Message& message)
+{
+    std::vector<char> output;
+    encode(message, output);
+
+    while (true)
+    {
+        // A full socket means a kit not reading what it is sent, which is
+        // as good as gone; so never wait.
+        if (::send(_fd, output.data(), output.size(), MSG_DONTWAIT | MSG_NOSIGNAL) ==
+            static_cast<ssize_t>(output.size()))
+        {
+            return true;
+        }
+
+        if (errno != EINTR)
+            return false;
+    }
+}
+
+int ControlChannel::receive(Message& message)
+{
+    while (true)
+    {
+        // With MSG_TRUNC, the whole size of a message too large for the
+        // buffer is returned, to refuse it.
+        const ssize_t size = recv(_fd, _buffer.data(), _buffer.size(), MSG_DONTWAIT | MSG_TRUNC);
+        if (size > 0)
+        {
+            if (static_cast<size_t>(size) > _buffer.size() ||
+                !decode(_buffer.data(), size, message))
+            {
+                return -1;
+            }
+
+            return 1;
+        }
+
+        if (size < 0 && errno == EINTR)
+            continue;
+
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+
+        // The end, or an error.
+        return -1;
+    }
+}
+
+bool ControlChannel::poll(const int timeoutMs)
+{
+    pollfd pfd = { _fd, POLLIN, 0 };
+    return ::poll(&pfd, 1, timeoutMs) > 0;
+}
+
+void ControlChannel::encode(const Message& message, std::vector<char>& output)
+{
+    const size_t start = output.size();
+    append<uint32_t>(output, 0);
+    append<uint8_t>(output, static_cast<uint8_t>(message.type));
+    output.insert(output.end(), 3, '\0');
+    append<uint32_t>(output, message.sequence);
+    append<int32_t>(output, message.pid);
+    appendString(output, message.session);
+    appendString(output, message.url);
+
+    const uint32_t size = static_cast<uint32_t>(output.size() - start);
+    std::memcpy(output.data() + start, &size, sizeof(size));
+}
+
+bool ControlChannel::decode(const char* data, const size_t size, Message& message)
+{
+    if (size < HeaderSize || read<uint32_t>(data) != size)
+        return false;
+
+    const uint8_t type = read<uint8_t>(data + 4);
+    if (type < static_cast<uint8_t>(Type::CreateSession) || type > static_cast<uint8_t>(Type::Active))
+        return false;
+
+    message.type = static_cast<Type>(type);
+    message.sequence = read<uint32_t>(data + 8);
+    message.pid = read<int32_t>(data + 12);
+
+    const char* end = data + size;
+    data += HeaderSize;
+    return readString(data, end, message.session) &&
+           readString(data, end, message.url) &&
+           data == end;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,116 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_CONTROLCHANNEL_HPP
+#define INCLUDED_CONTROLCHANNEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// The connection between the broker and one of its kits, over a
+/// socketpair of their own.
+///
+/// The socket is SOCK_SEQPACKET, so each message arrives whole or not at
+/// all, and neither side ever waits for the rest of one. Sending and
+/// receiving don't block either: the broker serves all its kits from one
+/// event loop, which a slow kit mustn't hold up.
+///
+/// A message is a fixed binary header, the size of the whole message
+/// first, followed by its strings, each preceded by its 16-bit size.
+class ControlChannel
+{
+public:
+    enum class Type : uint8_t
+    {
+        /// Broker to kit: host session on url.
+        CreateSession = 1,
+        /// Kit to broker, unasked: initialized, and waiting for a document.
+        Ready = 2,
+        /// Kit to broker: the session of a CreateSession is up.
+        SessionCreated = 3,
+        /// Kit to broker, unasked: the document at url is hosted now.
+        Hosting = 4,
+        /// Kit to broker, unasked: exiting, route nothing more here.
+        Down = 5,
+        /// Kit to broker: the request wasn't understood.
+        Bad = 6,
+        /// Broker to kit: short of memory, save and unload the document.
+        Unload = 7,
+        /// Kit to broker, unasked: the document was worked on since it
+        /// last told, at most every so often.
+        Active = 8
+    };
+
+    struct Message
+    {
+        Message() :
+            type(Type::Bad),
+            sequence(0),
+            pid(0)
+        {
+        }
+
+        Type type;
+        /// Set by the broker; a kit sends that of the last request it took.
+        uint32_t sequence;
+        /// Of the kit, in what it sends.
+        int32_t pid;
+        std::string session;
+        std::string url;
+    };
+
+    /// The size of the fixed part of a message.
+    static const size_t HeaderSize = 16;
+
+    /// The largest message, the strings included.
+    static const size_t MaxMessageSize = HeaderSize + 2 * (2 + 0xffff);
+
+    /// Takes ownership of the socket fd.
+    explicit ControlChannel(int fd);
+    ~ControlChannel();
+
+    ControlChannel(const ControlChannel&) = delete;
+    ControlChannel& operator=(const ControlChannel&) = delete;
+
+    int getFd() const { return _fd; }
+
+    /// Creates the socketpair of a kit: fds[0] for the broker, closed on
+    /// exec, and fds[1] for the kit, which outlives an exec. Returns false
+    /// on failure.
+    static bool createPair(int fds[2]);
+
+    /// Sends message. Returns false if the other side is gone, or hasn't
+    /// taken what it was sent before.
+    bool send(const Message& message);
+
+    /// Receives the next message, if any. Returns 1 if message was
+    /// received, 0 if none is waiting, and -1 if the other side is gone or
+    /// sent something malformed.
+    int receive(Message& message);
+
+    /// Whether a message, or the end, can be received within timeoutMs.
+    bool poll(int timeoutMs);
+
+    /// Appends message in binary form to output. Strings are cut at 64 KiB.
+    static void encode(const Message& message, std::vector<char>& output);
+
+    /// Parses the message of size bytes at data. Returns false if it is
+    /// malformed.
+    static bool decode(const char* data, size_t size, Message& message);
+
+private:
+    const int _fd;
+    std::vector<char> _buffer;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
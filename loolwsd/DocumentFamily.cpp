@@ -0,0 +1,91 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "DocumentFamily.hpp"
+
+namespace
+{
+    struct Family
+    {
+        DocumentFamily::Type type;
+        const char* name;
+        const char* factoryUrl;
+        /// Space-separated, each one followed by a space too.
+        const char* extensions;
+    };
+
+    const Family Families[DocumentFamily::Count] =
+    {
+        { DocumentFamily::Type::Generic, "generic", nullptr, "" },
+        { DocumentFamily::Type::Text, "text", "private:factory/swriter",
+          "odt ott fodt doc dot docx dotx docm rtf txt wpd sxw stw abw lwp pages " },
+        { DocumentFamily::Type::Spreadsheet, "spreadsheet", "private:factory/scalc",
+          "ods ots fods xls xlt xlsx xltx xlsm xlsb csv sxc stc dif slk numbers " },
+        { DocumentFamily::Type::Presentation, "presentation", "private:factory/simpress",
+          "odp otp fodp ppt pot pps pptx potx ppsx pptm sxi sti key " },
+        { DocumentFamily::Type::Drawing, "drawing", "private:factory/sdraw",
+          "odg otg fodg vsd vsdx sxd std cdr pub " }
+    };
+}
+
+namespace DocumentFamily
+{
+    Type fromUrl(const std::string& url)
+    {
+        // The extension is that of the path, without query or fragment.
+        const std::string path = url.substr(0, url.find_first_of("?#"));
+        const size_t dot = path.rfind('.');
+        if (dot == std::string::npos || path.find('/', dot) != std::string::npos)
+            return Type::Generic;
+
+        std::string extension = path.substr(dot + 1);
+        if (extension.empty())
+            return Type::Generic;
+
+        std::transform(extension.begin(), extension.end(), extension.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        extension += ' ';
+
+        for (const auto& family : Families)
+        {
+            const char* found = std::strstr(family.extensions, extension.c_str());
+            if (found != nullptr && (found == family.extensions || found[-1] == ' '))
+                return family.type;
+        }
+
+        return Type::Generic;
+    }
+
+    Type fromName(const std::string& name)
+    {
+        for (const auto& family : Families)
+        {
+            if (name == family.name)
+                return family.type;
+        }
+
+        return Type::Generic;
+    }
+
+    const char* toName(const Type type)
+    {
+        return Families[static_cast<size_t>(type)].name;
+    }
+
+    const char* getFactoryUrl(const Type type)
+    {
+        return Families[static_cast<size_t>(type)].factoryUrl;
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,49 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_DOCUMENTFAMILY_HPP
+#define INCLUDED_DOCUMENTFAMILY_HPP
+
+#include <cstddef>
+#include <string>
+
+/// The kinds of documents, by the LibreOffice module editing them, which
+/// a kit can be warmed up for: having loaded the module once, it opens the
+/// first document of its kind much faster.
+namespace DocumentFamily
+{
+    enum class Type
+    {
+        /// Not warmed up for any kind.
+        Generic = 0,
+        Text,
+        Spreadsheet,
+        Presentation,
+        Drawing
+    };
+
+    /// The number of types, Generic included.
+    const size_t Count = 5;
+
+    /// The type of the document at url, by its extension; Generic if
+    /// unknown.
+    Type fromUrl(const std::string& url);
+
+    /// The type named name; Generic if unknown.
+    Type fromName(const std::string& name);
+
+    const char* toName(Type type);
+
+    /// The URL loading a new empty document of type, nullptr for Generic.
+    const char* getFactoryUrl(Type type);
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -7,13 +7,22 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include <sys/epoll.h>
 #include <sys/wait.h>
 
+#include <array>
 #include <cstdlib>
 #include <cstring>
+#include <unordered_map>
+#include <vector>
 
 #include "Common.hpp"
 #include "Capabilities.hpp"
+#include "ControlChannel.hpp"
+#include "DocumentFamily.hpp"
+#include "MemoryCollector.hpp"
+#include "MemoryGovernor.hpp"
+#include "PrespawnPool.hpp"
 #include "Util.hpp"
 
 // First include the grist of the helper process - ideally
@@ -28,63 +37,46 @@
 
 typedef int (LokHookPreInit)  ( const char *install_path, const char *user_profile_path );
 
-using Poco::ProcessHandle;
-
 const std::string FIFO_LOOLWSD = "loolwsdfifo";
-const std::string BROKER_SUFIX = ".fifo";
-const std::string BROKER_PREFIX = "lokit";
 
-static int readerChild = -1;
 static int readerBroker = -1;
+static int epollFd = -1;
 
 static std::string loolkitPath;
 static std::atomic<unsigned> forkCounter;
 static std::chrono::steady_clock::time_point lastMaintenanceTime = std::chrono::steady_clock::now();
 static unsigned int childCounter = 0;
 static int numPreSpawnedChildren = 0;
+static int maxPreSpawnedChildren = 0;
+static double memoryStallThreshold = 0;
+static double memoryUsageThreshold = 0;
 
+/// Guards _childProcesses. Nothing done under it waits on a kit.
 static std::recursive_mutex forkMutex;
 
 namespace
 {
+    /// The epoll data of the loolwsd FIFO; that of a kit is its pid.
+    const uint64_t LoolwsdEvent = 0;
+
     class ChildProcess
     {
     public:
-        ChildProcess() :
-            _pid(-1),
-            _readPipe(-1),
-            _writePipe(-1)
-        {
-        }
-
-        ChildProcess(const Poco::Process::PID pid, const int readPipe, const int writePipe) :
+        /// Takes ownership of the broker's end of the control channel, if any.
+        ChildProcess(const Poco::Process::PID pid, const int controlFd, const DocumentFamily::Type family) :
             _pid(pid),
-            _readPipe(readPipe),
-            _writePipe(writePipe)
+            _channel(controlFd >= 0 ? new ControlChannel(controlFd) : nullptr),
+            _sequence(0),
+            _urlSequence(0),
+            _spawnTime(std::chrono::steady_clock::now()),
+            _ready(false),
+            _family(family),
+            _lastActive(_spawnTime)
         {
         }
 
-        ChildProcess(ChildProcess&& other) :
-            _pid(other._pid),
-            _readPipe(other._readPipe),
-            _writePipe(other._writePipe)
-        {
-            other._pid = -1;
-            other._readPipe = -1;
-            other._writePipe = -1;
-        }
-
-        const ChildProcess& operator=(ChildProcess&& other)
-        {
-            _pid = other._pid;
-            other._pid = -1;
-            _readPipe = other._readPipe;
-            other._readPipe = -1;
-            _writePipe = other._writePipe;
-            other._writePipe = -1;
-
-            return *this;
-        }
+        ChildProcess(const ChildProcess&) = delete;
+        ChildProcess& operator=(const ChildProcess&) = delete;
 
         ~ChildProcess()
         {
@@ -106,62 +98,166 @@ namespace
                _pid = -1;
             }
 
-            if (_readPipe != -1)
+            if (_channel)
             {
-                ::close(_readPipe);
-                _readPipe = -1;
+                epoll_ctl(epollFd, EPOLL_CTL_DEL, _channel->getFd(), nullptr);
+                _channel.reset();
             }
+        }
 
-            if (_writePipe != -1)
-            {
-                ::close(_writePipe);
-                _writePipe = -1;
-            }
+        /// Sends message to the kit, numbered. Doesn't wait.
+        bool send(ControlChannel::Message& message)
+        {
+            if (!_channel)
+                return false;
+
+            message.sequence = ++_sequence;
+            if (message.type == ControlChannel::Type::CreateSession)
+                _urlSequence = message.sequence;
+
+            return _channel->send(message);
+        }
+
+        /// See ControlChannel::receive().
+        int receive(ControlChannel::Message& message)
+        {
+            return _channel ? _channel->receive(message) : -1;
+        }
+
+        /// Whether the kit sent state before it took the last session
+        /// created, which set the URL already.
+        bool isStale(const ControlChannel::Message& state) const
+        {
+            return state.sequence < _urlSequence;
         }
 
         void setUrl(const std::string& url) { _url = url; }
         const std::string& getUrl() const { return _url; }
 
         Poco::Process::PID getPid() const { return _pid; }
-        int getReadPipe() const { return _readPipe; }
-        int getWritePipe() const { return _writePipe; }
+        int getControlFd() const { return _channel ? _channel->getFd() : -1; }
+
+        std::chrono::steady_clock::time_point getSpawnTime() const { return _spawnTime; }
+        void setReady() { _ready = true; }
+        bool isReady() const { return _ready; }
+
+        /// What the kit was warmed up for.
+        DocumentFamily::Type getFamily() const { return _family; }
+
+        /// When the kit's document was last told to be worked on.
+        std::chrono::steady_clock::time_point getLastActive() const { return _lastActive; }
+        void setActive() { _lastActive = std::chrono::steady_clock::now(); }
 
     private:
         std::string _url;
         Poco::Process::PID _pid;
-        int _readPipe;
-        int _writePipe;
+        std::unique_ptr<ControlChannel> _channel;
+        uint32_t _sequence;
+        uint32_t _urlSequence;
+        const std::chrono::steady_clock::time_point _spawnTime;
+        bool _ready;
+        const DocumentFamily::Type _family;
+        std::chrono::steady_clock::time_point _lastActive;
     };
 
     static std::map<Process::PID, std::shared_ptr<ChildProcess>> _childProcesses;
 
-    /// Safely looks up a child hosting a URL.
-    std::shared_ptr<ChildProcess> findChild(const std::string& url)
+    /// The children of _childProcesses hosting a document, by its URL.
+    static std::unordered_multimap<std::string, std::shared_ptr<ChildProcess>> _hostingChildren;
+
+    /// The children of _childProcesses hosting nothing, by the family
+    /// they are warmed up for.
+    static std::array<std::unordered_map<Process::PID, std::shared_ptr<ChildProcess>>,
+                      DocumentFamily::Count> _emptyChildren;
+
+    /// Files child in the index of its URL, or of its family if empty.
+    void indexChild(const std::shared_ptr<ChildProcess>& child)
     {
-        std::lock_guard<std::recursive_mutex> lock(forkMutex);
+        if (child->getUrl().empty())
+            _emptyChildren[static_cast<size_t>(child->getFamily())][child->getPid()] = child;
+        else
+            _hostingChildren.emplace(child->getUrl(), child);
+    }
 
-        std::shared_ptr<ChildProcess> child;
-        for (const auto& it : _childProcesses)
+    /// Takes child out of the index it is in.
+    void unindexChild(const std::shared_ptr<ChildProcess>& child)
+    {
+        if (child->getUrl().empty())
         {
-            if (it.second->getUrl() == url)
+            _emptyChildren[static_cast<size_t>(child->getFamily())].erase(child->getPid());
+            return;
+        }
+
+        // Only a child lagging behind another can share its URL.
+        const auto range = _hostingChildren.equal_range(child->getUrl());
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (it->second == child)
             {
-                return it.second;
+                _hostingChildren.erase(it);
+                return;
             }
+        }
+    }
 
-            if (it.second->getUrl().empty())
-                child = it.second;
+    /// Safely sets the URL child hosts, empty for none, and refiles it.
+    void setChildUrl(const std::shared_ptr<ChildProcess>& child, const std::string& url)
+    {
+        std::lock_guard<std::recursive_mutex> lock(forkMutex);
+
+        if (child->getUrl() == url)
+            return;
+
+        unindexChild(child);
+        child->setUrl(url);
+        indexChild(child);
+    }
+
+    /// Safely looks up a child hosting a URL, or else an empty one,
+    /// preferably warmed up for its family, or at least for none.
+    std::shared_ptr<ChildProcess> findChild(const std::string& url)
+    {
+        std::lock_guard<std::recursive_mutex> lock(forkMutex);
+
+        const auto hosting = _hostingChildren.find(url);
+        if (hosting != _hostingChildren.end())
+            return hosting->second;
+
+        const DocumentFamily::Type family = DocumentFamily::fromUrl(url);
+        for (const auto type : { family, DocumentFamily::Type::Generic })
+        {
+            const auto& empty = _emptyChildren[static_cast<size_t>(type)];
+            if (!empty.empty())
+                return empty.begin()->second;
         }
 
-        return child;
+        for (const auto& empty : _emptyChildren)
+        {
+            if (!empty.empty())
+                return empty.begin()->second;
+        }
+
+        return nullptr;
     }
 
-    /// Safely looks up the pipe descriptor
-    /// of a child. Returns -1 on error.
-    int getChildPipe(const Process::PID pid)
+    /// Safely counts the children hosting nothing.
+    size_t countEmptyChildren()
     {
         std::lock_guard<std::recursive_mutex> lock(forkMutex);
-        const auto it = _childProcesses.find(pid);
-        return (it != _childProcesses.end() ? it->second->getWritePipe() : -1);
+
+        size_t count = 0;
+        for (const auto& empty : _emptyChildren)
+            count += empty.size();
+
+        return count;
+    }
+
+    /// Safely counts the children hosting nothing warmed up for family.
+    size_t countEmptyChildren(const DocumentFamily::Type family)
+    {
+        std::lock_guard<std::recursive_mutex> lock(forkMutex);
+
+        return _emptyChildren[static_cast<size_t>(family)].size();
     }
 
     /// Safely removes a child process.
@@ -172,145 +268,89 @@ namespace
         if (it != _childProcesses.end())
         {
             // Close the child resources.
+            unindexChild(it->second);
             it->second->close();
             _childProcesses.erase(it);
         }
     }
-}
-
-class PipeRunnable: public Runnable
-{
-public:
-    PipeRunnable()
-      : _start(nullptr),
-        _end(nullptr)
-    {
-    }
 
-    ssize_t getResponseLine(int pipeReader, std::string& response)
+    /// Safely removes an empty child warmed up for family that is ready,
+    /// to shrink the pool. Returns false if there is none.
+    bool retireEmptyChild(const DocumentFamily::Type family)
     {
-        ssize_t bytes = -1;
-        response.clear();
+        std::lock_guard<std::recursive_mutex> lock(forkMutex);
 
-        try
+        for (const auto& it : _emptyChildren[static_cast<size_t>(family)])
         {
-            while (true)
+            if (it.second->isReady())
             {
-                if (_start == _end)
-                {
-                    bytes = Util::readMessage(pipeReader, _buffer, sizeof(_buffer));
-                    if ( bytes < 0 )
-                    {
-                        _start = _end = nullptr;
-                        break;
-                    }
-
-                    _start = _buffer;
-                    _end = _buffer + bytes;
-                }
-
-                if ( _start != _end )
-                {
-                    char byteChar = *_start++;
-                    while (_start != _end && byteChar != '\r' && byteChar != '\n')
-                    {
-                        response += byteChar;
-                        byteChar = *_start++;
-                    }
-
-                    if (byteChar == '\r' && *_start == '\n')
-                    {
-                        _start++;
-                        break;
-                    }
-                }
+                const Process::PID pid = it.first;
+                Log::info("Retiring empty child [" + std::to_string(pid) + "].");
+                removeChild(pid);
+                return true;
             }
         }
-        catch (const std::exception& exc)
-        {
-            Log::error() << "Exception while reading from pipe ["
-                         << pipeReader << "]: " << exc.what() << Log::end;
-            return -1;
-        }
 
-        return bytes;
+        return false;
     }
 
-    bool createThread(const Process::PID pid, const std::string& session, const std::string& url)
+    /// Safely asks the child whose document was the least recently worked
+    /// on to save and unload it. Returns false if none hosts any.
+    bool unloadLeastActiveChild()
     {
-        const std::string message = "thread " + session + " " + url + "\r\n";
-        if (Util::writeFIFO(getChildPipe(pid), message) < 0)
+        std::lock_guard<std::recursive_mutex> lock(forkMutex);
+
+        std::shared_ptr<ChildProcess> child;
+        for (const auto& it : _hostingChildren)
         {
-            Log::error("Error sending thread message to child [" + std::to_string(pid) + "].");
-            return false;
+            if (!child || it.second->getLastActive() < child->getLastActive())
+                child = it.second;
         }
 
-        std::string response;
-        if (getResponseLine(readerChild, response) < 0)
-        {
-            Log::error("Error reading response to thread message from child [" + std::to_string(pid) + "].");
+        if (!child)
             return false;
-        }
 
-        StringTokenizer tokens(response, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
-        return (tokens.count() == 2 && tokens[0] == std::to_string(pid) && tokens[1] == "ok");
+        Log::warn("Short of memory, unloading [" + child->getUrl() + "] of child [" +
+                  std::to_string(child->getPid()) + "].");
+
+        // Should it fail to, the next one is picked the next time.
+        child->setActive();
+
+        ControlChannel::Message message;
+        message.type = ControlChannel::Type::Unload;
+        if (!child->send(message))
+            Log::error("Error sending unload message to child [" + std::to_string(child->getPid()) + "].");
+
+        return true;
     }
+}
 
-    /// Sync ChildProcess instances with its child.
-    /// Returns the number of empty children.
-    size_t syncChildren()
+/// Serves the loolwsd FIFO and the control channels of all the kits from
+/// one epoll loop. Requests are sent to kits without waiting for their
+/// replies, so a slow kit holds up nothing but itself. The kits tell of
+/// the document they host, and of exiting, as it happens: what the broker
+/// knows of them is never polled for.
+class ControlRunnable: public Runnable
+{
+public:
+    ControlRunnable(PrespawnPool& pool) :
+        _pool(pool)
     {
-        std::lock_guard<std::recursive_mutex> lock(forkMutex);
+    }
 
-        Log::trace("Synching children.");
-        size_t empty_count = 0;
-        for (auto it = _childProcesses.begin(); it != _childProcesses.end(); )
+    bool createThread(ChildProcess& child, const std::string& session, const std::string& url)
+    {
+        ControlChannel::Message message;
+        message.type = ControlChannel::Type::CreateSession;
+        message.session = session;
+        message.url = url;
+        if (!child.send(message))
         {
-            const auto message = "query url \r\n";
-            std::string response;
-            if (Util::writeFIFO(it->second->getWritePipe(), message) < 0 ||
-                getResponseLine(readerChild, response) < 0)
-            {
-                auto log = Log::error();
-                log << "Error querying child [" << std::to_string(it->second->getPid()) << "].";
-                if (it->second->getUrl().empty())
-                {
-                    log << " Removing empty child." << Log::end;
-                    it = _childProcesses.erase(it);
-                }
-                else
-                {
-                    ++it;
-                }
-                continue;
-            }
-
-            StringTokenizer tokens(response, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
-            if (tokens.count() == 2 && tokens[0] == std::to_string(it->second->getPid()))
-            {
-                Log::debug("Child [" + std::to_string(it->second->getPid()) + "] hosts [" + tokens[1] + "].");
-                if (tokens[1] == "empty")
-                {
-                    it->second->setUrl("");
-                    ++empty_count;
-                }
-                else
-                {
-                    it->second->setUrl(tokens[1]);
-                }
-            }
-            else
-            {
-                Log::error("Unexpected response from child [" + std::to_string(it->second->getPid()) +
-                           "] to query: [" + tokens[1] + "].");
-            }
-
-            ++it;
+            Log::error("Error sending thread message to child [" + std::to_string(child.getPid()) + "].");
+            return false;
         }
 
-        Log::trace("Synching children done.");
-
-        return empty_count;
+        return true;
     }
 
     void handleInput(const std::string& message)
@@ -326,19 +366,26 @@ public:
             Log::debug("Finding kit for URL [" + url + "] on thread [" + session + "].");
 
             const auto child = findChild(url);
+
+            // Joining a document opens none.
+            if (!child || child->getUrl() != url)
+                _pool.recordOpen(std::chrono::steady_clock::now(), child != nullptr, DocumentFamily::fromUrl(url));
+
             if (child)
             {
                 if (child->getUrl() == url)
                     Log::debug("Found URL [" + url + "] hosted on child [" + std::to_string(child->getPid()) + "].");
                 else
-                    Log::debug("URL [" + url + "] is not hosted. Using empty child [" + std::to_string(child->getPid()) + "].");
+                    Log::debug("URL [" + url + "] is not hosted. Using empty " +
+                               DocumentFamily::toName(child->getFamily()) + " child [" +
+                               std::to_string(child->getPid()) + "].");
 
-                if (!createThread(child->getPid(), session, url))
+                if (!createThread(*child, session, url))
                 {
                     Log::error("Error creating thread [" + session + "] for URL [" + url + "].");
                 }
 
-                child->setUrl(url);
+                setChildUrl(child, url);
             }
             else
             {
@@ -355,29 +402,152 @@ public:
 
     void run() override
     {
-        struct pollfd pollPipeBroker;
-
-        pollPipeBroker.fd = readerBroker;
-        pollPipeBroker.events = POLLIN;
-        pollPipeBroker.revents = 0;
-
-        static const std::string thread_name = "brk_pipe_reader";
+        static const std::string thread_name = "brk_control";
 
         if (prctl(PR_SET_NAME, reinterpret_cast<unsigned long>(thread_name.c_str()), 0, 0, 0) != 0)
             Log::error("Cannot set thread name to " + thread_name + ".");
 
         Log::debug("Thread [" + thread_name + "] started.");
 
-        Util::pollPipeForReading(pollPipeBroker, FIFO_LOOLWSD, readerBroker,
-                                 [this](std::string& message) {return handleInput(message); } );
+        epoll_event events[16];
+        while (!TerminationFlag)
+        {
+            const int count = epoll_wait(epollFd, events, sizeof(events) / sizeof(events[0]), POLL_TIMEOUT_MS);
+            if (count < 0)
+            {
+                if (errno != EINTR)
+                {
+                    Log::error("Failed to wait for control events.");
+                    break;
+                }
+
+                continue;
+            }
+
+            for (int i = 0; i < count; ++i)
+            {
+                if (events[i].data.u64 == LoolwsdEvent)
+                    handleLoolwsdEvent(events[i].events);
+                else
+                    handleChildEvent(static_cast<Process::PID>(events[i].data.u64));
+            }
+        }
 
         Log::debug("Thread [" + thread_name + "] finished.");
     }
 
 private:
-    char* _start;
-    char* _end;
-    char  _buffer[READ_BUFFER_SIZE];
+    /// Reads what loolwsd sent, and handles each whole line of it.
+    void handleLoolwsdEvent(const uint32_t events)
+    {
+        ssize_t bytes = 0;
+        if (events & EPOLLIN)
+        {
+            char buffer[READ_BUFFER_SIZE];
+            bytes = Util::readFIFO(readerBroker, buffer, sizeof(buffer));
+            if (bytes > 0)
+                _input.append(buffer, bytes);
+        }
+
+        size_t start = 0;
+        size_t end;
+        while ((end = _input.find("\r\n", start)) != std::string::npos)
+        {
+            std::string message = _input.substr(start, end - start);
+            start = end + 2;
+
+            Log::trace(FIFO_LOOLWSD + " recv: " + message);
+            if (message == "eof")
+            {
+                stopLoolwsdEvents();
+                return;
+            }
+
+            handleInput(message);
+        }
+
+        _input.erase(0, start);
+
+        if (bytes <= 0)
+        {
+            Log::error("Broken pipe [" + FIFO_LOOLWSD + "] with wsd.");
+            stopLoolwsdEvents();
+        }
+    }
+
+    void stopLoolwsdEvents()
+    {
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, readerBroker, nullptr);
+        _input.clear();
+    }
+
+    /// Takes all a kit sent.
+    void handleChildEvent(const Process::PID pid)
+    {
+        std::lock_guard<std::recursive_mutex> lock(forkMutex);
+
+        const auto it = _childProcesses.find(pid);
+        if (it == _childProcesses.end())
+            return;
+
+        const std::shared_ptr<ChildProcess> child = it->second;
+        ControlChannel::Message message;
+        int received;
+        while ((received = child->receive(message)) > 0)
+        {
+            if (message.pid != pid)
+            {
+                Log::error() << "Child [" << pid << "] sent as [" << message.pid << "]." << Log::end;
+                continue;
+            }
+
+            switch (message.type)
+            {
+            case ControlChannel::Type::Ready:
+            {
+                const auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - child->getSpawnTime());
+                Log::debug() << "Child [" << pid << "] is ready after " << duration.count() << " ms." << Log::end;
+                child->setReady();
+                _pool.recordSpawn(duration);
+                break;
+            }
+            case ControlChannel::Type::SessionCreated:
+                Log::debug("Child [" + std::to_string(pid) + "] created session [" + message.session + "].");
+                break;
+            case ControlChannel::Type::Hosting:
+                if (child->isStale(message))
+                    break;
+
+                Log::debug("Child [" + std::to_string(pid) + "] hosts [" + message.url + "].");
+                setChildUrl(child, message.url);
+                child->setActive();
+                break;
+            case ControlChannel::Type::Active:
+                child->setActive();
+                break;
+            case ControlChannel::Type::Down:
+                Log::info("Child [" + std::to_string(pid) + "] is going down.");
+                removeChild(pid);
+                return;
+            default:
+                Log::error() << "Unexpected message from child [" << pid << "]: "
+                             << static_cast<int>(message.type) << "." << Log::end;
+                break;
+            }
+        }
+
+        if (received < 0)
+        {
+            Log::warn("Control channel with child [" + std::to_string(pid) + "] closed.");
+            removeChild(pid);
+        }
+    }
+
+    /// What was read from loolwsd, short of a whole line.
+    std::string _input;
+    /// Guarded by forkMutex.
+    PrespawnPool& _pool;
 };
 
 /// Initializes LibreOfficeKit for cross-fork re-use.
@@ -428,32 +598,49 @@ static bool globalPreinit(const std::string &loTemplate)
     return preInit((loTemplate + "/program").c_str(), "file:///user") == 0;
 }
 
+/// Closes, in a forked kit, the descriptors of the broker.
+static void closeBrokerFds()
+{
+    for (const auto& it : _childProcesses)
+    {
+        if (it.second->getControlFd() >= 0)
+            close(it.second->getControlFd());
+    }
+
+    close(epollFd);
+    close(readerBroker);
+}
+
 static int createLibreOfficeKit(const bool sharePages,
                                 const std::string& childRoot,
                                 const std::string& sysTemplate,
                                 const std::string& loTemplate,
-                                const std::string& loSubPath)
+                                const std::string& loSubPath,
+                                const DocumentFamily::Type family)
 {
     Process::PID childPID;
-    int fifoWriter = -1;
 
-    const Path pipePath = Path::forDirectory(childRoot + Path::separator() + FIFO_PATH);
-    const std::string pipeKit = Path(pipePath, BROKER_PREFIX + std::to_string(childCounter++) + BROKER_SUFIX).toString();
+    std::lock_guard<std::recursive_mutex> lock(forkMutex);
 
-    if (mkfifo(pipeKit.c_str(), 0666) < 0 && errno != EEXIST)
+    int controlFds[2];
+    if (!ControlChannel::createPair(controlFds))
     {
-        Log::error("Error: Failed to create pipe FIFO [" + pipeKit + "].");
+        Log::error("Error: Failed to create the control channel of a kit.");
         return -1;
     }
 
+    ++childCounter;
     if (sharePages)
     {
-        Log::debug("Forking LibreOfficeKit.");
+        Log::debug(std::string("Forking LibreOfficeKit for ") + DocumentFamily::toName(family) + " documents.");
 
         Process::PID pid;
         if (!(pid = fork()))
         {
             // child
+            close(controlFds[0]);
+            closeBrokerFds();
+
             if (std::getenv("SLEEPKITFORDEBUGGER"))
             {
                 std::cerr << "Sleeping " << std::getenv("SLEEPKITFORDEBUGGER")
@@ -462,105 +649,120 @@ static int createLibreOfficeKit(const bool sharePages,
                 Thread::sleep(std::stoul(std::getenv("SLEEPKITFORDEBUGGER")) * 1000);
             }
 
-            lokit_main(childRoot, sysTemplate, loTemplate, loSubPath, pipeKit);
+            lokit_main(childRoot, sysTemplate, loTemplate, loSubPath, controlFds[1], family);
             _exit(Application::EXIT_OK);
         }
         else
         {
             // parent
             childPID = pid; // (somehow - switch the hash to use real pids or ?) ...
-            Log::info("Forked kit [" + std::to_string(childPID) + "].");
+            if (childPID > 0)
+                Log::info("Forked kit [" + std::to_string(childPID) + "].");
         }
     }
     else
     {
-        Process::Args args;
+        std::vector<std::string> args;
+        args.push_back(loolkitPath);
         args.push_back("--childroot=" + childRoot);
         args.push_back("--systemplate=" + sysTemplate);
         args.push_back("--lotemplate=" + loTemplate);
         args.push_back("--losubpath=" + loSubPath);
-        args.push_back("--pipe=" + pipeKit);
+        args.push_back("--controlfd=" + std::to_string(controlFds[1]));
+        args.push_back(std::string("--family=") + DocumentFamily::toName(family));
         args.push_back("--clientport=" + std::to_string(ClientPortNumber));
+        args.push_back("--idletimeout=" + std::to_string(IdleTimeoutSecs));
+        args.push_back("--callbackflushms=" + std::to_string(ChildProcessSession::getCallbackFlushMS()));
+        if (!TileEncoder::getConfiguration().empty())
+            args.push_back("--tileencoder=" + TileEncoder::getConfiguration());
+        if (ChildProcessSession::getUseHugePages())
+            args.push_back("--hugepages");
+        if (UseTcpTransport)
+            args.push_back("--kittransport=tcp");
 
         Log::info("Launching LibreOfficeKit #" + std::to_string(childCounter) +
-                  ": " + loolkitPath + " " +
-                  Poco::cat(std::string(" "), args.begin(), args.end()));
+                  ": " + Poco::cat(std::string(" "), args.begin(), args.end()));
+
+        // Everything exec needs is made before forking: the broker has
+        // threads, so the child can't allocate.
+        std::vector<char*> argv;
+        for (auto& arg : args)
+            argv.push_back(&arg[0]);
+        argv.push_back(nullptr);
+        const int maxFd = getdtablesize();
+
+        // Poco's Process::launch closes every descriptor but the standard
+        // ones, that of the control channel too, so spawn by hand.
+        childPID = fork();
+        if (childPID == 0)
+        {
+            for (int fd = 3; fd < maxFd; ++fd)
+            {
+                if (fd != controlFds[1])
+                    close(fd);
+            }
+
+            execv(loolkitPath.c_str(), argv.data());
+            _exit(Application::EXIT_SOFTWARE);
+        }
 
-        ProcessHandle procChild = Process::launch(loolkitPath, args);
-        childPID = procChild.id();
-        Log::info("Spawned kit [" + std::to_string(childPID) + "].");
+        if (childPID > 0)
+            Log::info("Spawned kit [" + std::to_string(childPID) + "].");
 
-        if (!Process::isRunning(procChild))
+        if (childPID < 0 || kill(childPID, 0) != 0)
         {
             // This can happen if we fail to copy it, or bad chroot etc.
             Log::error("Error: loolkit [" + std::to_string(childPID) + "] was stillborn.");
+            close(controlFds[0]);
+            close(controlFds[1]);
             return -1;
         }
     }
 
-    // open non-blocking to make sure that a broken lokit process will not
-    // block the loolbroker forever
-    {
-        int retries = 5;
-        // Note that the use of a condition variable and mutex here is totally pointless as far as I
-        // see. There is no code that would notify the condition variable.
-        std::mutex fifoMutex;
-        std::condition_variable fifoCV;
-        std::unique_lock<std::mutex> lock(fifoMutex);
-
-        if (std::getenv("SLEEPKITFORDEBUGGER"))
-            retries = std::numeric_limits<int>::max();
-
-        while(retries && fifoWriter < 0)
-        {
-            fifoCV.wait_for(
-                lock,
-                std::chrono::microseconds(80000),
-                [&fifoWriter, &pipeKit]
-                {
-                    return (fifoWriter = open(pipeKit.c_str(), O_WRONLY | O_NONBLOCK)) >= 0;
-                });
-
-            if (fifoWriter < 0)
-            {
-                Log::debug("Retrying to establish pipe connection: " + std::to_string(retries));
-            }
-
-            --retries;
-        }
-    }
-
-    if (fifoWriter < 0)
+    close(controlFds[1]);
+    if (childPID < 0)
     {
-        Log::error("Error: failed to open write pipe [" + pipeKit + "] with kit. Abandoning child.");
-        // This is an elaborate way to send a SIGINT to childPID: Construct and immediately destroy
-        // a ChildProcess object for it.
-        ChildProcess(childPID, -1, -1);
+        Log::error("Error: Failed to fork a kit.");
+        close(controlFds[0]);
         return -1;
     }
 
-    int flags;
-    if ((flags = fcntl(fifoWriter, F_GETFL, 0)) < 0)
-    {
-        Log::error("Error: failed to get pipe flags [" + pipeKit + "].");
-        ChildProcess(childPID, -1, -1);
-        return -1;
-    }
+    auto child = std::make_shared<ChildProcess>(childPID, controlFds[0], family);
 
-    flags &= ~O_NONBLOCK;
-    if (fcntl(fifoWriter, F_SETFL, flags) < 0)
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = static_cast<uint64_t>(childPID);
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, controlFds[0], &event) != 0)
     {
-        Log::error("Error: failed to set pipe flags [" + pipeKit + "].");
-        ChildProcess(childPID, -1, -1);
+        Log::error("Error: Failed to watch the control channel of kit [" + std::to_string(childPID) + "]. Abandoning child.");
         return -1;
     }
 
     Log::info() << "Adding Kit #" << childCounter << ", PID: " << childPID << Log::end;
 
-    _childProcesses[childPID] = std::make_shared<ChildProcess>(childPID, -1, fifoWriter);
+    _childProcesses[childPID] = child;
+    indexChild(child);
     return childPID;
 }
 
+/// Tells the Admin console of the pool, when that changed.
+static void notifyPoolStats(const PrespawnPool& pool, const size_t empty, const size_t target)
+{
+    static std::string lastStats;
+
+    std::ostringstream stats;
+    stats << "prespawn" << " "
+          << pool.getHits() << " "
+          << pool.getMisses() << " "
+          << empty << " "
+          << target;
+    if (stats.str() != lastStats)
+    {
+        lastStats = stats.str();
+        Util::writeFIFO(writerNotify, lastStats + " \r\n");
+    }
+}
+
 static bool waitForTerminationChild(const Process::PID pid, int count = CHILD_TIMEOUT_SECS)
 {
     while (count-- > 0)
@@ -630,11 +832,50 @@ int main(int argc, char** argv)
             eq = std::strchr(cmd, '=');
             numPreSpawnedChildren = std::stoi(std::string(eq+1));
         }
+        else if (std::strstr(cmd, "--maxprespawns=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            maxPreSpawnedChildren = std::stoi(std::string(eq+1));
+        }
         else if (std::strstr(cmd, "--clientport=") == cmd)
         {
             eq = std::strchr(cmd, '=');
             ClientPortNumber = std::stoll(std::string(eq+1));
         }
+        else if (std::strstr(cmd, "--idletimeout=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            IdleTimeoutSecs = std::stoi(std::string(eq+1));
+        }
+        else if (std::strstr(cmd, "--callbackflushms=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            ChildProcessSession::setCallbackFlushMS(std::stoi(std::string(eq+1)));
+        }
+        else if (std::strstr(cmd, "--tileencoder=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            TileEncoder::configure(std::string(eq+1));
+        }
+        else if (std::strcmp(cmd, "--hugepages") == 0)
+        {
+            ChildProcessSession::setUseHugePages(true);
+        }
+        else if (std::strstr(cmd, "--kittransport=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            UseTcpTransport = (std::strcmp(eq+1, "tcp") == 0);
+        }
+        else if (std::strstr(cmd, "--memorystall=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            memoryStallThreshold = std::stod(std::string(eq+1));
+        }
+        else if (std::strstr(cmd, "--memoryusage=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            memoryUsageThreshold = std::stod(std::string(eq+1));
+        }
     }
 
     loolkitPath = Poco::Path(argv[0]).parent().toString() + "loolkit";
@@ -653,38 +894,26 @@ int main(int argc, char** argv)
         std::exit(Application::EXIT_SOFTWARE);
     }
 
-    if (!std::getenv("LD_BIND_NOW"))
-        Log::info("Note: LD_BIND_NOW is not set.");
-
-    if (!std::getenv("LOK_VIEW_CALLBACK"))
-        Log::info("Note: LOK_VIEW_CALLBACK is not set.");
-
-    int pipeFlags = O_RDONLY | O_NONBLOCK;
-    const std::string pipeBroker = Path(pipePath, FIFO_BROKER).toString();
-    if (mkfifo(pipeBroker.c_str(), 0666) < 0 && errno != EEXIST)
+    if ((epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0)
     {
-        Log::error("Error: Failed to create pipe FIFO [" + FIFO_BROKER + "].");
+        Log::error("Error: failed to create the epoll instance. Exiting.");
         std::exit(Application::EXIT_SOFTWARE);
     }
 
-    if ((readerChild = open(pipeBroker.c_str(), pipeFlags) ) < 0)
+    epoll_event loolwsdEvent = {};
+    loolwsdEvent.events = EPOLLIN;
+    loolwsdEvent.data.u64 = LoolwsdEvent;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, readerBroker, &loolwsdEvent) != 0)
     {
-        Log::error("Error: pipe opened for reading.");
+        Log::error("Error: failed to watch pipe [" + pipeLoolwsd + "]. Exiting.");
         std::exit(Application::EXIT_SOFTWARE);
     }
 
-    if ((pipeFlags = fcntl(readerChild, F_GETFL, 0)) < 0)
-    {
-        Log::error("Error: failed to get pipe flags [" + FIFO_BROKER + "].");
-        std::exit(Application::EXIT_SOFTWARE);
-    }
+    if (!std::getenv("LD_BIND_NOW"))
+        Log::info("Note: LD_BIND_NOW is not set.");
 
-    pipeFlags &= ~O_NONBLOCK;
-    if (fcntl(readerChild, F_SETFL, pipeFlags) < 0)
-    {
-        Log::error("Error: failed to set pipe flags [" + FIFO_BROKER + "].");
-        std::exit(Application::EXIT_SOFTWARE);
-    }
+    if (!std::getenv("LOK_VIEW_CALLBACK"))
+        Log::info("Note: LOK_VIEW_CALLBACK is not set.");
 
     // Open notify pipe
     const std::string pipeNotify = Path(pipePath, FIFO_NOTIFY).toString();
@@ -706,26 +935,34 @@ int main(int argc, char** argv)
 
     // We must have at least one child, more is created dynamically.
     if (createLibreOfficeKit(sharePages, childRoot, sysTemplate,
-                             loTemplate, loSubPath) < 0)
+                             loTemplate, loSubPath, DocumentFamily::Type::Generic) < 0)
     {
         Log::error("Error: failed to create children.");
         std::exit(Application::EXIT_SOFTWARE);
     }
 
-    if (numPreSpawnedChildren > 1)
-        forkCounter = numPreSpawnedChildren - 1;
-
     if (!sharePages)
     {
         dropCapability(CAP_SYS_CHROOT);
         dropCapability(CAP_MKNOD);
         dropCapability(CAP_FOWNER);
+        dropCapability(CAP_SYS_ADMIN);
     }
 
-    PipeRunnable pipeHandler;
-    Poco::Thread pipeThread;
+    // The rest of the pool is spawned with the first round of the loop.
+    PrespawnPool pool(numPreSpawnedChildren, std::max(numPreSpawnedChildren, maxPreSpawnedChildren));
+    Log::info() << "Keeping " << pool.getMinSize() << " to " << pool.getMaxSize()
+                << " children spawned in advance." << Log::end;
+
+    MemoryGovernor governor(memoryStallThreshold, memoryUsageThreshold);
+    Log::info() << "Unloading documents when stalled on memory over " << governor.getStallThreshold()
+                << "% of the time, or using over " << governor.getUsageThreshold()
+                << "% of the cgroup's memory (0 for never)." << Log::end;
 
-    pipeThread.start(pipeHandler);
+    ControlRunnable controlHandler(pool);
+    Poco::Thread controlThread;
+
+    controlThread.start(controlHandler);
 
     Log::info("loolbroker is ready.");
 
@@ -787,7 +1024,6 @@ int main(int argc, char** argv)
                 Util::removeFile(childPath, true);
             }
 
-            pipeHandler.syncChildren();
             timeoutCounter = 0;
         }
         else if (pid < 0)
@@ -810,25 +1046,35 @@ int main(int argc, char** argv)
             }
         }
 
-        if (forkCounter > 0 && childExitCode == EXIT_SUCCESS)
+        if (childExitCode == EXIT_SUCCESS)
         {
             std::lock_guard<std::recursive_mutex> lock(forkMutex);
 
-            const int empty = pipeHandler.syncChildren();
-            const int total = _childProcesses.size();
-
-            // Figure out how many children we need. Always create at least as many
-            // as configured pre-spawn or one more than requested (whichever is larger).
-            int spawn = std::max(static_cast<int>(forkCounter) + 1, numPreSpawnedChildren);
-            Log::debug() << "Creating " << spawn << (spawn == 1 ? "child" : "children") << ". Current total: "
-                         << total << ", Empty: " << empty << Log::end;
-            do
+            // Requests which found no child come on top of what the pool
+            // is to hold, as generic children.
+            const auto now = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < DocumentFamily::Count; ++i)
             {
-                if (createLibreOfficeKit(sharePages, childRoot, sysTemplate,
-                                         loTemplate, loSubPath) < 0)
-                    Log::error("Error: fork failed.");
+                const auto family = static_cast<DocumentFamily::Type>(i);
+                const int empty = countEmptyChildren(family);
+                const int target = static_cast<int>(pool.getTarget(now, family) +
+                                                    (family == DocumentFamily::Type::Generic ? forkCounter.load() : 0));
+                if (empty < target)
+                {
+                    const int total = _childProcesses.size();
+                    int spawn = target - empty;
+                    Log::debug() << "Creating " << spawn << " " << DocumentFamily::toName(family)
+                                 << (spawn == 1 ? " child" : " children") << ". Current total: "
+                                 << total << ", Empty: " << empty << ", Target: " << target << Log::end;
+                    do
+                    {
+                        if (createLibreOfficeKit(sharePages, childRoot, sysTemplate,
+                                                 loTemplate, loSubPath, family) < 0)
+                            Log::error("Error: fork failed.");
+                    }
+                    while (--spawn > 0);
+                }
             }
-            while (--spawn > 0);
 
             // We've done our best. If need more, retrying will bump the counter.
             forkCounter = 0;
@@ -838,6 +1084,39 @@ int main(int argc, char** argv)
         {
             timeoutCounter = 0;
             childExitCode = EXIT_SUCCESS;
+
+            {
+                std::lock_guard<std::recursive_mutex> lock(forkMutex);
+
+                // Shrink one child at a time, as the demand goes down or
+                // moves to another family.
+                const auto now = std::chrono::steady_clock::now();
+                const size_t target = pool.getTarget(now);
+                size_t empty = countEmptyChildren();
+                for (size_t i = 0; i < DocumentFamily::Count; ++i)
+                {
+                    const auto family = static_cast<DocumentFamily::Type>(i);
+                    if (countEmptyChildren(family) > pool.getTarget(now, family) && retireEmptyChild(family))
+                    {
+                        --empty;
+                        break;
+                    }
+                }
+
+                notifyPoolStats(pool, empty, target);
+            }
+
+            // loolwsd can't read our smaps, we aren't dumpable.
+            const std::string report = ProcessMemory::getReport();
+            if (!report.empty())
+                Util::writeFIFO(writerNotify, report + " \r\n");
+
+            if (governor.shouldUnload(std::chrono::steady_clock::now(),
+                                      MemoryGovernor::readStall(), MemoryGovernor::readUsage()))
+            {
+                unloadLeastActiveChild();
+            }
+
             sleep(MAINTENANCE_INTERVAL);
         }
     }
@@ -859,11 +1138,15 @@ int main(int argc, char** argv)
         }
     }
 
+    _hostingChildren.clear();
+    for (auto& empty : _emptyChildren)
+        empty.clear();
+
     _childProcesses.clear();
 
-    pipeThread.join();
+    controlThread.join();
     close(writerNotify);
-    close(readerChild);
+    close(epollFd);
     close(readerBroker);
 
     Log::info("Process [loolbroker] finished.");
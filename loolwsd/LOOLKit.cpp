@@ -11,20 +11,27 @@
  * NB. this file is compiled both standalone, and as part of the LOOLBroker.
  */
 
+#include <sys/mount.h>
 #include <sys/prctl.h>
 #include <sys/poll.h>
 #include <sys/syscall.h>
+#include <dirent.h>
+#include <sched.h>
 #include <signal.h>
 #include <ftw.h>
 #include <utime.h>
 #include <unistd.h>
 #include <dlfcn.h>
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <vector>
 
 #include <Poco/Exception.h>
 #include <Poco/Mutex.h>
@@ -38,6 +45,7 @@
 #include <Poco/StringTokenizer.h>
 #include <Poco/Thread.h>
 #include <Poco/ThreadLocal.h>
+#include <Poco/URI.h>
 #include <Poco/Util/Application.h>
 
 #define LOK_USE_UNSTABLE_API
@@ -47,9 +55,18 @@
 #include "Capabilities.hpp"
 #include "ChildProcessSession.hpp"
 #include "Common.hpp"
+#include "ControlChannel.hpp"
+#include "DocumentFamily.hpp"
 #include "LOKitHelper.hpp"
 #include "LOOLProtocol.hpp"
+#include "MemoryCollector.hpp"
+#include "MemoryGovernor.hpp"
 #include "QueueHandler.hpp"
+#include "ReceiveBuffer.hpp"
+#include "TileEncoder.hpp"
+#include "TileHeader.hpp"
+#include "TileRing.hpp"
+#include "UnixChannel.hpp"
 #include "Util.hpp"
 
 using namespace LOOLProtocol;
@@ -70,15 +87,32 @@ using Poco::Util::Application;
 
 const std::string CHILD_URI = "/loolws/child/";
 const std::string FIFO_PATH = "pipe";
-const std::string FIFO_BROKER = "loolbroker.fifo";
 const std::string FIFO_NOTIFY = "loolnotify.fifo";
 
 static int writerNotify = -1;
 
+/// Seconds after which a document nobody worked on is saved and unloaded;
+/// 0 for never. Set by --idletimeout.
+static int IdleTimeoutSecs = 0;
+
+/// Whether sessions connect to the master by a WebSocket over TCP rather
+/// than its Unix socket. Set by --kittransport=tcp.
+static bool UseTcpTransport = false;
+
 namespace
 {
+    /// Shared memory of a session for the tiles on their way to the master.
+    const size_t TileRingCapacity = 8 * 1024 * 1024;
+
+    /// How often at most the broker is told of a document being worked on.
+    const std::chrono::seconds ActivityReportInterval(10);
+
+    /// How often the Admin console is told of our memory, which it can't read.
+    const std::chrono::seconds MemoryReportInterval(5);
+
     ThreadLocal<std::string> sourceForLinkOrCopy;
     ThreadLocal<Path> destinationForLinkOrCopy;
+    ThreadLocal<std::string> lastDirectoryForLinkOrCopy;
 
     int linkOrCopyFunction(const char *fpath,
                            const struct stat* /*sb*/,
@@ -95,7 +129,13 @@ namespace
         switch (typeflag)
         {
         case FTW_F:
-            File(newPath.parent()).createDirectories();
+            // Files of a directory come one after the other, so it is
+            // rarely needed to make sure theirs exists.
+            if (newPath.parent().toString() != *lastDirectoryForLinkOrCopy)
+            {
+                File(newPath.parent()).createDirectories();
+                *lastDirectoryForLinkOrCopy = newPath.parent().toString();
+            }
             if (link(fpath, newPath.toString().c_str()) == -1)
             {
                 Log::error("Error: link(\"" + std::string(fpath) + "\",\"" + newPath.toString() +
@@ -143,18 +183,156 @@ namespace
         if (sourceForLinkOrCopy->back() == '/')
             sourceForLinkOrCopy->pop_back();
         *destinationForLinkOrCopy = destination;
+        lastDirectoryForLinkOrCopy->clear();
         if (nftw(source.c_str(), linkOrCopyFunction, 10, FTW_DEPTH) == -1)
             Log::error("linkOrCopy: nftw() failed for '" + source + "'");
     }
+
+    /// Directories of the system template written to in a jail, which are
+    /// linked rather than mounted read-only.
+    const char* const WritableJailDirs[] = { "dev", "etc", "tmp", "var" };
+
+    bool isWritableJailDir(const std::string& name)
+    {
+        for (const auto dir : WritableJailDirs)
+        {
+            if (name == dir)
+                return true;
+        }
+
+        return false;
+    }
+
+    /// Mounts the directory source read-only on destination, an existing
+    /// directory, and notes the latter in mounted.
+    bool bindMount(const std::string& source, const std::string& destination, std::vector<std::string>& mounted)
+    {
+        if (mount(source.c_str(), destination.c_str(), nullptr, MS_BIND | MS_REC, nullptr) != 0)
+        {
+            Log::warn("Error: bind mount of '" + source + "' failed: " + std::strerror(errno));
+            return false;
+        }
+
+        mounted.push_back(destination);
+
+        // A bind mount only takes flags when remounted.
+        if (mount(nullptr, destination.c_str(), nullptr, MS_REMOUNT | MS_BIND | MS_RDONLY | MS_NOSUID, nullptr) != 0)
+        {
+            Log::warn("Error: read-only remount of '" + destination + "' failed: " + std::strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Sets up the jail with read-only bind mounts of the templates instead
+    /// of linking their thousands of files, all but the directories written
+    /// to. The mounts are made in a mount namespace of the kit's own: nobody
+    /// else sees them, and they go with the kit, so removing its jail never
+    /// reaches into the templates.
+    ///
+    /// Needs CAP_SYS_ADMIN. Returns false, leaving no mount behind, if the
+    /// jail is to be linked instead.
+    bool bindMountJail(const std::string& sysTemplate, const std::string& loTemplate,
+                       const Path& jailPath, const Path& jailLOInstallation)
+    {
+        if (unshare(CLONE_NEWNS) != 0 ||
+            mount(nullptr, "/", nullptr, MS_REC | MS_PRIVATE, nullptr) != 0)
+        {
+            Log::info("No mount namespace of our own (" + std::string(std::strerror(errno)) + "), linking the jail.");
+            return false;
+        }
+
+        DIR* dir = opendir(sysTemplate.c_str());
+        if (dir == nullptr)
+        {
+            Log::error("Error: cannot read directory '" + sysTemplate + "'.");
+            return false;
+        }
+
+        // The directories first: what is linked can't be undone.
+        std::vector<std::string> linked;
+        std::vector<std::string> mounted;
+        bool success = true;
+        while (const dirent* entry = readdir(dir))
+        {
+            const std::string name = entry->d_name;
+            if (name == "." || name == "..")
+                continue;
+
+            const std::string source = Path(Path::forDirectory(sysTemplate), name).toString();
+            const Path destination(jailPath, name);
+            struct stat st;
+            if (stat(source.c_str(), &st) != 0)
+            {
+                Log::error("Error: stat(\"" + source + "\") failed.");
+                success = false;
+                break;
+            }
+
+            // What is there already, like the symlink to the LibreOffice
+            // installation, would be hidden by a mount.
+            if (!S_ISDIR(st.st_mode) || isWritableJailDir(name) || File(destination).exists())
+            {
+                linked.push_back(name);
+                continue;
+            }
+
+            File(destination).createDirectory();
+            if (!bindMount(source, destination.toString(), mounted))
+            {
+                success = false;
+                break;
+            }
+        }
+
+        closedir(dir);
+
+        if (success)
+            success = bindMount(loTemplate, jailLOInstallation.toString(), mounted);
+
+        if (!success)
+        {
+            for (auto it = mounted.rbegin(); it != mounted.rend(); ++it)
+            {
+                umount2(it->c_str(), MNT_DETACH);
+            }
+
+            Log::warn("Bind mounting the jail failed, linking it instead.");
+            return false;
+        }
+
+        for (const auto& name : linked)
+        {
+            const std::string source = Path(Path::forDirectory(sysTemplate), name).toString();
+            const Path destination(jailPath, name);
+            if (File(source).isDirectory())
+            {
+                File(destination).createDirectories();
+                linkOrCopy(source, destination);
+            }
+            else if (link(source.c_str(), destination.toString().c_str()) == -1)
+            {
+                Log::error("Error: link(\"" + source + "\",\"" + destination.toString() +
+                           "\") failed. Exiting.");
+                std::exit(Application::EXIT_SOFTWARE);
+            }
+        }
+
+        return true;
+    }
 }
 
 class Connection: public Runnable
 {
 public:
+    /// Either ws or channel connects to the master.
     Connection(std::shared_ptr<ChildProcessSession> session,
-               std::shared_ptr<WebSocket> ws) :
+               std::shared_ptr<WebSocket> ws,
+               std::shared_ptr<UnixChannel> channel) :
         _session(session),
         _ws(ws),
+        _channel(channel),
         _stop(false)
     {
         Log::info("Connection ctor in child for " + _session->getId());
@@ -166,7 +344,6 @@ public:
         stop();
     }
 
-    std::shared_ptr<WebSocket> getWebSocket() const { return _ws; }
     std::shared_ptr<ChildProcessSession> getSession() { return _session; }
 
     void start()
@@ -189,13 +366,22 @@ public:
         _thread.join();
     }
 
-    void handle(TileQueue& queue, const std::string& firstLine, char* buffer, int n)
+    /// Ends run() as if the master had closed the connection.
+    void shutdownReceive()
     {
-        if (firstLine.find("paste") != 0)
+        if (_channel)
+            _channel->shutdownReceive();
+        else
+            _ws->shutdownReceive();
+    }
+
+    void handle(TileQueue& queue, const StringView firstLine, char* buffer, int n)
+    {
+        if (!firstLine.startsWith("paste"))
         {
             // Everything else is expected to be a single line.
-            assert(firstLine.size() == static_cast<std::string::size_type>(n));
-            queue.put(firstLine);
+            assert(firstLine.size() == static_cast<size_t>(n));
+            queue.put(firstLine.toString());
         }
         else
             queue.put(std::string(buffer, n));
@@ -218,44 +404,36 @@ public:
             Thread queueHandlerThread;
             queueHandlerThread.start(handler);
 
-            int flags;
+            int flags = 0;
             int n;
+            ReceiveBuffer buffer;
             do
             {
-                char buffer[1024];
-                n = _ws->receiveFrame(buffer, sizeof(buffer), flags);
+                n = (_channel ? _channel->receive(buffer, flags) : receiveMessage(*_ws, buffer, flags));
                 if (n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE)
                 {
-                    std::string firstLine = getFirstLine(buffer, n);
+                    // Tile requests are binary, and their fields may contain newlines.
+                    if (TileHeader::isBinary(buffer.data(), n))
+                    {
+                        queue.put(std::string(buffer.data(), n));
+                        continue;
+                    }
+
+                    const Tokenizer tokens(buffer.data(), n);
+                    const StringView firstLine = tokens.getLine();
                     if (firstLine == "eof")
                     {
                         Log::info("Received EOF. Finishing.");
                         break;
                     }
 
-                    StringTokenizer tokens(firstLine, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
-
                     if (firstLine == "disconnect")
                     {
-                        Log::info("Client disconnected [" + (tokens.count() == 2 ? tokens[1] : std::string("no reason")) + "].");
+                        Log::info("Client disconnected [" + (tokens.count() == 2 ? tokens[1].toString() : std::string("no reason")) + "].");
                         break;
                     }
 
-                    // Check if it is a "nextmessage:" and in that case read the large
-                    // follow-up message separately, and handle that only.
-                    int size;
-                    if (tokens.count() == 2 && tokens[0] == "nextmessage:" && getTokenInteger(tokens[1], "size", size) && size > 0)
-                    {
-                        char largeBuffer[size];
-                        n = _ws->receiveFrame(largeBuffer, size, flags);
-                        if (n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE)
-                        {
-                            firstLine = getFirstLine(largeBuffer, n);
-                            handle(queue, firstLine, largeBuffer, n);
-                        }
-                    }
-                    else
-                        handle(queue, firstLine, buffer, n);
+                    handle(queue, firstLine, buffer.data(), n);
                 }
             }
             while (!_stop && n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE);
@@ -291,6 +469,7 @@ private:
     Thread _thread;
     std::shared_ptr<ChildProcessSession> _session;
     std::shared_ptr<WebSocket> _ws;
+    std::shared_ptr<UnixChannel> _channel;
     volatile bool _stop;
 };
 
@@ -322,7 +501,8 @@ public:
         _isDocLoaded(false),
         _isDocPasswordProtected(false),
         _docPasswordType(PasswordType::ToView),
-        _clientViews(0)
+        _clientViews(0),
+        _isModified(_multiView)
     {
         (void)_isDocLoaded; // FIXME LOOLBroker.cpp includes LOOLKit.cpp
         Log::info("Document ctor for url [" + _url + "] on child [" + _jailId +
@@ -348,12 +528,8 @@ public:
                 // stop all websockets
                 if (aIterator.second->isRunning())
                 {
-                    std::shared_ptr<WebSocket> ws = aIterator.second->getWebSocket();
-                    if ( ws )
-                    {
-                        ws->shutdownReceive();
-                        aIterator.second->join();
-                    }
+                    aIterator.second->shutdownReceive();
+                    aIterator.second->join();
                 }
             }
             catch(Poco::Net::NetException& exc)
@@ -400,25 +576,55 @@ public:
                     << " view for url: " << _url << " for thread: " << sessionId
                     << " on child: " << _jailId << Log::end;
 
-        // Open websocket connection between the child process and the
-        // parent. The parent forwards us requests that it can't handle.
+        // Open a connection between the child process and the parent.
+        // The parent forwards us requests that it can't handle.
+        // The Unix channel is cheaper; the WebSocket over TCP remains for
+        // when it is unavailable, or --kittransport=tcp.
+        std::shared_ptr<UnixChannel> channel;
+        std::shared_ptr<WebSocket> ws;
+        if (!UseTcpTransport)
+        {
+            channel = UnixChannel::connect(MASTER_SOCKET_NAME);
+            if (!channel)
+                Log::warn("Cannot connect to the master on its Unix socket, using TCP.", true);
+        }
 
-        HTTPClientSession cs("127.0.0.1", MASTER_PORT_NUMBER);
-        cs.setTimeout(0);
-        HTTPRequest request(HTTPRequest::HTTP_GET, CHILD_URI + sessionId);
-        HTTPResponse response;
+        std::unique_ptr<TileRing> tileRing;
+        if (channel)
+        {
+            // What the WebSocket request would ask for.
+            const std::string uri = CHILD_URI + sessionId;
+            channel->send(uri.data(), uri.size(), WebSocket::FRAME_TEXT);
+
+            // Then the shared memory for the tiles, which are passed by reference.
+            tileRing = TileRing::create(TileRingCapacity);
+            if (tileRing)
+                channel->send(nullptr, 0, TileRing::FrameFlagRing, tileRing->getFd());
+            else
+                Log::warn("Failed to create the shared memory for tiles.", true);
+        }
+        else
+        {
+            HTTPClientSession cs("127.0.0.1", MASTER_PORT_NUMBER);
+            cs.setTimeout(0);
+            HTTPRequest request(HTTPRequest::HTTP_GET, CHILD_URI + sessionId);
+            HTTPResponse response;
 
-        auto ws = std::make_shared<WebSocket>(cs, request, response);
-        ws->setReceiveTimeout(0);
+            ws = std::make_shared<WebSocket>(cs, request, response);
+            ws->setReceiveTimeout(0);
+        }
 
         auto session = std::make_shared<ChildProcessSession>(sessionId, ws, _loKitDocument, _jailId,
                        [this](const std::string& id, const std::string& uri, const std::string& docPassword, bool isDocPasswordProvided) { return onLoad(id, uri, docPassword, isDocPasswordProvided); },
                        [this](const std::string& id) { onUnload(id); });
+        if (channel)
+            session->setChannel(channel, std::move(tileRing));
+
         // child -> 0,  sessionId -> 1, PID -> 2
         std::string hello("child " + sessionId + " " + std::to_string(Process::id()));
         session->sendTextFrame(hello);
 
-        auto thread = std::make_shared<Connection>(session, ws);
+        auto thread = std::make_shared<Connection>(session, ws, channel);
         const auto aInserted = _connections.emplace(intSessionId, thread);
 
         if ( aInserted.second )
@@ -468,14 +674,71 @@ public:
         return purgeSessions() > 0;
     }
 
-    /// Returns true if there is no activity and
-    /// the document is saved.
+    /// Returns true if nobody uses the document anymore.
     bool canDiscard()
     {
-        //TODO: Implement proper time-out on inactivity.
         return !hasConnections();
     }
 
+    /// Milliseconds since any session of the document was last active.
+    double getInactivityMS()
+    {
+        std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+        double inactivity = std::numeric_limits<double>::max();
+        for (const auto& it : _connections)
+        {
+            inactivity = std::min(inactivity, it.second->getSession()->getStatistics().getInactivityMS());
+        }
+
+        return inactivity;
+    }
+
+    /// Returns true if nobody worked on the document for the idle
+    /// time-out, if any.
+    bool isIdle()
+    {
+        return IdleTimeoutSecs > 0 && getInactivityMS() >= IdleTimeoutSecs * 1000.0;
+    }
+
+    /// Whether the edits saved by save() reach the storage of the document.
+    bool canUnload() const
+    {
+        return MemoryGovernor::canUnload(Poco::URI(_jailedUrl).getPath());
+    }
+
+    /// Saves the document where it was loaded from, if it was modified, to
+    /// unload it. Returns false if that failed.
+    bool save()
+    {
+        std::shared_ptr<ChildProcessSession> session;
+        {
+            std::unique_lock<std::recursive_mutex> lock(_mutex);
+            if (_loKitDocument == nullptr || !_isModified)
+                return true;
+
+            if (!_connections.empty())
+                session = _connections.cbegin()->second->getSession();
+        }
+
+        // The sessions' lock first, as they take them.
+        std::unique_lock<TimedRecursiveMutex> sessionLock;
+        if (session)
+            sessionLock = session->getLock();
+
+        std::unique_lock<std::recursive_mutex> lock(_mutex);
+
+        Log::info("Saving [" + _url + "] to unload it.");
+        if (!_loKitDocument->pClass->saveAs(_loKitDocument, _jailedUrl.c_str(), nullptr, nullptr))
+        {
+            Log::error("Failed to save [" + _url + "]: " + _loKit->pClass->getError(_loKit));
+            return false;
+        }
+
+        _isModified = false;
+        return true;
+    }
+
     /// Set Document password for given URL
     void setDocumentPassword(int nPasswordType)
     {
@@ -557,6 +820,13 @@ private:
         Document* self = reinterpret_cast<Document*>(pData);
         if (self)
         {
+            if (nType == LOK_CALLBACK_STATE_CHANGED && pPayload != nullptr)
+            {
+                static const char Modified[] = ".uno:ModifiedStatus=";
+                if (std::strncmp(pPayload, Modified, sizeof(Modified) - 1) == 0)
+                    self->_isModified = (std::strcmp(pPayload + sizeof(Modified) - 1, "true") == 0);
+            }
+
             std::unique_lock<std::recursive_mutex> lock(self->_mutex);
 
             for (auto& it: self->_connections)
@@ -752,32 +1022,30 @@ private:
     std::recursive_mutex _mutex;
     std::map<unsigned, std::shared_ptr<Connection>> _connections;
     std::atomic<unsigned> _clientViews;
+    /// Whether there are changes to save. With multiple views, we aren't
+    /// told, so we always save.
+    std::atomic<bool> _isModified;
 };
 
 void lokit_main(const std::string& childRoot,
                 const std::string& sysTemplate,
                 const std::string& loTemplate,
                 const std::string& loSubPath,
-                const std::string& pipe)
+                const int controlFd,
+                const DocumentFamily::Type family)
 {
 #ifdef LOOLKIT_NO_MAIN
     // Reinitialize logging when forked.
     Log::initialize("kit");
 #endif
 
-    struct pollfd pollPipeBroker;
-    ssize_t bytes = -1;
-    int   ready = 0;
-    bool  isDirtyKit = false;
-    char  buffer[READ_BUFFER_SIZE];
-    char* start = nullptr;
-    char* end = nullptr;
+    bool isDirtyKit = false;
 
     assert(!childRoot.empty());
     assert(!sysTemplate.empty());
     assert(!loTemplate.empty());
     assert(!loSubPath.empty());
-    assert(!pipe.empty());
+    assert(controlFd >= 0);
 
     std::map<std::string, std::shared_ptr<Document>> _documents;
 
@@ -797,24 +1065,10 @@ void lokit_main(const std::string& childRoot,
 
     try
     {
-        int writerBroker;
-        int readerBroker;
-
-        if ((readerBroker = open(pipe.c_str(), O_RDONLY) ) < 0)
-        {
-            Log::error("Error: failed to open pipe [" + pipe + "] read only.");
-            std::exit(Application::EXIT_SOFTWARE);
-        }
-
-        const Path pipePath = Path::forDirectory(childRoot + Path::separator() + FIFO_PATH);
-        const std::string pipeBroker = Path(pipePath, FIFO_BROKER).toString();
-        if ((writerBroker = open(pipeBroker.c_str(), O_WRONLY) ) < 0)
-        {
-            Log::error("Error: failed to open pipe [" + FIFO_BROKER + "] write only.");
-            std::exit(Application::EXIT_SOFTWARE);
-        }
+        ControlChannel channel(controlFd);
 
         // Open notify pipe
+        const Path pipePath = Path::forDirectory(childRoot + Path::separator() + FIFO_PATH);
         const std::string pipeNotify = Path(pipePath, FIFO_NOTIFY).toString();
         if ((writerNotify = open(pipeNotify.c_str(), O_WRONLY) ) < 0)
         {
@@ -852,9 +1106,20 @@ void lokit_main(const std::string& childRoot,
         jailLOInstallation.makeDirectory();
         File(jailLOInstallation).createDirectory();
 
-        // Copy (link) LO installation and other necessary files into it from the template.
-        linkOrCopy(sysTemplate, jailPath);
-        linkOrCopy(loTemplate, jailLOInstallation);
+        // Mount, or else copy (link), LO installation and other necessary
+        // files into it from the template.
+        const auto jailStart = std::chrono::steady_clock::now();
+        const bool mounted = bindMountJail(sysTemplate, loTemplate, jailPath, jailLOInstallation);
+        if (!mounted)
+        {
+            linkOrCopy(sysTemplate, jailPath);
+            linkOrCopy(loTemplate, jailLOInstallation);
+        }
+
+        Log::info() << "Jail set up by " << (mounted ? "bind mounting" : "linking") << " in "
+                    << std::chrono::duration_cast<std::chrono::milliseconds>(
+                           std::chrono::steady_clock::now() - jailStart).count()
+                    << " ms." << Log::end;
 
         // We need this because sometimes the hostname is not resolved
         const std::vector<std::string> networkFiles = {"/etc/host.conf", "/etc/hosts", "/etc/nsswitch.conf", "/etc/resolv.conf"};
@@ -899,6 +1164,7 @@ void lokit_main(const std::string& childRoot,
         dropCapability(CAP_SYS_CHROOT);
         dropCapability(CAP_MKNOD);
         dropCapability(CAP_FOWNER);
+        dropCapability(CAP_SYS_ADMIN);
 
         loKit = lok_init_2(instdir_path.c_str(), "file:///user");
         if (loKit == nullptr)
@@ -907,105 +1173,71 @@ void lokit_main(const std::string& childRoot,
             std::exit(Application::EXIT_SOFTWARE);
         }
 
+        // Load an empty document of the family the kit is for, and drop
+        // it: what its module loads and initializes stays, for the first
+        // real document not to pay for it.
+        const char* factoryUrl = DocumentFamily::getFactoryUrl(family);
+        if (factoryUrl != nullptr)
+        {
+            const auto warmStart = std::chrono::steady_clock::now();
+            LibreOfficeKitDocument* warmDocument = loKit->pClass->documentLoad(loKit, factoryUrl);
+            if (warmDocument != nullptr)
+            {
+                warmDocument->pClass->destroy(warmDocument);
+                Log::info() << "Warmed up for " << DocumentFamily::toName(family) << " documents in "
+                            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                                   std::chrono::steady_clock::now() - warmStart).count()
+                            << " ms." << Log::end;
+            }
+            else
+            {
+                Log::warn(std::string("Failed to warm up for ") + DocumentFamily::toName(family) + " documents.");
+            }
+        }
+
         Log::info("loolkit [" + std::to_string(Process::id()) + "] is ready.");
 
-        std::string response;
-        std::string message;
+        // For the broker to know how long a kit takes to be ready.
+        ControlChannel::Message ready;
+        ready.type = ControlChannel::Type::Ready;
+        ready.pid = Process::id();
+        if (!channel.send(ready))
+            Log::error("Error sending ready to broker.");
+
+        // The sequence number of the last request taken, and the URL the
+        // broker was last told of.
+        uint32_t lastSequence = 0;
+        std::string hostedUrl;
+        auto lastActivityReport = std::chrono::steady_clock::now();
+        auto lastMemoryReport = std::chrono::steady_clock::time_point();
+        bool unloadRequested = false;
 
         while (!TerminationFlag)
         {
-            if (start == end)
+            if (channel.poll(POLL_TIMEOUT_MS))
             {
-                pollPipeBroker.fd = readerBroker;
-                pollPipeBroker.events = POLLIN;
-                pollPipeBroker.revents = 0;
-
-                ready = poll(&pollPipeBroker, 1, POLL_TIMEOUT_MS);
-                if (ready == 0)
-                {
-                    // time out maintenance
-                    for (auto it = _documents.cbegin(); it != _documents.cend(); )
-                    {
-                        it = (it->second->canDiscard() ? _documents.erase(it) : ++it);
-                    }
-
-                    if (isDirtyKit && _documents.empty())
-                        TerminationFlag = true;
-                }
-                else
-                if (ready < 0)
-                {
-                    Log::error("Failed to poll pipe [" + pipe + "].");
-                    continue;
-                }
-                else
-                if (pollPipeBroker.revents & (POLLIN | POLLPRI))
+                ControlChannel::Message request;
+                const int received = channel.receive(request);
+                if (received < 0)
                 {
-                    bytes = Util::readFIFO(readerBroker, buffer, sizeof(buffer));
-                    if (bytes < 0)
-                    {
-                        start = end = nullptr;
-                        Log::error("Error reading message from pipe [" + pipe + "].");
-                        continue;
-                    }
-                    start = buffer;
-                    end = buffer + bytes;
-                }
-                else
-                if (pollPipeBroker.revents & (POLLERR | POLLHUP))
-                {
-                    Log::error("Broken pipe [" + pipe + "] with broker.");
+                    Log::error("Control channel with broker closed.");
                     break;
                 }
-            }
-
-            if (start != end)
-            {
-                char byteChar = *start++;
-                while (start != end && byteChar != '\r' && byteChar != '\n')
+                else if (received > 0)
                 {
-                    message += byteChar;
-                    byteChar = *start++;
-                }
+                    Log::trace() << "Recv: type " << static_cast<int>(request.type)
+                                 << ", #" << request.sequence << Log::end;
+                    lastSequence = request.sequence;
 
-                if (byteChar == '\r' && *start == '\n')
-                {
-                    start++;
-                    StringTokenizer tokens(message, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
-                    response = std::to_string(Process::id()) + " ";
-
-                    Log::trace("Recv: " + message);
-
-                    for (auto it = _documents.cbegin(); it != _documents.cend(); )
-                    {
-                        it = (it->second->canDiscard() ? _documents.erase(it) : ++it);
-                    }
+                    ControlChannel::Message response;
+                    response.sequence = request.sequence;
+                    response.pid = Process::id();
 
-                    if (isDirtyKit && _documents.empty())
+                    if (request.type == ControlChannel::Type::CreateSession)
                     {
-                        TerminationFlag = true;
-                        response += "down \r\n";
-                    }
-                    else if (tokens[0] == "query" && tokens.count() > 1)
-                    {
-                        if (tokens[1] == "url")
-                        {
-                            if (_documents.empty())
-                            {
-                                response += "empty \r\n";
-                            }
-                            else
-                            {
-                                // We really only support single URL hosting.
-                                response += _documents.cbegin()->first + "\r\n";
-                            }
-                        }
-                    }
-                    else if (tokens[0] == "thread")
-                    {
-                        const std::string& sessionId = tokens[1];
+                        const std::string& sessionId = request.session;
                         const unsigned intSessionId = Util::decodeId(sessionId);
-                        const std::string& url = tokens[2];
+                        const std::string& url = request.url;
 
                         Log::debug("Thread request for session [" + sessionId + "], url: [" + url + "].");
                         auto it = _documents.lower_bound(url);
@@ -1014,27 +1246,117 @@ void lokit_main(const std::string& childRoot,
 
                         it->second->createSession(sessionId, intSessionId);
                         isDirtyKit = true;
-                        response += "ok \r\n";
+                        response.type = ControlChannel::Type::SessionCreated;
+                        response.session = sessionId;
+                    }
+                    else if (request.type == ControlChannel::Type::Unload)
+                    {
+                        // No reply: the broker learns of it as we go down.
+                        Log::info("Broker is short of memory, unloading.");
+                        unloadRequested = true;
                     }
                     else
                     {
-                        response += "bad \r\n";
+                        response.type = ControlChannel::Type::Bad;
                     }
 
-                    Util::writeFIFO(writerBroker, response);
+                    if (!unloadRequested)
+                    {
+                        if (!channel.send(response))
+                            Log::error("Error sending reply to broker.");
+
+                        Log::trace() << "KitToBroker: type " << static_cast<int>(response.type)
+                                     << ", #" << response.sequence << Log::end;
+                    }
+                }
+            }
 
-                    // Don't log the CR LF at end
-                    assert(response.length() > 2);
-                    assert(response[response.length()-1] == '\n');
-                    assert(response[response.length()-2] == '\r');
-                    Log::trace("KitToBroker: " + response.substr(0, response.length()-2));
-                    message.clear();
+            for (auto it = _documents.cbegin(); it != _documents.cend(); )
+            {
+                if (it->second->canDiscard())
+                {
+                    it = _documents.erase(it);
                 }
+                else if ((unloadRequested || it->second->isIdle()) && !it->second->canUnload())
+                {
+                    // A copy, of a WOPI document say, is written back by the master on
+                    // save only; the broker picks another document the next time.
+                    if (unloadRequested)
+                        Log::warn("Not unloading document [" + it->first + "], it is a copy of its storage.");
+                    ++it;
+                }
+                else if ((unloadRequested || it->second->isIdle()) && it->second->save())
+                {
+                    // The sessions end with the document; the clients may
+                    // load it again.
+                    Log::info("Unloading " + std::string(unloadRequested ? "" : "idle ") +
+                              "document [" + it->first + "].");
+                    it = _documents.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+
+            unloadRequested = false;
+
+            // The broker isn't asking, it is told of what changes.
+            if (isDirtyKit && _documents.empty())
+            {
+                TerminationFlag = true;
+            }
+            else if (!_documents.empty() && _documents.cbegin()->first != hostedUrl)
+            {
+                // We really only support single URL hosting.
+                hostedUrl = _documents.cbegin()->first;
+
+                ControlChannel::Message state;
+                state.type = ControlChannel::Type::Hosting;
+                state.sequence = lastSequence;
+                state.pid = Process::id();
+                state.url = hostedUrl;
+                if (!channel.send(state))
+                    Log::error("Error sending state to broker.");
+            }
+
+            // For the broker to unload the least recently active documents
+            // first, when short of memory.
+            const auto now = std::chrono::steady_clock::now();
+            if (!_documents.empty() && now - lastActivityReport >= ActivityReportInterval)
+            {
+                const auto sinceReport = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastActivityReport);
+                if (_documents.cbegin()->second->getInactivityMS() < sinceReport.count())
+                {
+                    ControlChannel::Message active;
+                    active.type = ControlChannel::Type::Active;
+                    active.sequence = lastSequence;
+                    active.pid = Process::id();
+                    active.url = hostedUrl;
+                    if (!channel.send(active))
+                        Log::error("Error sending activity to broker.");
+
+                    lastActivityReport = now;
+                }
+            }
+
+            // The master can't read our smaps, we aren't dumpable.
+            if (!_documents.empty() && now - lastMemoryReport >= MemoryReportInterval)
+            {
+                const std::string report = ProcessMemory::getReport();
+                if (!report.empty())
+                    Util::writeFIFO(writerNotify, report + " \r\n");
+
+                lastMemoryReport = now;
             }
         }
 
-        close(writerBroker);
-        close(readerBroker);
+        // Whatever the reason, nothing more is to be routed here.
+        ControlChannel::Message down;
+        down.type = ControlChannel::Type::Down;
+        down.sequence = lastSequence;
+        down.pid = Process::id();
+        channel.send(down);
     }
     catch (const Exception& exc)
     {
@@ -1084,7 +1406,8 @@ int main(int argc, char** argv)
     std::string sysTemplate;
     std::string loTemplate;
     std::string loSubPath;
-    std::string pipe;
+    int controlFd = -1;
+    DocumentFamily::Type family = DocumentFamily::Type::Generic;
 
     for (int i = 1; i < argc; ++i)
     {
@@ -1111,10 +1434,39 @@ int main(int argc, char** argv)
             eq = std::strchr(cmd, '=');
             loSubPath = std::string(eq+1);
         }
-        else if (std::strstr(cmd, "--pipe=") == cmd)
+        else if (std::strstr(cmd, "--controlfd=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            controlFd = std::stoi(std::string(eq+1));
+        }
+        else if (std::strstr(cmd, "--idletimeout=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            IdleTimeoutSecs = std::stoi(std::string(eq+1));
+        }
+        else if (std::strstr(cmd, "--callbackflushms=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            ChildProcessSession::setCallbackFlushMS(std::stoi(std::string(eq+1)));
+        }
+        else if (std::strstr(cmd, "--tileencoder=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            TileEncoder::configure(std::string(eq+1));
+        }
+        else if (std::strcmp(cmd, "--hugepages") == 0)
+        {
+            ChildProcessSession::setUseHugePages(true);
+        }
+        else if (std::strstr(cmd, "--kittransport=") == cmd)
+        {
+            eq = std::strchr(cmd, '=');
+            UseTcpTransport = (std::strcmp(eq+1, "tcp") == 0);
+        }
+        else if (std::strstr(cmd, "--family=") == cmd)
         {
             eq = std::strchr(cmd, '=');
-            pipe = std::string(eq+1);
+            family = DocumentFamily::fromName(std::string(eq+1));
         }
         else if (std::strstr(cmd, "--clientport=") == cmd)
         {
@@ -1129,13 +1481,13 @@ int main(int argc, char** argv)
         std::exit(Application::EXIT_SOFTWARE);
     }
 
-    if (pipe.empty())
+    if (controlFd < 0)
     {
-        Log::error("Error: --pipe is empty");
+        Log::error("Error: --controlfd is missing");
         std::exit(Application::EXIT_SOFTWARE);
     }
 
-    lokit_main(childRoot, sysTemplate, loTemplate, loSubPath, pipe);
+    lokit_main(childRoot, sysTemplate, loTemplate, loSubPath, controlFd, family);
 
     return Application::EXIT_OK;
 }
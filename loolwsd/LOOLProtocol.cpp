@@ -7,18 +7,28 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/.
  */
 
+#include <sys/socket.h>
+
 #include <cassert>
+#include <cstdint>
 #include <cstring>
-#include <map>
+#include <limits>
 #include <string>
+#include <vector>
 
 #define LOK_USE_UNSTABLE_API
 #include <LibreOfficeKit/LibreOfficeKitEnums.h>
 
+#include <Poco/Net/WebSocket.h>
 #include <Poco/StringTokenizer.h>
 
 #include "LOOLProtocol.hpp"
+#include "ReceiveBuffer.hpp"
+#include "TileHeader.hpp"
+#include "WebSocketDecoder.hpp"
 
+using Poco::Net::WebSocket;
+using Poco::Net::WebSocketException;
 using Poco::StringTokenizer;
 
 namespace LOOLProtocol
@@ -45,75 +55,31 @@ namespace LOOLProtocol
 
     bool stringToInteger(const std::string& input, int& value)
     {
-        try
-        {
-            value = std::stoi(input);
-        }
-        catch (std::invalid_argument&)
-        {
-            return false;
-        }
-
-        return true;
+        return Tokenizer::parseInteger(StringView(input.data(), input.size()), value);
     }
 
     bool getTokenInteger(const std::string& token, const std::string& name, int& value)
     {
-        size_t nextIdx;
-        try
-        {
-            if (token.size() < name.size() + 2 ||
-                token.substr(0, name.size()) != name ||
-                token[name.size()] != '=' ||
-                (value = std::stoi(token.substr(name.size() + 1), &nextIdx), false) ||
-                nextIdx != token.size() - name.size() - 1)
-            {
-                throw std::invalid_argument("bah");
-            }
-        }
-        catch (std::invalid_argument&)
-        {
-            return false;
-        }
+        return Tokenizer::getInteger(StringView(token.data(), token.size()), name.c_str(), value);
+    }
 
-        return true;
+    bool getTokenInteger(const StringView token, const char* name, int& value)
+    {
+        return Tokenizer::getInteger(token, name, value);
     }
 
     bool getTokenString(const std::string& token, const std::string& name, std::string& value)
     {
-        try
-        {
-            if (token.size() < name.size() + 2 ||
-                token.substr(0, name.size()) != name ||
-                token[name.size()] != '=')
-            {
-                throw std::invalid_argument("bah");
-            }
-        }
-        catch (std::invalid_argument&)
-        {
-            return false;
-        }
-        value = token.substr(name.size() + 1);
-        return true;
+        return getTokenString(StringView(token.data(), token.size()), name.c_str(), value);
     }
 
-    bool getTokenKeyword(const std::string& token, const std::string& name, const std::map<std::string, int>& map, int& value)
+    bool getTokenString(const StringView token, const char* name, std::string& value)
     {
-        if (token.size() < name.size() + 2 ||
-            token.substr(0, name.size()) != name ||
-            token[name.size()] != '=')
-            return false;
-
-        std::string t = token.substr(name.size()+1);
-        if (t[0] == '\'' && t[t.size()-1] == '\'')
-            t = t.substr(1, t.size()-2);
-
-        auto p = map.find(t);
-        if (p == map.cend())
+        StringView text;
+        if (!Tokenizer::getValue(token, name, text))
             return false;
 
-        value = p->second;
+        value.assign(text.data(), text.size());
         return true;
     }
 
@@ -167,12 +133,76 @@ namespace LOOLProtocol
         if (message == nullptr || length <= 0)
             return "";
 
+        // Binary tile messages are logged in their text form.
+        TileHeader header;
+        if (TileHeader::isBinary(message, length) && header.parse(message, length))
+        {
+            std::vector<char> text;
+            header.writeText(text);
+            if (text.back() == '\n')
+                text.pop_back();
+
+            return "'" + std::string(text.begin(), text.end()) + "'" +
+                   (header.payloadOffset < static_cast<size_t>(length) ? "..." : "");
+        }
+
         const auto firstLine = getFirstLine(message, length);
         std::string result = "'" + firstLine + "'";
         if (firstLine.size() < static_cast<std::string::size_type>(length))
             result += "...";
         return result;
     }
+
+    namespace
+    {
+        /// Peeks at the header of the next frame on ws, without consuming
+        /// it, to grow buffer to the size of its payload. Gives up quietly
+        /// if the header isn't there; receiveFrame() then reports why.
+        void reserveForNextFrame(WebSocket& ws, ReceiveBuffer& buffer)
+        {
+            const int fd = ws.impl()->sockfd();
+            char header[10];
+            if (recv(fd, header, 2, MSG_PEEK | MSG_WAITALL) != 2)
+                return;
+
+            const size_t headerSize = WebSocketDecoder::getHeaderSize(header);
+            if (headerSize > 2 &&
+                recv(fd, header, headerSize, MSG_PEEK | MSG_WAITALL) != static_cast<ssize_t>(headerSize))
+            {
+                return;
+            }
+
+            const uint64_t length = WebSocketDecoder::getPayloadLength(header);
+            if (length > static_cast<uint64_t>(std::numeric_limits<int>::max()) || !buffer.reserve(length))
+            {
+                throw WebSocketException("Frame of " + std::to_string(length) + " bytes is over the limit.",
+                                         WebSocket::WS_ERR_PAYLOAD_TOO_BIG);
+            }
+        }
+    }
+
+    int receiveMessage(WebSocket& ws, ReceiveBuffer& buffer, int& flags)
+    {
+        // The previous message is handled by now.
+        buffer.shrink();
+
+        reserveForNextFrame(ws, buffer);
+        int n = ws.receiveFrame(buffer.data(), static_cast<int>(buffer.capacity()), flags);
+        if (n <= 0 || (flags & WebSocket::FRAME_OP_BITMASK) == WebSocket::FRAME_OP_CLOSE)
+            return n;
+
+        // Peers of protocol versions before 0.2 announce large messages.
+        const std::string firstLine = getFirstLine(buffer.data(), n);
+        StringTokenizer tokens(firstLine, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+        int size;
+        if (tokens.count() == 2 && tokens[0] == "nextmessage:" && getTokenInteger(tokens[1], "size", size) && size > 0)
+        {
+            reserveForNextFrame(ws, buffer);
+            n = ws.receiveFrame(buffer.data(), static_cast<int>(buffer.capacity()), flags);
+        }
+
+        return n;
+    }
 };
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
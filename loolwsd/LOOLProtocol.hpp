@@ -10,12 +10,21 @@
 #ifndef INCLUDED_LOOLPROTOCOL_HPP
 #define INCLUDED_LOOLPROTOCOL_HPP
 
+#include <cstddef>
 #include <map>
 #include <string>
+#include <utility>
 
 #define LOK_USE_UNSTABLE_API
 #include <LibreOfficeKit/LibreOfficeKitEnums.h>
 
+#include "Command.hpp"
+#include "Tokenizer.hpp"
+
+namespace Poco { namespace Net { class WebSocket; } }
+
+class ReceiveBuffer;
+
 namespace LOOLProtocol
 {
     // The frames sent from the client to the server are called
@@ -30,42 +39,21 @@ namespace LOOLProtocol
     // mouse events. And in fact, those are here part of the
     // "commands".
 
-    // Not sure if these enums will be needed
-    enum class Command
-    {
-        GETTEXTSELECTION,
-        KEY,
-        LOAD,
-        MOUSE,
-        RESETSELECTION,
-        SAVEAS,
-        SELECTGRAPHIC,
-        SELECTTEXT,
-        STATUS,
-        TILE,
-        UNO,
-    };
-
-    enum class Message
-    {
-        CHILD,
-        CURSOR_VISIBLE,
-        ERROR,
-        GRAPHIC_SELECTION,
-        HYPERLINK_CLICKED,
-        INVALIDATE_CURSOR,
-        INVALIDATE_TILES,
-        STATUS,
-        TEXT_SELECTION,
-        TEXT_SELECTION_END,
-        TEXT_SELECTION_START,
-        TILE,
-    };
-
     // Protocol Version Number.
     // See protocol.txt.
     constexpr unsigned ProtocolMajorVersionNumber = 0;
-    constexpr unsigned ProtocolMinorVersionNumber = 1;
+    constexpr unsigned ProtocolMinorVersionNumber = 4;
+    /// The first minor version whose receivers take the message size from
+    /// the WebSocket frame header, so that no "nextmessage:" is sent.
+    constexpr unsigned ProtocolNativeFramingMinorVersionNumber = 2;
+    /// The first minor version whose clients understand "batch:" messages.
+    constexpr unsigned ProtocolBatchMinorVersionNumber = 3;
+    /// The first minor version whose clients take tile messages in the
+    /// binary form of TileHeader.
+    constexpr unsigned ProtocolBinaryTileMinorVersionNumber = 4;
+    /// The first minor version whose clients understand "solidtile:",
+    /// older ones get single-colour tiles as PNG images.
+    constexpr unsigned ProtocolSolidTileMinorVersionNumber = 4;
 
     inline
     std::string GetProtocolVersion()
@@ -78,17 +66,33 @@ namespace LOOLProtocol
     // Negative numbers for error.
     std::tuple<int, int, std::string> ParseVersion(const std::string& version);
 
+    // These parse in place, without exceptions; see Tokenizer.
     bool stringToInteger(const std::string& input, int& value);
-	
+
     bool getTokenInteger(const std::string& token, const std::string& name, int& value);
+    bool getTokenInteger(StringView token, const char* name, int& value);
     bool getTokenString(const std::string& token, const std::string& name, std::string& value);
-    bool getTokenKeyword(const std::string& token, const std::string& name, const std::map<std::string, int>& map, int& value);
+    bool getTokenString(StringView token, const char* name, std::string& value);
+
+    template <size_t N>
+    bool getTokenKeyword(const std::string& token, const char* name,
+                         const std::pair<const char*, int> (&keywords)[N], int& value)
+    {
+        return Tokenizer::getKeyword(StringView(token.data(), token.size()), name, keywords, value);
+    }
 
     // Functions that parse messages. All return false if parsing fails
     bool parseStatus(const std::string& message, LibreOfficeKitDocumentType& type, int& nParts, int& currentPart, int& width, int& height);
 
     std::string getFirstLine(const char *message, int length);
     std::string getAbbreviatedMessage(const char *message, int length);
+
+    /// Receives the next message from ws into buffer, sized from the frame
+    /// header. Follows a "nextmessage: size=<byteSize>" frame of an older
+    /// peer to the frame it announces.
+    /// Returns the payload size as WebSocket::receiveFrame() does.
+    /// Throws WebSocketException if the message is over the maximum size.
+    int receiveMessage(Poco::Net::WebSocket& ws, ReceiveBuffer& buffer, int& flags);
 };
 
 #endif
@@ -34,6 +34,7 @@
 #include "LOOLProtocol.hpp"
 #include "LOOLSession.hpp"
 #include "TileCache.hpp"
+#include "TileHeader.hpp"
 #include "Util.hpp"
 
 using namespace LOOLProtocol;
@@ -44,6 +45,26 @@ using Poco::Net::WebSocket;
 using Poco::Path;
 using Poco::StringTokenizer;
 
+namespace
+{
+    /// Whether the message carries a PNG image after its first line.
+    bool isImageMessage(const char *buffer, const int length)
+    {
+        // Of the binary tile messages, only solid tiles come without one.
+        if (TileHeader::isBinary(buffer, length))
+            return buffer[0] != static_cast<char>(TileHeader::Type::Solid);
+
+        for (const char* prefix : { "tile:", "delta:", "renderfont:" })
+        {
+            const size_t size = std::strlen(prefix);
+            if (static_cast<size_t>(length) >= size && std::memcmp(buffer, prefix, size) == 0)
+                return true;
+        }
+
+        return false;
+    }
+}
+
 LOOLSession::LOOLSession(const std::string& id, const Kind kind,
                          std::shared_ptr<WebSocket> ws) :
     _kind(kind),
@@ -54,23 +75,29 @@ LOOLSession::LOOLSession(const std::string& id, const Kind kind,
     _isDocPasswordProvided(false),
     _isDocLoaded(false),
     _isDocPasswordProtected(false),
-    _disconnected(false)
+    _disconnected(false),
+    // Our child processes are as new as we are, only clients can be older.
+    _announceLargeMessages(kind == Kind::ToClient)
 {
-    // Only a post request can have a null ws.
-    if (_kind != Kind::ToClient)
-        assert(_ws);
-
+    // Only a post request, or a session to be given a channel, can have a null ws.
     setId(id);
 }
 
 LOOLSession::~LOOLSession()
 {
-    Util::shutdownWebSocket(_ws);
+    if (_deflater && _deflater->getInputBytes() > 0)
+    {
+        Log::info() << getName() << " compressed " << _deflater->getInputBytes() << " bytes of text into "
+                    << _deflater->getOutputBytes() << " ("
+                    << (100 * _deflater->getOutputBytes() / _deflater->getInputBytes()) << "%)." << Log::end;
+    }
+
+    shutdownWebSocket();
 }
 
 void LOOLSession::sendTextFrame(const std::string& text)
 {
-    if (!_ws)
+    if (!_ws && !_channel)
     {
         Log::error("Error: No socket to send " + getAbbreviatedMessage(text.c_str(), text.size()) + " to.");
         return;
@@ -80,18 +107,26 @@ void LOOLSession::sendTextFrame(const std::string& text)
 
     std::unique_lock<std::mutex> lock(_mutex);
     const int length = text.size();
-    if ( length > SMALL_MESSAGE_SIZE )
+    if (_announceLargeMessages && length > SMALL_MESSAGE_SIZE)
     {
         const std::string nextmessage = "nextmessage: size=" + std::to_string(length);
-        _ws->sendFrame(nextmessage.data(), nextmessage.size());
+        sendFrame(nextmessage.data(), nextmessage.size(), WebSocket::FRAME_TEXT);
+    }
+
+    if (_deflater && text.size() >= PerMessageDeflate::MinCompressedSize)
+    {
+        _deflater->compress(text.data(), text.size(), _compressed);
+        sendFrame(_compressed.data(), _compressed.size(),
+                  WebSocket::FRAME_TEXT | PerMessageDeflate::FrameFlagCompressed);
+        return;
     }
 
-    _ws->sendFrame(text.data(), length);
+    sendFrame(text.data(), length, WebSocket::FRAME_TEXT);
 }
 
 void LOOLSession::sendBinaryFrame(const char *buffer, int length)
 {
-    if (!_ws)
+    if (!_ws && !_channel)
     {
         Log::error("Error: No socket to send binary frame of " + std::to_string(length) + " bytes to.");
         return;
@@ -101,13 +136,96 @@ void LOOLSession::sendBinaryFrame(const char *buffer, int length)
 
     std::unique_lock<std::mutex> lock(_mutex);
 
-    if ( length > SMALL_MESSAGE_SIZE )
+    if (_announceLargeMessages && length > SMALL_MESSAGE_SIZE)
     {
         const std::string nextmessage = "nextmessage: size=" + std::to_string(length);
-        _ws->sendFrame(nextmessage.data(), nextmessage.size());
+        sendFrame(nextmessage.data(), nextmessage.size(), WebSocket::FRAME_TEXT);
     }
 
-    _ws->sendFrame(buffer, length, WebSocket::FRAME_BINARY);
+    // Most messages from the kit are forwarded as binary frames, only the
+    // images among them don't deflate any further.
+    if (_deflater && static_cast<size_t>(length) >= PerMessageDeflate::MinCompressedSize && !isImageMessage(buffer, length))
+    {
+        _deflater->compress(buffer, length, _compressed);
+        sendFrame(_compressed.data(), _compressed.size(),
+                  WebSocket::FRAME_BINARY | PerMessageDeflate::FrameFlagCompressed);
+        return;
+    }
+
+    sendFrame(buffer, length, WebSocket::FRAME_BINARY,
+              _outbound ? OutboundQueue::getTileKey(buffer, length) : std::string());
+}
+
+void LOOLSession::sendFrame(const char* data, const size_t size, const int flags, const std::string& tileKey)
+{
+    if (_channel)
+    {
+        // The master takes images out of the ring, if there is room.
+        TileRing::Descriptor descriptor;
+        if (_tileRing && isImageMessage(data, size) && _tileRing->write(data, size, descriptor))
+        {
+            _channel->send(reinterpret_cast<const char*>(&descriptor), sizeof(descriptor),
+                           flags | TileRing::FrameFlagShared);
+            return;
+        }
+
+        _channel->send(data, size, flags);
+        return;
+    }
+    else if (!_outbound)
+    {
+        _ws->sendFrame(data, size, flags);
+        return;
+    }
+
+    const bool overflowed = _outbound->getStats().overflowed;
+    if (!_outbound->push(OutboundQueue::makeFrame(flags, data, size), tileKey) &&
+        !overflowed && _outbound->getStats().overflowed)
+    {
+        Log::warn(getName() + ": Client doesn't keep up, dropping the connection.");
+    }
+}
+
+void LOOLSession::setDeflater(std::unique_ptr<PerMessageDeflate::Deflater> deflater)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _deflater = std::move(deflater);
+}
+
+void LOOLSession::setOutboundQueue(const std::shared_ptr<OutboundQueue>& outbound)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _outbound = outbound;
+}
+
+void LOOLSession::shutdownWebSocket()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_channel)
+        _channel->shutdown();
+    else if (_outbound)
+        _outbound->close();
+    else
+        Util::shutdownWebSocket(_ws);
+}
+
+void LOOLSession::setChannel(const std::shared_ptr<UnixChannel>& channel, std::unique_ptr<TileRing> tileRing)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _channel = channel;
+    _tileRing = std::move(tileRing);
+}
+
+void LOOLSession::setAnnounceLargeMessages(const bool announce)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _announceLargeMessages = announce;
+}
+
+std::unique_ptr<StringTokenizer> LOOLSession::tokenize(const char *buffer, int length)
+{
+    return std::unique_ptr<StringTokenizer>(new StringTokenizer(getFirstLine(buffer, length), " ",
+                                                                StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM));
 }
 
 void LOOLSession::parseDocOptions(const StringTokenizer& tokens, int& part, std::string& timestamp)
@@ -143,6 +261,11 @@ void LOOLSession::parseDocOptions(const StringTokenizer& tokens, int& part, std:
             _isDocPasswordProvided = true;
             ++offset;
         }
+        else if (tokens[i].find("tileencoder=") == 0)
+        {
+            _tileEncoderName = tokens[i].substr(strlen("tileencoder="));
+            ++offset;
+        }
     }
 
     if (tokens.count() > offset)
@@ -166,19 +289,24 @@ void LOOLSession::disconnect(const std::string& reason)
             else
                 sendTextFrame("disconnect");
             _disconnected = true;
-            Util::shutdownWebSocket(_ws);
+            shutdownWebSocket();
         }
     }
     catch (const IOException& exc)
     {
         Log::error("LOOLSession::disconnect: Exception: " + exc.displayText() + (exc.nested() ? " (" + exc.nested()->displayText() + ")" : ""));
     }
+    catch (const std::runtime_error& exc)
+    {
+        // From a UnixChannel.
+        Log::error(std::string("LOOLSession::disconnect: Exception: ") + exc.what());
+    }
 }
 
 bool LOOLSession::handleDisconnect(StringTokenizer& /*tokens*/)
 {
     _disconnected = true;
-    Util::shutdownWebSocket(_ws);
+    shutdownWebSocket();
     return false;
 }
 
@@ -17,6 +17,7 @@
 #include <mutex>
 #include <ostream>
 #include <set>
+#include <vector>
 
 #include <Poco/Net/WebSocket.h>
 #include <Poco/Buffer.h>
@@ -27,7 +28,11 @@
 #include <Poco/Types.h>
 
 #include "MessageQueue.hpp"
+#include "OutboundQueue.hpp"
+#include "PerMessageDeflate.hpp"
 #include "TileCache.hpp"
+#include "TileRing.hpp"
+#include "UnixChannel.hpp"
 
 class LOOLSession
 {
@@ -44,6 +49,20 @@ public:
 
     void sendTextFrame(const std::string& text);
 
+    /// Compresses the text messages with deflater from now on, once the
+    /// client agreed to permessage-deflate.
+    void setDeflater(std::unique_ptr<PerMessageDeflate::Deflater> deflater);
+
+    /// Queues the frames in outbound from now on, rather than writing
+    /// them to the socket and waiting for the client to take them.
+    void setOutboundQueue(const std::shared_ptr<OutboundQueue>& outbound);
+
+    /// Sends over channel rather than a WebSocket, which a session between
+    /// the master and a kit then doesn't have. The images go through
+    /// tileRing, if given, which the master has been sent.
+    void setChannel(const std::shared_ptr<UnixChannel>& channel,
+                    std::unique_ptr<TileRing> tileRing = nullptr);
+
     virtual bool getStatus(const char *buffer, int length) = 0;
 
     virtual bool getCommandValues(const char *buffer, int length, Poco::StringTokenizer& tokens) = 0;
@@ -52,6 +71,10 @@ public:
 
     bool handleInput(const char *buffer, int length);
 
+    /// Whether handling the next input may block for long, e.g. waiting
+    /// for a kit to load the document, rather than just forward it.
+    virtual bool mayBlock() const { return false; }
+
     /// Invoked when we want to disconnect a session.
     virtual void disconnect(const std::string& reason = "");
 
@@ -71,6 +94,17 @@ protected:
 
     void sendBinaryFrame(const char *buffer, int length);
 
+    /// Whether large messages are preceded by "nextmessage:", for peers
+    /// of protocol versions before 0.2. See protocol.txt.
+    void setAnnounceLargeMessages(bool announce);
+
+    /// Sends the close frame, after what is queued.
+    void shutdownWebSocket();
+
+    /// The Poco tokens of the first line, for the handlers that take them.
+    /// Commands are dispatched on a Tokenizer, which doesn't allocate.
+    static std::unique_ptr<Poco::StringTokenizer> tokenize(const char *buffer, int length);
+
     /// Parses the options of the "load" command, shared between MasterProcessSession::loadDocument() and ChildProcessSession::loadDocument().
     void parseDocOptions(const Poco::StringTokenizer& tokens, int& part, std::string& timestamp);
 
@@ -115,17 +149,31 @@ protected:
     /// Document options: a JSON string, containing options (rendering, also possibly load in the future).
     std::string _docOptions;
 
+    /// The tile encoder requested by the client, if any. See TileEncoder.
+    std::string _tileEncoderName;
+
 private:
 
     virtual bool _handleInput(const char *buffer, int length) = 0;
 
 private:
+    /// Writes a frame, queues it, or sends it over the channel; called with _mutex held. tileKey is
+    /// for OutboundQueue::Policy::Coalesce.
+    void sendFrame(const char* data, size_t size, int flags, const std::string& tileKey = std::string());
+
     /// A session ID specific to an end-to-end connection (from user to lokit).
     std::string _id;
     /// A readable name that identifies our peer and ID.
     std::string _name;
     /// True if we have been disconnected.
     bool _disconnected;
+    /// Guarded by _mutex, like sending.
+    bool _announceLargeMessages;
+    std::unique_ptr<PerMessageDeflate::Deflater> _deflater;
+    std::vector<char> _compressed;
+    std::shared_ptr<OutboundQueue> _outbound;
+    std::shared_ptr<UnixChannel> _channel;
+    std::unique_ptr<TileRing> _tileRing;
 
     std::mutex _mutex;
 };
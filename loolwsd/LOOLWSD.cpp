@@ -42,6 +42,7 @@ DEALINGS IN THE SOFTWARE.
 
 #include <errno.h>
 #include <locale.h>
+#include <poll.h>
 #include <unistd.h>
 
 #include <sys/types.h>
@@ -51,12 +52,17 @@ DEALINGS IN THE SOFTWARE.
 #include <ftw.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <sstream>
+#include <thread>
 
 #include <Poco/Exception.h>
 #include <Poco/File.h>
@@ -96,12 +102,17 @@ DEALINGS IN THE SOFTWARE.
 #include "Admin.hpp"
 #include "Auth.hpp"
 #include "ChildProcessSession.hpp"
+#include "ClientReactor.hpp"
 #include "Common.hpp"
 #include "LOOLProtocol.hpp"
 #include "LOOLSession.hpp"
 #include "LOOLWSD.hpp"
 #include "MasterProcessSession.hpp"
-#include "QueueHandler.hpp"
+#include "PerMessageDeflate.hpp"
+#include "ReceiveBuffer.hpp"
+#include "TileEncoder.hpp"
+#include "TileRing.hpp"
+#include "UnixChannel.hpp"
 #include "Util.hpp"
 
 using namespace LOOLProtocol;
@@ -149,8 +160,11 @@ using Poco::Util::Option;
 using Poco::Util::OptionSet;
 using Poco::Util::ServerApplication;
 
-// Document management mutex.
-std::mutex DocumentURI::DocumentURIMutex;
+// Document management mutexes.
+std::mutex DocumentURI::DocumentURIMutexes[DocumentURI::MutexCount];
+
+/// Owns the client WebSockets after the handshake, created in main().
+static std::shared_ptr<ClientReactor> Reactor;
 
 /// Handles the filename part of the convert-to POST request payload.
 class ConvertToPartHandler : public PartHandler
@@ -203,13 +217,12 @@ void SocketProcessor(std::shared_ptr<WebSocket> ws,
         int flags = 0;
         int n = 0;
         ws->setReceiveTimeout(0);
+        ReceiveBuffer buffer;
         do
         {
-            char buffer[200000]; //FIXME: Dynamic?
-
             if (ws->poll(waitTime, Socket::SELECT_READ))
             {
-                n = ws->receiveFrame(buffer, sizeof(buffer), flags);
+                n = receiveMessage(*ws, buffer, flags);
 
                 if ((flags & WebSocket::FRAME_OP_BITMASK) == WebSocket::FRAME_OP_PING)
                 {
@@ -218,7 +231,7 @@ void SocketProcessor(std::shared_ptr<WebSocket> ws,
                     // However Firefox (probably) or Node.js (possibly) doesn't
                     // like that and closes the socket when we do.
                     // Echoing the payload as a normal frame works with Firefox.
-                    ws->sendFrame(buffer, n, WebSocket::FRAME_FLAG_FIN | WebSocket::FRAME_OP_PONG);
+                    ws->sendFrame(buffer.data(), n, WebSocket::FRAME_FLAG_FIN | WebSocket::FRAME_OP_PONG);
                 }
                 else if ((flags & WebSocket::FRAME_OP_BITMASK) == WebSocket::FRAME_OP_PONG)
                 {
@@ -235,9 +248,7 @@ void SocketProcessor(std::shared_ptr<WebSocket> ws,
                 else if ((flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE)
                 {
                     assert(n > 0);
-                    const std::string firstLine = getFirstLine(buffer, n);
-                    StringTokenizer tokens(firstLine, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
-                    int size;
+                    const std::string firstLine = getFirstLine(buffer.data(), n);
 
                     if (firstLine == "eof")
                     {
@@ -248,15 +259,21 @@ void SocketProcessor(std::shared_ptr<WebSocket> ws,
                     if ((flags & WebSocket::FrameFlags::FRAME_FLAG_FIN) != WebSocket::FrameFlags::FRAME_FLAG_FIN)
                     {
                         // One WS message split into multiple frames.
-                        std::vector<char> message(buffer, buffer + n);
+                        std::vector<char> message(buffer.data(), buffer.data() + n);
                         while (true)
                         {
-                            n = ws->receiveFrame(buffer, sizeof(buffer), flags);
+                            n = receiveMessage(*ws, buffer, flags);
 
                             if (n <= 0 || (flags & WebSocket::FRAME_OP_BITMASK) == WebSocket::FRAME_OP_CLOSE)
                                 break;
 
-                            message.insert(message.end(), buffer, buffer + n);
+                            if (message.size() + n > ReceiveBuffer::getMaxMessageSize())
+                            {
+                                throw WebSocketException("Fragmented message is over the limit.",
+                                                         WebSocket::WS_ERR_PAYLOAD_TOO_BIG);
+                            }
+
+                            message.insert(message.end(), buffer.data(), buffer.data() + n);
                             if ((flags & WebSocket::FrameFlags::FRAME_FLAG_FIN) == WebSocket::FrameFlags::FRAME_FLAG_FIN)
                             {
                                 // No more frames: invoke the handler. Assume
@@ -267,26 +284,11 @@ void SocketProcessor(std::shared_ptr<WebSocket> ws,
                             }
                         }
                     }
-                    else if (tokens.count() == 2 &&
-                             tokens[0] == "nextmessage:" && getTokenInteger(tokens[1], "size", size) && size > 0)
-                    {
-                        // Check if it is a "nextmessage:" and in that case read the large
-                        // follow-up message separately, and handle that only.
-
-                        char largeBuffer[size];     //FIXME: Security risk! Flooding may segfault us.
-
-                        n = ws->receiveFrame(largeBuffer, size, flags);
-                        if (n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE && !handler(largeBuffer, n, false))
-                        {
-                            Log::info("Socket handler flagged for finishing.");
-                            break;
-                        }
-                    }
                     else if (firstLine.size() == static_cast<std::string::size_type>(n))
                     {
                         handler(firstLine.c_str(), firstLine.size(), true);
                     }
-                    else if (!handler(buffer, n, false))
+                    else if (!handler(buffer.data(), n, false))
                     {
                         Log::info("Socket handler flagged for finishing.");
                         break;
@@ -505,41 +507,30 @@ private:
         // request.getCookies(cookies);
         // Log::info("Cookie: " + cookies.get("PHPSESSID", ""));
 
+        // The WebSocket handshake sends our headers along.
+        PerMessageDeflate::Parameters deflateParameters;
+        std::string extension;
+        const bool deflate = (!LOOLWSD::NoCompression && request.has("Sec-WebSocket-Extensions") &&
+                              PerMessageDeflate::negotiate(request.get("Sec-WebSocket-Extensions"),
+                                                           deflateParameters, extension));
+        if (deflate)
+            response.set("Sec-WebSocket-Extensions", extension);
+
         auto ws = std::make_shared<WebSocket>(request, response);
         auto session = std::make_shared<MasterProcessSession>(id, LOOLSession::Kind::ToClient, ws);
 
-        // For ToClient sessions, we store incoming messages in a queue and have a separate
-        // thread that handles them. This is so that we can empty the queue when we get a
-        // "canceltiles" message.
-        BasicTileQueue queue;
-        QueueHandler handler(queue, session, "wsd_queue_" + session->getId());
-
-        Thread queueHandlerThread;
-        queueHandlerThread.start(handler);
-
-        SocketProcessor(ws, response, [&session, &queue](const char* data, const int size, const bool singleLine)
-            {
-                // FIXME: There is a race here when a request A gets in the queue and
-                // is processed _after_ a later request B, because B gets processed
-                // synchronously and A is waiting in the queue thread.
-                // The fix is to push everything into the queue
-                // (i.e. change MessageQueue to vector<char>).
-                const std::string firstLine = getFirstLine(data, size);
-                if (singleLine || firstLine.find("paste") == 0)
-                {
-                    queue.put(std::string(data, size));
-                    return true;
-                }
-                else
-                {
-                    return session->handleInput(data, size);
-                }
-            });
+        std::unique_ptr<PerMessageDeflate::Inflater> inflater;
+        if (deflate)
+        {
+            Log::debug("Session [" + id + "] uses " + extension + ".");
+            session->setDeflater(std::unique_ptr<PerMessageDeflate::Deflater>(new PerMessageDeflate::Deflater(deflateParameters)));
+            inflater.reset(new PerMessageDeflate::Inflater(deflateParameters));
+        }
 
-        Log::info("Get request processor for session [" + id + "] finished. Clearing and joining the queue.");
-        queue.clear();
-        queue.put("eof");
-        queueHandlerThread.join();
+        // The reactor reads the socket from now on and runs the session on a worker,
+        // so this thread is free for the next request.
+        Reactor->add(ws, session, std::move(inflater));
+        Log::info("Get request processor for session [" + id + "] handed the socket over.");
     }
 
 public:
@@ -635,6 +626,193 @@ public:
     }
 };
 
+/// Handle prisoners connecting over the Unix socket instead, each on its
+/// own thread as PrisonerRequestHandler.
+class PrisonerChannelListener : public Runnable
+{
+public:
+    explicit PrisonerChannelListener(const int listenFd) :
+        _listenFd(listenFd),
+        _handlers(0)
+    {
+    }
+
+    ~PrisonerChannelListener()
+    {
+        close(_listenFd);
+    }
+
+    void run() override
+    {
+        static const std::string thread_name = "prison_listen";
+
+        if (prctl(PR_SET_NAME, reinterpret_cast<unsigned long>(thread_name.c_str()), 0, 0, 0) != 0)
+            Log::error("Cannot set thread name to " + thread_name + ".");
+
+        Log::debug("Thread [" + thread_name + "] started.");
+
+        while (!TerminationFlag)
+        {
+            pollfd pfd = { _listenFd, POLLIN, 0 };
+            if (poll(&pfd, 1, POLL_TIMEOUT_MS) <= 0)
+                continue;
+
+            auto channel = UnixChannel::accept(_listenFd);
+            if (!channel)
+            {
+                Log::warn("Rejected a connection on the Unix socket.", true);
+                continue;
+            }
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                ++_handlers;
+            }
+
+            std::thread([this, channel]()
+                {
+                    handle(channel);
+
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    --_handlers;
+                    _handlersCV.notify_all();
+                }).detach();
+        }
+
+        // The sessions forward to the clients, so they end first.
+        std::unique_lock<std::mutex> lock(_mutex);
+        _handlersCV.wait(lock, [this]() { return _handlers == 0; });
+
+        Log::debug("Thread [" + thread_name + "] finished.");
+    }
+
+private:
+    void handle(const std::shared_ptr<UnixChannel>& channel)
+    {
+        std::string thread_name = "prison_ux_";
+        try
+        {
+            // The first message is the URI the kit would request over TCP.
+            ReceiveBuffer buffer;
+            int flags = 0;
+            const int n = (channel->poll(CHILD_TIMEOUT_SECS * 1000) ? channel->receive(buffer, flags) : 0);
+            const std::string uri(buffer.data(), std::max(n, 0));
+            if (uri.find(LOOLWSD::CHILD_URI) != 0)
+            {
+                Log::error("Unexpected request on the Unix socket [" + uri + "].");
+                return;
+            }
+
+            const auto id = uri.substr(LOOLWSD::CHILD_URI.size());
+            thread_name += id;
+
+            if (prctl(PR_SET_NAME, reinterpret_cast<unsigned long>(thread_name.c_str()), 0, 0, 0) != 0)
+                Log::error("Cannot set thread name to " + thread_name + ".");
+
+            Log::debug("Thread [" + thread_name + "] started.");
+
+            auto session = std::make_shared<MasterProcessSession>(id, LOOLSession::Kind::ToPrisoner, nullptr);
+            session->setChannel(channel);
+
+            ChannelProcessor(*channel, buffer, [&session](const char* data, const int size)
+                {
+                    return session->handleInput(data, size);
+                });
+        }
+        catch (const Exception& exc)
+        {
+            Log::error() << "PrisonerChannelListener::handle: Exception: " << exc.displayText()
+                         << (exc.nested() ? " (" + exc.nested()->displayText() + ")" : "")
+                         << Log::end;
+        }
+        catch (const std::exception& exc)
+        {
+            Log::error(std::string("PrisonerChannelListener::handle: Exception: ") + exc.what());
+        }
+        catch (...)
+        {
+            Log::error("PrisonerChannelListener::handle: Unexpected exception");
+        }
+
+        Log::debug("Thread [" + thread_name + "] finished.");
+    }
+
+    /// Like SocketProcessor, for a kit's UnixChannel. Tiles in the kit's
+    /// TileRing are handled where they are.
+    static void ChannelProcessor(UnixChannel& channel, ReceiveBuffer& buffer,
+                                 std::function<bool(const char* data, const int size)> handler)
+    {
+        std::unique_ptr<TileRing> tileRing;
+        int flags = 0;
+        while (!TerminationFlag)
+        {
+            if (!channel.poll(POLL_TIMEOUT_MS))
+                continue;
+
+            int n = channel.receive(buffer, flags);
+            if ((n <= 0 && (flags & TileRing::FrameFlagRing) == 0) ||
+                (flags & WebSocket::FRAME_OP_BITMASK) == WebSocket::FRAME_OP_CLOSE)
+            {
+                Log::debug("Kit closed the Unix channel.");
+                break;
+            }
+
+            if (flags & TileRing::FrameFlagRing)
+            {
+                tileRing = TileRing::map(channel.takeReceivedFd());
+                if (!tileRing)
+                {
+                    Log::error("Invalid shared memory from the kit.");
+                    break;
+                }
+
+                Log::debug("Kit shares " + std::to_string(tileRing->getCapacity()) + " bytes of memory for tiles.");
+                continue;
+            }
+
+            const char* data = buffer.data();
+            TileRing::Descriptor descriptor = {};
+            if (flags & TileRing::FrameFlagShared)
+            {
+                if (tileRing && static_cast<size_t>(n) == sizeof(descriptor))
+                {
+                    std::memcpy(&descriptor, buffer.data(), sizeof(descriptor));
+                    data = tileRing->read(descriptor);
+                }
+
+                if (data == buffer.data() || data == nullptr)
+                {
+                    Log::error("Invalid tile descriptor from the kit.");
+                    break;
+                }
+
+                n = descriptor.size;
+            }
+
+            if (getFirstLine(data, n) == "eof")
+            {
+                Log::info("Received EOF. Finishing.");
+                break;
+            }
+
+            const bool keep = handler(data, n);
+            if (flags & TileRing::FrameFlagShared)
+                tileRing->release(descriptor);
+
+            if (!keep)
+            {
+                Log::info("Socket handler flagged for finishing.");
+                break;
+            }
+        }
+    }
+
+    const int _listenFd;
+    std::mutex _mutex;
+    std::condition_variable _handlersCV;
+    size_t _handlers;
+};
+
 template <class RequestHandler>
 class RequestHandlerFactory: public HTTPRequestHandlerFactory
 {
@@ -674,14 +852,14 @@ public:
         _ws.setReceiveTimeout(0);
         try
         {
+            ReceiveBuffer buffer;
             do
             {
-                char buffer[200000];
-                n = _ws.receiveFrame(buffer, sizeof(buffer), flags);
+                n = receiveMessage(_ws, buffer, flags);
                 if (n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE)
                 {
                     Log::trace() << "Client got " << n << " bytes: "
-                                 << getAbbreviatedMessage(buffer, n) << Log::end;
+                                 << getAbbreviatedMessage(buffer.data(), n) << Log::end;
                 }
             }
             while (n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE);
@@ -750,7 +928,19 @@ std::string LOOLWSD::ChildRoot;
 std::string LOOLWSD::LoSubPath = "lo";
 
 int LOOLWSD::NumPreSpawnedChildren = 10;
+int LOOLWSD::MaxPreSpawnedChildren = 40;
+int LOOLWSD::IdleTimeoutSecs = 0;
+int LOOLWSD::CallbackFlushMS = 5;
+bool LOOLWSD::UseHugePages = false;
+bool LOOLWSD::KitUsesTcp = false;
+double LOOLWSD::MemoryStallThreshold = 0;
+double LOOLWSD::MemoryUsageThreshold = 0;
+int LOOLWSD::NumClientWorkers = 0;
+int LOOLWSD::NumLoadWorkers = 16;
 bool LOOLWSD::DoTest = false;
+bool LOOLWSD::NoCompression = false;
+size_t LOOLWSD::OutboundLimit = 16 * 1024 * 1024;
+OutboundQueue::Policy LOOLWSD::OutboundPolicy = OutboundQueue::Policy::Coalesce;
 const std::string LOOLWSD::CHILD_URI = "/loolws/child/";
 const std::string LOOLWSD::PIDLOG = "/tmp/loolwsd.pid";
 const std::string LOOLWSD::FIFO_PATH = "pipe";
@@ -825,6 +1015,74 @@ void LOOLWSD::defineOptions(OptionSet& optionSet)
                         .repeatable(false)
                         .argument("number"));
 
+    optionSet.addOption(Option("maxprespawns", "", "Number of child processes up to which those started in advance grow, as documents are opened faster (default: 40).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("number"));
+
+    optionSet.addOption(Option("idletimeout", "", "Seconds after which a document nobody worked on is saved and unloaded, if its edits can be saved to storage (default: 0, never).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("seconds"));
+
+    optionSet.addOption(Option("callbackflushms", "", "Milliseconds for which the callback messages of a burst are collected, to be sent to the client at once (default: 5, 0 to send each right away).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("ms"));
+
+    optionSet.addOption(Option("tileencoder", "", "Tile encoders by document type, as <backend>[:<preset>] entries, e.g. png:fast,spreadsheet=deflate:fastest; the backend is png or deflate, the preset default, fast, fastest, small or a zlib level 0-9 (default: png).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("encoders"));
+
+    optionSet.addOption(Option("hugepages", "", "Advise the kernel to back large tile pixmaps with transparent huge pages.")
+                        .required(false)
+                        .repeatable(false));
+
+    optionSet.addOption(Option("kittransport", "", "How child processes connect to the server: 'unix' by its Unix domain socket, falling back to TCP when unavailable, or 'tcp' by a WebSocket (default: unix).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("transport"));
+
+    optionSet.addOption(Option("memorystall", "", "Percentage of the time processes may stall on memory before documents are saved and unloaded, the least recently worked on first, if their edits can be saved to storage (default: 0, never).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("percent"));
+
+    optionSet.addOption(Option("memoryusage", "", "Percentage of the memory limit of the cgroup which may be used before documents are saved and unloaded, the least recently worked on first, if their edits can be saved to storage (default: 0, never).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("percent"));
+
+    optionSet.addOption(Option("clientworkers", "", "Number of threads handling the messages of all the clients (default: twice the number of CPUs, at least 4).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("number"));
+
+    optionSet.addOption(Option("loadworkers", "", "Number of threads handling the clients whose documents are opening, which wait for a kit and the document to be copied in (default: 16).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("number"));
+
+    optionSet.addOption(Option("maxmessagesize", "", "Largest message accepted from a client or a child process, in bytes.")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("bytes"));
+
+    optionSet.addOption(Option("nocompression", "", "Don't compress the messages to clients with permessage-deflate.")
+                        .required(false)
+                        .repeatable(false));
+
+    optionSet.addOption(Option("outboundlimit", "", "Bytes queued for a client that reads slowly before the outbound policy applies (default: " + std::to_string(OutboundLimit) + ").")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("bytes"));
+
+    optionSet.addOption(Option("outboundpolicy", "", "What to do with a client past the outbound limit: 'coalesce' drops its outdated tiles, disconnecting it at four times the limit, 'disconnect' disconnects it (default: coalesce).")
+                        .required(false)
+                        .repeatable(false)
+                        .argument("policy"));
+
     optionSet.addOption(Option("test", "", "Interactive testing.")
                         .required(false)
                         .repeatable(false));
@@ -858,6 +1116,51 @@ void LOOLWSD::handleOption(const std::string& optionName, const std::string& val
         LoSubPath = value;
     else if (optionName == "numprespawns")
         NumPreSpawnedChildren = std::stoi(value);
+    else if (optionName == "maxprespawns")
+        MaxPreSpawnedChildren = std::stoi(value);
+    else if (optionName == "idletimeout")
+        IdleTimeoutSecs = std::stoi(value);
+    else if (optionName == "callbackflushms")
+        CallbackFlushMS = std::stoi(value);
+    else if (optionName == "tileencoder")
+    {
+        if (!TileEncoder::configure(value))
+            throw Poco::Util::InvalidArgumentException("Unknown tile encoder: " + value);
+    }
+    else if (optionName == "hugepages")
+        UseHugePages = true;
+    else if (optionName == "kittransport")
+    {
+        if (value == "unix")
+            KitUsesTcp = false;
+        else if (value == "tcp")
+            KitUsesTcp = true;
+        else
+            throw Poco::Util::InvalidArgumentException("Unknown kit transport: " + value);
+    }
+    else if (optionName == "memorystall")
+        MemoryStallThreshold = std::stod(value);
+    else if (optionName == "memoryusage")
+        MemoryUsageThreshold = std::stod(value);
+    else if (optionName == "clientworkers")
+        NumClientWorkers = std::stoi(value);
+    else if (optionName == "loadworkers")
+        NumLoadWorkers = std::max(1, std::stoi(value));
+    else if (optionName == "maxmessagesize")
+        ReceiveBuffer::setMaxMessageSize(std::stoul(value));
+    else if (optionName == "nocompression")
+        NoCompression = true;
+    else if (optionName == "outboundlimit")
+        OutboundLimit = std::stoul(value);
+    else if (optionName == "outboundpolicy")
+    {
+        if (value == "coalesce")
+            OutboundPolicy = OutboundQueue::Policy::Coalesce;
+        else if (value == "disconnect")
+            OutboundPolicy = OutboundQueue::Policy::Disconnect;
+        else
+            throw Poco::Util::InvalidArgumentException("Unknown outbound policy: " + value);
+    }
     else if (optionName == "test")
         LOOLWSD::DoTest = true;
 }
@@ -885,6 +1188,17 @@ Process::PID LOOLWSD::createBroker()
     args.push_back("--lotemplate=" + LoTemplate);
     args.push_back("--childroot=" + ChildRoot);
     args.push_back("--numprespawns=" + std::to_string(NumPreSpawnedChildren));
+    args.push_back("--maxprespawns=" + std::to_string(MaxPreSpawnedChildren));
+    args.push_back("--idletimeout=" + std::to_string(IdleTimeoutSecs));
+    args.push_back("--callbackflushms=" + std::to_string(CallbackFlushMS));
+    if (!TileEncoder::getConfiguration().empty())
+        args.push_back("--tileencoder=" + TileEncoder::getConfiguration());
+    if (UseHugePages)
+        args.push_back("--hugepages");
+    if (KitUsesTcp)
+        args.push_back("--kittransport=tcp");
+    args.push_back("--memorystall=" + std::to_string(MemoryStallThreshold));
+    args.push_back("--memoryusage=" + std::to_string(MemoryUsageThreshold));
     args.push_back("--clientport=" + std::to_string(ClientPortNumber));
 
     const std::string brokerPath = Path(Application::instance().commandPath()).parent().toString() + "loolbroker";
@@ -939,7 +1253,7 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
         throw IncompatibleOptionsException("port");
 
     if (LOOLWSD::DoTest)
-        NumPreSpawnedChildren = 1;
+        NumPreSpawnedChildren = MaxPreSpawnedChildren = 1;
 
     // log pid information
     {
@@ -1011,6 +1325,12 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
     auto params2 = new HTTPServerParams();
     params2->setMaxThreads(MAX_SESSIONS);
 
+    if (NumClientWorkers <= 0)
+        NumClientWorkers = std::max(4u, 2 * std::thread::hardware_concurrency());
+
+    // The client sockets are handed over to it once they are upgraded.
+    Reactor.reset(new ClientReactor(NumClientWorkers, NumLoadWorkers, OutboundLimit, OutboundPolicy));
+
     // Start a server listening on the port for clients
     ServerSocket svs(ClientPortNumber);
     ThreadPool threadPool(NumPreSpawnedChildren*6, MAX_SESSIONS * 2);
@@ -1025,6 +1345,19 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
 
     srv2.start();
 
+    // Kits prefer the Unix socket, and fall back on the port.
+    const int prisonerSocket = UnixChannel::listen(MASTER_SOCKET_NAME);
+    std::unique_ptr<PrisonerChannelListener> prisonerListener;
+    if (prisonerSocket < 0)
+    {
+        Log::warn("Failed to listen on the Unix socket " + MASTER_SOCKET_NAME + " for child processes.", true);
+    }
+    else
+    {
+        prisonerListener.reset(new PrisonerChannelListener(prisonerSocket));
+        threadPool.start(*prisonerListener);
+    }
+
     if ( (BrokerWritePipe = open(pipeLoolwsd.c_str(), O_WRONLY) ) < 0 )
     {
         Log::error("Error: failed to open pipe [" + pipeLoolwsd + "] write only.");
@@ -1032,7 +1365,7 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
     }
 
     // Start the Admin manager.
-    Admin admin(brokerPid, BrokerWritePipe, notifyPipe);
+    Admin admin(brokerPid, BrokerWritePipe, notifyPipe, Reactor);
     threadPool.start(admin);
 
     TestInput input(*this, svs, srv);
@@ -1124,6 +1457,12 @@ int LOOLWSD::main(const std::vector<std::string>& /*args*/)
 
     // close all websockets
     threadPool.joinAll();
+    Reactor.reset();
+
+    const auto bufferStats = ReceiveBuffer::getStats();
+    Log::info() << "Receive buffers: " << bufferStats.bytesInFlight << " bytes in flight, "
+                << bufferStats.maxBytesInFlight << " at most, " << bufferStats.pooledBytes
+                << " pooled, " << bufferStats.rejected << " messages rejected as too large." << Log::end;
 
     // Terminate child processes
     Util::writeFIFO(LOOLWSD::BrokerWritePipe, "eof\r\n");
@@ -11,6 +11,7 @@
 #define INCLUDED_LOOLWSD_HPP
 
 #include <atomic>
+#include <functional>
 #include <mutex>
 #include <string>
 
@@ -22,6 +23,7 @@
 
 #include "Auth.hpp"
 #include "Common.hpp"
+#include "OutboundQueue.hpp"
 #include "Storage.hpp"
 #include "Util.hpp"
 
@@ -47,9 +49,9 @@ public:
         if (uriPublic.getPath().empty())
             throw std::runtime_error("Invalid URL.");
 
-        // This lock could become a bottleneck.
-        // In that case, we can use a pool and index by publicPath.
-        std::unique_lock<std::mutex> lock(DocumentURIMutex);
+        // Only the same document is to be set up once at a time; others,
+        // each being copied or downloaded, mustn't wait for it.
+        std::unique_lock<std::mutex> lock(getMutex(uriPublic.getPath()));
 
         // The URL is the publicly visible one, not visible in the chroot jail.
         // We need to map it to a jailed path and copy the file there.
@@ -100,8 +102,16 @@ private:
 
 private:
 
-    // DocumentURI management mutex.
-    static std::mutex DocumentURIMutex;
+    /// The mutex of the documents at publicPath, one of a fixed pool.
+    static std::mutex& getMutex(const std::string& publicPath)
+    {
+        return DocumentURIMutexes[std::hash<std::string>()(publicPath) % MutexCount];
+    }
+
+    static const size_t MutexCount = 64;
+
+    // DocumentURI management mutexes, by the hash of the public path.
+    static std::mutex DocumentURIMutexes[MutexCount];
 
 private:
     const Poco::URI _uriPublic;
@@ -119,8 +129,20 @@ public:
     // statics
     static std::atomic<unsigned> NextSessionId;
     static int NumPreSpawnedChildren;
+    static int MaxPreSpawnedChildren;
+    static int IdleTimeoutSecs;
+    static int CallbackFlushMS;
+    static bool UseHugePages;
+    static bool KitUsesTcp;
+    static double MemoryStallThreshold;
+    static double MemoryUsageThreshold;
+    static int NumClientWorkers;
+    static int NumLoadWorkers;
     static int BrokerWritePipe;
     static bool DoTest;
+    static bool NoCompression;
+    static size_t OutboundLimit;
+    static OutboundQueue::Policy OutboundPolicy;
     static std::string Cache;
     static std::string SysTemplate;
     static std::string LoTemplate;
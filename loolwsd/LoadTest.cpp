@@ -42,6 +42,8 @@
 #include "Common.hpp"
 #include "LoadTest.hpp"
 #include "LOOLProtocol.hpp"
+#include "ReceiveBuffer.hpp"
+#include "TileHeader.hpp"
 #include "Util.hpp"
 
 using namespace LOOLProtocol;
@@ -89,34 +91,20 @@ public:
         int tileCount = 0;
         try
         {
+            ReceiveBuffer buffer;
             do
             {
-                char buffer[100000];
-                n = _ws.receiveFrame(buffer, sizeof(buffer), flags);
+                n = receiveMessage(_ws, buffer, flags);
                 if (n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE)
                 {
 #if 0
                     Log::debug() << "Client got " << n << " bytes: "
-                                 << getAbbreviatedMessage(buffer, n) << Log::end;
+                                 << getAbbreviatedMessage(buffer.data(), n) << Log::end;
 #endif
-                    std::string response = getFirstLine(buffer, n);
+                    std::string response = getFirstLine(buffer.data(), n);
                     StringTokenizer tokens(response, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
 
-                    int size;
-                    if (tokens.count() == 2 && tokens[0] == "nextmessage:" && getTokenInteger(tokens[1], "size", size) && size > 0)
-                    {
-                        char largeBuffer[size];
-
-                        n = _ws.receiveFrame(largeBuffer, size, flags);
-
-#if 0
-                        Log::debug() << "Client got " << n << " bytes: "
-                                     << getAbbreviatedMessage(largeBuffer, n) << Log::end;
-#endif
-                        if (n > 0 && (flags & WebSocket::FRAME_OP_BITMASK) != WebSocket::FRAME_OP_CLOSE)
-                            response = getFirstLine(largeBuffer, n);
-                    }
-                    else if (tokens[0] == "loolclient")
+                    if (tokens.count() == 2 && tokens[0] == "loolclient")
                     {
                         const auto versionTuple = ParseVersion(tokens[1]);
                         if (std::get<0>(versionTuple) != ProtocolMajorVersionNumber ||
@@ -135,7 +123,8 @@ public:
                         parseStatus(response, _type, _numParts, _currentPart, _width, _height);
                         _cond.signal();
                     }
-                    else if (response.find("tile:") == 0)
+                    else if (response.find("tile:") == 0 || response.find("solidtile:") == 0 ||
+                             TileHeader::isBinary(buffer.data(), n))
                     {
                         tileCount++;
                     }
@@ -18,7 +18,10 @@
 #include "LOOLSession.hpp"
 #include "LOOLWSD.hpp"
 #include "MasterProcessSession.hpp"
+#include "MessageBatch.hpp"
 #include "Rectangle.hpp"
+#include "TileEncoder.hpp"
+#include "TileHeader.hpp"
 #include "Util.hpp"
 
 using namespace LOOLProtocol;
@@ -26,6 +29,25 @@ using namespace LOOLProtocol;
 using Poco::Path;
 using Poco::StringTokenizer;
 
+namespace
+{
+    /// Turns the solid tile into a tile: and appends the PNG image of its
+    /// colour, for clients that don't understand "solidtile:".
+    bool appendSolidImage(TileHeader& tile, std::vector<char>& output)
+    {
+        std::vector<unsigned char> pixmap(4 * tile.width * tile.height);
+        for (size_t i = 0; i < pixmap.size(); i += 4)
+        {
+            std::memcpy(pixmap.data() + i, tile.color, 4);
+        }
+
+        tile.type = TileHeader::Type::Tile;
+        tile.writeText(output);
+        return TileEncoder::getDefault()->encode(pixmap.data(), 0, 0, tile.width, tile.height,
+                                                 tile.width, tile.height, output, LOK_TILEMODE_RGBA);
+    }
+}
+
 std::map<std::string, std::shared_ptr<MasterProcessSession>> MasterProcessSession::AvailableChildSessions;
 std::mutex MasterProcessSession::AvailableChildSessionMutex;
 std::condition_variable MasterProcessSession::AvailableChildSessionCV;
@@ -35,7 +57,11 @@ MasterProcessSession::MasterProcessSession(const std::string& id,
                                            std::shared_ptr<Poco::Net::WebSocket> ws) :
     LOOLSession(id, kind, ws),
     _curPart(0),
-    _loadPart(-1)
+    _loadPart(-1),
+    _acceptsBatches(false),
+    _acceptsBinaryTiles(false),
+    _acceptsSolidTiles(false),
+    _isBatching(false)
 {
     Log::info("MasterProcessSession ctor [" + getName() + "].");
 }
@@ -93,20 +119,31 @@ bool MasterProcessSession::handleDisconnect(Poco::StringTokenizer& tokens)
 
 bool MasterProcessSession::_handleInput(const char *buffer, int length)
 {
-    const std::string firstLine = getFirstLine(buffer, length);
-    StringTokenizer tokens(firstLine, " ", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+    // Tile messages in binary form aren't tokenized, their fields may hold any byte.
+    if (TileHeader::isBinary(buffer, length))
+        return handleBinaryTile(buffer, length);
+
+    const Tokenizer tokens(buffer, length);
+    const Command command = getCommand(tokens[0]);
 
-    if (tokens[0] == "loolclient")
+    if (command == Command::LOOLCLIENT)
     {
-        const auto versionTuple = ParseVersion(tokens[1]);
+        const auto versionTuple = ParseVersion(tokens[1].toString());
         if (std::get<0>(versionTuple) != ProtocolMajorVersionNumber ||
-            std::get<1>(versionTuple) != ProtocolMinorVersionNumber)
+            std::get<1>(versionTuple) < 1 ||
+            std::get<1>(versionTuple) > static_cast<int>(ProtocolMinorVersionNumber))
         {
             sendTextFrame("error: cmd=loolclient kind=badversion");
             return false;
         }
 
-        sendTextFrame("loolserver " + GetProtocolVersion());
+        // Speak the client's minor version, older clients expect an exact match.
+        const unsigned minor = std::get<1>(versionTuple);
+        setAnnounceLargeMessages(minor < ProtocolNativeFramingMinorVersionNumber);
+        _acceptsBatches = (minor >= ProtocolBatchMinorVersionNumber);
+        _acceptsBinaryTiles = (minor >= ProtocolBinaryTileMinorVersionNumber);
+        _acceptsSolidTiles = (minor >= ProtocolSolidTileMinorVersionNumber);
+        sendTextFrame("loolserver " + std::to_string(ProtocolMajorVersionNumber) + '.' + std::to_string(minor));
         return true;
     }
 
@@ -117,6 +154,7 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
 
         // Snoop at some  messages and manipulate tile cache information as needed
         auto peer = _peer.lock();
+        const Message message = (_kind == Kind::ToPrisoner ? getMessage(tokens[0]) : Message::UNKNOWN);
 
         if (_kind == Kind::ToPrisoner)
         {
@@ -126,7 +164,10 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
                 return false;
             }
 
-            if (tokens[0] == "error:")
+            if (message == Message::BATCH)
+                return handleBatch(buffer, length);
+
+            if (message == Message::ERROR)
             {
                 std::string errorCommand;
                 std::string errorKind;
@@ -151,14 +192,14 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
                 }
             }
 
-            if (tokens[0] == "curpart:" &&
+            if (message == Message::CURPART &&
                 tokens.count() == 2 &&
                 getTokenInteger(tokens[1], "part", _curPart))
             {
                 return true;
             }
 
-            if (tokens.count() == 2 && tokens[0] == "saveas:")
+            if (tokens.count() == 2 && message == Message::SAVEAS)
             {
                 std::string url;
                 if (!getTokenString(tokens[1], "url", url))
@@ -185,27 +226,12 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
 
         if (_kind == Kind::ToPrisoner && peer && peer->_tileCache && !_isDocPasswordProtected)
         {
-            if (tokens[0] == "tile:")
-            {
-                int part, width, height, tilePosX, tilePosY, tileWidth, tileHeight;
-                if (tokens.count() < 8 ||
-                    !getTokenInteger(tokens[1], "part", part) ||
-                    !getTokenInteger(tokens[2], "width", width) ||
-                    !getTokenInteger(tokens[3], "height", height) ||
-                    !getTokenInteger(tokens[4], "tileposx", tilePosX) ||
-                    !getTokenInteger(tokens[5], "tileposy", tilePosY) ||
-                    !getTokenInteger(tokens[6], "tilewidth", tileWidth) ||
-                    !getTokenInteger(tokens[7], "tileheight", tileHeight))
-                    assert(false);
-
-                assert(firstLine.size() < static_cast<std::string::size_type>(length));
-                peer->_tileCache->saveTile(part, width, height, tilePosX, tilePosY, tileWidth, tileHeight, buffer + firstLine.size() + 1, length - firstLine.size() - 1);
-            }
-            else if (tokens[0] == "status:")
+            const size_t lineSize = tokens.getLine().size();
+            if (message == Message::STATUS)
             {
                 peer->_tileCache->saveTextFile(std::string(buffer, length), "status.txt");
             }
-            else if (tokens[0] == "commandvalues:")
+            else if (message == Message::COMMANDVALUES)
             {
                 const std::string stringMsg(buffer, length);
                 const auto index = stringMsg.find_first_of("{");
@@ -224,33 +250,33 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
                     }
                 }
             }
-            else if (tokens[0] == "partpagerectangles:")
+            else if (message == Message::PARTPAGERECTANGLES)
             {
                 if (tokens.count() > 1 && !tokens[1].empty())
                     peer->_tileCache->saveTextFile(std::string(buffer, length), "partpagerectangles.txt");
             }
-            else if (tokens[0] == "invalidatecursor:")
+            else if (message == Message::INVALIDATE_CURSOR)
             {
                 peer->_tileCache->setEditing(true);
             }
-            else if (tokens[0] == "invalidatetiles:")
+            else if (message == Message::INVALIDATE_TILES)
             {
                 // FIXME temporarily, set the editing on the 1st invalidate, TODO extend
                 // the protocol so that the client can set the editing or view only.
                 peer->_tileCache->setEditing(true);
 
-                assert(firstLine.size() == static_cast<std::string::size_type>(length));
-                peer->_tileCache->invalidateTiles(firstLine);
+                assert(lineSize == static_cast<size_t>(length));
+                peer->_tileCache->invalidateTiles(tokens.getLine().toString());
             }
-            else if (tokens[0] == "renderfont:")
+            else if (message == Message::RENDERFONT)
             {
                 std::string font;
                 if (tokens.count() < 2 ||
                     !getTokenString(tokens[1], "font", font))
                     assert(false);
 
-                assert(firstLine.size() < static_cast<std::string::size_type>(length));
-                peer->_tileCache->saveRendering(font, "font", buffer + firstLine.size() + 1, length - firstLine.size() - 1);
+                assert(lineSize < static_cast<size_t>(length));
+                peer->_tileCache->saveRendering(font, "font", buffer + lineSize + 1, length - lineSize - 1);
             }
         }
 
@@ -258,7 +284,7 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
         return true;
     }
 
-    if (tokens[0] == "child")
+    if (getMessage(tokens[0]) == Message::CHILD)
     {
         if (_kind != Kind::ToPrisoner)
         {
@@ -277,8 +303,8 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
         }
 
         // child -> 0,  sessionId -> 1, PID -> 2
-        setId(tokens[1]);
-        _childId = tokens[2];
+        setId(tokens[1].toString());
+        _childId = tokens[2].toString();
 
         std::unique_lock<std::mutex> lock(AvailableChildSessionMutex);
         AvailableChildSessions.emplace(getId(), shared_from_this());
@@ -294,86 +320,60 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
         // Message from child process to be forwarded to client.
 
         // I think we should never get here
-        Log::error(getName() + ": Unexpected request [" + tokens[0] + "].");
+        Log::error(getName() + ": Unexpected request [" + tokens[0].toString() + "].");
         assert(false);
     }
-    else if (tokens[0] == "load")
+    else if (command == Command::LOAD)
     {
         if (_docURL != "")
         {
             sendTextFrame("error: cmd=load kind=docalreadyloaded");
             return false;
         }
-        return loadDocument(buffer, length, tokens);
-    }
-    else if (tokens[0] != "canceltiles" &&
-             tokens[0] != "clientzoom" &&
-             tokens[0] != "clientvisiblearea" &&
-             tokens[0] != "commandvalues" &&
-             tokens[0] != "disconnect" &&
-             tokens[0] != "downloadas" &&
-             tokens[0] != "getchildid" &&
-             tokens[0] != "gettextselection" &&
-             tokens[0] != "paste" &&
-             tokens[0] != "insertfile" &&
-             tokens[0] != "invalidatetiles" &&
-             tokens[0] != "key" &&
-             tokens[0] != "mouse" &&
-             tokens[0] != "partpagerectangles" &&
-             tokens[0] != "renderfont" &&
-             tokens[0] != "requestloksession" &&
-             tokens[0] != "resetselection" &&
-             tokens[0] != "saveas" &&
-             tokens[0] != "selectgraphic" &&
-             tokens[0] != "selecttext" &&
-             tokens[0] != "setclientpart" &&
-             tokens[0] != "setpage" &&
-             tokens[0] != "status" &&
-             tokens[0] != "tile" &&
-             tokens[0] != "tilecombine" &&
-             tokens[0] != "unload" &&
-             tokens[0] != "uno")
-    {
-        sendTextFrame("error: cmd=" + tokens[0] + " kind=unknown");
+        return loadDocument(buffer, length, *tokenize(buffer, length));
+    }
+    else if (command == Command::UNKNOWN)
+    {
+        sendTextFrame("error: cmd=" + tokens[0].toString() + " kind=unknown");
         return false;
     }
     else if (_docURL == "")
     {
-        sendTextFrame("error: cmd=" + tokens[0] + " kind=nodocloaded");
+        sendTextFrame("error: cmd=" + tokens[0].toString() + " kind=nodocloaded");
         return false;
     }
-    else if (tokens[0] == "canceltiles")
+    else if (command == Command::CANCELTILES)
     {
         if (!_peer.expired())
             forwardToPeer(buffer, length);
     }
-    else if (tokens[0] == "commandvalues")
+    else if (command == Command::COMMANDVALUES)
     {
-        return getCommandValues(buffer, length, tokens);
+        return getCommandValues(buffer, length, *tokenize(buffer, length));
     }
-    else if (tokens[0] == "partpagerectangles")
+    else if (command == Command::PARTPAGERECTANGLES)
     {
         return getPartPageRectangles(buffer, length);
     }
-    else if (tokens[0] == "invalidatetiles")
+    else if (command == Command::INVALIDATETILES)
     {
-        return invalidateTiles(buffer, length, tokens);
+        return invalidateTiles(buffer, length, *tokenize(buffer, length));
     }
-    else if (tokens[0] == "renderfont")
+    else if (command == Command::RENDERFONT)
     {
-        sendFontRendering(buffer, length, tokens);
+        sendFontRendering(buffer, length, *tokenize(buffer, length));
     }
-    else if (tokens[0] == "status")
+    else if (command == Command::STATUS)
     {
         return getStatus(buffer, length);
     }
-    else if (tokens[0] == "tile")
+    else if (command == Command::TILE)
     {
-        sendTile(buffer, length, tokens);
+        handleTileRequest(buffer, length);
     }
-    else if (tokens[0] == "tilecombine")
+    else if (command == Command::TILECOMBINE)
     {
-        sendCombinedTiles(buffer, length, tokens);
+        sendCombinedTiles(buffer, length, *tokenize(buffer, length));
     }
     else
     {
@@ -384,22 +384,22 @@ bool MasterProcessSession::_handleInput(const char *buffer, int length)
         if (_peer.expired())
             dispatchChild();
 
-        if (tokens[0] == "setclientpart")
+        if (command == Command::SETCLIENTPART)
             _tileCache->removeFile("status.txt");
 
-        if (tokens[0] != "requestloksession")
+        if (command != Command::REQUESTLOKSESSION)
         {
             forwardToPeer(buffer, length);
         }
 
-        if ((tokens.count() > 1 && tokens[0] == "uno" && tokens[1] == ".uno:Save"))
+        if ((tokens.count() > 1 && command == Command::UNO && tokens[1] == ".uno:Save"))
         {
            _tileCache->documentSaved();
         }
-        else if (tokens[0] == "disconnect")
+        else if (command == Command::DISCONNECT)
         {
             // This was the last we would hear from the client on this socket.
-            return handleDisconnect(tokens);
+            return handleDisconnect(*tokenize(buffer, length));
         }
     }
     return true;
@@ -566,61 +566,121 @@ void MasterProcessSession::sendFontRendering(const char *buffer, int length, Str
     forwardToPeer(buffer, length);
 }
 
-void MasterProcessSession::sendTile(const char *buffer, int length, StringTokenizer& tokens)
+void MasterProcessSession::sendTile(const char *buffer, int length, StringTokenizer& /*tokens*/)
 {
-    int part, width, height, tilePosX, tilePosY, tileWidth, tileHeight;
+    handleTileRequest(buffer, length);
+}
 
-    if (tokens.count() < 8 ||
-        !getTokenInteger(tokens[1], "part", part) ||
-        !getTokenInteger(tokens[2], "width", width) ||
-        !getTokenInteger(tokens[3], "height", height) ||
-        !getTokenInteger(tokens[4], "tileposx", tilePosX) ||
-        !getTokenInteger(tokens[5], "tileposy", tilePosY) ||
-        !getTokenInteger(tokens[6], "tilewidth", tileWidth) ||
-        !getTokenInteger(tokens[7], "tileheight", tileHeight))
+void MasterProcessSession::handleTileRequest(const char *buffer, int length)
+{
+    TileHeader tile;
+    if (!tile.parse(buffer, length) || tile.type != TileHeader::Type::Request)
     {
         sendTextFrame("error: cmd=tile kind=syntax");
         return;
     }
 
-    if (part < 0 ||
-        width <= 0 ||
-        height <= 0 ||
-        tilePosX < 0 ||
-        tilePosY < 0 ||
-        tileWidth <= 0 ||
-        tileHeight <= 0)
+    if (!tile.isValid())
     {
         sendTextFrame("error: cmd=tile kind=invalid");
         return;
     }
 
-    std::string response = "tile: " + Poco::cat(std::string(" "), tokens.begin() + 1, tokens.end()) + "\n";
-
-    std::vector<char> output;
-    output.reserve(4 * width * height);
-    output.resize(response.size());
-    std::memcpy(output.data(), response.data(), response.size());
-
-    std::unique_ptr<std::fstream> cachedTile = _tileCache->lookupTile(part, width, height, tilePosX, tilePosY, tileWidth, tileHeight);
+    std::unique_ptr<std::fstream> cachedTile = _tileCache->lookupTile(tile.part, tile.width, tile.height, tile.tilePosX, tile.tilePosY,
+                                                                      tile.tileWidth, tile.tileHeight);
     if (cachedTile && cachedTile->is_open())
     {
-        cachedTile->seekg(0, std::ios_base::end);
-        size_t pos = output.size();
-        std::streamsize size = cachedTile->tellg();
-        output.resize(pos + size);
-        cachedTile->seekg(0, std::ios_base::beg);
-        cachedTile->read(output.data() + pos, size);
-        cachedTile->close();
-
-        sendBinaryFrame(output.data(), output.size());
-
+        tile.version = _tileCache->getTileVersion(tile.part, tile.width, tile.height, tile.tilePosX, tile.tilePosY,
+                                                  tile.tileWidth, tile.tileHeight);
+        sendCachedTile(tile, *cachedTile);
         return;
     }
 
     if (_peer.expired())
         dispatchChild();
-    forwardToPeer(buffer, length);
+
+    // The kit takes requests in binary form, whichever the client sent.
+    if (TileHeader::isBinary(buffer, length))
+    {
+        forwardToPeer(buffer, length);
+        return;
+    }
+
+    std::vector<char> request;
+    tile.writeBinary(request);
+    forwardToPeer(request.data(), request.size());
+}
+
+bool MasterProcessSession::handleBinaryTile(const char *buffer, int length)
+{
+    if (_kind == Kind::ToClient)
+    {
+        if (!_acceptsBinaryTiles)
+        {
+            sendTextFrame("error: cmd=tile kind=unknown");
+            return false;
+        }
+
+        if (_docURL == "")
+        {
+            sendTextFrame("error: cmd=tile kind=nodocloaded");
+            return false;
+        }
+
+        handleTileRequest(buffer, length);
+        return true;
+    }
+
+    auto peer = _peer.lock();
+    if (!peer)
+    {
+        LOOLSession::disconnect();
+        return false;
+    }
+
+    TileHeader tile;
+    tile.parse(buffer, length);
+    if (peer->_tileCache && !_isDocPasswordProtected)
+    {
+        if (tile.type == TileHeader::Type::Tile)
+        {
+            peer->_tileCache->saveTile(tile.part, tile.width, tile.height, tile.tilePosX, tile.tilePosY, tile.tileWidth, tile.tileHeight,
+                                       buffer + tile.payloadOffset, length - tile.payloadOffset, tile.version);
+        }
+        else if (tile.type == TileHeader::Type::Solid)
+        {
+            // Cached as just its "color=rrggbbaa" token, see sendCachedTile().
+            const std::string color = tile.getColorToken();
+            peer->_tileCache->saveTile(tile.part, tile.width, tile.height, tile.tilePosX, tile.tilePosY, tile.tileWidth, tile.tileHeight,
+                                       color.data(), color.size(), tile.version);
+        }
+    }
+
+    if (tile.type == TileHeader::Type::Solid && !peer->_acceptsSolidTiles)
+    {
+        std::vector<char> response;
+        if (!appendSolidImage(tile, response))
+        {
+            Log::error(getName() + ": Failed to encode solid tile.");
+            return false;
+        }
+
+        forwardToPeer(response.data(), response.size());
+        return true;
+    }
+
+    if (peer->_acceptsBinaryTiles)
+    {
+        forwardToPeer(buffer, length);
+        return true;
+    }
+
+    // Older clients get the text form, followed by the same image.
+    std::vector<char> response;
+    tile.writeText(response);
+    response.insert(response.end(), buffer + tile.payloadOffset, buffer + length);
+    forwardToPeer(response.data(), response.size());
+    return true;
 }
 
 void MasterProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*length*/, StringTokenizer& tokens)
@@ -628,6 +688,7 @@ void MasterProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*lengt
     int part, pixelWidth, pixelHeight, tileWidth, tileHeight;
     std::string tilePositionsX, tilePositionsY;
     std::string reqTimestamp;
+    std::string oldVersions;
 
     if (tokens.count() < 8 ||
         !getTokenInteger(tokens[1], "part", part) ||
@@ -650,18 +711,23 @@ void MasterProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*lengt
         return;
     }
 
-    if (tokens.count() > 8)
-        getTokenString(tokens[8], "timestamp", reqTimestamp);
+    for (size_t i = 8; i < tokens.count(); ++i)
+    {
+        if (!getTokenString(tokens[i], "timestamp", reqTimestamp))
+            getTokenString(tokens[i], "oldver", oldVersions);
+    }
 
     Util::Rectangle renderArea;
 
     StringTokenizer positionXtokens(tilePositionsX, ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
     StringTokenizer positionYtokens(tilePositionsY, ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+    StringTokenizer oldVersionTokens(oldVersions, ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
 
     size_t numberOfPositions = positionYtokens.count();
 
     // check that number of positions for X and Y is the same
-    if (numberOfPositions != positionYtokens.count())
+    if (numberOfPositions != positionYtokens.count() ||
+        (!oldVersions.empty() && numberOfPositions != oldVersionTokens.count()))
     {
         sendTextFrame("error: cmd=tilecombine kind=invalid");
         return;
@@ -669,6 +735,7 @@ void MasterProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*lengt
 
     std::string forwardTileX;
     std::string forwardTileY;
+    std::string forwardOldVersions;
 
     for (size_t i = 0; i < numberOfPositions; i++)
     {
@@ -689,36 +756,20 @@ void MasterProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*lengt
 
         if (cachedTile && cachedTile->is_open())
         {
-            std::ostringstream oss;
-            oss << "tile: part=" << part
-                << " width=" << pixelWidth
-                << " height=" << pixelHeight
-                << " tileposx=" << x
-                << " tileposy=" << y
-                << " tilewidth=" << tileWidth
-                << " tileheight=" << tileHeight;
-
-            if (!reqTimestamp.empty())
-            {
-                oss << " timestamp=" << reqTimestamp;
-            }
-
-            oss << "\n";
-            const std::string response = oss.str();
-
-            std::vector<char> output;
-            output.reserve(4 * pixelWidth * pixelHeight);
-            output.resize(response.size());
-            std::memcpy(output.data(), response.data(), response.size());
-            cachedTile->seekg(0, std::ios_base::end);
-            const size_t pos = output.size();
-            const std::streamsize size = cachedTile->tellg();
-            output.resize(pos + size);
-            cachedTile->seekg(0, std::ios_base::beg);
-            cachedTile->read(output.data() + pos, size);
-            cachedTile->close();
-
-            sendBinaryFrame(output.data(), output.size());
+            const std::string extra = (reqTimestamp.empty() ? std::string() : "timestamp=" + reqTimestamp);
+            TileHeader tile;
+            tile.type = TileHeader::Type::Request;
+            tile.part = part;
+            tile.width = pixelWidth;
+            tile.height = pixelHeight;
+            tile.tilePosX = x;
+            tile.tilePosY = y;
+            tile.tileWidth = tileWidth;
+            tile.tileHeight = tileHeight;
+            tile.extra = extra.data();
+            tile.extraSize = extra.size();
+            tile.version = _tileCache->getTileVersion(part, pixelWidth, pixelHeight, x, y, tileWidth, tileHeight);
+            sendCachedTile(tile, *cachedTile);
         }
         else
         {
@@ -729,6 +780,13 @@ void MasterProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*lengt
             if (!forwardTileY.empty())
                 forwardTileY += ",";
             forwardTileY += std::to_string(y);
+
+            if (!oldVersions.empty())
+            {
+                if (!forwardOldVersions.empty())
+                    forwardOldVersions += ",";
+                forwardOldVersions += oldVersionTokens[i];
+            }
         }
     }
 
@@ -749,9 +807,58 @@ void MasterProcessSession::sendCombinedTiles(const char* /*buffer*/, int /*lengt
     if (!reqTimestamp.empty())
         forward += " timestamp=" + reqTimestamp;
 
+    if (!forwardOldVersions.empty())
+        forward += " oldver=" + forwardOldVersions;
+
     forwardToPeer(forward.c_str(), forward.size());
 }
 
+void MasterProcessSession::sendCachedTile(TileHeader tile, std::fstream& cachedTile)
+{
+    cachedTile.seekg(0, std::ios_base::end);
+    const std::streamsize size = cachedTile.tellg();
+    std::vector<char> data(size);
+    cachedTile.seekg(0, std::ios_base::beg);
+    cachedTile.read(data.data(), size);
+    cachedTile.close();
+
+    // Solid tiles are cached as their "color=" token, PNGs can't start with that.
+    const bool isSolid = (size > 6 && std::memcmp(data.data(), "color=", 6) == 0);
+
+    // The client's oldver= is only meaningful to the kit.
+    tile.type = (isSolid ? TileHeader::Type::Solid : TileHeader::Type::Tile);
+    tile.oldVersion = 0;
+    if (isSolid && !TileHeader::parseColor(data.data() + 6, data.size() - 6, tile.color))
+    {
+        Log::error(getName() + ": Invalid cached solid tile: " + std::string(data.data(), data.size()));
+        return;
+    }
+
+    std::vector<char> output;
+    if (isSolid && !_acceptsSolidTiles)
+    {
+        if (!appendSolidImage(tile, output))
+        {
+            Log::error(getName() + ": Failed to encode cached solid tile.");
+            return;
+        }
+
+        sendBinaryFrame(output.data(), output.size());
+        return;
+    }
+
+    output.reserve(TileHeader::Size + tile.extraSize + data.size());
+    if (_acceptsBinaryTiles)
+        tile.writeBinary(output);
+    else
+        tile.writeText(output);
+
+    if (!isSolid)
+        output.insert(output.end(), data.begin(), data.end());
+
+    sendBinaryFrame(output.data(), output.size());
+}
+
 void MasterProcessSession::dispatchChild()
 {
     int retries = 3;
@@ -794,7 +901,7 @@ void MasterProcessSession::dispatchChild()
     if (retries < 0 && !isFound)
     {
         Log::error(getName() + ": Failed to connect to child. Shutting down socket.");
-        Util::shutdownWebSocket(_ws);
+        shutdownWebSocket();
         return;
     }
 
@@ -815,6 +922,9 @@ void MasterProcessSession::dispatchChild()
     if (_isDocPasswordProvided)
         oss << " password=" << _docPassword;
 
+    if (!_tileEncoderName.empty())
+        oss << " tileencoder=" << _tileEncoderName;
+
     if (!_docOptions.empty())
         oss << " options=" << _docOptions;
 
@@ -827,6 +937,12 @@ void MasterProcessSession::forwardToPeer(const char *buffer, int length)
     const auto message = getAbbreviatedMessage(buffer, length);
     Log::trace(_kindString + ",forwardToPeer," + message);
 
+    if (_isBatching)
+    {
+        _batchToForward.emplace_back(buffer, length);
+        return;
+    }
+
     auto peer = _peer.lock();
     if (!peer)
     {
@@ -836,4 +952,43 @@ void MasterProcessSession::forwardToPeer(const char *buffer, int length)
     peer->sendBinaryFrame(buffer, length);
 }
 
+bool MasterProcessSession::handleBatch(const char *buffer, int length)
+{
+    std::vector<std::string> messages;
+    if (!MessageBatch::split(buffer, length, messages))
+    {
+        Log::error(getName() + ": Invalid batch: " + getAbbreviatedMessage(buffer, length));
+        return true;
+    }
+
+    // Snoop at each, as if it came alone.
+    _isBatching = true;
+    bool result = true;
+    for (const auto& message : messages)
+    {
+        result = handleInput(message.data(), message.size());
+        if (!result)
+            break;
+    }
+
+    _isBatching = false;
+
+    auto peer = _peer.lock();
+    if (peer && peer->_acceptsBatches && _batchToForward.size() > 1)
+    {
+        const std::string batch = MessageBatch::join(_batchToForward);
+        peer->sendBinaryFrame(batch.data(), batch.size());
+    }
+    else if (peer)
+    {
+        for (const auto& message : _batchToForward)
+        {
+            peer->sendBinaryFrame(message.data(), message.size());
+        }
+    }
+
+    _batchToForward.clear();
+    return result;
+}
+
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
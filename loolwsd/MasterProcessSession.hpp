@@ -11,11 +11,15 @@
 #define INCLUDED_MASTERPROCESSSESSION_HPP
 
 
+#include <vector>
+
 #include <Poco/Random.h>
 
 #include "LOOLSession.hpp"
 #include "TileCache.hpp"
 
+struct TileHeader;
+
 class MasterProcessSession final : public LOOLSession, public std::enable_shared_from_this<MasterProcessSession>
 {
 public:
@@ -35,6 +39,9 @@ public:
     virtual void disconnect(const std::string& reason = "") override;
     virtual bool handleDisconnect(Poco::StringTokenizer& tokens) override;
 
+    /// Until a kit has the document, most input waits for dispatchChild().
+    virtual bool mayBlock() const override { return _kind == Kind::ToClient && _peer.expired(); }
+
     /**
      * Return the URL of the saved-as document when it's ready. If called
      * before it's ready, the call blocks till then.
@@ -52,9 +59,24 @@ public:
 
     virtual void sendFontRendering(const char *buffer, int length, Poco::StringTokenizer& tokens) override;
 
+    /// Sends a tile found in the cache, as tile: or solidtile:, in the form
+    /// the client takes. tile is the request, with the version of the tile, if known.
+    void sendCachedTile(TileHeader tile, std::fstream& cachedTile);
+
+    /// Answers a tile request, in either form, from the cache or the kit.
+    void handleTileRequest(const char *buffer, int length);
+
+    /// Handles a tile message in binary form: a request from the client,
+    /// or a response from the kit, to cache and forward.
+    bool handleBinaryTile(const char *buffer, int length);
+
     void dispatchChild();
     void forwardToPeer(const char *buffer, int length);
 
+    /// Handles the messages of a "batch:" from the child one by one, and
+    /// forwards them in a batch again if the client understands that.
+    bool handleBatch(const char *buffer, int length);
+
     // If _kind==ToPrisoner and the child process has started and completed its handshake with the
     // parent process: Points to the WebSocketSession for the child process handling the document in
     // question, if any.
@@ -86,6 +108,15 @@ private:
     int _loadPart;
     /// Kind::ToClient instances store URLs of completed 'save as' documents.
     MessageQueue _saveAsQueue;
+    /// Kind::ToClient: whether the client understands "batch:" messages.
+    bool _acceptsBatches;
+    /// Kind::ToClient: whether the client takes tile messages in binary form.
+    bool _acceptsBinaryTiles;
+    /// Kind::ToClient: whether the client understands "solidtile:".
+    bool _acceptsSolidTiles;
+    /// Kind::ToPrisoner: the messages to forward, while handling a batch.
+    bool _isBatching;
+    std::vector<std::string> _batchToForward;
 };
 
 #endif
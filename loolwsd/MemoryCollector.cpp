@@ -0,0 +1,216 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "MemoryCollector.hpp"
+
+namespace
+{
+    bool readFile(const std::string& path, std::string& content)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+
+        std::ostringstream stream;
+        stream << file.rdbuf();
+        content = stream.str();
+        return !content.empty();
+    }
+
+    /// Adds the KiB value of the field named key in line, if it is, to
+    /// total.
+    bool addField(const std::string& line, const char* key, size_t& total)
+    {
+        const size_t size = std::strlen(key);
+        if (line.compare(0, size, key) != 0 || line.size() <= size || line[size] != ':')
+            return false;
+
+        total += std::strtoul(line.c_str() + size + 1, nullptr, 10);
+        return true;
+    }
+}
+
+bool ProcessMemory::read(const pid_t pid, ProcessMemory& memory)
+{
+    const std::string dir = "/proc/" + std::to_string(pid) + "/";
+    std::string text;
+    return (readFile(dir + "smaps_rollup", text) || readFile(dir + "smaps", text)) &&
+           parseSmaps(text, memory);
+}
+
+bool ProcessMemory::parseSmaps(const std::string& text, ProcessMemory& memory)
+{
+    // Each mapping, or the rollup of them all, has lines like
+    // Pss:                 123 kB
+    ProcessMemory sum;
+    bool found = false;
+    std::istringstream lines(text);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        size_t privatePages = 0;
+        if (addField(line, "Rss", sum.rss) ||
+            addField(line, "Pss", sum.pss))
+        {
+            found = true;
+        }
+        else if (addField(line, "Private_Clean", privatePages) ||
+                 addField(line, "Private_Dirty", privatePages))
+        {
+            sum.uss += privatePages;
+            found = true;
+        }
+    }
+
+    if (found)
+    {
+        sum.shared = sum.pss - std::min(sum.uss, sum.pss);
+        memory = sum;
+    }
+
+    return found;
+}
+
+std::string ProcessMemory::getReport()
+{
+    // A process can read its own smaps, dumpable or not.
+    ProcessMemory memory;
+    if (!read(getpid(), memory))
+        return std::string();
+
+    return "mem " + std::to_string(getpid()) + " " + std::to_string(memory.pss) + " " +
+           std::to_string(memory.uss) + " " + std::to_string(memory.rss);
+}
+
+bool ProcessMemory::parseReport(const std::string& message, pid_t& pid, ProcessMemory& memory)
+{
+    std::istringstream stream(message);
+    std::string command;
+    ProcessMemory report;
+    if (!(stream >> command >> pid >> report.pss >> report.uss >> report.rss) || command != "mem")
+        return false;
+
+    report.shared = report.pss - std::min(report.uss, report.pss);
+    memory = report;
+    return true;
+}
+
+MemoryCollector::MemoryCollector(const std::chrono::milliseconds interval) :
+    _interval(interval),
+    _stop(false)
+{
+}
+
+MemoryCollector::~MemoryCollector()
+{
+    stop();
+}
+
+void MemoryCollector::start()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_thread.joinable())
+    {
+        _stop = false;
+        _thread = std::thread([this]() { run(); });
+    }
+}
+
+void MemoryCollector::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+
+    _stopCV.notify_all();
+    if (_thread.joinable())
+        _thread.join();
+}
+
+void MemoryCollector::watch(const pid_t pid)
+{
+    ProcessMemory memory;
+    const bool read = ProcessMemory::read(pid, memory);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto it = _samples.find(pid);
+    if (it == _samples.end())
+        _samples.emplace(pid, memory);
+    else if (read)
+        it->second = memory;
+}
+
+void MemoryCollector::report(const pid_t pid, const ProcessMemory& memory)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto it = _samples.find(pid);
+    if (it != _samples.end())
+        it->second = memory;
+}
+
+void MemoryCollector::unwatch(const pid_t pid)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _samples.erase(pid);
+}
+
+ProcessMemory MemoryCollector::get(const pid_t pid) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    const auto it = _samples.find(pid);
+    return (it != _samples.end() ? it->second : ProcessMemory());
+}
+
+void MemoryCollector::collect()
+{
+    std::vector<pid_t> pids;
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (const auto& it : _samples)
+            pids.push_back(it.first);
+    }
+
+    // /proc is read without the lock, for readers not to wait on it.
+    for (const auto pid : pids)
+    {
+        ProcessMemory memory;
+        if (!ProcessMemory::read(pid, memory))
+            continue;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        const auto it = _samples.find(pid);
+        if (it != _samples.end())
+            it->second = memory;
+    }
+}
+
+void MemoryCollector::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop)
+    {
+        lock.unlock();
+        collect();
+        lock.lock();
+
+        _stopCV.wait_for(lock, _interval, [this]() { return _stop; });
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_MEMORYCOLLECTOR_HPP
+#define INCLUDED_MEMORYCOLLECTOR_HPP
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// The memory of a process, in KiB.
+struct ProcessMemory
+{
+    ProcessMemory() :
+        pss(0),
+        uss(0),
+        shared(0),
+        rss(0)
+    {
+    }
+
+    /// Proportional set size: the pages of the process, those it shares
+    /// divided among their sharers, so that summed over processes each
+    /// page counts once.
+    size_t pss;
+    /// Unique set size: the pages of the process alone, freed with it.
+    size_t uss;
+    /// What of PSS is shared with others, like the pages of the broker
+    /// which kits are forked from: PSS - USS.
+    size_t shared;
+    size_t rss;
+
+    /// Reads the memory of pid from /proc/pid/smaps_rollup, or smaps
+    /// before Linux 4.14. Returns false if they can't be read: the process
+    /// is gone, or is not dumpable, like the broker and the kits, which
+    /// have capabilities, and report their own instead.
+    static bool read(pid_t pid, ProcessMemory& memory);
+
+    /// Sums the fields of smaps, or smaps_rollup, text into memory.
+    /// Returns false if there are none.
+    static bool parseSmaps(const std::string& text, ProcessMemory& memory);
+
+    /// The "mem" message of the notify FIFO by which a process tells
+    /// its own memory; empty if it can't be read.
+    static std::string getReport();
+
+    /// Parses a "mem" message into the pid it is of and its memory.
+    static bool parseReport(const std::string& message, pid_t& pid, ProcessMemory& memory);
+};
+
+/// Samples the memory of processes every interval on a thread of its
+/// own, for the Admin console to tell it without reading /proc, let alone
+/// spawning processes, on every query. Processes whose memory can't be
+/// read keep what they last reported.
+class MemoryCollector
+{
+public:
+    explicit MemoryCollector(std::chrono::milliseconds interval);
+    ~MemoryCollector();
+
+    MemoryCollector(const MemoryCollector&) = delete;
+    MemoryCollector& operator=(const MemoryCollector&) = delete;
+
+    void start();
+    void stop();
+
+    /// Samples pid from now on, the first time right away.
+    void watch(pid_t pid);
+    void unwatch(pid_t pid);
+
+    /// Takes memory as the sample of pid, if watched, as reported by the
+    /// process itself.
+    void report(pid_t pid, const ProcessMemory& memory);
+
+    /// The last sample of pid, zeros if none.
+    ProcessMemory get(pid_t pid) const;
+
+    /// Samples all the processes watched.
+    void collect();
+
+private:
+    void run();
+
+    const std::chrono::milliseconds _interval;
+    mutable std::mutex _mutex;
+    std::condition_variable _stopCV;
+    /// Guarded by _mutex.
+    std::map<pid_t, ProcessMemory> _samples;
+    bool _stop;
+    std::thread _thread;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
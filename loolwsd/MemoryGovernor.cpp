@@ -0,0 +1,153 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "MemoryGovernor.hpp"
+
+namespace
+{
+    /// cgroup v1 tells of no limit with about the largest page-aligned
+    /// 64-bit value.
+    const double UnlimitedBytes = 1e18;
+
+    bool readFile(const std::string& path, std::string& content)
+    {
+        std::ifstream file(path);
+        if (!file)
+            return false;
+
+        std::ostringstream stream;
+        stream << file.rdbuf();
+        content = stream.str();
+        return true;
+    }
+
+    /// The usage of the cgroup in dir, with the files named so, or
+    /// negative if unknown.
+    double readUsageIn(const std::string& dir, const char* usageName, const char* limitName)
+    {
+        std::string usage;
+        std::string limit;
+        if (!readFile(dir + "/" + usageName, usage) || !readFile(dir + "/" + limitName, limit))
+            return -1;
+
+        return MemoryGovernor::parseUsage(usage, limit);
+    }
+}
+
+MemoryGovernor::MemoryGovernor(const double stallThreshold, const double usageThreshold,
+                               const std::chrono::seconds cooldown) :
+    _stallThreshold(stallThreshold),
+    _usageThreshold(usageThreshold),
+    _cooldown(cooldown),
+    _unloaded(false)
+{
+}
+
+bool MemoryGovernor::shouldUnload(const TimePoint now, const double stall, const double usage)
+{
+    const bool pressure = (_stallThreshold > 0 && stall > _stallThreshold) ||
+                          (_usageThreshold > 0 && usage > _usageThreshold);
+    if (!pressure || (_unloaded && now - _lastUnload < _cooldown))
+        return false;
+
+    _lastUnload = now;
+    _unloaded = true;
+    return true;
+}
+
+double MemoryGovernor::parseStall(const std::string& text)
+{
+    // some avg10=1.23 avg60=0.50 avg300=0.10 total=12345
+    // full avg10=0.00 ...
+    static const std::string Prefix = "some avg10=";
+    const size_t pos = text.find(Prefix);
+    if (pos == std::string::npos || (pos > 0 && text[pos - 1] != '\n'))
+        return -1;
+
+    const char* start = text.c_str() + pos + Prefix.size();
+    char* end = nullptr;
+    const double stall = std::strtod(start, &end);
+    return (end == start ? -1 : stall);
+}
+
+double MemoryGovernor::parseUsage(const std::string& usage, const std::string& limit)
+{
+    // cgroup v2 tells of no limit with "max".
+    char* end = nullptr;
+    const double limitBytes = std::strtod(limit.c_str(), &end);
+    if (end == limit.c_str() || limitBytes <= 0 || limitBytes >= UnlimitedBytes)
+        return -1;
+
+    const double usageBytes = std::strtod(usage.c_str(), &end);
+    if (end == usage.c_str())
+        return -1;
+
+    return usageBytes * 100 / limitBytes;
+}
+
+double MemoryGovernor::readStall()
+{
+    std::string text;
+    return (readFile("/proc/pressure/memory", text) ? parseStall(text) : -1);
+}
+
+double MemoryGovernor::readUsage()
+{
+    static const std::string Root = "/sys/fs/cgroup";
+
+    std::string cgroups;
+    readFile("/proc/self/cgroup", cgroups);
+
+    // 0::/path with v2, or 4:memory:/path with v1. In a container, the
+    // path may not be there, the cgroup being its root.
+    std::istringstream lines(cgroups);
+    std::string line;
+    while (std::getline(lines, line))
+    {
+        const size_t first = line.find(':');
+        const size_t second = line.find(':', first + 1);
+        if (first == std::string::npos || second == std::string::npos)
+            continue;
+
+        const std::string controllers = line.substr(first + 1, second - first - 1);
+        const std::string path = line.substr(second + 1);
+        double usage = -1;
+        if (controllers.empty())
+        {
+            usage = readUsageIn(Root + path, "memory.current", "memory.max");
+            if (usage < 0)
+                usage = readUsageIn(Root, "memory.current", "memory.max");
+        }
+        else if (("," + controllers + ",").find(",memory,") != std::string::npos)
+        {
+            usage = readUsageIn(Root + "/memory" + path, "memory.usage_in_bytes", "memory.limit_in_bytes");
+            if (usage < 0)
+                usage = readUsageIn(Root + "/memory", "memory.usage_in_bytes", "memory.limit_in_bytes");
+        }
+
+        if (usage >= 0)
+            return usage;
+    }
+
+    return -1;
+}
+
+bool MemoryGovernor::canUnload(const std::string& jailedPath)
+{
+    struct stat st;
+    return stat(jailedPath.c_str(), &st) == 0 && S_ISREG(st.st_mode) && st.st_nlink > 1;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,71 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_MEMORYGOVERNOR_HPP
+#define INCLUDED_MEMORYGOVERNOR_HPP
+
+#include <chrono>
+#include <string>
+
+/// Decides when the host, or the cgroup we run in, is so short of memory
+/// that a document is to be unloaded.
+///
+/// The pressure is read from the kernel's pressure stall information, the
+/// share of time processes waited for memory, and from the usage of the
+/// cgroup against its limit. Both lag behind what is freed, so documents
+/// are unloaded one at a time, a cooldown apart. Not thread-safe.
+class MemoryGovernor
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    /// Under pressure when processes stalled on memory more than
+    /// stallThreshold percent of the last 10 seconds, or the cgroup uses
+    /// more than usageThreshold percent of its limit; 0 disables either.
+    MemoryGovernor(double stallThreshold, double usageThreshold,
+                   std::chrono::seconds cooldown = std::chrono::seconds(10));
+
+    /// Whether to unload a document at now, given the percentages of
+    /// stall and usage, negative when unknown.
+    bool shouldUnload(TimePoint now, double stall, double usage);
+
+    /// The "some avg10" percentage of /proc/pressure/memory in text,
+    /// negative if not there.
+    static double parseStall(const std::string& text);
+
+    /// The percentage of limit used, from the contents of the cgroup's
+    /// files; negative if there is no limit.
+    static double parseUsage(const std::string& usage, const std::string& limit);
+
+    /// Reads the stall percentage of the host, negative if unknown.
+    static double readStall();
+
+    /// Reads the usage percentage of our cgroup, negative if unknown or
+    /// unlimited. Both cgroup v2 and v1 are read.
+    static double readUsage();
+
+    /// Whether the document loaded from jailedPath may be unloaded, which
+    /// saves it there. Only a hard link reaches its storage; the edits
+    /// saved to a copy, like those of WOPI documents, would be lost.
+    static bool canUnload(const std::string& jailedPath);
+
+    double getStallThreshold() const { return _stallThreshold; }
+    double getUsageThreshold() const { return _usageThreshold; }
+
+private:
+    const double _stallThreshold;
+    const double _usageThreshold;
+    const std::chrono::seconds _cooldown;
+    TimePoint _lastUnload;
+    bool _unloaded;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
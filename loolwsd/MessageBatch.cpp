@@ -0,0 +1,151 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "MessageBatch.hpp"
+
+namespace
+{
+    const std::string BatchPrefix = "batch: sizes=";
+
+    /// Messages of which only the latest counts.
+    const char* const SupersededCommands[] =
+    {
+        "cellcursor:", "cellformula:", "curpart:", "cursorvisible:", "graphicselection:",
+        "invalidatecursor:", "mousepointer:", "textselection:", "textselectionend:",
+        "textselectionstart:"
+    };
+
+    /// What message reports the latest of, or empty if it is never superseded.
+    std::string getSupersedeKey(const std::string& message)
+    {
+        const size_t end = std::min(message.find(' '), message.find('\n'));
+        const std::string command = message.substr(0, end);
+        if (command == "statechanged:")
+        {
+            // One per command, as in "statechanged: .uno:Bold=true".
+            const size_t equals = message.find('=');
+            if (end == std::string::npos || equals == std::string::npos ||
+                message.compare(end + 1, 5, ".uno:") != 0 || message.find('\n') < equals)
+            {
+                return std::string();
+            }
+
+            return message.substr(0, equals);
+        }
+
+        for (const char* superseded : SupersededCommands)
+        {
+            if (command == superseded)
+                return command;
+        }
+
+        return std::string();
+    }
+}
+
+void MessageBatch::add(const std::string& message)
+{
+    const std::string key = getSupersedeKey(message);
+    if (!key.empty())
+    {
+        // The prefix alone would take textselectionstart: for textselection:.
+        const auto it = std::find_if(_messages.begin(), _messages.end(),
+                                     [&key](const std::string& queued)
+                                     {
+                                         return queued.compare(0, key.size(), key) == 0 &&
+                                                getSupersedeKey(queued) == key;
+                                     });
+        if (it != _messages.end())
+        {
+            _messages.erase(it);
+            ++_dropped;
+        }
+    }
+
+    _messages.push_back(message);
+}
+
+std::string MessageBatch::take()
+{
+    std::string message;
+    if (_messages.size() == 1)
+        message.swap(_messages.front());
+    else
+        message = join(_messages);
+
+    _messages.clear();
+    return message;
+}
+
+std::string MessageBatch::join(const std::vector<std::string>& messages)
+{
+    std::string header = BatchPrefix;
+    size_t size = 0;
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        header += (i > 0 ? "," : "") + std::to_string(messages[i].size());
+        size += messages[i].size();
+    }
+
+    header += '\n';
+
+    std::string batch;
+    batch.reserve(header.size() + size);
+    batch += header;
+    for (const auto& message : messages)
+    {
+        batch += message;
+    }
+
+    return batch;
+}
+
+bool MessageBatch::split(const char* data, const size_t size, std::vector<std::string>& messages)
+{
+    const char* newline = static_cast<const char*>(std::memchr(data, '\n', size));
+    if (newline == nullptr || size < BatchPrefix.size() ||
+        BatchPrefix.compare(0, BatchPrefix.size(), data, BatchPrefix.size()) != 0)
+    {
+        return false;
+    }
+
+    std::vector<size_t> sizes;
+    size_t total = 0;
+    const char* sizeStart = data + BatchPrefix.size();
+    while (sizeStart < newline)
+    {
+        const char* sizeEnd = std::find(sizeStart, newline, ',');
+        if (sizeEnd == sizeStart || sizeEnd - sizeStart > 9 ||
+            std::find_if(sizeStart, sizeEnd, [](const char c) { return c < '0' || c > '9'; }) != sizeEnd)
+        {
+            return false;
+        }
+
+        sizes.push_back(std::stoul(std::string(sizeStart, sizeEnd)));
+        total += sizes.back();
+        sizeStart = sizeEnd + 1;
+    }
+
+    const char* payload = newline + 1;
+    if (sizes.empty() || newline[-1] == ',' || total != static_cast<size_t>(data + size - payload))
+        return false;
+
+    for (const size_t messageSize : sizes)
+    {
+        messages.emplace_back(payload, messageSize);
+        payload += messageSize;
+    }
+
+    return true;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,57 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_MESSAGEBATCH_HPP
+#define INCLUDED_MESSAGEBATCH_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/// Collects the messages of a burst of callbacks, to send them as one
+/// "batch:" message (see protocol.txt).
+///
+/// Messages that only report the latest position or state, like the
+/// cursor, the selections and the state of a command, supersede the
+/// earlier ones of their kind, which are dropped.
+class MessageBatch
+{
+public:
+    MessageBatch() :
+        _dropped(0)
+    {
+    }
+
+    /// Appends message, dropping the one it supersedes, if any.
+    void add(const std::string& message);
+
+    bool empty() const { return _messages.empty(); }
+    size_t size() const { return _messages.size(); }
+
+    /// Messages dropped as superseded so far.
+    size_t getDropped() const { return _dropped; }
+
+    /// Returns the collected messages as one message, which is a "batch:"
+    /// unless there is only one, and starts over.
+    std::string take();
+
+    static std::string join(const std::vector<std::string>& messages);
+
+    /// Appends the messages of the "batch:" message at data to messages.
+    /// Returns false if it is malformed.
+    static bool split(const char* data, size_t size, std::vector<std::string>& messages);
+
+private:
+    std::vector<std::string> _messages;
+    size_t _dropped;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -11,6 +11,8 @@
 
 #include <algorithm>
 
+#include "TileHeader.hpp"
+
 MessageQueue::~MessageQueue()
 {
     clear();
@@ -31,6 +33,22 @@ std::string MessageQueue::get()
     return get_impl();
 }
 
+bool MessageQueue::try_get(std::string& value)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!wait_impl())
+        return false;
+
+    value = get_impl();
+    return true;
+}
+
+bool MessageQueue::empty()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return !wait_impl();
+}
+
 void MessageQueue::clear()
 {
     std::unique_lock<std::mutex> lock(_mutex);
@@ -75,7 +93,10 @@ void BasicTileQueue::put_impl(const std::string& value)
                     {
                         // must not remove the tiles with 'id=', they are special, used
                         // eg. for previews etc.
-                        return (v.compare(0, 5, "tile ") == 0) && (v.find("id=") == std::string::npos);
+                        TileHeader header;
+                        return TileHeader::isBinary(v.data(), v.size()) &&
+                               header.parse(v.data(), v.size()) &&
+                               header.type == TileHeader::Type::Request && !header.hasId();
                     }
                     ),
                 _queue.end());
@@ -89,7 +110,7 @@ void BasicTileQueue::put_impl(const std::string& value)
 
 void TileQueue::put_impl(const std::string& value)
 {
-    if (value.compare(0, 5, "tile ") == 0)
+    if (TileHeader::isBinary(value.data(), value.size()))
     {
         // TODO: implement a real re-ordering here, so that the tiles closest to
         // the cursor are returned first.
@@ -33,6 +33,13 @@ public:
     /// Thread safe obtaining of the message.
     std::string get();
 
+    /// Thread safe obtaining of the message, without waiting for one.
+    /// Returns false if the queue is empty.
+    bool try_get(std::string& value);
+
+    /// Thread safe check for pending messages.
+    bool empty();
+
     /// Thread safe removal of all the pending messages.
     void clear();
 
@@ -0,0 +1,234 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include "OutboundQueue.hpp"
+#include "TileHeader.hpp"
+
+namespace
+{
+    /// The close frame, with status 1000, normal closure.
+    const char CloseFrame[] = { '\x88', 0x02, 0x03, '\xe8' };
+
+    /// The queued bytes at which Policy::Coalesce gives up on a client.
+    const size_t CoalesceHardLimitFactor = 4;
+
+    /// Whether key, of a tile:, delta: or solidtile:, is of the same tile as other.
+    bool isSameTile(const std::string& key, const std::string& other)
+    {
+        const size_t space = key.find(' ');
+        const size_t otherSpace = other.find(' ');
+        return space != std::string::npos && otherSpace != std::string::npos &&
+               key.compare(space, std::string::npos, other, otherSpace, std::string::npos) == 0;
+    }
+}
+
+OutboundQueue::OutboundQueue(const int fd, const size_t maxBytes, const Policy policy,
+                             std::function<void(bool)> setPollWrite) :
+    _fd(fd),
+    _maxBytes(maxBytes),
+    _policy(policy),
+    _setPollWrite(std::move(setPollWrite)),
+    _offset(0),
+    _pollingWrite(false),
+    _closed(false),
+    _stats({ 0, 0, 0, 0, false })
+{
+}
+
+bool OutboundQueue::push(std::vector<char> frame, const std::string& tileKey)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_closed || _stats.overflowed)
+        return false;
+
+    if (_stats.queuedBytes + frame.size() > _maxBytes)
+    {
+        // A delta needs the tile before it, but a whole tile or a solid one
+        // makes everything queued for its tile obsolete. The front frame
+        // may be partly written already, so it stays.
+        if (_policy == Policy::Coalesce && !tileKey.empty() && tileKey.compare(0, 6, "delta:") != 0)
+        {
+            for (auto it = _frames.begin() + (_offset > 0 ? 1 : 0); it != _frames.end(); )
+            {
+                if (!it->tileKey.empty() && isSameTile(it->tileKey, tileKey))
+                {
+                    _stats.queuedBytes -= it->data.size();
+                    ++_stats.coalescedTiles;
+                    it = _frames.erase(it);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+
+        const size_t limit = (_policy == Policy::Coalesce ? CoalesceHardLimitFactor * _maxBytes : _maxBytes);
+        if (_stats.queuedBytes + frame.size() > limit)
+        {
+            overflow();
+            return false;
+        }
+    }
+
+    _stats.queuedBytes += frame.size();
+    _stats.maxQueuedBytes = std::max(_stats.maxQueuedBytes, _stats.queuedBytes);
+    _frames.push_back(Frame{ std::move(frame), tileKey });
+
+    // Waiting for the socket already, it's up to flush().
+    if (!_pollingWrite && !write())
+    {
+        ::shutdown(_fd, SHUT_RDWR);
+        return false;
+    }
+
+    return true;
+}
+
+void OutboundQueue::close()
+{
+    if (push(std::vector<char>(CloseFrame, CloseFrame + sizeof(CloseFrame))))
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _closed = true;
+    }
+}
+
+bool OutboundQueue::flush()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return write();
+}
+
+OutboundQueue::Stats OutboundQueue::getStats() const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return _stats;
+}
+
+bool OutboundQueue::write()
+{
+    while (!_frames.empty())
+    {
+        const std::vector<char>& data = _frames.front().data;
+        const ssize_t written = ::send(_fd, data.data() + _offset, data.size() - _offset,
+                                       MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return false;
+
+            if (!_pollingWrite)
+            {
+                _pollingWrite = true;
+                _setPollWrite(true);
+            }
+
+            return true;
+        }
+
+        _offset += written;
+        _stats.writtenBytes += written;
+        if (_offset == data.size())
+        {
+            _stats.queuedBytes -= data.size();
+            _frames.pop_front();
+            _offset = 0;
+        }
+    }
+
+    if (_pollingWrite)
+    {
+        _pollingWrite = false;
+        _setPollWrite(false);
+    }
+
+    return true;
+}
+
+void OutboundQueue::overflow()
+{
+    _stats.overflowed = true;
+    _stats.queuedBytes = 0;
+    _frames.clear();
+    _offset = 0;
+
+    // The reader sees the end of the connection and cleans up.
+    ::shutdown(_fd, SHUT_RDWR);
+}
+
+std::vector<char> OutboundQueue::makeFrame(const int flags, const char* data, const size_t size)
+{
+    std::vector<char> frame;
+    frame.reserve(size + 10);
+    frame.push_back(static_cast<char>(flags));
+    if (size < 126)
+    {
+        frame.push_back(static_cast<char>(size));
+    }
+    else if (size <= 0xffff)
+    {
+        frame.push_back(126);
+        frame.push_back(static_cast<char>(size >> 8));
+        frame.push_back(static_cast<char>(size));
+    }
+    else
+    {
+        frame.push_back(127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+        {
+            frame.push_back(static_cast<char>(static_cast<uint64_t>(size) >> shift));
+        }
+    }
+
+    frame.insert(frame.end(), data, data + size);
+    return frame;
+}
+
+std::string OutboundQueue::getTileKey(const char* message, const size_t size)
+{
+    if (TileHeader::isBinary(message, size))
+    {
+        TileHeader header;
+        if (!header.parse(message, size) || header.type == TileHeader::Type::Request)
+            return std::string();
+
+        return std::string(header.getCommand()) + ' ' + header.getDescription();
+    }
+
+    const char* end = std::find(message, message + size, '\n');
+    const std::string firstLine(message, end);
+    if (firstLine.compare(0, 6, "tile: ") != 0 && firstLine.compare(0, 7, "delta: ") != 0 &&
+        firstLine.compare(0, 11, "solidtile: ") != 0)
+    {
+        return std::string();
+    }
+
+    // The command, then part, width, height, tileposx, tileposy, tilewidth and tileheight.
+    size_t pos = 0;
+    for (int token = 0; token < 8 && pos != std::string::npos; ++token)
+    {
+        pos = firstLine.find(' ', pos + 1);
+    }
+
+    return firstLine.substr(0, pos);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
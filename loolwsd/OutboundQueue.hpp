@@ -0,0 +1,107 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_OUTBOUNDQUEUE_HPP
+#define INCLUDED_OUTBOUNDQUEUE_HPP
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// The WebSocket frames waiting to be written to a client.
+///
+/// Senders queue their frames and return; the queue writes what the
+/// socket takes without blocking, and leaves the rest to the I/O layer,
+/// which calls flush() when the socket is writable again. A slow client
+/// thus never holds up the threads sending to it, only its queue grows,
+/// up to a limit.
+class OutboundQueue
+{
+public:
+    /// What happens when more than the limit is queued.
+    enum class Policy
+    {
+        /// A tile replaces the queued, not yet started, frames of the same
+        /// tile. The client is disconnected at four times the limit.
+        Coalesce,
+        /// The client is disconnected.
+        Disconnect
+    };
+
+    struct Stats
+    {
+        size_t queuedBytes;
+        size_t maxQueuedBytes;
+        size_t writtenBytes;
+        /// Tiles replaced by newer renderings before they went out.
+        size_t coalescedTiles;
+        /// Whether the client was disconnected for being too slow.
+        bool overflowed;
+    };
+
+    /// fd is the socket. setPollWrite is called, with the queue locked,
+    /// with true when the socket is full and flush() is needed once it is
+    /// writable, and with false when everything is written.
+    OutboundQueue(int fd, size_t maxBytes, Policy policy, std::function<void(bool)> setPollWrite);
+
+    OutboundQueue(const OutboundQueue&) = delete;
+    OutboundQueue& operator=(const OutboundQueue&) = delete;
+
+    /// Queues frame, made by makeFrame(); tileKey is getTileKey() of its
+    /// message. Returns false if the frame is dropped because the queue
+    /// overflowed, in which case the connection is shut down.
+    bool push(std::vector<char> frame, const std::string& tileKey = std::string());
+
+    /// Queues a close frame, the last one.
+    void close();
+
+    /// Writes what the socket takes. Returns false on errors.
+    bool flush();
+
+    Stats getStats() const;
+
+    /// A WebSocket frame as the server sends it, unmasked. flags are
+    /// those of the first byte, as in Poco::Net::WebSocket::FrameFlags.
+    static std::vector<char> makeFrame(int flags, const char* data, size_t size);
+
+    /// What identifies the tile of a tile:, delta: or solidtile: message,
+    /// in text or binary form, for coalescing; empty for other messages.
+    static std::string getTileKey(const char* message, size_t size);
+
+private:
+    struct Frame
+    {
+        std::vector<char> data;
+        std::string tileKey;
+    };
+
+    /// Writes from the queue until the socket is full. Called locked.
+    bool write();
+    void overflow();
+
+    const int _fd;
+    const size_t _maxBytes;
+    const Policy _policy;
+    const std::function<void(bool)> _setPollWrite;
+
+    mutable std::mutex _mutex;
+    std::deque<Frame> _frames;
+    /// Bytes of the front frame already written.
+    size_t _offset;
+    bool _pollingWrite;
+    bool _closed;
+    Stats _stats;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
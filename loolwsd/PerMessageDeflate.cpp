@@ -0,0 +1,254 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+
+#include "PerMessageDeflate.hpp"
+
+namespace
+{
+    /// A compressed message leaves out the end of the sync flush.
+    const char FlushTail[] = { 0x00, 0x00, '\xff', '\xff' };
+
+    const int MaxWindowBits = 15;
+
+    std::string trim(const std::string& text)
+    {
+        const size_t start = text.find_first_not_of(" \t");
+        if (start == std::string::npos)
+            return std::string();
+
+        return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+    }
+
+    std::vector<std::string> split(const std::string& text, const char separator)
+    {
+        std::vector<std::string> parts;
+        size_t start = 0;
+        while (start <= text.size())
+        {
+            size_t end = text.find(separator, start);
+            if (end == std::string::npos)
+                end = text.size();
+
+            parts.push_back(trim(text.substr(start, end - start)));
+            start = end + 1;
+        }
+
+        return parts;
+    }
+
+    /// The window bits given as value, or -1 if not valid.
+    int parseWindowBits(std::string value)
+    {
+        if (value.size() > 2 && value.front() == '"' && value.back() == '"')
+            value = value.substr(1, value.size() - 2);
+
+        if (value.empty() || value.size() > 2 ||
+            value.find_first_not_of("0123456789") != std::string::npos)
+        {
+            return -1;
+        }
+
+        const int bits = std::stoi(value);
+        return (bits >= 8 && bits <= MaxWindowBits ? bits : -1);
+    }
+
+    /// Inflates size bytes at data into output after its first written
+    /// bytes; fails if that grows beyond maxSize.
+    bool inflateInto(z_stream& stream, const char* data, const size_t size, const size_t maxSize,
+                     std::vector<char>& output, size_t& written)
+    {
+        stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream.avail_in = size;
+        do
+        {
+            if (written == output.size())
+            {
+                if (output.size() > maxSize)
+                    return false;
+
+                output.resize(std::min(output.size() * 2, maxSize + 1));
+            }
+
+            stream.next_out = reinterpret_cast<Bytef*>(output.data() + written);
+            stream.avail_out = output.size() - written;
+            const int result = inflate(&stream, Z_SYNC_FLUSH);
+            written = output.size() - stream.avail_out;
+            if (result == Z_STREAM_END)
+            {
+                // A final block; whatever follows starts afresh.
+                inflateReset(&stream);
+            }
+            else if (result == Z_BUF_ERROR && stream.avail_out > 0)
+            {
+                break;
+            }
+            else if (result != Z_OK && result != Z_BUF_ERROR)
+            {
+                return false;
+            }
+        }
+        while (stream.avail_in > 0 || stream.avail_out == 0);
+
+        return written <= maxSize;
+    }
+}
+
+namespace PerMessageDeflate
+{
+    bool negotiate(const std::string& offers, Parameters& parameters, std::string& response)
+    {
+        for (const auto& offer : split(offers, ','))
+        {
+            const std::vector<std::string> tokens = split(offer, ';');
+            if (tokens[0] != "permessage-deflate")
+                continue;
+
+            Parameters agreed = { false, false, MaxWindowBits };
+            std::string answer = "permessage-deflate";
+            std::set<std::string> seen;
+            bool valid = true;
+            for (size_t i = 1; i < tokens.size() && valid; ++i)
+            {
+                std::string name = tokens[i];
+                std::string value;
+                const size_t equals = name.find('=');
+                if (equals != std::string::npos)
+                {
+                    value = trim(name.substr(equals + 1));
+                    name = trim(name.substr(0, equals));
+                }
+
+                if (!seen.insert(name).second)
+                {
+                    valid = false;
+                }
+                else if (name == "server_no_context_takeover" && equals == std::string::npos)
+                {
+                    agreed.serverNoContextTakeover = true;
+                    answer += "; server_no_context_takeover";
+                }
+                else if (name == "client_no_context_takeover" && equals == std::string::npos)
+                {
+                    agreed.clientNoContextTakeover = true;
+                    answer += "; client_no_context_takeover";
+                }
+                else if (name == "server_max_window_bits")
+                {
+                    // zlib can't deflate with a window of 256 bytes.
+                    agreed.serverMaxWindowBits = parseWindowBits(value);
+                    valid = (agreed.serverMaxWindowBits >= 9);
+                    answer += "; server_max_window_bits=" + std::to_string(agreed.serverMaxWindowBits);
+                }
+                else if (name == "client_max_window_bits")
+                {
+                    // We inflate with the largest window anyway.
+                    valid = (equals == std::string::npos || parseWindowBits(value) > 0);
+                }
+                else
+                {
+                    valid = false;
+                }
+            }
+
+            if (valid)
+            {
+                parameters = agreed;
+                response = answer;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    Deflater::Deflater(const Parameters& parameters) :
+        _stream(),
+        _noContextTakeover(parameters.serverNoContextTakeover),
+        _inputBytes(0),
+        _outputBytes(0)
+    {
+        if (deflateInit2(&_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -parameters.serverMaxWindowBits,
+                         8, Z_DEFAULT_STRATEGY) != Z_OK)
+        {
+            throw std::runtime_error("Failed to initialize the message compressor.");
+        }
+    }
+
+    Deflater::~Deflater()
+    {
+        deflateEnd(&_stream);
+    }
+
+    void Deflater::compress(const char* data, const size_t size, std::vector<char>& output)
+    {
+        output.resize(deflateBound(&_stream, size) + sizeof(FlushTail));
+        _stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        _stream.avail_in = size;
+
+        size_t written = 0;
+        do
+        {
+            if (written == output.size())
+                output.resize(output.size() * 2);
+
+            _stream.next_out = reinterpret_cast<Bytef*>(output.data() + written);
+            _stream.avail_out = output.size() - written;
+            deflate(&_stream, Z_SYNC_FLUSH);
+            written = output.size() - _stream.avail_out;
+        }
+        while (_stream.avail_out == 0);
+
+        if (written >= sizeof(FlushTail) &&
+            std::memcmp(output.data() + written - sizeof(FlushTail), FlushTail, sizeof(FlushTail)) == 0)
+        {
+            written -= sizeof(FlushTail);
+        }
+
+        output.resize(written);
+        if (_noContextTakeover)
+            deflateReset(&_stream);
+
+        _inputBytes += size;
+        _outputBytes += written;
+    }
+
+    Inflater::Inflater(const Parameters& parameters) :
+        _stream(),
+        _noContextTakeover(parameters.clientNoContextTakeover)
+    {
+        if (inflateInit2(&_stream, -MaxWindowBits) != Z_OK)
+            throw std::runtime_error("Failed to initialize the message decompressor.");
+    }
+
+    Inflater::~Inflater()
+    {
+        inflateEnd(&_stream);
+    }
+
+    bool Inflater::decompress(const char* data, const size_t size, const size_t maxSize, std::vector<char>& output)
+    {
+        output.resize(std::min(std::max<size_t>(size * 4, 1024), maxSize + 1));
+        size_t written = 0;
+        const bool valid = inflateInto(_stream, data, size, maxSize, output, written) &&
+                           inflateInto(_stream, FlushTail, sizeof(FlushTail), maxSize, output, written);
+
+        output.resize(written);
+        if (_noContextTakeover || !valid)
+            inflateReset(&_stream);
+
+        return valid;
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
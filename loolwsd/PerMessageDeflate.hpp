@@ -0,0 +1,95 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_PERMESSAGEDEFLATE_HPP
+#define INCLUDED_PERMESSAGEDEFLATE_HPP
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+/// The permessage-deflate WebSocket extension (RFC 7692).
+///
+/// Messages are compressed one after the other into a single deflate
+/// stream, unless a side asks for no context takeover, so repeated text
+/// like command names and JSON keys costs next to nothing after its first
+/// occurrence.
+namespace PerMessageDeflate
+{
+    /// RSV1, set on the first frame of a compressed message.
+    constexpr int FrameFlagCompressed = 0x40;
+
+    /// Text messages shorter than this are sent as they are.
+    constexpr size_t MinCompressedSize = 64;
+
+    /// What was agreed on in the handshake.
+    struct Parameters
+    {
+        /// We reset our compressor after each message.
+        bool serverNoContextTakeover;
+        /// The client resets its compressor after each message.
+        bool clientNoContextTakeover;
+        /// The window of our compressor, 9 to 15.
+        int serverMaxWindowBits;
+    };
+
+    /// Picks the first offer in the Sec-WebSocket-Extensions header of a
+    /// client that we support. Returns false if there is none, otherwise
+    /// sets parameters and the Sec-WebSocket-Extensions header to answer.
+    bool negotiate(const std::string& offers, Parameters& parameters, std::string& response);
+
+    /// Compresses the messages we send.
+    class Deflater
+    {
+    public:
+        explicit Deflater(const Parameters& parameters);
+        ~Deflater();
+
+        Deflater(const Deflater&) = delete;
+        Deflater& operator=(const Deflater&) = delete;
+
+        /// Sets output to the payload of the compressed message.
+        void compress(const char* data, size_t size, std::vector<char>& output);
+
+        /// Bytes given to compress() and bytes it produced.
+        size_t getInputBytes() const { return _inputBytes; }
+        size_t getOutputBytes() const { return _outputBytes; }
+
+    private:
+        z_stream _stream;
+        const bool _noContextTakeover;
+        size_t _inputBytes;
+        size_t _outputBytes;
+    };
+
+    /// Decompresses the messages we receive.
+    class Inflater
+    {
+    public:
+        explicit Inflater(const Parameters& parameters);
+        ~Inflater();
+
+        Inflater(const Inflater&) = delete;
+        Inflater& operator=(const Inflater&) = delete;
+
+        /// Sets output to the message whose compressed payload is at data.
+        /// Returns false if it is corrupt or inflates beyond maxSize.
+        bool decompress(const char* data, size_t size, size_t maxSize, std::vector<char>& output);
+
+    private:
+        z_stream _stream;
+        const bool _noContextTakeover;
+    };
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,426 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIXEL_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "Pixel.hpp"
+
+namespace
+{
+    /// Unpremultiply lookup: Table[alpha * 256 + channel].
+    /// Replaces the three divisions per pixel of the original transform,
+    /// including its truncation for malformed (channel > alpha) input.
+    const uint8_t* getUnpremultiplyTable()
+    {
+        static const std::vector<uint8_t> Table = []()
+        {
+            std::vector<uint8_t> table(256 * 256, 0);
+            for (unsigned alpha = 1; alpha < 256; ++alpha)
+            {
+                for (unsigned channel = 0; channel < 256; ++channel)
+                {
+                    table[alpha * 256 + channel] = static_cast<uint8_t>((channel * 255 + alpha / 2) / alpha);
+                }
+            }
+
+            return table;
+        }();
+
+        return Table.data();
+    }
+
+    inline
+    void unpremultiplyPixel(const uint8_t* table, const unsigned char* src, unsigned char* dst)
+    {
+        uint32_t pixel;
+        std::memcpy(&pixel, src, sizeof(uint32_t));
+        const uint8_t alpha = (pixel & 0xff000000) >> 24;
+        const uint8_t* row = table + alpha * 256;
+        dst[0] = alpha ? row[(pixel & 0xff0000) >> 16] : 0;
+        dst[1] = alpha ? row[(pixel & 0x00ff00) >>  8] : 0;
+        dst[2] = alpha ? row[(pixel & 0x0000ff) >>  0] : 0;
+        dst[3] = alpha;
+    }
+
+    void unpremultiplyScalar(const unsigned char* src, unsigned char* dst, size_t pixels)
+    {
+        const uint8_t* table = getUnpremultiplyTable();
+        for (size_t i = 0; i < pixels; ++i)
+        {
+            unpremultiplyPixel(table, src + i * 4, dst + i * 4);
+        }
+    }
+
+    void swizzleScalar(const unsigned char* src, unsigned char* dst, size_t pixels)
+    {
+        for (size_t i = 0; i < pixels * 4; i += 4)
+        {
+            const unsigned char b = src[i];
+            dst[i] = src[i + 2];
+            dst[i + 1] = src[i + 1];
+            dst[i + 2] = b;
+            dst[i + 3] = src[i + 3];
+        }
+    }
+
+    bool isUniformScalar(const unsigned char* pixels, size_t count, const uint32_t pixel)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t other;
+            std::memcpy(&other, pixels + i * 4, sizeof(uint32_t));
+            if (other != pixel)
+                return false;
+        }
+
+        return true;
+    }
+
+#ifdef PIXEL_HAVE_X86
+    // Rendered tiles are overwhelmingly made of fully opaque or fully
+    // transparent pixels. For those, unpremultiplying is a plain R/B swap
+    // (or all zeros), which vectorizes trivially. Blocks containing any
+    // partially transparent pixel fall back to the lookup table.
+
+    __attribute__((target("sse2")))
+    inline __m128i swizzle128(const __m128i px)
+    {
+        const __m128i ag = _mm_and_si128(px, _mm_set1_epi32(0xff00ff00));
+        const __m128i rb = _mm_and_si128(px, _mm_set1_epi32(0x00ff00ff));
+        return _mm_or_si128(ag, _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16)));
+    }
+
+    __attribute__((target("sse2")))
+    void unpremultiplySSE2(const unsigned char* src, unsigned char* dst, size_t pixels)
+    {
+        const uint8_t* table = getUnpremultiplyTable();
+        const __m128i opaque = _mm_set1_epi32(0xff);
+        const __m128i zero = _mm_setzero_si128();
+
+        size_t i = 0;
+        for (; i + 4 <= pixels; i += 4)
+        {
+            const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+            const __m128i alpha = _mm_srli_epi32(px, 24);
+            const __m128i isOpaque = _mm_cmpeq_epi32(alpha, opaque);
+            const __m128i isTransparent = _mm_cmpeq_epi32(alpha, zero);
+            if (_mm_movemask_epi8(_mm_or_si128(isOpaque, isTransparent)) == 0xffff)
+            {
+                const __m128i out = _mm_andnot_si128(isTransparent, swizzle128(px));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), out);
+            }
+            else
+            {
+                for (size_t j = i; j < i + 4; ++j)
+                {
+                    unpremultiplyPixel(table, src + j * 4, dst + j * 4);
+                }
+            }
+        }
+
+        for (; i < pixels; ++i)
+        {
+            unpremultiplyPixel(table, src + i * 4, dst + i * 4);
+        }
+    }
+
+    __attribute__((target("sse2")))
+    void swizzleSSE2(const unsigned char* src, unsigned char* dst, size_t pixels)
+    {
+        size_t i = 0;
+        for (; i + 4 <= pixels; i += 4)
+        {
+            const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 4));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 4), swizzle128(px));
+        }
+
+        swizzleScalar(src + i * 4, dst + i * 4, pixels - i);
+    }
+
+    __attribute__((target("sse2")))
+    bool isUniformSSE2(const unsigned char* pixels, size_t count, const uint32_t pixel)
+    {
+        const __m128i expected = _mm_set1_epi32(pixel);
+
+        // 16 pixels per iteration, bailing out early on the first difference.
+        size_t i = 0;
+        for (; i + 16 <= count; i += 16)
+        {
+            const __m128i* p = reinterpret_cast<const __m128i*>(pixels + i * 4);
+            const __m128i a = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128(p), expected),
+                                            _mm_cmpeq_epi32(_mm_loadu_si128(p + 1), expected));
+            const __m128i b = _mm_and_si128(_mm_cmpeq_epi32(_mm_loadu_si128(p + 2), expected),
+                                            _mm_cmpeq_epi32(_mm_loadu_si128(p + 3), expected));
+            if (_mm_movemask_epi8(_mm_and_si128(a, b)) != 0xffff)
+                return false;
+        }
+
+        return isUniformScalar(pixels + i * 4, count - i, pixel);
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i swizzle256(const __m256i px)
+    {
+        const __m256i ag = _mm256_and_si256(px, _mm256_set1_epi32(0xff00ff00));
+        const __m256i rb = _mm256_and_si256(px, _mm256_set1_epi32(0x00ff00ff));
+        return _mm256_or_si256(ag, _mm256_or_si256(_mm256_slli_epi32(rb, 16), _mm256_srli_epi32(rb, 16)));
+    }
+
+    __attribute__((target("avx2")))
+    void unpremultiplyAVX2(const unsigned char* src, unsigned char* dst, size_t pixels)
+    {
+        const uint8_t* table = getUnpremultiplyTable();
+        const __m256i opaque = _mm256_set1_epi32(0xff);
+        const __m256i zero = _mm256_setzero_si256();
+
+        size_t i = 0;
+        for (; i + 8 <= pixels; i += 8)
+        {
+            const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+            const __m256i alpha = _mm256_srli_epi32(px, 24);
+            const __m256i isOpaque = _mm256_cmpeq_epi32(alpha, opaque);
+            const __m256i isTransparent = _mm256_cmpeq_epi32(alpha, zero);
+            if (_mm256_movemask_epi8(_mm256_or_si256(isOpaque, isTransparent)) == -1)
+            {
+                const __m256i out = _mm256_andnot_si256(isTransparent, swizzle256(px));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), out);
+            }
+            else
+            {
+                for (size_t j = i; j < i + 8; ++j)
+                {
+                    unpremultiplyPixel(table, src + j * 4, dst + j * 4);
+                }
+            }
+        }
+
+        for (; i < pixels; ++i)
+        {
+            unpremultiplyPixel(table, src + i * 4, dst + i * 4);
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void swizzleAVX2(const unsigned char* src, unsigned char* dst, size_t pixels)
+    {
+        size_t i = 0;
+        for (; i + 8 <= pixels; i += 8)
+        {
+            const __m256i px = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i * 4), swizzle256(px));
+        }
+
+        swizzleScalar(src + i * 4, dst + i * 4, pixels - i);
+    }
+
+    __attribute__((target("avx2")))
+    bool isUniformAVX2(const unsigned char* pixels, size_t count, const uint32_t pixel)
+    {
+        const __m256i expected = _mm256_set1_epi32(pixel);
+
+        size_t i = 0;
+        for (; i + 32 <= count; i += 32)
+        {
+            const __m256i* p = reinterpret_cast<const __m256i*>(pixels + i * 4);
+            const __m256i a = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256(p), expected),
+                                               _mm256_cmpeq_epi32(_mm256_loadu_si256(p + 1), expected));
+            const __m256i b = _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_loadu_si256(p + 2), expected),
+                                               _mm256_cmpeq_epi32(_mm256_loadu_si256(p + 3), expected));
+            if (_mm256_movemask_epi8(_mm256_and_si256(a, b)) != -1)
+                return false;
+        }
+
+        return isUniformScalar(pixels + i * 4, count - i, pixel);
+    }
+#endif
+
+    Pixel::Kernel detectKernel()
+    {
+#ifdef PIXEL_HAVE_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return Pixel::Kernel::AVX2;
+        if (__builtin_cpu_supports("sse2"))
+            return Pixel::Kernel::SSE2;
+#endif
+        return Pixel::Kernel::Scalar;
+    }
+}
+
+namespace Pixel
+{
+    Kernel getBestKernel()
+    {
+        static const Kernel Best = detectKernel();
+        return Best;
+    }
+
+    bool isKernelSupported(const Kernel kernel)
+    {
+        switch (kernel)
+        {
+        case Kernel::Scalar:
+            return true;
+        case Kernel::SSE2:
+            return getBestKernel() != Kernel::Scalar;
+        case Kernel::AVX2:
+            return getBestKernel() == Kernel::AVX2;
+        }
+
+        return false;
+    }
+
+    const char* kernelName(const Kernel kernel)
+    {
+        switch (kernel)
+        {
+        case Kernel::Scalar:
+            return "scalar";
+        case Kernel::SSE2:
+            return "sse2";
+        case Kernel::AVX2:
+            return "avx2";
+        }
+
+        return "unknown";
+    }
+
+    void unpremultiplyRow(const unsigned char* src, unsigned char* dst, const size_t pixels)
+    {
+        unpremultiplyRow(src, dst, pixels, getBestKernel());
+    }
+
+    void unpremultiplyRow(const unsigned char* src, unsigned char* dst, const size_t pixels, const Kernel kernel)
+    {
+        switch (kernel)
+        {
+#ifdef PIXEL_HAVE_X86
+        case Kernel::AVX2:
+            unpremultiplyAVX2(src, dst, pixels);
+            return;
+        case Kernel::SSE2:
+            unpremultiplySSE2(src, dst, pixels);
+            return;
+#endif
+        default:
+            unpremultiplyScalar(src, dst, pixels);
+            return;
+        }
+    }
+
+    void swizzleRow(const unsigned char* src, unsigned char* dst, const size_t pixels)
+    {
+        swizzleRow(src, dst, pixels, getBestKernel());
+    }
+
+    void swizzleRow(const unsigned char* src, unsigned char* dst, const size_t pixels, const Kernel kernel)
+    {
+        switch (kernel)
+        {
+#ifdef PIXEL_HAVE_X86
+        case Kernel::AVX2:
+            swizzleAVX2(src, dst, pixels);
+            return;
+        case Kernel::SSE2:
+            swizzleSSE2(src, dst, pixels);
+            return;
+#endif
+        default:
+            swizzleScalar(src, dst, pixels);
+            return;
+        }
+    }
+
+    bool isUniform(const unsigned char* pixels, const size_t count, uint32_t& pixel)
+    {
+        return isUniform(pixels, count, pixel, getBestKernel());
+    }
+
+    bool isUniform(const unsigned char* pixels, const size_t count, uint32_t& pixel, const Kernel kernel)
+    {
+        if (count == 0)
+            return false;
+
+        std::memcpy(&pixel, pixels, sizeof(uint32_t));
+        switch (kernel)
+        {
+#ifdef PIXEL_HAVE_X86
+        case Kernel::AVX2:
+            return isUniformAVX2(pixels, count, pixel);
+        case Kernel::SSE2:
+            return isUniformSSE2(pixels, count, pixel);
+#endif
+        default:
+            return isUniformScalar(pixels, count, pixel);
+        }
+    }
+
+    bool getChangedRect(const unsigned char* before, const unsigned char* after, const int width, const int height,
+                        int& x, int& y, int& changedWidth, int& changedHeight)
+    {
+        const size_t stride = width * 4;
+
+        // memcmp is vectorized by libc, so whole rows are compared first.
+        int top = 0;
+        while (top < height && std::memcmp(before + top * stride, after + top * stride, stride) == 0)
+        {
+            ++top;
+        }
+
+        if (top == height)
+            return false;
+
+        int bottom = height - 1;
+        while (bottom > top && std::memcmp(before + bottom * stride, after + bottom * stride, stride) == 0)
+        {
+            --bottom;
+        }
+
+        // Narrow down the columns, only scanning what isn't known to be changed yet.
+        int left = width - 1;
+        int right = 0;
+        for (int row = top; row <= bottom; ++row)
+        {
+            const uint32_t* b = reinterpret_cast<const uint32_t*>(before + row * stride);
+            const uint32_t* a = reinterpret_cast<const uint32_t*>(after + row * stride);
+            for (int col = 0; col < left; ++col)
+            {
+                if (b[col] != a[col])
+                {
+                    left = col;
+                    break;
+                }
+            }
+
+            for (int col = width - 1; col > right; --col)
+            {
+                if (b[col] != a[col])
+                {
+                    right = col;
+                    break;
+                }
+            }
+        }
+
+        x = left;
+        y = top;
+        changedWidth = right - left + 1;
+        changedHeight = bottom - top + 1;
+        return true;
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
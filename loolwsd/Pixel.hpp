@@ -0,0 +1,61 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_PIXEL_HPP
+#define INCLUDED_PIXEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+/// Row-wise pixel format conversion kernels used before handing
+/// rendered tiles to the PNG encoder.
+namespace Pixel
+{
+    /// Implementations of the conversion kernels.
+    enum class Kernel
+    {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    /// Returns the fastest kernel supported by the running CPU.
+    Kernel getBestKernel();
+
+    /// Returns true if the given kernel can run on this CPU.
+    bool isKernelSupported(Kernel kernel);
+
+    /// Returns a printable name of the kernel.
+    const char* kernelName(Kernel kernel);
+
+    /// Unpremultiplies native-endian ARGB (BGRA bytes on little endian)
+    /// and converts to RGBA bytes, as produced by LOK_TILEMODE_BGRA.
+    /// The output is bit-exact with the cairo-derived unpremultiply_data.
+    /// src and dst may be the same buffer.
+    void unpremultiplyRow(const unsigned char* src, unsigned char* dst, size_t pixels);
+    void unpremultiplyRow(const unsigned char* src, unsigned char* dst, size_t pixels, Kernel kernel);
+
+    /// Swaps the red and blue channels, without touching alpha.
+    /// src and dst may be the same buffer.
+    void swizzleRow(const unsigned char* src, unsigned char* dst, size_t pixels);
+    void swizzleRow(const unsigned char* src, unsigned char* dst, size_t pixels, Kernel kernel);
+
+    /// Returns true if all the 32-bit pixels are the same, storing it in pixel.
+    bool isUniform(const unsigned char* pixels, size_t count, uint32_t& pixel);
+    bool isUniform(const unsigned char* pixels, size_t count, uint32_t& pixel, Kernel kernel);
+
+    /// Finds the bounding rectangle of the pixels that differ between
+    /// two width x height 32-bit pixmaps. Returns false if they are equal.
+    bool getChangedRect(const unsigned char* before, const unsigned char* after, int width, int height,
+                        int& x, int& y, int& changedWidth, int& changedHeight);
+}
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
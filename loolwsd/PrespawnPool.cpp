@@ -0,0 +1,129 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cmath>
+
+#include "PrespawnPool.hpp"
+
+const int PrespawnPool::DefaultSpawnMs;
+
+namespace
+{
+    /// The weight of a new spawn time sample.
+    const double SpawnWeight = 0.25;
+
+    /// The pool covers this many times the opens expected while spawning,
+    /// for bursts.
+    const double Headroom = 2.0;
+
+    /// For a whole share not to be rounded down.
+    const double Epsilon = 1e-9;
+
+    double seconds(const PrespawnPool::TimePoint from, const PrespawnPool::TimePoint to)
+    {
+        return std::max(0.0, std::chrono::duration<double>(to - from).count());
+    }
+}
+
+PrespawnPool::PrespawnPool(const size_t minSize, const size_t maxSize, const std::chrono::seconds rateWindow) :
+    _minSize(minSize),
+    _maxSize(std::max(minSize, maxSize)),
+    _window(std::max(1.0, static_cast<double>(rateWindow.count()))),
+    _rates(),
+    _rateTime(std::chrono::steady_clock::now()),
+    _spawnMs(DefaultSpawnMs),
+    _spawnSampled(false),
+    _hits(0),
+    _misses(0)
+{
+}
+
+void PrespawnPool::recordOpen(const TimePoint now, const bool hit, const DocumentFamily::Type family)
+{
+    // Each open adds 1/window to a rate decaying over window; a steady
+    // rate r thus converges to r.
+    decay(now);
+    _rates[static_cast<size_t>(family)] += 1.0 / _window;
+
+    if (hit)
+        ++_hits;
+    else
+        ++_misses;
+}
+
+void PrespawnPool::recordSpawn(const std::chrono::milliseconds duration)
+{
+    const double sample = static_cast<double>(duration.count());
+    _spawnMs = (_spawnSampled ? SpawnWeight * sample + (1 - SpawnWeight) * _spawnMs : sample);
+    _spawnSampled = true;
+}
+
+double PrespawnPool::getRate(const TimePoint now) const
+{
+    double rate = 0;
+    for (const auto familyRate : _rates)
+        rate += familyRate;
+
+    return rate * getDecay(now);
+}
+
+double PrespawnPool::getRate(const TimePoint now, const DocumentFamily::Type family) const
+{
+    return _rates[static_cast<size_t>(family)] * getDecay(now);
+}
+
+size_t PrespawnPool::getTarget(const TimePoint now) const
+{
+    const double expected = getRate(now) * _spawnMs / 1000 * Headroom;
+    const size_t target = static_cast<size_t>(std::ceil(std::min(expected, static_cast<double>(_maxSize))));
+    return std::min(std::max(target, _minSize), _maxSize);
+}
+
+size_t PrespawnPool::getTarget(const TimePoint now, const DocumentFamily::Type family) const
+{
+    const size_t total = getTarget(now);
+    const double rate = getRate(now);
+    if (rate <= 0)
+        return (family == DocumentFamily::Type::Generic ? total : 0);
+
+    // Rounding the shares down leaves the rest to the generic kits: the
+    // pool when the demand is low or mixed, and what has no family.
+    size_t specialized = 0;
+    for (size_t i = 0; i < DocumentFamily::Count; ++i)
+    {
+        const auto type = static_cast<DocumentFamily::Type>(i);
+        if (type == DocumentFamily::Type::Generic)
+            continue;
+
+        const size_t share = static_cast<size_t>(std::floor(total * getRate(now, type) / rate + Epsilon));
+        if (type == family)
+            return share;
+
+        specialized += share;
+    }
+
+    return total - std::min(specialized, total);
+}
+
+void PrespawnPool::decay(const TimePoint now)
+{
+    const double factor = getDecay(now);
+    for (auto& rate : _rates)
+        rate *= factor;
+
+    _rateTime = std::max(_rateTime, now);
+}
+
+double PrespawnPool::getDecay(const TimePoint now) const
+{
+    return std::exp(-seconds(_rateTime, now) / _window);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
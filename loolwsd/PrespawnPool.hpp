@@ -0,0 +1,86 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_PRESPAWNPOOL_HPP
+#define INCLUDED_PRESPAWNPOOL_HPP
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+#include "DocumentFamily.hpp"
+
+/// Sizes the pool of empty kits the broker keeps warm from the demand:
+/// enough of them to take the documents opened while replacements spawn,
+/// within the bounds given.
+///
+/// The rate of opening is an exponentially weighted one, decaying with
+/// time when nothing is opened, so the pool shrinks back when idle; the
+/// time to spawn a kit is an exponentially weighted average of its
+/// samples. The pool is split between the families of documents by their
+/// share of the demand, the rest of it being generic kits. Not thread-safe.
+class PrespawnPool
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    PrespawnPool(size_t minSize, size_t maxSize,
+                 std::chrono::seconds rateWindow = std::chrono::seconds(60));
+
+    /// A new document of family is opened: in a warm kit if hit, else it
+    /// waits for one to spawn.
+    void recordOpen(TimePoint now, bool hit,
+                    DocumentFamily::Type family = DocumentFamily::Type::Generic);
+
+    /// A kit took duration from being spawned to being ready.
+    void recordSpawn(std::chrono::milliseconds duration);
+
+    /// How many empty kits to keep at now.
+    size_t getTarget(TimePoint now) const;
+
+    /// How many of those to warm up for family: its share of the demand,
+    /// rounded down. Generic kits make up the rest.
+    size_t getTarget(TimePoint now, DocumentFamily::Type family) const;
+
+    /// Documents opened per second, as of now.
+    double getRate(TimePoint now) const;
+
+    /// Documents of family opened per second, as of now.
+    double getRate(TimePoint now, DocumentFamily::Type family) const;
+
+    std::chrono::milliseconds getSpawnTime() const { return std::chrono::milliseconds(static_cast<long long>(_spawnMs)); }
+    size_t getMinSize() const { return _minSize; }
+    size_t getMaxSize() const { return _maxSize; }
+    unsigned getHits() const { return _hits; }
+    unsigned getMisses() const { return _misses; }
+
+    /// Spawn time assumed until the first kit is ready.
+    static const int DefaultSpawnMs = 3000;
+
+private:
+    /// Brings the rates to now.
+    void decay(TimePoint now);
+
+    /// What is left of the rates at now.
+    double getDecay(TimePoint now) const;
+
+    const size_t _minSize;
+    const size_t _maxSize;
+    const double _window;
+    std::array<double, DocumentFamily::Count> _rates;
+    TimePoint _rateTime;
+    double _spawnMs;
+    bool _spawnSampled;
+    unsigned _hits;
+    unsigned _misses;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,191 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Micro-benchmark of parsing and dispatching protocol messages: the
+// Poco::StringTokenizer and string comparison way against Tokenizer and
+// the command table. Doesn't need LibreOffice or a running server.
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <Poco/StringTokenizer.h>
+
+#include "Command.hpp"
+#include "TileHeader.hpp"
+#include "Tokenizer.hpp"
+
+namespace
+{
+    /// What a session typically receives, mostly input and tiles.
+    const char* const Messages[] =
+    {
+        "mouse type=move x=1280 y=3420 count=1 buttons=0 modifier=0",
+        "mouse type=buttondown x=1280 y=3420 count=1 buttons=1 modifier=0",
+        "mouse type=buttonup x=1280 y=3420 count=1 buttons=1 modifier=0",
+        "key type=input char=97 key=0",
+        "key type=up char=0 key=512",
+        "tile part=0 width=256 height=256 tileposx=0 tileposy=3840 tilewidth=3840 tileheight=3840",
+        "tile part=0 width=256 height=256 tileposx=3840 tileposy=3840 tilewidth=3840 tileheight=3840 oldver=12",
+        "clientvisiblearea x=0 y=0 width=23040 height=11520",
+        "uno .uno:Bold",
+        "canceltiles",
+        "status",
+        "selecttext type=end x=5120 y=3420",
+    };
+
+    /// The previous getTokenInteger(), for comparison.
+    bool getTokenIntegerWithStoi(const std::string& token, const std::string& name, int& value)
+    {
+        size_t nextIdx;
+        try
+        {
+            if (token.size() < name.size() + 2 ||
+                token.substr(0, name.size()) != name ||
+                token[name.size()] != '=' ||
+                (value = std::stoi(token.substr(name.size() + 1), &nextIdx), false) ||
+                nextIdx != token.size() - name.size() - 1)
+            {
+                throw std::invalid_argument("bah");
+            }
+        }
+        catch (std::invalid_argument&)
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    /// The dispatch before the command table: a comparison per command.
+    int dispatchByComparison(const std::string& command)
+    {
+        const char* const names[] = { "canceltiles", "clientzoom", "clientvisiblearea", "commandvalues",
+                                      "disconnect", "downloadas", "getchildid", "gettextselection", "paste",
+                                      "insertfile", "invalidatetiles", "key", "mouse", "partpagerectangles",
+                                      "renderfont", "requestloksession", "resetselection", "saveas",
+                                      "selectgraphic", "selecttext", "setclientpart", "setpage", "status",
+                                      "tile", "tilecombine", "unload", "uno" };
+        for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i)
+        {
+            if (command == names[i])
+                return static_cast<int>(i) + 1;
+        }
+
+        return 0;
+    }
+
+    /// Runs parse over all the messages iterations times, and prints how
+    /// many it parsed per second. The sum keeps the work from being
+    /// optimized away.
+    template <typename Parse>
+    void bench(const char* name, const std::vector<std::string>& messages, const int iterations, Parse parse)
+    {
+        long long sum = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            for (const auto& message : messages)
+            {
+                sum += parse(message);
+            }
+        }
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        const double count = static_cast<double>(iterations) * messages.size();
+        std::cout << "  " << std::setw(36) << std::left << name
+                  << std::fixed << std::setprecision(2)
+                  << std::setw(10) << std::right << count / elapsed.count() / 1e6 << " M messages/s"
+                  << "  (" << sum << ")" << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = (argc > 1 ? std::atoi(argv[1]) : 100000);
+    if (iterations <= 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [iterations]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::vector<std::string> messages(std::begin(Messages), std::end(Messages));
+
+    std::cout << "dispatch" << std::endl;
+    bench("StringTokenizer + comparisons", messages, iterations, [](const std::string& message) -> int
+    {
+        Poco::StringTokenizer tokens(message, " ", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
+        return dispatchByComparison(tokens[0]);
+    });
+    bench("Tokenizer + command table", messages, iterations, [](const std::string& message) -> int
+    {
+        const Tokenizer tokens(message.data(), message.size());
+        return static_cast<int>(LOOLProtocol::getCommand(tokens[0]));
+    });
+
+    std::cout << "dispatch and integer fields" << std::endl;
+    bench("StringTokenizer + std::stoi", messages, iterations, [](const std::string& message) -> int
+    {
+        Poco::StringTokenizer tokens(message, " ", Poco::StringTokenizer::TOK_IGNORE_EMPTY | Poco::StringTokenizer::TOK_TRIM);
+        int sum = dispatchByComparison(tokens[0]);
+        for (size_t i = 1; i < tokens.count(); ++i)
+        {
+            int value;
+            if (getTokenIntegerWithStoi(tokens[i], "x", value))
+                sum += value;
+        }
+
+        return sum;
+    });
+    bench("Tokenizer + parseInteger", messages, iterations, [](const std::string& message) -> int
+    {
+        const Tokenizer tokens(message.data(), message.size());
+        int sum = static_cast<int>(LOOLProtocol::getCommand(tokens[0]));
+        for (size_t i = 1; i < tokens.count(); ++i)
+        {
+            int value;
+            if (Tokenizer::getInteger(tokens[i], "x", value))
+                sum += value;
+        }
+
+        return sum;
+    });
+
+    // The same tile request, in both forms.
+    TileHeader request;
+    request.parse(Messages[5], std::strlen(Messages[5]));
+    std::vector<char> binary;
+    request.writeBinary(binary);
+    std::vector<char> text;
+    request.writeText(text);
+    const std::vector<std::string> requests = { std::string(text.begin(), text.end()) };
+    const std::vector<std::string> binaryRequests = { std::string(binary.begin(), binary.end()) };
+
+    std::cout << "tile requests" << std::endl;
+    bench("TileHeader, text", requests, iterations * 10, [](const std::string& message) -> int
+    {
+        TileHeader tile;
+        return tile.parse(message.data(), message.size()) ? tile.tilePosY : 0;
+    });
+    bench("TileHeader, binary", binaryRequests, iterations * 10, [](const std::string& message) -> int
+    {
+        TileHeader tile;
+        return tile.parse(message.data(), message.size()) ? tile.tilePosY : 0;
+    });
+
+    return EXIT_SUCCESS;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
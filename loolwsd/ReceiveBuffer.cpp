@@ -0,0 +1,144 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#include "Common.hpp"
+#include "ReceiveBuffer.hpp"
+
+namespace
+{
+    /// Free memory kept for reuse; beyond this it goes back to the system.
+    const size_t MaxPooledBytes = 16 * 1024 * 1024;
+
+    const size_t MinCapacity = 4096;
+
+    std::atomic<size_t> MaxMessageSize(MAX_MESSAGE_SIZE);
+
+    std::mutex PoolMutex;
+    /// Free blocks by capacity; guarded by PoolMutex, like PoolStats.
+    std::multimap<size_t, char*> FreeBlocks;
+    ReceiveBuffer::Stats PoolStats = { 0, 0, 0, 0 };
+
+    /// Capacities are powers of two, so that freed blocks fit later requests.
+    size_t roundCapacity(const size_t size)
+    {
+        size_t capacity = MinCapacity;
+        while (capacity < size)
+        {
+            capacity *= 2;
+        }
+
+        return capacity;
+    }
+
+    char* allocate(const size_t capacity)
+    {
+        {
+            std::unique_lock<std::mutex> lock(PoolMutex);
+            PoolStats.bytesInFlight += capacity;
+            if (PoolStats.bytesInFlight > PoolStats.maxBytesInFlight)
+                PoolStats.maxBytesInFlight = PoolStats.bytesInFlight;
+
+            const auto it = FreeBlocks.find(capacity);
+            if (it != FreeBlocks.end())
+            {
+                char* data = it->second;
+                FreeBlocks.erase(it);
+                PoolStats.pooledBytes -= capacity;
+                return data;
+            }
+        }
+
+        return new char[capacity];
+    }
+
+    void release(char* data, const size_t capacity)
+    {
+        {
+            std::unique_lock<std::mutex> lock(PoolMutex);
+            PoolStats.bytesInFlight -= capacity;
+            if (PoolStats.pooledBytes + capacity <= MaxPooledBytes)
+            {
+                FreeBlocks.emplace(capacity, data);
+                PoolStats.pooledBytes += capacity;
+                return;
+            }
+        }
+
+        delete[] data;
+    }
+}
+
+const size_t ReceiveBuffer::DefaultCapacity;
+const size_t ReceiveBuffer::ShrinkCapacity;
+
+ReceiveBuffer::ReceiveBuffer(const size_t capacity) :
+    _data(nullptr),
+    _capacity(roundCapacity(capacity)),
+    _initialCapacity(_capacity)
+{
+    _data = allocate(_capacity);
+}
+
+ReceiveBuffer::~ReceiveBuffer()
+{
+    release(_data, _capacity);
+}
+
+bool ReceiveBuffer::reserve(const size_t size)
+{
+    if (size <= _capacity)
+        return true;
+
+    if (size > MaxMessageSize)
+    {
+        std::unique_lock<std::mutex> lock(PoolMutex);
+        ++PoolStats.rejected;
+        return false;
+    }
+
+    const size_t capacity = roundCapacity(size);
+    char* data = allocate(capacity);
+    release(_data, _capacity);
+    _data = data;
+    _capacity = capacity;
+    return true;
+}
+
+void ReceiveBuffer::shrink()
+{
+    if (_capacity <= _initialCapacity || _capacity <= ShrinkCapacity)
+        return;
+
+    char* data = allocate(_initialCapacity);
+    release(_data, _capacity);
+    _data = data;
+    _capacity = _initialCapacity;
+}
+
+void ReceiveBuffer::setMaxMessageSize(const size_t size)
+{
+    MaxMessageSize = size;
+}
+
+size_t ReceiveBuffer::getMaxMessageSize()
+{
+    return MaxMessageSize;
+}
+
+ReceiveBuffer::Stats ReceiveBuffer::getStats()
+{
+    std::unique_lock<std::mutex> lock(PoolMutex);
+    return PoolStats;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,71 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_RECEIVEBUFFER_HPP
+#define INCLUDED_RECEIVEBUFFER_HPP
+
+#include <cstddef>
+
+/// The buffer a connection receives its frames into.
+///
+/// It grows for large messages, as their frame header or a "nextmessage:"
+/// announces them, up to the maximum message size, and shrinks back
+/// afterwards. The memory comes
+/// from a pool shared by all connections, which also accounts for the
+/// bytes held.
+class ReceiveBuffer
+{
+public:
+    struct Stats
+    {
+        /// Memory held by all buffers now, and at most.
+        size_t bytesInFlight;
+        size_t maxBytesInFlight;
+        /// Memory kept in the pool for reuse.
+        size_t pooledBytes;
+        /// Messages refused for being over the maximum size.
+        size_t rejected;
+    };
+
+    /// Fits most messages, tiles included, without growing.
+    static const size_t DefaultCapacity = 64 * 1024;
+    static const size_t ShrinkCapacity = 1024 * 1024;
+
+    explicit ReceiveBuffer(size_t capacity = DefaultCapacity);
+    ~ReceiveBuffer();
+
+    ReceiveBuffer(const ReceiveBuffer&) = delete;
+    ReceiveBuffer& operator=(const ReceiveBuffer&) = delete;
+
+    char* data() const { return _data; }
+    size_t capacity() const { return _capacity; }
+
+    /// Makes room for a message of size bytes; the contents are lost.
+    /// Returns false if size is over the maximum message size.
+    bool reserve(size_t size);
+
+    /// Gives back the memory grown for an unusually large message.
+    /// Growth up to ShrinkCapacity is kept, tiles would need it again.
+    void shrink();
+
+    /// Applies to all buffers, of this process.
+    static void setMaxMessageSize(size_t size);
+    static size_t getMaxMessageSize();
+
+    static Stats getStats();
+
+private:
+    char* _data;
+    size_t _capacity;
+    const size_t _initialCapacity;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,227 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+// Micro-benchmark of the tile encoding path. Runs on synthetic tiles,
+// or on a corpus of rendered tiles (e.g. a tile cache directory), and
+// doesn't need LibreOffice or a running server.
+
+#include <ftw.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <png.h>
+
+#include "Pixel.hpp"
+#include "TileEncoder.hpp"
+
+namespace
+{
+    const int TileSize = 256;
+
+    /// A tile of premultiplied BGRA pixels resembling rendered content.
+    struct SampleTile
+    {
+        std::string name;
+        std::vector<unsigned char> pixels;
+        int width;
+        int height;
+    };
+
+    std::vector<SampleTile> makeSamples()
+    {
+        std::vector<SampleTile> samples;
+        const size_t bytes = TileSize * TileSize * 4;
+
+        // Blank page background.
+        samples.push_back({ "white", std::vector<unsigned char>(bytes, 0xff), TileSize, TileSize });
+
+        // Transparent margins.
+        samples.push_back({ "transparent", std::vector<unsigned char>(bytes, 0), TileSize, TileSize });
+
+        // Anti-aliased text: mostly white with short runs of grey edges.
+        std::mt19937 rng(42);
+        std::vector<unsigned char> text(bytes, 0xff);
+        for (int y = 0; y < TileSize; ++y)
+        {
+            if (y % 16 > 10)
+                continue;
+
+            for (int x = 0; x < TileSize; ++x)
+            {
+                if (rng() % 5 == 0)
+                {
+                    const unsigned char v = rng();
+                    unsigned char* px = &text[(y * TileSize + x) * 4];
+                    px[0] = px[1] = px[2] = v;
+                }
+            }
+        }
+
+        samples.push_back({ "text", text, TileSize, TileSize });
+
+        // Translucent overlay (e.g. a selection), the worst case.
+        std::vector<unsigned char> overlay(bytes);
+        for (size_t i = 0; i < bytes; i += 4)
+        {
+            const unsigned char alpha = 0x80 + rng() % 0x40;
+            overlay[i] = overlay[i + 1] = overlay[i + 2] = rng() % (alpha + 1);
+            overlay[i + 3] = alpha;
+        }
+
+        samples.push_back({ "translucent", overlay, TileSize, TileSize });
+
+        return samples;
+    }
+
+    std::vector<SampleTile>* Corpus = nullptr;
+
+    /// Loads a PNG tile and converts it back to premultiplied BGRA, as painted by LOK.
+    int loadTile(const char* path, const struct stat*, int type, struct FTW*)
+    {
+        const std::string name(path);
+        if (type != FTW_F || name.size() < 4 || name.compare(name.size() - 4, 4, ".png") != 0)
+            return 0;
+
+        png_image image;
+        std::memset(&image, 0, sizeof(image));
+        image.version = PNG_IMAGE_VERSION;
+        if (!png_image_begin_read_from_file(&image, path))
+            return 0;
+
+        image.format = PNG_FORMAT_BGRA;
+        std::vector<unsigned char> pixels(PNG_IMAGE_SIZE(image));
+        if (!png_image_finish_read(&image, nullptr, pixels.data(), 0, nullptr))
+            return 0;
+
+        for (size_t i = 0; i < pixels.size(); i += 4)
+        {
+            const unsigned alpha = pixels[i + 3];
+            for (size_t c = 0; c < 3; ++c)
+            {
+                pixels[i + c] = (pixels[i + c] * alpha + 127) / 255;
+            }
+        }
+
+        Corpus->push_back({ name, pixels, static_cast<int>(image.width), static_cast<int>(image.height) });
+        return 0;
+    }
+
+    std::vector<SampleTile> loadCorpus(const std::string& path)
+    {
+        std::vector<SampleTile> corpus;
+        Corpus = &corpus;
+        nftw(path.c_str(), loadTile, 16, FTW_PHYS);
+        Corpus = nullptr;
+        return corpus;
+    }
+
+    void benchUnpremultiply(const std::vector<SampleTile>& samples, const int iterations)
+    {
+        std::cout << "unpremultiply (MPixel/s)" << std::endl;
+        std::vector<unsigned char> row(TileSize * 4);
+        for (const auto& sample : samples)
+        {
+            std::cout << "  " << std::setw(12) << std::left << sample.name;
+            for (const auto kernel : { Pixel::Kernel::Scalar, Pixel::Kernel::SSE2, Pixel::Kernel::AVX2 })
+            {
+                if (!Pixel::isKernelSupported(kernel))
+                    continue;
+
+                const auto start = std::chrono::steady_clock::now();
+                for (int i = 0; i < iterations; ++i)
+                {
+                    for (int y = 0; y < TileSize; ++y)
+                    {
+                        Pixel::unpremultiplyRow(sample.pixels.data() + y * TileSize * 4, row.data(), TileSize, kernel);
+                    }
+                }
+
+                const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                const double mpixels = static_cast<double>(iterations) * TileSize * TileSize / 1e6;
+                std::cout << "  " << Pixel::kernelName(kernel) << ": "
+                          << std::fixed << std::setprecision(1) << mpixels / elapsed.count();
+            }
+
+            std::cout << std::endl;
+        }
+    }
+
+    void benchEncoders(const std::vector<SampleTile>& tiles, const int iterations)
+    {
+        std::cout << "encode " << tiles.size() << " tiles x " << iterations << std::endl;
+        for (const auto& spec : { "png:default", "png:fast", "png:fastest", "png:small",
+                                  "deflate:default", "deflate:fast", "deflate:fastest", "deflate:small" })
+        {
+            const auto encoder = TileEncoder::create(spec);
+            size_t bytes = 0;
+            std::vector<char> output;
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i)
+            {
+                for (const auto& tile : tiles)
+                {
+                    output.clear();
+                    encoder->encode(const_cast<unsigned char*>(tile.pixels.data()), 0, 0, tile.width, tile.height,
+                                    tile.width, tile.height, output, LOK_TILEMODE_BGRA);
+                    bytes += output.size();
+                }
+            }
+
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            const double count = static_cast<double>(iterations) * tiles.size();
+            std::cout << "  " << std::setw(16) << std::left << encoder->getName()
+                      << std::fixed << std::setprecision(3)
+                      << std::setw(10) << std::right << elapsed.count() * 1000 / count << " ms/tile "
+                      << std::setw(10) << std::right << static_cast<size_t>(bytes / count) << " bytes/tile" << std::endl;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    const int iterations = (argc > 1 ? std::atoi(argv[1]) : 200);
+    if (iterations <= 0)
+    {
+        std::cerr << "Usage: " << argv[0] << " [iterations [tile directory]]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Best kernel: " << Pixel::kernelName(Pixel::getBestKernel()) << std::endl;
+
+    const std::vector<SampleTile> samples = makeSamples();
+    benchUnpremultiply(samples, iterations);
+
+    if (argc > 2)
+    {
+        const std::vector<SampleTile> corpus = loadCorpus(argv[2]);
+        if (corpus.empty())
+        {
+            std::cerr << "No PNG tiles found in " << argv[2] << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        benchEncoders(corpus, std::max(1, iterations / 20));
+    }
+    else
+    {
+        benchEncoders(samples, std::max(1, iterations / 20));
+    }
+
+    return EXIT_SUCCESS;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -88,7 +88,7 @@ std::unique_ptr<std::fstream> TileCache::lookupTile(int part, int width, int hei
     return result;
 }
 
-void TileCache::saveTile(int part, int width, int height, int tilePosX, int tilePosY, int tileWidth, int tileHeight, const char *data, size_t size)
+void TileCache::saveTile(int part, int width, int height, int tilePosX, int tilePosY, int tileWidth, int tileHeight, const char *data, size_t size, int version)
 {
     if (_isEditing && !_hasUnsavedChanges)
         _hasUnsavedChanges = true;
@@ -97,11 +97,25 @@ void TileCache::saveTile(int part, int width, int height, int tilePosX, int tile
 
     File(dirName).createDirectories();
 
-    std::string fileName = dirName + "/" + cacheFileName(part, width, height, tilePosX, tilePosY, tileWidth, tileHeight);
+    const std::string cachedName = cacheFileName(part, width, height, tilePosX, tilePosY, tileWidth, tileHeight);
+    std::string fileName = dirName + "/" + cachedName;
 
     std::fstream outStream(fileName, std::ios::out);
     outStream.write(data, size);
     outStream.close();
+
+    Poco::FastMutex::ScopedLock lock(_cacheMutex);
+    if (version > 0)
+        _tileVersions[cachedName] = version;
+    else
+        _tileVersions.erase(cachedName);
+}
+
+int TileCache::getTileVersion(int part, int width, int height, int tilePosX, int tilePosY, int tileWidth, int tileHeight)
+{
+    Poco::FastMutex::ScopedLock lock(_cacheMutex);
+    const auto it = _tileVersions.find(cacheFileName(part, width, height, tilePosX, tilePosY, tileWidth, tileHeight));
+    return (it != _tileVersions.end() ? it->second : 0);
 }
 
 std::string TileCache::getTextFile(std::string fileName)
@@ -217,6 +231,16 @@ std::unique_ptr<std::fstream> TileCache::lookupRendering(const std::string& name
 
 void TileCache::invalidateTiles(int part, int x, int y, int width, int height)
 {
+    _cacheMutex.lock();
+    for (auto it = _tileVersions.begin(); it != _tileVersions.end(); )
+    {
+        if (intersectsTile(it->first, part, x, y, width, height))
+            it = _tileVersions.erase(it);
+        else
+            ++it;
+    }
+    _cacheMutex.unlock();
+
     // in the Editing cache, remove immediately
     const std::string editingDirName = cacheDirName(true);
     File editingDir(editingDirName);
@@ -260,8 +284,9 @@ void TileCache::invalidateTiles(const std::string& tiles)
     {
         invalidateTiles(-1, 0, 0, INT_MAX, INT_MAX);
     }
-    else if (tokens.count() != 6)
+    else if (tokens.count() < 6)
     {
+        // Trailing tokens, like pushed=, don't concern the cache.
         return;
     }
     else
@@ -11,6 +11,7 @@
 #define INCLUDED_TILECACHE_HPP
 
 #include <fstream>
+#include <map>
 #include <memory>
 #include <set>
 #include <string>
@@ -37,7 +38,11 @@ public:
     TileCache(const std::string& docURL, const std::string& timestamp);
 
     std::unique_ptr<std::fstream> lookupTile(int part, int width, int height, int tilePosX, int tilePosY, int tileWidth, int tileHeight);
-    void saveTile(int part, int width, int height, int tilePosX, int tilePosY, int tileWidth, int tileHeight, const char *data, size_t size);
+    /// version is the kit's rendering version of the tile (ver=), if any.
+    void saveTile(int part, int width, int height, int tilePosX, int tilePosY, int tileWidth, int tileHeight, const char *data, size_t size, int version = 0);
+
+    /// The rendering version of a cached tile, or 0 if unknown.
+    int getTileVersion(int part, int width, int height, int tilePosX, int tilePosY, int tileWidth, int tileHeight);
     std::string getTextFile(std::string fileName);
 
     /// Notify the cache that the document was saved - to copy tiles from the Editing cache to Persistent.
@@ -97,6 +102,10 @@ private:
     /// Set of tiles that we want to remove from the Persistent cache on the next save.
     std::set<std::string> _toBeRemoved;
 
+    /// Rendering versions of the tiles cached in this run, by file name.
+    /// Clients send them back to get delta updates.
+    std::map<std::string, int> _tileVersions;
+
     Poco::FastMutex _cacheMutex;
 };
 
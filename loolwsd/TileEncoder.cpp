@@ -0,0 +1,444 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+#include <png.h>
+#include <zlib.h>
+
+#if HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#include "Pixel.hpp"
+#include "TileEncoder.hpp"
+
+// Callback functions for libpng
+
+extern "C"
+{
+    static void user_write_status_fn(png_structp, png_uint_32, int)
+    {
+    }
+
+    static void user_write_fn(png_structp png_ptr, png_bytep data, png_size_t length)
+    {
+        std::vector<char> *outputp = (std::vector<char> *) png_get_io_ptr(png_ptr);
+        const size_t oldsize = outputp->size();
+        outputp->resize(oldsize + length);
+        std::memcpy(outputp->data() + oldsize, data, length);
+    }
+
+    static void user_flush_fn(png_structp)
+    {
+    }
+}
+
+namespace
+{
+    /// PNG row filter types, as in the PNG specification.
+    enum RowFilter
+    {
+        FilterNone = 0,
+        FilterSub = 1,
+        FilterUp = 2
+    };
+
+    /// Compression parameters of a preset.
+    struct Settings
+    {
+        std::string preset;
+        int level;
+        int strategy;
+        /// libpng filter mask; 0 leaves libpng's adaptive default.
+        int pngFilters;
+        /// The single filter used by the deflate backend.
+        RowFilter rowFilter;
+    };
+
+    bool getSettings(const std::string& preset, Settings& settings)
+    {
+        if (preset.empty() || preset == "default")
+        {
+            settings = { "default", Z_DEFAULT_COMPRESSION, Z_DEFAULT_STRATEGY, 0, FilterUp };
+        }
+        else if (preset == "fast")
+        {
+            settings = { preset, 1, Z_RLE, PNG_FILTER_SUB, FilterSub };
+        }
+        else if (preset == "fastest")
+        {
+            settings = { preset, 1, Z_HUFFMAN_ONLY, PNG_FILTER_NONE, FilterNone };
+        }
+        else if (preset == "small")
+        {
+            settings = { preset, 9, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS, FilterUp };
+        }
+        else if (preset.size() == 1 && preset[0] >= '0' && preset[0] <= '9')
+        {
+            settings = { preset, preset[0] - '0', Z_DEFAULT_STRATEGY, 0, FilterSub };
+        }
+        else
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    /// Copies (and for BGRA, unpremultiplies) a row into RGBA bytes.
+    inline
+    const unsigned char* getRGBARow(const unsigned char* pixmap, int startX, int startY, int y, int width,
+                                    int bufferWidth, LibreOfficeKitTileMode mode, unsigned char* row)
+    {
+        const unsigned char* src = pixmap + ((startY + y) * bufferWidth * 4) + (startX * 4);
+        if (mode == LOK_TILEMODE_BGRA)
+        {
+            Pixel::unpremultiplyRow(src, row, width);
+            return row;
+        }
+
+        return src;
+    }
+
+    /// The libpng backend.
+    class PngEncoder : public TileEncoder
+    {
+    public:
+        PngEncoder(const Settings& settings) :
+            TileEncoder("png:" + settings.preset),
+            _settings(settings)
+        {
+        }
+
+        bool encode(unsigned char* pixmap, int startX, int startY, int width, int height,
+                    int bufferWidth, int bufferHeight,
+                    std::vector<char>& output, LibreOfficeKitTileMode mode) const override
+        {
+            if (bufferWidth < width || bufferHeight < height)
+                return false;
+
+            // Convert whole rows up-front with the vectorized kernels rather
+            // than per-pixel in a libpng user transform.
+            // Declared before setjmp so a libpng error doesn't skip its destructor.
+            std::vector<unsigned char> row;
+            if (mode == LOK_TILEMODE_BGRA)
+            {
+                row.resize(width * 4);
+            }
+
+            png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+
+            png_infop info_ptr = png_create_info_struct(png_ptr);
+
+            if (setjmp(png_jmpbuf(png_ptr)))
+            {
+                png_destroy_write_struct(&png_ptr, nullptr);
+                return false;
+            }
+
+            png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+            if (_settings.level != Z_DEFAULT_COMPRESSION)
+            {
+                png_set_compression_level(png_ptr, _settings.level);
+            }
+
+            if (_settings.strategy != Z_DEFAULT_STRATEGY)
+            {
+                png_set_compression_strategy(png_ptr, _settings.strategy);
+            }
+
+            if (_settings.pngFilters != 0)
+            {
+                png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, _settings.pngFilters);
+            }
+
+            png_set_write_fn(png_ptr, &output, user_write_fn, user_flush_fn);
+            png_set_write_status_fn(png_ptr, user_write_status_fn);
+
+            png_write_info(png_ptr, info_ptr);
+
+            for (int y = 0; y < height; ++y)
+            {
+                png_write_row(png_ptr, const_cast<unsigned char*>(getRGBARow(pixmap, startX, startY, y, width, bufferWidth, mode, row.data())));
+            }
+
+            png_write_end(png_ptr, info_ptr);
+
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+
+            return true;
+        }
+
+    private:
+        const Settings _settings;
+    };
+
+    /// Writes PNG files directly: one fixed row filter, no per-row
+    /// heuristics and one deflate stream, avoiding libpng's overhead.
+    class DeflateEncoder : public TileEncoder
+    {
+    public:
+        DeflateEncoder(const Settings& settings) :
+            TileEncoder("deflate:" + settings.preset),
+            _settings(settings)
+        {
+        }
+
+        bool encode(unsigned char* pixmap, int startX, int startY, int width, int height,
+                    int bufferWidth, int bufferHeight,
+                    std::vector<char>& output, LibreOfficeKitTileMode mode) const override
+        {
+            if (bufferWidth < width || bufferHeight < height || width <= 0 || height <= 0)
+                return false;
+
+            // Filtered image data: a filter type byte followed by each row.
+            const size_t stride = width * 4;
+            std::vector<unsigned char> filtered((stride + 1) * height);
+            std::vector<unsigned char> row(stride);
+            std::vector<unsigned char> previous(stride, 0);
+            for (int y = 0; y < height; ++y)
+            {
+                const unsigned char* rgba = getRGBARow(pixmap, startX, startY, y, width, bufferWidth, mode, row.data());
+                unsigned char* out = &filtered[y * (stride + 1)];
+                out[0] = _settings.rowFilter;
+                filterRow(rgba, previous.data(), out + 1, stride);
+                std::memcpy(previous.data(), rgba, stride);
+            }
+
+            static const unsigned char Signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+            output.insert(output.end(), Signature, Signature + sizeof(Signature));
+
+            unsigned char header[13];
+            putUInt32(header, width);
+            putUInt32(header + 4, height);
+            header[8] = 8; // Bit depth.
+            header[9] = 6; // RGBA.
+            header[10] = header[11] = header[12] = 0;
+            writeChunk(output, "IHDR", header, sizeof(header));
+
+            // Compress straight into output, then fill in the chunk header.
+            const size_t chunkStart = output.size();
+            output.resize(chunkStart + 8 + getCompressBound(filtered.size()));
+            size_t compressedSize = 0;
+            if (!deflateImage(filtered, reinterpret_cast<unsigned char*>(output.data() + chunkStart + 8),
+                          output.size() - chunkStart - 8, compressedSize))
+            {
+                output.resize(chunkStart);
+                return false;
+            }
+
+            output.resize(chunkStart + 8 + compressedSize);
+            putUInt32(reinterpret_cast<unsigned char*>(output.data() + chunkStart), compressedSize);
+            std::memcpy(output.data() + chunkStart + 4, "IDAT", 4);
+            appendCrc(output, chunkStart + 4);
+
+            writeChunk(output, "IEND", nullptr, 0);
+            return true;
+        }
+
+    private:
+        void filterRow(const unsigned char* cur, const unsigned char* prev, unsigned char* out, size_t stride) const
+        {
+            switch (_settings.rowFilter)
+            {
+            case FilterSub:
+                std::memcpy(out, cur, 4);
+                for (size_t i = 4; i < stride; ++i)
+                {
+                    out[i] = cur[i] - cur[i - 4];
+                }
+                break;
+            case FilterUp:
+                for (size_t i = 0; i < stride; ++i)
+                {
+                    out[i] = cur[i] - prev[i];
+                }
+                break;
+            case FilterNone:
+                std::memcpy(out, cur, stride);
+                break;
+            }
+        }
+
+        size_t getCompressBound(size_t size) const
+        {
+#if HAVE_LIBDEFLATE
+            return std::max<size_t>(::compressBound(size), libdeflate_zlib_compress_bound(nullptr, size));
+#else
+            return ::compressBound(size);
+#endif
+        }
+
+#if HAVE_LIBDEFLATE
+        /// The compressor of this encoder's level on the calling thread:
+        /// they are large to allocate and can't be shared between threads.
+        libdeflate_compressor* getCompressor() const
+        {
+            struct Compressors
+            {
+                ~Compressors()
+                {
+                    for (const auto& compressor : byLevel)
+                        libdeflate_free_compressor(compressor.second);
+                }
+
+                std::map<int, libdeflate_compressor*> byLevel;
+            };
+
+            static thread_local Compressors compressors;
+
+            const int level = (_settings.level == Z_DEFAULT_COMPRESSION ? 6 : std::max(_settings.level, 1));
+            libdeflate_compressor*& compressor = compressors.byLevel[level];
+            if (compressor == nullptr)
+                compressor = libdeflate_alloc_compressor(level);
+
+            return compressor;
+        }
+#endif
+
+        bool deflateImage(const std::vector<unsigned char>& input, unsigned char* out, size_t outSize, size_t& written) const
+        {
+#if HAVE_LIBDEFLATE
+            // libdeflate has no strategies, the preset's is ignored and only
+            // its level applies.
+            libdeflate_compressor* compressor = getCompressor();
+            if (compressor == nullptr)
+                return false;
+
+            written = libdeflate_zlib_compress(compressor, input.data(), input.size(), out, outSize);
+            return written > 0;
+#else
+            z_stream stream;
+            std::memset(&stream, 0, sizeof(stream));
+            if (deflateInit2(&stream, _settings.level, Z_DEFLATED, 15, 8, _settings.strategy) != Z_OK)
+                return false;
+
+            stream.next_in = const_cast<unsigned char*>(input.data());
+            stream.avail_in = input.size();
+            stream.next_out = out;
+            stream.avail_out = outSize;
+            const int result = deflate(&stream, Z_FINISH);
+            written = stream.total_out;
+            deflateEnd(&stream);
+            return result == Z_STREAM_END;
+#endif
+        }
+
+        static void putUInt32(unsigned char* out, uint32_t value)
+        {
+            out[0] = value >> 24;
+            out[1] = value >> 16;
+            out[2] = value >> 8;
+            out[3] = value;
+        }
+
+        /// Appends the CRC of output[from..end], i.e. a chunk's type and data.
+        static void appendCrc(std::vector<char>& output, size_t from)
+        {
+            unsigned char crc[4];
+            putUInt32(crc, crc32(0, reinterpret_cast<const unsigned char*>(output.data() + from), output.size() - from));
+            output.insert(output.end(), crc, crc + 4);
+        }
+
+        static void writeChunk(std::vector<char>& output, const char* type, const unsigned char* data, size_t size)
+        {
+            unsigned char length[4];
+            putUInt32(length, size);
+            output.insert(output.end(), length, length + 4);
+            const size_t typeStart = output.size();
+            output.insert(output.end(), type, type + 4);
+            if (size > 0)
+                output.insert(output.end(), data, data + size);
+            appendCrc(output, typeStart);
+        }
+
+    private:
+        const Settings _settings;
+    };
+
+    /// The configured encoders by document type ("" for the default), and
+    /// the configuration they were parsed from.
+    std::map<std::string, std::shared_ptr<TileEncoder>> ConfiguredEncoders;
+    std::string Configuration;
+}
+
+std::shared_ptr<TileEncoder> TileEncoder::create(const std::string& spec)
+{
+    const auto pos = spec.find(':');
+    const std::string backend = spec.substr(0, pos);
+    const std::string preset = (pos == std::string::npos ? std::string() : spec.substr(pos + 1));
+
+    Settings settings;
+    if (!getSettings(preset, settings))
+        return nullptr;
+
+    if (backend == "png")
+        return std::make_shared<PngEncoder>(settings);
+    if (backend == "deflate")
+        return std::make_shared<DeflateEncoder>(settings);
+
+    return nullptr;
+}
+
+std::shared_ptr<TileEncoder> TileEncoder::getDefault()
+{
+    static const std::shared_ptr<TileEncoder> Default = create("png");
+    return Default;
+}
+
+bool TileEncoder::configure(const std::string& config)
+{
+    std::map<std::string, std::shared_ptr<TileEncoder>> encoders;
+    std::istringstream iss(config);
+    std::string entry;
+    while (std::getline(iss, entry, ','))
+    {
+        std::string docType;
+        const auto pos = entry.find('=');
+        if (pos != std::string::npos)
+        {
+            docType = entry.substr(0, pos);
+            entry = entry.substr(pos + 1);
+        }
+
+        const auto encoder = TileEncoder::create(entry);
+        if (!encoder)
+            return false;
+
+        encoders[docType] = encoder;
+    }
+
+    ConfiguredEncoders.swap(encoders);
+    Configuration = config;
+    return true;
+}
+
+const std::string& TileEncoder::getConfiguration()
+{
+    return Configuration;
+}
+
+std::shared_ptr<TileEncoder> TileEncoder::getForDocType(const std::string& docType)
+{
+    auto it = ConfiguredEncoders.find(docType);
+    if (it == ConfiguredEncoders.end())
+        it = ConfiguredEncoders.find("");
+
+    return (it != ConfiguredEncoders.end() ? it->second : getDefault());
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
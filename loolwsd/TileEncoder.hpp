@@ -0,0 +1,75 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILEENCODER_HPP
+#define INCLUDED_TILEENCODER_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#define LOK_USE_UNSTABLE_API
+#include <LibreOfficeKit/LibreOfficeKitEnums.h>
+
+/// Compresses rendered pixmaps into PNG images.
+///
+/// Encoders are named "<backend>[:<preset>]", where the backend is
+/// "png" (libpng, the default) or "deflate" (a single-filter PNG writer
+/// around zlib, or libdeflate when available), and the preset is one of
+/// "default", "fast", "fastest", "small" or a zlib level 0-9. libdeflate
+/// has no strategies, with it only the level of the preset applies.
+/// Encoders can be shared between threads.
+class TileEncoder
+{
+public:
+    virtual ~TileEncoder() {}
+
+    /// The canonical "<backend>:<preset>" name of this encoder.
+    const std::string& getName() const { return _name; }
+
+    /// Appends the PNG image of the width x height area at (startX, startY)
+    /// of the bufferWidth x bufferHeight pixmap to output.
+    // Sadly, older libpng headers don't use const for the pixmap pointer parameter to
+    // png_write_row(), so can't use const here for pixmap.
+    virtual bool encode(unsigned char* pixmap, int startX, int startY, int width, int height,
+                        int bufferWidth, int bufferHeight,
+                        std::vector<char>& output, LibreOfficeKitTileMode mode) const = 0;
+
+    /// Creates the encoder named by spec, or returns nullptr if the
+    /// backend or preset is unknown.
+    static std::shared_ptr<TileEncoder> create(const std::string& spec);
+
+    /// The libpng encoder with libpng's default settings.
+    static std::shared_ptr<TileEncoder> getDefault();
+
+    /// Sets the encoders by document type (as reported in status:), as
+    /// given by --tileencoder, e.g. "png:fast,spreadsheet=deflate:fastest".
+    /// Entries without a type apply to all types not listed. Returns false,
+    /// changing nothing, if an entry is invalid. Call before encoding.
+    static bool configure(const std::string& config);
+
+    /// What configure() was last given.
+    static const std::string& getConfiguration();
+
+    /// The encoder configured for the given document type, or the default.
+    static std::shared_ptr<TileEncoder> getForDocType(const std::string& docType);
+
+protected:
+    TileEncoder(const std::string& name) :
+        _name(name)
+    {
+    }
+
+private:
+    const std::string _name;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
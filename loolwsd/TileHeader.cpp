@@ -0,0 +1,330 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <utility>
+
+#include "TileHeader.hpp"
+#include "Tokenizer.hpp"
+
+const size_t TileHeader::Size;
+
+namespace
+{
+    /// The extra tokens' size is a 16-bit field of the binary form.
+    const size_t MaxExtraSize = 0xffff;
+
+    /// The fields every tile message starts with, in this order.
+    const char* const Fields[] = { "part", "width", "height", "tileposx", "tileposy", "tilewidth", "tileheight" };
+
+    int hexDigit(const char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    void writeInteger(char* data, const int value)
+    {
+        const uint32_t bits = static_cast<uint32_t>(value);
+        for (int i = 0; i < 4; ++i)
+        {
+            data[i] = static_cast<char>(bits >> (8 * i));
+        }
+    }
+
+    int readInteger(const char* data)
+    {
+        uint32_t bits = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            bits |= static_cast<uint32_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+        }
+
+        return static_cast<int>(bits);
+    }
+
+    void appendText(std::vector<char>& output, const char* text)
+    {
+        output.insert(output.end(), text, text + std::strlen(text));
+    }
+
+    void appendInteger(std::vector<char>& output, const char* key, const int value)
+    {
+        char token[32];
+        std::snprintf(token, sizeof(token), " %s=%d", key, value);
+        appendText(output, token);
+    }
+}
+
+TileHeader::TileHeader() :
+    type(Type::None),
+    part(0),
+    width(0),
+    height(0),
+    tilePosX(0),
+    tilePosY(0),
+    tileWidth(0),
+    tileHeight(0),
+    version(0),
+    oldVersion(0),
+    deltaX(0),
+    deltaY(0),
+    deltaWidth(0),
+    deltaHeight(0),
+    color{ 0, 0, 0, 0 },
+    extra(nullptr),
+    extraSize(0),
+    payloadOffset(0)
+{
+}
+
+bool TileHeader::isBinary(const char* data, const size_t size)
+{
+    if (size < Size || data[0] < static_cast<char>(Type::Request) ||
+        data[0] > static_cast<char>(Type::Solid) || data[1] != 0)
+    {
+        return false;
+    }
+
+    const size_t extraBytes = static_cast<uint8_t>(data[2]) | (static_cast<uint8_t>(data[3]) << 8);
+    return Size + extraBytes <= size;
+}
+
+bool TileHeader::parse(const char* data, const size_t size)
+{
+    *this = TileHeader();
+
+    if (isBinary(data, size))
+    {
+        type = static_cast<Type>(data[0]);
+        extraSize = static_cast<uint8_t>(data[2]) | (static_cast<uint8_t>(data[3]) << 8);
+        int* const fields[] = { &part, &width, &height, &tilePosX, &tilePosY, &tileWidth, &tileHeight,
+                                &version, &oldVersion, &deltaX, &deltaY, &deltaWidth, &deltaHeight };
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+        {
+            *fields[i] = readInteger(data + 4 + 4 * i);
+        }
+
+        std::memcpy(color, data + 56, sizeof(color));
+        extra = (extraSize > 0 ? data + Size : nullptr);
+        payloadOffset = Size + extraSize;
+        return true;
+    }
+
+    const Tokenizer tokens(data, size);
+    payloadOffset = std::min(tokens.getLine().size() + 1, size);
+    if (tokens.count() < 8)
+        return false;
+
+    for (Type candidate : { Type::Request, Type::Tile, Type::Delta, Type::Solid })
+    {
+        type = candidate;
+        if (tokens[0] == getCommand())
+            break;
+
+        type = Type::None;
+    }
+
+    if (type == Type::None)
+        return false;
+
+    int* const fields[] = { &part, &width, &height, &tilePosX, &tilePosY, &tileWidth, &tileHeight };
+    for (size_t i = 1; i <= 7; ++i)
+    {
+        if (!Tokenizer::getInteger(tokens[i], Fields[i - 1], *fields[i - 1]))
+            return false;
+    }
+
+    const std::pair<const char*, int*> optionalFields[] = {
+        { "ver", &version }, { "oldver", &oldVersion },
+        { "deltax", &deltaX }, { "deltay", &deltaY }, { "deltawidth", &deltaWidth }, { "deltaheight", &deltaHeight } };
+
+    const char* extraEnd = nullptr;
+    for (size_t i = 8; i < tokens.count(); ++i)
+    {
+        StringView value;
+        if (Tokenizer::getValue(tokens[i], "color", value))
+        {
+            if (!parseColor(value.data(), value.size(), color))
+                return false;
+
+            continue;
+        }
+
+        bool isKnown = false;
+        for (const auto& field : optionalFields)
+        {
+            if (Tokenizer::getValue(tokens[i], field.first, value))
+            {
+                if (!Tokenizer::parseInteger(value, *field.second))
+                    return false;
+
+                isKnown = true;
+                break;
+            }
+        }
+
+        if (!isKnown)
+        {
+            // Known tokens between unknown ones stay in the extra as well.
+            extra = (extra != nullptr ? extra : tokens[i].data());
+            extraEnd = tokens[i].data() + tokens[i].size();
+        }
+    }
+
+    extraSize = (extra != nullptr ? extraEnd - extra : 0);
+    return extraSize <= MaxExtraSize;
+}
+
+bool TileHeader::isValid() const
+{
+    return part >= 0 && width > 0 && height > 0 && tilePosX >= 0 && tilePosY >= 0 &&
+           tileWidth > 0 && tileHeight > 0;
+}
+
+bool TileHeader::hasId() const
+{
+    for (size_t i = 0; i + 3 <= extraSize; ++i)
+    {
+        if ((i == 0 || extra[i - 1] == ' ') && std::memcmp(extra + i, "id=", 3) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+const char* TileHeader::getCommand() const
+{
+    switch (type)
+    {
+    case Type::Request:
+        return "tile";
+    case Type::Tile:
+        return "tile:";
+    case Type::Delta:
+        return "delta:";
+    case Type::Solid:
+        return "solidtile:";
+    case Type::None:
+        break;
+    }
+
+    return "";
+}
+
+std::string TileHeader::getDescription() const
+{
+    char description[192];
+    const int size = std::snprintf(description, sizeof(description),
+                                   "part=%d width=%d height=%d tileposx=%d tileposy=%d tilewidth=%d tileheight=%d",
+                                   part, width, height, tilePosX, tilePosY, tileWidth, tileHeight);
+    return std::string(description, size);
+}
+
+std::string TileHeader::getColorToken() const
+{
+    char token[16];
+    std::snprintf(token, sizeof(token), "color=%02x%02x%02x%02x", color[0], color[1], color[2], color[3]);
+    return token;
+}
+
+bool TileHeader::parseColor(const char* data, const size_t size, uint8_t color[4])
+{
+    if (size != 8)
+        return false;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        const int high = hexDigit(data[2 * i]);
+        const int low = hexDigit(data[2 * i + 1]);
+        if (high < 0 || low < 0)
+            return false;
+
+        color[i] = static_cast<uint8_t>(high * 16 + low);
+    }
+
+    return true;
+}
+
+void TileHeader::writeBinary(std::vector<char>& output) const
+{
+    const size_t start = output.size();
+    const size_t extraBytes = std::min(extraSize, MaxExtraSize);
+    output.resize(start + Size);
+
+    char* data = output.data() + start;
+    std::memset(data, 0, Size);
+    data[0] = static_cast<char>(type);
+    data[2] = static_cast<char>(extraBytes);
+    data[3] = static_cast<char>(extraBytes >> 8);
+
+    const int fields[] = { part, width, height, tilePosX, tilePosY, tileWidth, tileHeight,
+                           version, oldVersion, deltaX, deltaY, deltaWidth, deltaHeight };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+    {
+        writeInteger(data + 4 + 4 * i, fields[i]);
+    }
+
+    std::memcpy(data + 56, color, sizeof(color));
+    if (extraBytes > 0)
+        output.insert(output.end(), extra, extra + extraBytes);
+}
+
+void TileHeader::writeText(std::vector<char>& output) const
+{
+    appendText(output, getCommand());
+    output.push_back(' ');
+    const std::string description = getDescription();
+    output.insert(output.end(), description.begin(), description.end());
+
+    if (extraSize > 0)
+    {
+        output.push_back(' ');
+        output.insert(output.end(), extra, extra + extraSize);
+    }
+
+    if (type == Type::Request)
+    {
+        if (oldVersion != 0)
+            appendInteger(output, "oldver", oldVersion);
+
+        return;
+    }
+
+    if (version > 0)
+        appendInteger(output, "ver", version);
+
+    if (type == Type::Delta)
+    {
+        appendInteger(output, "oldver", oldVersion);
+        appendInteger(output, "deltax", deltaX);
+        appendInteger(output, "deltay", deltaY);
+        appendInteger(output, "deltawidth", deltaWidth);
+        appendInteger(output, "deltaheight", deltaHeight);
+    }
+
+    if (type == Type::Solid)
+    {
+        const std::string token = getColorToken();
+        output.push_back(' ');
+        output.insert(output.end(), token.begin(), token.end());
+        return;
+    }
+
+    output.push_back('\n');
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,104 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILEHEADER_HPP
+#define INCLUDED_TILEHEADER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// The fields of a tile request ("tile") or response ("tile:", "delta:"
+/// and "solidtile:"), in text or in binary form.
+///
+/// The binary form is Size bytes of little-endian fields at fixed offsets,
+/// followed by the extra tokens as text and then the image, if any. Its
+/// first byte is the Type, which no text message starts with. See
+/// protocol.txt for the layout.
+///
+/// Both forms are parsed in place, without allocating.
+struct TileHeader
+{
+    enum class Type : uint8_t
+    {
+        None = 0,
+        Request = 1,
+        Tile = 2,
+        Delta = 3,
+        Solid = 4
+    };
+
+    /// The size of the binary form without the extra tokens.
+    static const size_t Size = 64;
+
+    TileHeader();
+
+    /// Whether the message at data is a tile message in binary form.
+    static bool isBinary(const char* data, size_t size);
+
+    /// Parses the message at data, in either form. Returns false if it
+    /// isn't a tile message, or is malformed. The header then points into
+    /// data, which must outlive it.
+    bool parse(const char* data, size_t size);
+
+    /// Whether the fields are in range, as those of a request must be.
+    bool isValid() const;
+
+    /// Whether the extra tokens have an "id=", as preview requests do.
+    bool hasId() const;
+
+    /// "tile", "tile:", "delta:" or "solidtile:".
+    const char* getCommand() const;
+
+    /// "part=... tileheight=...", which names the tile.
+    std::string getDescription() const;
+
+    /// "color=rrggbbaa" of a solid tile.
+    std::string getColorToken() const;
+
+    /// Parses "rrggbbaa" into color.
+    static bool parseColor(const char* data, size_t size, uint8_t color[4]);
+
+    /// Appends the binary form, without the image.
+    void writeBinary(std::vector<char>& output) const;
+
+    /// Appends the text form, without the image. That of a tile or a
+    /// delta ends with the newline that precedes it.
+    void writeText(std::vector<char>& output) const;
+
+    Type type;
+    int part;
+    int width;
+    int height;
+    int tilePosX;
+    int tilePosY;
+    int tileWidth;
+    int tileHeight;
+    /// ver= of a response, 0 if none.
+    int version;
+    /// oldver= of a request or a delta, 0 if none.
+    int oldVersion;
+    /// The changed area of a delta.
+    int deltaX;
+    int deltaY;
+    int deltaWidth;
+    int deltaHeight;
+    /// color= of a solid tile, as red, green, blue and alpha.
+    uint8_t color[4];
+    /// The other tokens, such as "id=", passed back as they came.
+    const char* extra;
+    size_t extraSize;
+    /// Where the image starts in the parsed message.
+    size_t payloadOffset;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,201 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILEHISTORY_HPP
+#define INCLUDED_TILEHISTORY_HPP
+
+#include <cstring>
+#include <limits>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Pixel.hpp"
+
+/// Remembers the last rendering of recently painted tiles, so that a
+/// re-rendered tile can be sent as the rectangle that changed since the
+/// version the client has, rather than in full.
+///
+/// Every rendering gets a new version number. Clients send back the
+/// version they hold; a delta is only possible against the latest one.
+class TileHistory
+{
+public:
+    /// The outcome of recording a new rendering.
+    struct Update
+    {
+        /// The version of the new rendering.
+        int version;
+        /// Whether to send the changed rectangle only.
+        bool isDelta;
+        /// The changed rectangle, in pixels, when isDelta. Empty when unchanged.
+        int x;
+        int y;
+        int width;
+        int height;
+    };
+
+    /// firstVersion should differ between processes, so that versions
+    /// held by clients of an earlier process can't match.
+    TileHistory(size_t maxTiles, int keyframeInterval, int firstVersion) :
+        _maxTiles(maxTiles),
+        _keyframeInterval(keyframeInterval),
+        _nextVersion(firstVersion > 0 ? firstVersion : 1)
+    {
+    }
+
+    /// Records the width x height pixmap as the latest rendering of key.
+    /// oldVersion is the version the client holds, 0 if none.
+    Update update(const std::string& key, const unsigned char* pixmap, int width, int height, int oldVersion)
+    {
+        Update result = { nextVersion(), false, 0, 0, 0, 0 };
+
+        auto it = _tiles.find(key);
+        if (it == _tiles.end())
+        {
+            if (_tiles.size() >= _maxTiles)
+            {
+                _tiles.erase(_lru.back());
+                _lru.pop_back();
+            }
+
+            _lru.push_front(key);
+            it = _tiles.emplace(key, Entry()).first;
+            it->second.lru = _lru.begin();
+        }
+        else
+        {
+            _lru.splice(_lru.begin(), _lru, it->second.lru);
+        }
+
+        Entry& entry = it->second;
+        const size_t size = 4 * width * height;
+        if (oldVersion != 0 && oldVersion == entry.version &&
+            entry.width == width && entry.height == height &&
+            entry.deltas < _keyframeInterval)
+        {
+            if (!Pixel::getChangedRect(entry.pixmap.data(), pixmap, width, height,
+                                       result.x, result.y, result.width, result.height))
+            {
+                result.isDelta = true;
+            }
+            else if (2 * result.width * result.height <= width * height)
+            {
+                // Changes covering most of the tile are sent in full.
+                result.isDelta = true;
+            }
+        }
+
+        entry.version = result.version;
+        entry.width = width;
+        entry.height = height;
+        entry.deltas = (result.isDelta ? entry.deltas + 1 : 0);
+        entry.pixmap.resize(size);
+        std::memcpy(entry.pixmap.data(), pixmap, size);
+
+        return result;
+    }
+
+    /// The latest version of key, 0 if it isn't remembered.
+    int getVersion(const std::string& key) const
+    {
+        const auto it = _tiles.find(key);
+        return (it != _tiles.end() ? it->second.version : 0);
+    }
+
+    /// Forgets everything, e.g. when the document is unloaded.
+    void clear()
+    {
+        _tiles.clear();
+        _lru.clear();
+    }
+
+    size_t size() const { return _tiles.size(); }
+    size_t getMaxTiles() const { return _maxTiles; }
+
+private:
+    int nextVersion()
+    {
+        // Versions are positive ints on the wire.
+        const int version = _nextVersion;
+        _nextVersion = (_nextVersion == std::numeric_limits<int>::max() ? 1 : _nextVersion + 1);
+        return version;
+    }
+
+    struct Entry
+    {
+        Entry() :
+            version(0),
+            width(0),
+            height(0),
+            deltas(0)
+        {
+        }
+
+        int version;
+        int width;
+        int height;
+        /// Deltas sent since the last full tile.
+        int deltas;
+        std::vector<unsigned char> pixmap;
+        std::list<std::string>::iterator lru;
+    };
+
+    const size_t _maxTiles;
+    const int _keyframeInterval;
+    int _nextVersion;
+    std::map<std::string, Entry> _tiles;
+    /// Most recently rendered first.
+    std::list<std::string> _lru;
+};
+
+/// The versions of the tiles sent to one client. Several clients of a
+/// document get tiles rendered for each other, so a tile pushed without
+/// being asked for must be a delta against what this client holds, not
+/// against the latest version in the TileHistory.
+class TileVersions
+{
+public:
+    /// Records that version of key was sent.
+    void set(const std::string& key, int version, const TileHistory& history)
+    {
+        if (_versions.size() >= 2 * history.getMaxTiles() && _versions.find(key) == _versions.end())
+        {
+            // Only the latest versions can have a delta, forget the others.
+            for (auto it = _versions.begin(); it != _versions.end(); )
+            {
+                if (history.getVersion(it->first) != it->second)
+                    it = _versions.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        _versions[key] = version;
+    }
+
+    /// The version of key last sent, 0 if unknown.
+    int get(const std::string& key) const
+    {
+        const auto it = _versions.find(key);
+        return (it != _versions.end() ? it->second : 0);
+    }
+
+    void clear() { _versions.clear(); }
+
+    size_t size() const { return _versions.size(); }
+
+private:
+    std::map<std::string, int> _versions;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
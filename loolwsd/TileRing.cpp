@@ -0,0 +1,129 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <new>
+
+#include "TileRing.hpp"
+
+const int TileRing::FrameFlagShared;
+const int TileRing::FrameFlagRing;
+
+namespace
+{
+    /// The control block takes a page of its own.
+    const size_t ControlSize = 4096;
+
+    /// Without them, the kit could shrink the memory under the master and crash it.
+    const int Seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+}
+
+TileRing::TileRing(const int fd, char* memory, const size_t capacity) :
+    _fd(fd),
+    _memory(memory),
+    _control(reinterpret_cast<Control*>(memory)),
+    _data(memory + ControlSize),
+    _capacity(capacity),
+    _written(0)
+{
+}
+
+TileRing::~TileRing()
+{
+    munmap(_memory, ControlSize + _capacity);
+    close(_fd);
+}
+
+std::unique_ptr<TileRing> TileRing::create(const size_t capacity)
+{
+    static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "The ring needs lock-free 64-bit atomics across processes.");
+
+    const int fd = memfd_create("loolkit-tiles", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return nullptr;
+
+    if (ftruncate(fd, ControlSize + capacity) < 0 || fcntl(fd, F_ADD_SEALS, Seals) < 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* memory = mmap(nullptr, ControlSize + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    new (memory) Control();
+    static_cast<Control*>(memory)->released.store(0);
+    return std::unique_ptr<TileRing>(new TileRing(fd, static_cast<char*>(memory), capacity));
+}
+
+std::unique_ptr<TileRing> TileRing::map(const int fd)
+{
+    struct stat st;
+    if (fd < 0 || (fcntl(fd, F_GET_SEALS) & Seals) != Seals ||
+        fstat(fd, &st) < 0 || st.st_size <= static_cast<off_t>(ControlSize))
+    {
+        if (fd >= 0)
+            close(fd);
+
+        return nullptr;
+    }
+
+    const size_t capacity = st.st_size - ControlSize;
+    void* memory = mmap(nullptr, ControlSize + capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED)
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    return std::unique_ptr<TileRing>(new TileRing(fd, static_cast<char*>(memory), capacity));
+}
+
+bool TileRing::write(const char* data, const size_t size, Descriptor& descriptor)
+{
+    // A message doesn't wrap around, it starts over at the beginning.
+    uint64_t position = _written;
+    const size_t offset = position % _capacity;
+    if (offset + size > _capacity)
+        position += _capacity - offset;
+
+    if (position + size - _control->released.load(std::memory_order_acquire) > _capacity)
+        return false;
+
+    std::memcpy(_data + position % _capacity, data, size);
+    _written = position + size;
+    descriptor.position = position;
+    descriptor.size = size;
+    return true;
+}
+
+const char* TileRing::read(const Descriptor& descriptor) const
+{
+    const size_t offset = descriptor.position % _capacity;
+    if (descriptor.size > _capacity || offset + descriptor.size > _capacity)
+        return nullptr;
+
+    return _data + offset;
+}
+
+void TileRing::release(const Descriptor& descriptor)
+{
+    _control->released.store(descriptor.position + descriptor.size, std::memory_order_release);
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,88 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TILERING_HPP
+#define INCLUDED_TILERING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/// Shared memory in which a kit hands its rendered tiles to the master.
+///
+/// The kit creates the ring, a sealed memfd, and passes it to the master
+/// over its UnixChannel. It then writes each tile into the ring and sends
+/// only a Descriptor of it; the master handles the tile where it is,
+/// caching and forwarding it from the ring, and releases it. Messages
+/// are released in the order they are written, so the ring only needs to
+/// know how far the master got.
+class TileRing
+{
+public:
+    /// Where a message is, as sent in its place.
+    struct Descriptor
+    {
+        /// Bytes written to the ring before the message, padding included.
+        uint64_t position;
+        uint64_t size;
+    };
+
+    /// UnixChannel flags, beyond those of a WebSocket frame: the message
+    /// is a Descriptor, and the message carries the ring's fd.
+    static const int FrameFlagShared = 0x100;
+    static const int FrameFlagRing = 0x200;
+
+    ~TileRing();
+
+    TileRing(const TileRing&) = delete;
+    TileRing& operator=(const TileRing&) = delete;
+
+    /// A new ring of capacity bytes, or nullptr if shared memory fails.
+    static std::unique_ptr<TileRing> create(size_t capacity);
+
+    /// Maps the ring created by the other process as fd, which it takes
+    /// over. Returns nullptr if it is not a sealed ring.
+    static std::unique_ptr<TileRing> map(int fd);
+
+    int getFd() const { return _fd; }
+    size_t getCapacity() const { return _capacity; }
+
+    /// Copies the message at data into the ring. Returns false if there
+    /// is no room, which happens when the master lags behind.
+    bool write(const char* data, size_t size, Descriptor& descriptor);
+
+    /// The message described, or nullptr if the descriptor is invalid.
+    const char* read(const Descriptor& descriptor) const;
+
+    /// Gives the space of the message, and of those before it, back.
+    void release(const Descriptor& descriptor);
+
+private:
+    /// At the start of the memory, followed by the messages.
+    struct Control
+    {
+        /// Bytes released by the master, the end of the last released message.
+        std::atomic<uint64_t> released;
+    };
+
+    TileRing(int fd, char* memory, size_t capacity);
+
+    const int _fd;
+    char* const _memory;
+    Control* const _control;
+    char* const _data;
+    const size_t _capacity;
+    /// Bytes written by the kit so far.
+    uint64_t _written;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
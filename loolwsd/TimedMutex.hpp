@@ -0,0 +1,114 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TIMEDMUTEX_HPP
+#define INCLUDED_TIMEDMUTEX_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+/// A recursive mutex that measures how long it is waited for and held,
+/// to find out what blocks other sessions. Usable with std::unique_lock.
+class TimedRecursiveMutex
+{
+public:
+    struct Stats
+    {
+        /// Outermost lock() calls.
+        uint64_t count;
+        uint64_t totalWaitUs;
+        uint64_t maxWaitUs;
+        uint64_t totalHoldUs;
+        uint64_t maxHoldUs;
+    };
+
+    TimedRecursiveMutex() :
+        _depth(0),
+        _count(0),
+        _totalWaitUs(0),
+        _maxWaitUs(0),
+        _totalHoldUs(0),
+        _maxHoldUs(0)
+    {
+    }
+
+    TimedRecursiveMutex(const TimedRecursiveMutex&) = delete;
+    TimedRecursiveMutex& operator=(const TimedRecursiveMutex&) = delete;
+
+    void lock()
+    {
+        const auto start = Clock::now();
+        _mutex.lock();
+        if (_depth++ == 0)
+        {
+            _acquired = Clock::now();
+            const uint64_t waitUs = getMicroseconds(_acquired - start);
+            _totalWaitUs += waitUs;
+            if (waitUs > _maxWaitUs)
+                _maxWaitUs = waitUs;
+        }
+    }
+
+    bool try_lock()
+    {
+        if (!_mutex.try_lock())
+            return false;
+
+        if (_depth++ == 0)
+            _acquired = Clock::now();
+
+        return true;
+    }
+
+    void unlock()
+    {
+        // Still held here, so the members are ours to update.
+        if (--_depth == 0)
+        {
+            const uint64_t holdUs = getMicroseconds(Clock::now() - _acquired);
+            ++_count;
+            _totalHoldUs += holdUs;
+            if (holdUs > _maxHoldUs)
+                _maxHoldUs = holdUs;
+        }
+
+        _mutex.unlock();
+    }
+
+    /// Can be called without holding the lock.
+    Stats getStats() const
+    {
+        return Stats{ _count, _totalWaitUs, _maxWaitUs, _totalHoldUs, _maxHoldUs };
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static uint64_t getMicroseconds(const Clock::duration duration)
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    }
+
+    std::recursive_mutex _mutex;
+    unsigned _depth;
+    Clock::time_point _acquired;
+
+    // Written with the lock held, but read by getStats() without.
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _totalWaitUs;
+    std::atomic<uint64_t> _maxWaitUs;
+    std::atomic<uint64_t> _totalHoldUs;
+    std::atomic<uint64_t> _maxHoldUs;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
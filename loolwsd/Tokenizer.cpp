@@ -0,0 +1,130 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <climits>
+#include <cstring>
+
+#include "Tokenizer.hpp"
+
+const size_t Tokenizer::MaxTokens;
+
+namespace
+{
+    /// What TOK_TRIM trims, besides the separating spaces.
+    bool isSpace(const char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+}
+
+Tokenizer::Tokenizer(const char* message, const size_t size) :
+    _count(0)
+{
+    if (message == nullptr)
+        return;
+
+    const char* const lineEnd = static_cast<const char*>(std::memchr(message, '\n', size));
+    const char* const end = (lineEnd != nullptr ? lineEnd : message + size);
+    _line = StringView(message, end - message);
+
+    const char* begin = message;
+    while (_count < MaxTokens)
+    {
+        while (begin != end && isSpace(*begin))
+            ++begin;
+
+        if (begin == end)
+            break;
+
+        // The last token we have room for takes the rest of the line.
+        const char* tokenEnd = end;
+        if (_count + 1 < MaxTokens)
+        {
+            const char* const space = static_cast<const char*>(std::memchr(begin, ' ', end - begin));
+            tokenEnd = (space != nullptr ? space : end);
+        }
+
+        const char* next = tokenEnd;
+        while (tokenEnd != begin && isSpace(tokenEnd[-1]))
+            --tokenEnd;
+
+        _tokens[_count++] = StringView(begin, tokenEnd - begin);
+        begin = next;
+    }
+}
+
+bool Tokenizer::parseInteger(const StringView text, int& value)
+{
+    const char* begin = text.data();
+    const char* const end = begin + text.size();
+    const bool negative = (begin != end && *begin == '-');
+    if (negative)
+        ++begin;
+
+    if (begin == end)
+        return false;
+
+    long long result = 0;
+    for (; begin != end; ++begin)
+    {
+        if (*begin < '0' || *begin > '9')
+            return false;
+
+        result = result * 10 + (*begin - '0');
+        if (result > static_cast<long long>(INT_MAX) + 1)
+            return false;
+    }
+
+    result = (negative ? -result : result);
+    if (result > INT_MAX)
+        return false;
+
+    value = static_cast<int>(result);
+    return true;
+}
+
+bool Tokenizer::getValue(const StringView token, const char* name, StringView& value)
+{
+    const size_t size = std::strlen(name);
+    if (token.size() <= size + 1 || std::memcmp(token.data(), name, size) != 0 || token[size] != '=')
+        return false;
+
+    value = token.substr(size + 1);
+    return true;
+}
+
+bool Tokenizer::getInteger(const StringView token, const char* name, int& value)
+{
+    StringView text;
+    return getValue(token, name, text) && parseInteger(text, value);
+}
+
+bool Tokenizer::getKeyword(const StringView token, const char* name,
+                           const std::pair<const char*, int>* keywords, const size_t count, int& value)
+{
+    StringView keyword;
+    if (!getValue(token, name, keyword))
+        return false;
+
+    if (keyword.size() >= 2 && keyword[0] == '\'' && keyword[keyword.size() - 1] == '\'')
+        keyword = StringView(keyword.data() + 1, keyword.size() - 2);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (keyword == keywords[i].first)
+        {
+            value = keywords[i].second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
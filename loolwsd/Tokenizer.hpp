@@ -0,0 +1,122 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_TOKENIZER_HPP
+#define INCLUDED_TOKENIZER_HPP
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <utility>
+
+/// A range of characters in a message, which it doesn't own: the
+/// std::string_view of C++17, as much of it as the protocol needs.
+class StringView
+{
+public:
+    StringView() :
+        _data(nullptr),
+        _size(0)
+    {
+    }
+
+    StringView(const char* data, const size_t size) :
+        _data(data),
+        _size(size)
+    {
+    }
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    char operator[](const size_t index) const { return _data[index]; }
+
+    bool operator==(const char* text) const
+    {
+        return std::strlen(text) == _size && std::memcmp(_data, text, _size) == 0;
+    }
+
+    bool operator!=(const char* text) const { return !(*this == text); }
+
+    bool startsWith(const char* prefix) const
+    {
+        const size_t size = std::strlen(prefix);
+        return size <= _size && std::memcmp(_data, prefix, size) == 0;
+    }
+
+    /// The range from index on.
+    StringView substr(const size_t index) const
+    {
+        return index < _size ? StringView(_data + index, _size - index) : StringView();
+    }
+
+    std::string toString() const { return std::string(_data, _size); }
+
+private:
+    const char* _data;
+    size_t _size;
+};
+
+/// Splits the first line of a message into the tokens between spaces, as
+/// Poco::StringTokenizer does with TOK_IGNORE_EMPTY | TOK_TRIM, but in
+/// place: the tokens point into the message, which must outlive them, and
+/// nothing is copied nor allocated.
+///
+/// Up to MaxTokens tokens are kept, more than any command has; the last
+/// one then holds the rest of the line.
+class Tokenizer
+{
+public:
+    static const size_t MaxTokens = 32;
+
+    Tokenizer(const char* message, size_t size);
+
+    size_t count() const { return _count; }
+
+    /// The token at index, empty past the last one.
+    StringView operator[](const size_t index) const
+    {
+        return index < _count ? _tokens[index] : StringView();
+    }
+
+    /// The first line, without its newline.
+    StringView getLine() const { return _line; }
+
+    /// Parses a decimal int, unlike std::stoi without a string nor
+    /// exceptions. Fails on anything but an optional '-' and digits, and
+    /// on overflow.
+    static bool parseInteger(StringView text, int& value);
+
+    /// Whether token is "name=..." with a value, and if so, the value.
+    static bool getValue(StringView token, const char* name, StringView& value);
+
+    /// Whether token is "name=<int>", and if so, its value.
+    static bool getInteger(StringView token, const char* name, int& value);
+
+    /// Whether token is "name=<keyword>", the keyword optionally in single
+    /// quotes, and if so, the value paired with the keyword.
+    template <size_t N>
+    static bool getKeyword(const StringView token, const char* name,
+                           const std::pair<const char*, int> (&keywords)[N], int& value)
+    {
+        return getKeyword(token, name, keywords, N, value);
+    }
+
+    static bool getKeyword(StringView token, const char* name,
+                           const std::pair<const char*, int>* keywords, size_t count, int& value);
+
+private:
+    StringView _line;
+    StringView _tokens[MaxTokens];
+    size_t _count;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
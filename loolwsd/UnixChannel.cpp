@@ -0,0 +1,260 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+
+#include "ReceiveBuffer.hpp"
+#include "UnixChannel.hpp"
+
+const int UnixChannel::CloseFlags;
+
+namespace
+{
+    /// The address of the abstract socket called name, and its length.
+    socklen_t makeAddress(const std::string& name, sockaddr_un& address)
+    {
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+
+        // A leading NUL puts it in the abstract namespace.
+        const size_t size = std::min(name.size(), sizeof(address.sun_path) - 1);
+        std::memcpy(address.sun_path + 1, name.data(), size);
+        return offsetof(sockaddr_un, sun_path) + 1 + size;
+    }
+}
+
+UnixChannel::UnixChannel(const int fd) :
+    _fd(fd),
+    _receivedFd(-1)
+{
+}
+
+UnixChannel::~UnixChannel()
+{
+    if (_receivedFd >= 0)
+        ::close(_receivedFd);
+
+    ::close(_fd);
+}
+
+void UnixChannel::send(const char* data, const size_t size, const int flags, const int fd)
+{
+    Header header = { static_cast<uint32_t>(size), static_cast<uint32_t>(flags) };
+    iovec parts[2];
+    parts[0].iov_base = &header;
+    parts[0].iov_len = sizeof(header);
+    parts[1].iov_base = const_cast<char*>(data);
+    parts[1].iov_len = size;
+
+    msghdr message = {};
+    message.msg_iov = parts;
+    message.msg_iovlen = 2;
+
+    // Goes with the first byte, hence with the header.
+    char control[CMSG_SPACE(sizeof(int))] = {};
+    if (fd >= 0)
+    {
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    std::unique_lock<std::mutex> lock(_sendMutex);
+    while (message.msg_iovlen > 0)
+    {
+        ssize_t written = sendmsg(_fd, &message, MSG_NOSIGNAL);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            throw std::runtime_error(std::string("Failed to send on the Unix channel: ") + std::strerror(errno));
+        }
+
+        message.msg_control = nullptr;
+        message.msg_controllen = 0;
+
+        // Skip what was written, the socket may take a large message in parts.
+        while (message.msg_iovlen > 0 && static_cast<size_t>(written) >= message.msg_iov->iov_len)
+        {
+            written -= message.msg_iov->iov_len;
+            ++message.msg_iov;
+            --message.msg_iovlen;
+        }
+
+        if (message.msg_iovlen > 0)
+        {
+            message.msg_iov->iov_base = static_cast<char*>(message.msg_iov->iov_base) + written;
+            message.msg_iov->iov_len -= written;
+        }
+    }
+}
+
+int UnixChannel::receive(ReceiveBuffer& buffer, int& flags)
+{
+    // The previous message is handled by now.
+    buffer.shrink();
+
+    Header header;
+    if (!read(reinterpret_cast<char*>(&header), sizeof(header)))
+        return 0;
+
+    if (!buffer.reserve(header.size))
+        throw std::runtime_error("Message of " + std::to_string(header.size) + " bytes on the Unix channel is over the limit.");
+
+    if (!read(buffer.data(), header.size))
+        throw std::runtime_error("Unix channel closed in the middle of a message.");
+
+    flags = static_cast<int>(header.flags);
+    return static_cast<int>(header.size);
+}
+
+int UnixChannel::takeReceivedFd()
+{
+    const int fd = _receivedFd;
+    _receivedFd = -1;
+    return fd;
+}
+
+bool UnixChannel::poll(const int timeoutMs)
+{
+    pollfd pfd = { _fd, POLLIN, 0 };
+    return ::poll(&pfd, 1, timeoutMs) > 0;
+}
+
+void UnixChannel::shutdown()
+{
+    try
+    {
+        send(nullptr, 0, CloseFlags);
+    }
+    catch (const std::runtime_error&)
+    {
+        // Gone already.
+    }
+}
+
+void UnixChannel::shutdownReceive()
+{
+    ::shutdown(_fd, SHUT_RD);
+}
+
+bool UnixChannel::read(char* data, size_t size)
+{
+    bool started = false;
+    while (size > 0)
+    {
+        iovec part = { data, size };
+        char control[CMSG_SPACE(sizeof(int))];
+        msghdr message = {};
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        const ssize_t received = recvmsg(_fd, &message, MSG_CMSG_CLOEXEC);
+        if (received < 0 && errno == EINTR)
+            continue;
+
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); received > 0 && cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            {
+                if (_receivedFd >= 0)
+                    ::close(_receivedFd);
+
+                std::memcpy(&_receivedFd, CMSG_DATA(cmsg), sizeof(int));
+            }
+        }
+
+        if (received < 0)
+            throw std::runtime_error(std::string("Failed to receive on the Unix channel: ") + std::strerror(errno));
+
+        if (received == 0)
+        {
+            if (started)
+                throw std::runtime_error("Unix channel closed in the middle of a message.");
+
+            return false;
+        }
+
+        started = true;
+        data += received;
+        size -= received;
+    }
+
+    return true;
+}
+
+int UnixChannel::listen(const std::string& name)
+{
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    sockaddr_un address;
+    const socklen_t length = makeAddress(name, address);
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), length) < 0 || ::listen(fd, SOMAXCONN) < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+std::shared_ptr<UnixChannel> UnixChannel::accept(const int listenFd)
+{
+    const int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    auto channel = std::make_shared<UnixChannel>(fd);
+
+    // Abstract sockets have no file permissions; only our kits may talk to us.
+    ucred credentials;
+    socklen_t length = sizeof(credentials);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) < 0 || credentials.uid != getuid())
+        return nullptr;
+
+    return channel;
+}
+
+std::shared_ptr<UnixChannel> UnixChannel::connect(const std::string& name)
+{
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return nullptr;
+
+    auto channel = std::make_shared<UnixChannel>(fd);
+
+    sockaddr_un address;
+    const socklen_t length = makeAddress(name, address);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), length) < 0)
+        return nullptr;
+
+    return channel;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
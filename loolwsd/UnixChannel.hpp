@@ -0,0 +1,92 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_UNIXCHANNEL_HPP
+#define INCLUDED_UNIXCHANNEL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class ReceiveBuffer;
+
+/// A connection between the master and a kit over a Unix domain socket.
+///
+/// It carries the same messages as the WebSocket it replaces, without
+/// the HTTP handshake, masking and framing: each message is preceded by
+/// its size and the WebSocket frame flags it would have had, so that
+/// text, binary and close messages are told apart as before.
+///
+/// The socket is in the abstract namespace, which the jailed kits reach
+/// regardless of their chroot. Errors throw std::runtime_error.
+class UnixChannel
+{
+public:
+    /// The flags of a close message, those of a WebSocket close frame.
+    static const int CloseFlags = 0x88;
+
+    /// Takes ownership of the connected socket fd.
+    explicit UnixChannel(int fd);
+    ~UnixChannel();
+
+    UnixChannel(const UnixChannel&) = delete;
+    UnixChannel& operator=(const UnixChannel&) = delete;
+
+    /// Sends size bytes at data as one message, with a duplicate of fd
+    /// if it isn't -1. Thread-safe.
+    void send(const char* data, size_t size, int flags, int fd = -1);
+
+    /// Receives the next message into buffer. Returns its size, or 0
+    /// once the other side is gone.
+    int receive(ReceiveBuffer& buffer, int& flags);
+
+    /// The fd that came with the last message received, or -1. The caller
+    /// owns it.
+    int takeReceivedFd();
+
+    /// Whether a message, or the end, can be received within timeoutMs.
+    bool poll(int timeoutMs);
+
+    /// Sends a close message; errors are ignored.
+    void shutdown();
+
+    /// Makes receive() return 0, as if the other side were gone.
+    void shutdownReceive();
+
+    /// Listens on the socket called name. Returns the socket, or -1.
+    static int listen(const std::string& name);
+
+    /// Accepts a connection on listenFd from a process of our user.
+    /// Returns nullptr if there is none, or it is of someone else.
+    static std::shared_ptr<UnixChannel> accept(int listenFd);
+
+    /// Connects to the socket called name. Returns nullptr on failure.
+    static std::shared_ptr<UnixChannel> connect(const std::string& name);
+
+private:
+    struct Header
+    {
+        uint32_t size;
+        uint32_t flags;
+    };
+
+    /// Reads exactly size bytes. Returns false at the end of the stream.
+    bool read(char* data, size_t size);
+
+    const int _fd;
+    std::mutex _sendMutex;
+    /// Used by the receiving thread only.
+    int _receivedFd;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -19,8 +19,6 @@
 #include <sstream>
 #include <string>
 
-#include <png.h>
-
 #include <signal.h>
 
 #include <Poco/ConsoleChannel.h>
@@ -33,29 +31,8 @@
 #include <Poco/Util/Application.h>
 
 #include "Common.hpp"
+#include "TileEncoder.hpp"
 #include "Util.hpp"
-#include "Png.hpp"
-
-// Callback functions for libpng
-
-extern "C"
-{
-    static void user_write_status_fn(png_structp, png_uint_32, int)
-    {
-    }
-
-    static void user_write_fn(png_structp png_ptr, png_bytep data, png_size_t length)
-    {
-        std::vector<char> *outputp = (std::vector<char> *) png_get_io_ptr(png_ptr);
-        const size_t oldsize = outputp->size();
-        outputp->resize(oldsize + length);
-        std::memcpy(outputp->data() + oldsize, data, length);
-    }
-
-    static void user_flush_fn(png_structp)
-    {
-    }
-}
 
 volatile bool TerminationFlag = false;
 
@@ -229,42 +206,7 @@ namespace Util
     bool encodeSubBufferToPNG(unsigned char *pixmap, int startX, int startY, int width, int height,
                               int bufferWidth, int bufferHeight, std::vector<char>& output, LibreOfficeKitTileMode mode)
     {
-        if (bufferWidth < width || bufferHeight < height)
-            return false;
-
-        png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
-
-        png_infop info_ptr = png_create_info_struct(png_ptr);
-
-        if (setjmp(png_jmpbuf(png_ptr)))
-        {
-            png_destroy_write_struct(&png_ptr, nullptr);
-            return false;
-        }
-
-        png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
-
-        png_set_write_fn(png_ptr, &output, user_write_fn, user_flush_fn);
-        png_set_write_status_fn(png_ptr, user_write_status_fn);
-
-        png_write_info(png_ptr, info_ptr);
-
-        if (mode == LOK_TILEMODE_BGRA)
-        {
-            png_set_write_user_transform_fn (png_ptr, unpremultiply_data);
-        }
-
-        for (int y = 0; y < height; ++y)
-        {
-            size_t position = ((startY + y) * bufferWidth * 4) + (startX * 4);
-            png_write_row(png_ptr, pixmap + position);
-        }
-
-        png_write_end(png_ptr, info_ptr);
-
-        png_destroy_write_struct(&png_ptr, &info_ptr);
-
-        return true;
+        return TileEncoder::getDefault()->encode(pixmap, startX, startY, width, height, bufferWidth, bufferHeight, output, mode);
     }
 
     void shutdownWebSocket(std::shared_ptr<Poco::Net::WebSocket> ws)
@@ -382,27 +324,6 @@ namespace Util
         return bytes;
     }
 
-    ssize_t readMessage(int pipe, char* buffer, ssize_t size)
-    {
-        struct pollfd pollPipe;
-
-        pollPipe.fd = pipe;
-        pollPipe.events = POLLIN;
-        pollPipe.revents = 0;
-
-        const int nPoll = poll(&pollPipe, 1, CHILD_TIMEOUT_SECS * 1000);
-        if ( nPoll < 0 )
-            return -1;
-
-        if ( nPoll == 0 )
-            errno = ETIME;
-
-        if( (pollPipe.revents & POLLIN) != 0 )
-            return readFIFO(pipe, buffer, size);
-
-        return -1;
-    }
-
     static
     void handleTerminationSignal(const int signal)
     {
@@ -601,37 +522,6 @@ namespace Util
             }
         }
     }
-
-    unsigned getMemoryUsage(Poco::Process::PID nPid)
-    {
-        //TODO: Instead of RSS, return PSS
-        std::string sResponse;
-        const auto cmd = "ps o rss= -p " + std::to_string(nPid);
-        FILE* fp = popen(cmd.c_str(), "r");
-        if (fp == nullptr)
-        {
-            return 0;
-        }
-
-        char cmdBuffer[1024];
-        while (fgets(cmdBuffer, sizeof(cmdBuffer) - 1, fp) != nullptr)
-        {
-            sResponse += cmdBuffer;
-        }
-        pclose(fp);
-
-        unsigned nMem = 0;
-        try
-        {
-            nMem = std::stoi(sResponse);
-        }
-        catch(std::exception& e)
-        {
-            Log::warn() << "Trying to find memory of invalid/dead PID" << Log::end;
-        }
-
-        return nMem;
-    }
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -85,8 +85,6 @@ namespace Util
 
     ssize_t readFIFO(int pipe, char* buffer, ssize_t size);
 
-    ssize_t readMessage(int pipe, char* buffer, ssize_t size);
-
     /// Safely remove a file or directory.
     /// Supresses exception when the file is already removed.
     /// This can happen when there is a race (unavoidable) or when
@@ -126,8 +124,6 @@ namespace Util
 
     void pollPipeForReading(pollfd& pollPipe, const std::string& targetPipeName , const int& targetPipe,
                             std::function<void(std::string& message)> handler);
-
-    unsigned getMemoryUsage(Poco::Process::PID nPid);
 };
 
 //TODO: Move to own file.
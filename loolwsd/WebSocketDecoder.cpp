@@ -0,0 +1,179 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <cstdint>
+
+#include "WebSocketDecoder.hpp"
+
+namespace
+{
+    const unsigned char FlagFin = 0x80;
+    const unsigned char FlagCompressed = 0x40;
+    const unsigned char FlagsReserved = 0x70;
+    const unsigned char OpcodeMask = 0x0f;
+    const unsigned char FlagMask = 0x80;
+    const unsigned char LengthMask = 0x7f;
+
+    const unsigned char OpcodeContinuation = 0x0;
+    const unsigned char OpcodeText = 0x1;
+    const unsigned char OpcodeBinary = 0x2;
+    const unsigned char OpcodeClose = 0x8;
+    const unsigned char OpcodePing = 0x9;
+    const unsigned char OpcodePong = 0xa;
+
+    /// Control frames carry at most this much, and can't be fragmented.
+    const uint64_t MaxControlPayload = 125;
+
+    void appendUnmasked(std::vector<char>& output, const unsigned char* data, const size_t size,
+                        const unsigned char* mask)
+    {
+        const size_t start = output.size();
+        output.resize(start + size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            output[start + i] = (mask ? data[i] ^ mask[i % 4] : data[i]);
+        }
+    }
+}
+
+WebSocketDecoder::WebSocketDecoder(const size_t maxMessageSize) :
+    _maxMessageSize(maxMessageSize),
+    _offset(0),
+    _fragmented(false),
+    _compressed(false)
+{
+}
+
+void WebSocketDecoder::append(const char* data, const size_t size)
+{
+    // Drop what is decoded; usually nothing or part of a frame is left.
+    if (_offset > 0)
+    {
+        _input.erase(_input.begin(), _input.begin() + _offset);
+        _offset = 0;
+    }
+
+    _input.insert(_input.end(), data, data + size);
+}
+
+WebSocketDecoder::Result WebSocketDecoder::decode(std::vector<char>& payload)
+{
+    while (true)
+    {
+        const size_t available = _input.size() - _offset;
+        const unsigned char* frame = reinterpret_cast<const unsigned char*>(_input.data()) + _offset;
+        if (available < 2)
+            return Result::NeedMore;
+
+        const bool fin = (frame[0] & FlagFin);
+        const unsigned char opcode = (frame[0] & OpcodeMask);
+        const bool isControl = (opcode & 0x8);
+
+        size_t headerSize = getHeaderSize(_input.data() + _offset);
+        if (available < headerSize)
+            return Result::NeedMore;
+
+        const uint64_t length = getPayloadLength(_input.data() + _offset);
+
+        // Only the first frame of a message may be flagged as compressed,
+        // once permessage-deflate is negotiated; the rest must be clear.
+        const unsigned char reserved = (frame[0] & FlagsReserved);
+        if ((reserved & ~FlagCompressed) ||
+            (reserved && (!_inflater || isControl || opcode == OpcodeContinuation)) ||
+            (isControl && (!fin || length > MaxControlPayload)) ||
+            (!isControl && length > _maxMessageSize - _message.size()))
+        {
+            return Result::Error;
+        }
+
+        const unsigned char* mask = nullptr;
+        if (frame[1] & FlagMask)
+        {
+            mask = frame + headerSize;
+            headerSize += 4;
+        }
+
+        if (available < headerSize || available - headerSize < length)
+            return Result::NeedMore;
+
+        const unsigned char* data = frame + headerSize;
+        _offset += headerSize + length;
+
+        if (isControl)
+        {
+            payload.clear();
+            appendUnmasked(payload, data, length, mask);
+            switch (opcode)
+            {
+            case OpcodeClose:
+                return Result::Close;
+            case OpcodePing:
+                return Result::Ping;
+            case OpcodePong:
+                return Result::Pong;
+            default:
+                return Result::Error;
+            }
+        }
+
+        if ((opcode == OpcodeContinuation && !_fragmented) ||
+            ((opcode == OpcodeText || opcode == OpcodeBinary) && _fragmented) ||
+            (opcode != OpcodeContinuation && opcode != OpcodeText && opcode != OpcodeBinary))
+        {
+            return Result::Error;
+        }
+
+        if (opcode != OpcodeContinuation)
+            _compressed = (reserved != 0);
+
+        appendUnmasked(_message, data, length, mask);
+        if (!fin)
+        {
+            // Wait for the rest of the message.
+            _fragmented = true;
+            continue;
+        }
+
+        _fragmented = false;
+        if (_compressed)
+        {
+            const bool valid = _inflater->decompress(_message.data(), _message.size(), _maxMessageSize, payload);
+            _message.clear();
+            return (valid ? Result::Message : Result::Error);
+        }
+
+        payload.swap(_message);
+        _message.clear();
+        return Result::Message;
+    }
+}
+
+size_t WebSocketDecoder::getHeaderSize(const char* data)
+{
+    const unsigned char length = (static_cast<unsigned char>(data[1]) & LengthMask);
+    return (length == 126 ? 4 : length == 127 ? 10 : 2);
+}
+
+uint64_t WebSocketDecoder::getPayloadLength(const char* data)
+{
+    const unsigned char* header = reinterpret_cast<const unsigned char*>(data);
+    const size_t headerSize = getHeaderSize(data);
+    if (headerSize == 2)
+        return (header[1] & LengthMask);
+
+    uint64_t length = 0;
+    for (size_t i = 2; i < headerSize; ++i)
+    {
+        length = (length << 8) | header[i];
+    }
+
+    return length;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
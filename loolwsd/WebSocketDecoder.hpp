@@ -0,0 +1,79 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_WEBSOCKETDECODER_HPP
+#define INCLUDED_WEBSOCKETDECODER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "PerMessageDeflate.hpp"
+
+/// Decodes the frames a client sends on a WebSocket (RFC 6455) from
+/// whatever bytes have arrived so far, so that the reader never has to
+/// block waiting for the rest of a frame.
+class WebSocketDecoder
+{
+public:
+    enum class Result
+    {
+        /// No complete message or control frame yet.
+        NeedMore,
+        /// A text or binary message, reassembled from its fragments.
+        Message,
+        Ping,
+        Pong,
+        Close,
+        /// A protocol violation or a message over the size limit;
+        /// the connection should be dropped.
+        Error
+    };
+
+    /// maxMessageSize bounds the reassembled messages.
+    explicit WebSocketDecoder(size_t maxMessageSize);
+
+    /// Decompresses the messages flagged as compressed with inflater,
+    /// once permessage-deflate is negotiated.
+    void setInflater(std::unique_ptr<PerMessageDeflate::Inflater> inflater) { _inflater = std::move(inflater); }
+
+    /// Queues size bytes received from the socket.
+    void append(const char* data, size_t size);
+
+    /// Decodes the next message or control frame from the queued bytes.
+    /// payload gets the unmasked message or control frame payload.
+    Result decode(std::vector<char>& payload);
+
+    /// The size of the header of the frame starting with the two bytes
+    /// at data, without the masking key.
+    static size_t getHeaderSize(const char* data);
+
+    /// The payload length given in the getHeaderSize() bytes at data.
+    static uint64_t getPayloadLength(const char* data);
+
+    /// Bytes received but not yet returned by decode().
+    size_t getBufferedSize() const { return _input.size() - _offset + _message.size(); }
+
+private:
+    const size_t _maxMessageSize;
+    /// Received bytes; the ones before _offset are decoded.
+    std::vector<char> _input;
+    size_t _offset;
+    /// The fragments of the current message so far.
+    std::vector<char> _message;
+    bool _fragmented;
+    /// Whether the current message is compressed.
+    bool _compressed;
+    std::unique_ptr<PerMessageDeflate::Inflater> _inflater;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
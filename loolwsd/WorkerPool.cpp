@@ -0,0 +1,97 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <sys/prctl.h>
+
+#include "WorkerPool.hpp"
+
+WorkerPool::WorkerPool(const size_t workerCount, const size_t blockingWorkerCount, const std::string& name) :
+    _stop(false)
+{
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        _lane.threads.emplace_back(&WorkerPool::run, this, std::ref(_lane), name);
+    }
+
+    for (size_t i = 0; i < blockingWorkerCount; ++i)
+    {
+        _blockingLane.threads.emplace_back(&WorkerPool::run, this, std::ref(_blockingLane), name + "_blocking");
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop();
+}
+
+void WorkerPool::post(std::function<void()> task, const bool mayBlock)
+{
+    Lane& lane = (mayBlock ? _blockingLane : _lane);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_stop)
+            return;
+
+        lane.tasks.push_back(std::move(task));
+    }
+
+    lane.cv.notify_one();
+}
+
+void WorkerPool::stop()
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (_stop)
+            return;
+
+        _stop = true;
+    }
+
+    for (Lane* lane : { &_lane, &_blockingLane })
+    {
+        lane->cv.notify_all();
+        for (auto& thread : lane->threads)
+        {
+            thread.join();
+        }
+
+        lane->tasks.clear();
+    }
+}
+
+size_t WorkerPool::getQueuedCount(const bool mayBlock) const
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    return (mayBlock ? _blockingLane : _lane).tasks.size();
+}
+
+void WorkerPool::run(Lane& lane, const std::string& name)
+{
+    // Thread names are at most 15 characters.
+    prctl(PR_SET_NAME, reinterpret_cast<unsigned long>(name.substr(0, 15).c_str()), 0, 0, 0);
+
+    while (true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            lane.cv.wait(lock, [this, &lane]() { return _stop || !lane.tasks.empty(); });
+            if (_stop)
+                break;
+
+            task = std::move(lane.tasks.front());
+            lane.tasks.pop_front();
+        }
+
+        task();
+    }
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
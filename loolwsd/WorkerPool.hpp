@@ -0,0 +1,65 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#ifndef INCLUDED_WORKERPOOL_HPP
+#define INCLUDED_WORKERPOOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Runs tasks on a few threads, in the order posted.
+///
+/// Tasks that may block for long, like opening a document, which waits for
+/// a kit and copies the file in, go to threads of their own, so that they
+/// hold up each other at worst, and never the short tasks.
+class WorkerPool
+{
+public:
+    /// workerCount threads run the short tasks, blockingWorkerCount those
+    /// that may block. Threads are named name and name_blocking.
+    WorkerPool(size_t workerCount, size_t blockingWorkerCount, const std::string& name);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /// Queues task, for the blocking threads if mayBlock.
+    void post(std::function<void()> task, bool mayBlock = false);
+
+    /// Stops the threads once their current tasks return; queued ones are dropped.
+    void stop();
+
+    /// Tasks waiting for a thread.
+    size_t getQueuedCount(bool mayBlock) const;
+
+private:
+    struct Lane
+    {
+        std::deque<std::function<void()>> tasks;
+        std::condition_variable cv;
+        std::vector<std::thread> threads;
+    };
+
+    void run(Lane& lane, const std::string& name);
+
+    mutable std::mutex _mutex;
+    bool _stop;
+    Lane _lane;
+    Lane _blockingLane;
+};
+
+#endif
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
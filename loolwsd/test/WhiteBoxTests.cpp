@@ -0,0 +1,1360 @@
+/* -*- Mode: C++; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4; fill-column: 100 -*- */
+/*
+ * This file is part of the LibreOffice project.
+ *
+ * This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at http://mozilla.org/MPL/2.0/.
+ */
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <png.h>
+
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <BufferPool.hpp>
+#include <Command.hpp>
+#include <ControlChannel.hpp>
+#include <DocumentFamily.hpp>
+#include <Pixel.hpp>
+#include <MemoryCollector.hpp>
+#include <MemoryGovernor.hpp>
+#include <MessageBatch.hpp>
+#include <OutboundQueue.hpp>
+#include <PerMessageDeflate.hpp>
+#include <PrespawnPool.hpp>
+#include <Png.hpp>
+#include <ReceiveBuffer.hpp>
+#include <TileEncoder.hpp>
+#include <TileHeader.hpp>
+#include <TileHistory.hpp>
+#include <TileRing.hpp>
+#include <TimedMutex.hpp>
+#include <Tokenizer.hpp>
+#include <UnixChannel.hpp>
+#include <WebSocketDecoder.hpp>
+#include <WorkerPool.hpp>
+
+/// Unit tests of internals that don't need a running server.
+class WhiteBoxTests : public CPPUNIT_NS::TestFixture
+{
+    CPPUNIT_TEST_SUITE(WhiteBoxTests);
+    CPPUNIT_TEST(testUnpremultiply);
+    CPPUNIT_TEST(testSwizzle);
+    CPPUNIT_TEST(testTileEncoders);
+    CPPUNIT_TEST(testUniform);
+    CPPUNIT_TEST(testChangedRect);
+    CPPUNIT_TEST(testTileHistory);
+    CPPUNIT_TEST(testTileVersions);
+    CPPUNIT_TEST(testBufferPool);
+    CPPUNIT_TEST(testTimedMutex);
+    CPPUNIT_TEST(testWebSocketDecoder);
+    CPPUNIT_TEST(testReceiveBuffer);
+    CPPUNIT_TEST(testPerMessageDeflate);
+    CPPUNIT_TEST(testMessageBatch);
+    CPPUNIT_TEST(testOutboundQueue);
+    CPPUNIT_TEST(testUnixChannel);
+    CPPUNIT_TEST(testTileRing);
+    CPPUNIT_TEST(testTileHeader);
+    CPPUNIT_TEST(testTokenizer);
+    CPPUNIT_TEST(testControlChannel);
+    CPPUNIT_TEST(testPrespawnPool);
+    CPPUNIT_TEST(testDocumentFamily);
+    CPPUNIT_TEST(testMemoryGovernor);
+    CPPUNIT_TEST(testMemoryCollector);
+    CPPUNIT_TEST(testWorkerPool);
+    CPPUNIT_TEST_SUITE_END();
+
+    void testUnpremultiply();
+    void testSwizzle();
+    void testTileEncoders();
+    void testUniform();
+    void testChangedRect();
+    void testTileHistory();
+    void testTileVersions();
+    void testBufferPool();
+    void testTimedMutex();
+    void testWebSocketDecoder();
+    void testReceiveBuffer();
+    void testPerMessageDeflate();
+    void testMessageBatch();
+    void testOutboundQueue();
+    void testUnixChannel();
+    void testTileRing();
+    void testTileHeader();
+    void testTokenizer();
+    void testControlChannel();
+    void testPrespawnPool();
+    void testDocumentFamily();
+    void testMemoryGovernor();
+    void testMemoryCollector();
+    void testWorkerPool();
+};
+
+namespace
+{
+    /// Random premultiplied pixels, mixing runs of opaque, transparent
+    /// and translucent pixels so that every kernel path is taken.
+    std::vector<unsigned char> makePixels(const size_t pixels)
+    {
+        std::mt19937 rng(pixels);
+        std::vector<unsigned char> data(pixels * 4);
+        for (size_t i = 0; i < pixels; ++i)
+        {
+            unsigned char* px = &data[i * 4];
+            const unsigned kind = (i / 7) % 4;
+            px[0] = rng();
+            px[1] = rng();
+            px[2] = rng();
+            px[3] = (kind == 0 ? 0xff : kind == 1 ? 0 : rng());
+        }
+
+        return data;
+    }
+
+    const Pixel::Kernel Kernels[] = { Pixel::Kernel::Scalar, Pixel::Kernel::SSE2, Pixel::Kernel::AVX2 };
+}
+
+void WhiteBoxTests::testUnpremultiply()
+{
+    // Odd sizes exercise the vector tails.
+    for (const size_t pixels : { 1, 3, 7, 8, 31, 256, 1001 })
+    {
+        const std::vector<unsigned char> input = makePixels(pixels);
+
+        std::vector<unsigned char> expected(input);
+        png_row_info rowInfo;
+        std::memset(&rowInfo, 0, sizeof(rowInfo));
+        rowInfo.rowbytes = expected.size();
+        unpremultiply_data(nullptr, &rowInfo, expected.data());
+
+        for (const auto kernel : Kernels)
+        {
+            if (!Pixel::isKernelSupported(kernel))
+                continue;
+
+            std::vector<unsigned char> actual(input.size());
+            Pixel::unpremultiplyRow(input.data(), actual.data(), pixels, kernel);
+            CPPUNIT_ASSERT_MESSAGE(Pixel::kernelName(kernel), expected == actual);
+
+            // In-place conversion.
+            actual = input;
+            Pixel::unpremultiplyRow(actual.data(), actual.data(), pixels, kernel);
+            CPPUNIT_ASSERT_MESSAGE(Pixel::kernelName(kernel), expected == actual);
+        }
+    }
+}
+
+void WhiteBoxTests::testSwizzle()
+{
+    const std::vector<unsigned char> input = makePixels(1001);
+    for (const auto kernel : Kernels)
+    {
+        if (!Pixel::isKernelSupported(kernel))
+            continue;
+
+        std::vector<unsigned char> actual(input.size());
+        Pixel::swizzleRow(input.data(), actual.data(), 1001, kernel);
+        for (size_t i = 0; i < input.size(); i += 4)
+        {
+            CPPUNIT_ASSERT_EQUAL(input[i + 2], actual[i]);
+            CPPUNIT_ASSERT_EQUAL(input[i + 1], actual[i + 1]);
+            CPPUNIT_ASSERT_EQUAL(input[i], actual[i + 2]);
+            CPPUNIT_ASSERT_EQUAL(input[i + 3], actual[i + 3]);
+        }
+    }
+}
+
+void WhiteBoxTests::testTileEncoders()
+{
+    CPPUNIT_ASSERT(!TileEncoder::create("png:bogus"));
+    CPPUNIT_ASSERT(!TileEncoder::create("bogus"));
+    CPPUNIT_ASSERT_EQUAL(std::string("png:default"), TileEncoder::getDefault()->getName());
+
+    // Per document type, falling back to the untyped entry, then the default.
+    CPPUNIT_ASSERT(TileEncoder::configure("png:fast,spreadsheet=deflate:fastest"));
+    CPPUNIT_ASSERT_EQUAL(std::string("deflate:fastest"), TileEncoder::getForDocType("spreadsheet")->getName());
+    CPPUNIT_ASSERT_EQUAL(std::string("png:fast"), TileEncoder::getForDocType("text")->getName());
+    CPPUNIT_ASSERT(!TileEncoder::configure("text=bogus"));
+    CPPUNIT_ASSERT_EQUAL(std::string("png:fast"), TileEncoder::getForDocType("text")->getName());
+    CPPUNIT_ASSERT(TileEncoder::configure(""));
+    CPPUNIT_ASSERT_EQUAL(std::string("png:default"), TileEncoder::getForDocType("text")->getName());
+
+    // Encode the lower right 37x41 pixels of a 64x64 pixmap.
+    const int bufferSize = 64;
+    const int width = 37;
+    const int height = 41;
+    std::vector<unsigned char> pixmap = makePixels(bufferSize * bufferSize);
+
+    std::vector<unsigned char> expected;
+    for (int y = bufferSize - height; y < bufferSize; ++y)
+    {
+        const unsigned char* row = &pixmap[(y * bufferSize + bufferSize - width) * 4];
+        expected.insert(expected.end(), row, row + width * 4);
+    }
+
+    png_row_info rowInfo;
+    std::memset(&rowInfo, 0, sizeof(rowInfo));
+    rowInfo.rowbytes = expected.size();
+    unpremultiply_data(nullptr, &rowInfo, expected.data());
+
+    for (const auto spec : { "png", "png:fast", "png:fastest", "png:small", "png:0",
+                             "deflate", "deflate:fast", "deflate:fastest", "deflate:small", "deflate:9" })
+    {
+        const auto encoder = TileEncoder::create(spec);
+        CPPUNIT_ASSERT_MESSAGE(spec, encoder != nullptr);
+
+        // Encoders append to any existing content.
+        std::vector<char> output(3, 'x');
+        CPPUNIT_ASSERT(encoder->encode(pixmap.data(), bufferSize - width, bufferSize - height, width, height,
+                                       bufferSize, bufferSize, output, LOK_TILEMODE_BGRA));
+        CPPUNIT_ASSERT_EQUAL(std::string("xxx"), std::string(output.data(), 3));
+
+        png_image image;
+        std::memset(&image, 0, sizeof(image));
+        image.version = PNG_IMAGE_VERSION;
+        CPPUNIT_ASSERT_MESSAGE(spec, png_image_begin_read_from_memory(&image, output.data() + 3, output.size() - 3));
+        CPPUNIT_ASSERT_EQUAL(static_cast<png_uint_32>(width), image.width);
+        CPPUNIT_ASSERT_EQUAL(static_cast<png_uint_32>(height), image.height);
+
+        image.format = PNG_FORMAT_RGBA;
+        std::vector<unsigned char> actual(PNG_IMAGE_SIZE(image));
+        CPPUNIT_ASSERT_MESSAGE(spec, png_image_finish_read(&image, nullptr, actual.data(), 0, nullptr));
+        CPPUNIT_ASSERT_MESSAGE(spec, expected == actual);
+    }
+}
+
+void WhiteBoxTests::testUniform()
+{
+    for (const size_t pixels : { 1, 15, 16, 33, 256 * 256 })
+    {
+        std::vector<unsigned char> data(pixels * 4);
+        for (size_t i = 0; i < data.size(); i += 4)
+        {
+            data[i] = 0x10;
+            data[i + 1] = 0x20;
+            data[i + 2] = 0x30;
+            data[i + 3] = 0xff;
+        }
+
+        for (const auto kernel : Kernels)
+        {
+            if (!Pixel::isKernelSupported(kernel))
+                continue;
+
+            uint32_t pixel = 0;
+            std::vector<unsigned char> actual(data);
+            CPPUNIT_ASSERT_MESSAGE(Pixel::kernelName(kernel), Pixel::isUniform(actual.data(), pixels, pixel, kernel));
+            CPPUNIT_ASSERT_EQUAL(0, std::memcmp(&pixel, data.data(), 4));
+
+            // Any one differing byte, in the vector body or the tail.
+            for (const size_t index : { pixels * 4 - 1, pixels * 2 + 1 })
+            {
+                actual = data;
+                actual[index] ^= 1;
+                CPPUNIT_ASSERT_MESSAGE(Pixel::kernelName(kernel), pixels == 1 || !Pixel::isUniform(actual.data(), pixels, pixel, kernel));
+            }
+        }
+    }
+}
+
+void WhiteBoxTests::testChangedRect()
+{
+    const int width = 64;
+    const int height = 48;
+    const std::vector<unsigned char> before = makePixels(width * height);
+    std::vector<unsigned char> after(before);
+
+    int x = -1, y = -1, changedWidth = -1, changedHeight = -1;
+    CPPUNIT_ASSERT(!Pixel::getChangedRect(before.data(), after.data(), width, height, x, y, changedWidth, changedHeight));
+
+    // A single pixel.
+    after[(10 * width + 20) * 4 + 1] ^= 0xff;
+    CPPUNIT_ASSERT(Pixel::getChangedRect(before.data(), after.data(), width, height, x, y, changedWidth, changedHeight));
+    CPPUNIT_ASSERT_EQUAL(20, x);
+    CPPUNIT_ASSERT_EQUAL(10, y);
+    CPPUNIT_ASSERT_EQUAL(1, changedWidth);
+    CPPUNIT_ASSERT_EQUAL(1, changedHeight);
+
+    // Two pixels span the rectangle between them, up to the corners.
+    after[(47 * width + 0) * 4 + 3] ^= 0xff;
+    after[(5 * width + 63) * 4] ^= 0xff;
+    CPPUNIT_ASSERT(Pixel::getChangedRect(before.data(), after.data(), width, height, x, y, changedWidth, changedHeight));
+    CPPUNIT_ASSERT_EQUAL(0, x);
+    CPPUNIT_ASSERT_EQUAL(5, y);
+    CPPUNIT_ASSERT_EQUAL(64, changedWidth);
+    CPPUNIT_ASSERT_EQUAL(43, changedHeight);
+}
+
+void WhiteBoxTests::testTileHistory()
+{
+    const int size = 32;
+    const std::vector<unsigned char> first = makePixels(size * size);
+    std::vector<unsigned char> second(first);
+    second[(3 * size + 4) * 4] ^= 0xff;
+
+    TileHistory history(2, 2, 100);
+
+    // Nothing to compare against yet.
+    TileHistory::Update update = history.update("a", first.data(), size, size, 0);
+    CPPUNIT_ASSERT(!update.isDelta);
+    CPPUNIT_ASSERT_EQUAL(100, update.version);
+
+    // Small change against the version the client holds.
+    update = history.update("a", second.data(), size, size, 100);
+    CPPUNIT_ASSERT(update.isDelta);
+    CPPUNIT_ASSERT_EQUAL(101, update.version);
+    CPPUNIT_ASSERT_EQUAL(4, update.x);
+    CPPUNIT_ASSERT_EQUAL(3, update.y);
+    CPPUNIT_ASSERT_EQUAL(1, update.width);
+    CPPUNIT_ASSERT_EQUAL(1, update.height);
+
+    // Unchanged.
+    update = history.update("a", second.data(), size, size, 101);
+    CPPUNIT_ASSERT(update.isDelta);
+    CPPUNIT_ASSERT_EQUAL(0, update.width);
+
+    // A full tile after keyframeInterval deltas.
+    update = history.update("a", first.data(), size, size, 102);
+    CPPUNIT_ASSERT(!update.isDelta);
+
+    // Stale version.
+    update = history.update("a", second.data(), size, size, 101);
+    CPPUNIT_ASSERT(!update.isDelta);
+
+    // Mostly changed.
+    const std::vector<unsigned char> other = makePixels(size * size + 1);
+    update = history.update("a", other.data(), size, size, update.version);
+    CPPUNIT_ASSERT(!update.isDelta);
+
+    // The least recently rendered tile is evicted.
+    const int versionA = update.version;
+    update = history.update("b", first.data(), size, size, 0);
+    update = history.update("c", first.data(), size, size, 0);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), history.size());
+    update = history.update("a", other.data(), size, size, versionA);
+    CPPUNIT_ASSERT(!update.isDelta);
+}
+
+void WhiteBoxTests::testTileVersions()
+{
+    const int size = 32;
+    const std::vector<unsigned char> first = makePixels(size * size);
+    std::vector<unsigned char> second(first);
+    second[(3 * size + 4) * 4] ^= 0xff;
+    std::vector<unsigned char> third(second);
+    third[(5 * size + 6) * 4] ^= 0xff;
+
+    TileHistory history(2, 16, 100);
+    TileVersions sentA;
+    TileVersions sentB;
+    CPPUNIT_ASSERT_EQUAL(0, sentA.get("a"));
+
+    // Each session's client gets the tile in turn.
+    TileHistory::Update update = history.update("a", first.data(), size, size, sentA.get("a"));
+    sentA.set("a", update.version, history);
+    update = history.update("a", second.data(), size, size, sentB.get("a"));
+    sentB.set("a", update.version, history);
+    CPPUNIT_ASSERT(!update.isDelta);
+    CPPUNIT_ASSERT_EQUAL(100, sentA.get("a"));
+    CPPUNIT_ASSERT_EQUAL(101, sentB.get("a"));
+
+    // A push to the first client can't be a delta against what only the
+    // second one has.
+    update = history.update("a", third.data(), size, size, sentA.get("a"));
+    CPPUNIT_ASSERT(!update.isDelta);
+    sentA.set("a", update.version, history);
+
+    // The client holding the latest version gets a delta.
+    update = history.update("a", second.data(), size, size, sentA.get("a"));
+    CPPUNIT_ASSERT(update.isDelta);
+    sentA.set("a", update.version, history);
+    update = history.update("a", third.data(), size, size, sentB.get("a"));
+    CPPUNIT_ASSERT(!update.isDelta);
+
+    // Versions no longer in the history are forgotten.
+    for (int i = 0; i < 8; ++i)
+    {
+        const std::string key = std::to_string(i);
+        update = history.update(key, first.data(), size, size, 0);
+        sentA.set(key, update.version, history);
+    }
+
+    CPPUNIT_ASSERT(sentA.size() <= 4);
+    CPPUNIT_ASSERT_EQUAL(update.version, sentA.get("7"));
+    CPPUNIT_ASSERT_EQUAL(0, sentA.get("a"));
+}
+
+void WhiteBoxTests::testBufferPool()
+{
+    BufferPool pool(1024 * 1024, false);
+
+    unsigned char* data;
+    {
+        BufferPool::Pixmap pixmap = pool.getPixmap(256 * 256 * 4);
+        CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(256 * 256 * 4), pixmap.size());
+        data = pixmap.data();
+        std::memset(data, 0xff, pixmap.size());
+    }
+
+    // Returned pixmaps are reused for requests of a similar size only.
+    {
+        BufferPool::Pixmap pixmap = pool.getPixmap(200 * 256 * 4);
+        CPPUNIT_ASSERT(pixmap.data() == data);
+
+        BufferPool::Pixmap other = pool.getPixmap(200 * 256 * 4);
+        CPPUNIT_ASSERT(other.data() != data);
+    }
+
+    {
+        BufferPool::Pixmap pixmap = pool.getPixmap(16 * 16 * 4);
+        CPPUNIT_ASSERT(pixmap.data() != data);
+    }
+
+    BufferPool::Stats stats = pool.getStats();
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), stats.pixmapHits);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), stats.pixmapMisses);
+    CPPUNIT_ASSERT_EQUAL(stats.mappedBytes, stats.freeBytes);
+
+    // Beyond maxFreeBytes, returned pixmaps are unmapped.
+    {
+        BufferPool::Pixmap pixmap = pool.getPixmap(2 * 1024 * 1024);
+    }
+
+    stats = pool.getStats();
+    CPPUNIT_ASSERT_EQUAL(stats.mappedBytes, stats.freeBytes);
+    CPPUNIT_ASSERT(stats.mappedBytes <= 1024 * 1024);
+
+    // Outputs come back empty, with their capacity.
+    {
+        BufferPool::Output output = pool.getOutput(100);
+        output.get().assign(50, 'x');
+    }
+
+    BufferPool::Output output = pool.getOutput(10);
+    CPPUNIT_ASSERT(output.get().empty());
+    CPPUNIT_ASSERT(output.get().capacity() >= 100);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), pool.getStats().outputHits);
+
+    // Outputs count against maxFreeBytes too, large ones aren't kept.
+    const size_t freeBytes = pool.getStats().freeBytes;
+    {
+        BufferPool::Output large = pool.getOutput(2 * 1024 * 1024);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(freeBytes, pool.getStats().freeBytes);
+    {
+        BufferPool::Output small = pool.getOutput(1000);
+    }
+
+    CPPUNIT_ASSERT(pool.getStats().freeBytes >= freeBytes + 1000);
+    CPPUNIT_ASSERT(pool.getStats().freeBytes <= 1024 * 1024);
+}
+
+void WhiteBoxTests::testTimedMutex()
+{
+    TimedRecursiveMutex mutex;
+    {
+        std::unique_lock<TimedRecursiveMutex> lock(mutex);
+        std::unique_lock<TimedRecursiveMutex> nested(mutex);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    // Recursive locking counts once.
+    TimedRecursiveMutex::Stats stats = mutex.getStats();
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(1), stats.count);
+    CPPUNIT_ASSERT(stats.maxHoldUs >= 20000);
+    CPPUNIT_ASSERT_EQUAL(stats.maxHoldUs, stats.totalHoldUs);
+
+    // Waiting for another thread to release it.
+    std::unique_lock<TimedRecursiveMutex> lock(mutex);
+    std::thread thread([&mutex]() { std::unique_lock<TimedRecursiveMutex> other(mutex); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    lock.unlock();
+    thread.join();
+
+    stats = mutex.getStats();
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(3), stats.count);
+    CPPUNIT_ASSERT(stats.maxWaitUs >= 10000);
+}
+
+namespace
+{
+    /// A frame as a browser sends it: masked.
+    std::vector<char> makeFrame(const unsigned char opcode, const bool fin, const std::string& payload)
+    {
+        const unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+        std::vector<char> frame;
+        frame.push_back((fin ? 0x80 : 0) | opcode);
+        if (payload.size() < 126)
+        {
+            frame.push_back(0x80 | payload.size());
+        }
+        else if (payload.size() < 65536)
+        {
+            frame.push_back(0x80 | 126);
+            frame.push_back(payload.size() >> 8);
+            frame.push_back(payload.size() & 0xff);
+        }
+        else
+        {
+            frame.push_back(0x80 | 127);
+            for (int shift = 56; shift >= 0; shift -= 8)
+            {
+                frame.push_back((static_cast<uint64_t>(payload.size()) >> shift) & 0xff);
+            }
+        }
+
+        frame.insert(frame.end(), mask, mask + 4);
+        for (size_t i = 0; i < payload.size(); ++i)
+        {
+            frame.push_back(payload[i] ^ mask[i % 4]);
+        }
+
+        return frame;
+    }
+}
+
+void WhiteBoxTests::testWebSocketDecoder()
+{
+    typedef WebSocketDecoder::Result Result;
+    std::vector<char> payload;
+
+    // A message trickling in byte by byte.
+    WebSocketDecoder decoder(1024);
+    const std::string text(300, 'x');
+    const std::vector<char> frame = makeFrame(0x1, true, text);
+    for (size_t i = 0; i + 1 < frame.size(); ++i)
+    {
+        decoder.append(&frame[i], 1);
+        CPPUNIT_ASSERT(decoder.decode(payload) == Result::NeedMore);
+    }
+
+    decoder.append(&frame.back(), 1);
+    CPPUNIT_ASSERT(decoder.decode(payload) == Result::Message);
+    CPPUNIT_ASSERT_EQUAL(text, std::string(payload.begin(), payload.end()));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), decoder.getBufferedSize());
+
+    // Fragments with a ping in between, all arriving at once.
+    std::vector<char> input = makeFrame(0x1, false, "tile part=0 ");
+    const std::vector<char> ping = makeFrame(0x9, true, "ping");
+    const std::vector<char> last = makeFrame(0x0, true, "width=256");
+    input.insert(input.end(), ping.begin(), ping.end());
+    input.insert(input.end(), last.begin(), last.end());
+    decoder.append(input.data(), input.size());
+
+    CPPUNIT_ASSERT(decoder.decode(payload) == Result::Ping);
+    CPPUNIT_ASSERT_EQUAL(std::string("ping"), std::string(payload.begin(), payload.end()));
+    CPPUNIT_ASSERT(decoder.decode(payload) == Result::Message);
+    CPPUNIT_ASSERT_EQUAL(std::string("tile part=0 width=256"), std::string(payload.begin(), payload.end()));
+    CPPUNIT_ASSERT(decoder.decode(payload) == Result::NeedMore);
+
+    const std::vector<char> close = makeFrame(0x8, true, "");
+    decoder.append(close.data(), close.size());
+    CPPUNIT_ASSERT(decoder.decode(payload) == Result::Close);
+
+    // Oversized messages and stray continuations are errors.
+    WebSocketDecoder small(100);
+    const std::vector<char> large = makeFrame(0x2, true, std::string(101, 'x'));
+    small.append(large.data(), large.size());
+    CPPUNIT_ASSERT(small.decode(payload) == Result::Error);
+
+    WebSocketDecoder stray(100);
+    stray.append(last.data(), last.size());
+    CPPUNIT_ASSERT(stray.decode(payload) == Result::Error);
+
+    // The sizes receivers read off the header.
+    for (const size_t size : { 0, 125, 126, 65535, 65536 })
+    {
+        const std::vector<char> sized = makeFrame(0x2, true, std::string(size, 'x'));
+        const size_t headerSize = WebSocketDecoder::getHeaderSize(sized.data());
+        // Without the mask.
+        CPPUNIT_ASSERT_EQUAL(sized.size() - size - 4, headerSize);
+        CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(size), WebSocketDecoder::getPayloadLength(sized.data()));
+    }
+}
+
+void WhiteBoxTests::testReceiveBuffer()
+{
+    const size_t maxMessageSize = ReceiveBuffer::getMaxMessageSize();
+    ReceiveBuffer::setMaxMessageSize(8 * 1024 * 1024);
+
+    const ReceiveBuffer::Stats before = ReceiveBuffer::getStats();
+    {
+        ReceiveBuffer buffer;
+        CPPUNIT_ASSERT_EQUAL(ReceiveBuffer::DefaultCapacity, buffer.capacity());
+
+        // Grown for a large message, and back once it is handled.
+        CPPUNIT_ASSERT(buffer.reserve(3 * 1024 * 1024));
+        CPPUNIT_ASSERT(buffer.capacity() >= 3 * 1024 * 1024);
+        buffer.data()[3 * 1024 * 1024 - 1] = 'x';
+        buffer.shrink();
+        CPPUNIT_ASSERT_EQUAL(ReceiveBuffer::DefaultCapacity, buffer.capacity());
+
+        // Modest growth is kept.
+        CPPUNIT_ASSERT(buffer.reserve(200 * 1024));
+        const size_t capacity = buffer.capacity();
+        buffer.shrink();
+        CPPUNIT_ASSERT_EQUAL(capacity, buffer.capacity());
+
+        CPPUNIT_ASSERT(!buffer.reserve(9 * 1024 * 1024));
+        CPPUNIT_ASSERT_EQUAL(capacity, buffer.capacity());
+    }
+
+    const ReceiveBuffer::Stats after = ReceiveBuffer::getStats();
+    CPPUNIT_ASSERT_EQUAL(before.bytesInFlight, after.bytesInFlight);
+    CPPUNIT_ASSERT_EQUAL(before.rejected + 1, after.rejected);
+    CPPUNIT_ASSERT(after.maxBytesInFlight >= 3 * 1024 * 1024);
+
+    ReceiveBuffer::setMaxMessageSize(maxMessageSize);
+}
+
+void WhiteBoxTests::testPerMessageDeflate()
+{
+    PerMessageDeflate::Parameters parameters;
+    std::string response;
+
+    // What browsers offer.
+    CPPUNIT_ASSERT(PerMessageDeflate::negotiate("permessage-deflate; client_max_window_bits", parameters, response));
+    CPPUNIT_ASSERT_EQUAL(std::string("permessage-deflate"), response);
+    CPPUNIT_ASSERT(!parameters.serverNoContextTakeover);
+    CPPUNIT_ASSERT_EQUAL(15, parameters.serverMaxWindowBits);
+
+    // The first offer we can honour wins.
+    CPPUNIT_ASSERT(PerMessageDeflate::negotiate("x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=8, "
+                                                "permessage-deflate; server_no_context_takeover; server_max_window_bits=10",
+                                                parameters, response));
+    CPPUNIT_ASSERT_EQUAL(std::string("permessage-deflate; server_no_context_takeover; server_max_window_bits=10"), response);
+    CPPUNIT_ASSERT(parameters.serverNoContextTakeover);
+    CPPUNIT_ASSERT_EQUAL(10, parameters.serverMaxWindowBits);
+
+    CPPUNIT_ASSERT(!PerMessageDeflate::negotiate("permessage-deflate; foo", parameters, response));
+    CPPUNIT_ASSERT(!PerMessageDeflate::negotiate("permessage-deflate; client_no_context_takeover; client_no_context_takeover",
+                                                 parameters, response));
+
+    // Repeated messages shrink to almost nothing with context takeover.
+    PerMessageDeflate::negotiate("permessage-deflate", parameters, response);
+    PerMessageDeflate::Deflater deflater(parameters);
+    PerMessageDeflate::Inflater inflater(parameters);
+    const std::string message = "commandvalues: {\"commandName\":\".uno:CharFontName\",\"commandValues\":"
+                                "{\"Liberation Sans\":[\"Regular\",\"Bold\"],\"Liberation Serif\":[\"Regular\"]}}";
+    std::vector<char> compressed;
+    std::vector<char> output;
+    size_t lastSize = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        deflater.compress(message.data(), message.size(), compressed);
+        CPPUNIT_ASSERT(compressed.size() < message.size());
+        CPPUNIT_ASSERT(inflater.decompress(compressed.data(), compressed.size(), 1024, output));
+        CPPUNIT_ASSERT_EQUAL(message, std::string(output.begin(), output.end()));
+        if (i > 0)
+            CPPUNIT_ASSERT(compressed.size() < lastSize);
+
+        lastSize = compressed.size();
+    }
+
+    CPPUNIT_ASSERT_EQUAL(3 * message.size(), deflater.getInputBytes());
+
+    // Bombs are refused.
+    const std::string zeros(100000, '\0');
+    PerMessageDeflate::Deflater bomb(parameters);
+    bomb.compress(zeros.data(), zeros.size(), compressed);
+    PerMessageDeflate::Inflater guarded(parameters);
+    CPPUNIT_ASSERT(!guarded.decompress(compressed.data(), compressed.size(), 50000, output));
+
+    // The decoder inflates the messages flagged as compressed, once negotiated.
+    deflater.compress(message.data(), message.size(), compressed);
+    const std::vector<char> frame = makeFrame(0x1 | PerMessageDeflate::FrameFlagCompressed, true,
+                                              std::string(compressed.begin(), compressed.end()));
+
+    WebSocketDecoder plain(1024);
+    plain.append(frame.data(), frame.size());
+    CPPUNIT_ASSERT(plain.decode(output) == WebSocketDecoder::Result::Error);
+
+    PerMessageDeflate::Deflater clientDeflater(parameters);
+    clientDeflater.compress(message.data(), message.size(), compressed);
+    const std::vector<char> clientFrame = makeFrame(0x1 | PerMessageDeflate::FrameFlagCompressed, true,
+                                                    std::string(compressed.begin(), compressed.end()));
+    WebSocketDecoder decoder(1024);
+    decoder.setInflater(std::unique_ptr<PerMessageDeflate::Inflater>(new PerMessageDeflate::Inflater(parameters)));
+    decoder.append(clientFrame.data(), clientFrame.size());
+    CPPUNIT_ASSERT(decoder.decode(output) == WebSocketDecoder::Result::Message);
+    CPPUNIT_ASSERT_EQUAL(message, std::string(output.begin(), output.end()));
+}
+
+void WhiteBoxTests::testMessageBatch()
+{
+    MessageBatch batch;
+    batch.add("invalidatecursor: 0, 0, 10, 300");
+    batch.add("statechanged: .uno:Bold=true");
+    batch.add("textselection: 10, 10, 20, 20");
+    batch.add("invalidatetiles: part=0 x=0 y=0 width=100 height=100");
+    batch.add("statechanged: .uno:Italic=false");
+    batch.add("textselectionstart: 10, 10, 1, 20");
+    batch.add("invalidatecursor: 20, 0, 10, 300");
+    batch.add("statechanged: .uno:Bold=false");
+    batch.add("invalidatetiles: part=0 x=100 y=0 width=100 height=100");
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(7), batch.size());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), batch.getDropped());
+
+    const std::string message = batch.take();
+    CPPUNIT_ASSERT(batch.empty());
+
+    std::vector<std::string> messages;
+    CPPUNIT_ASSERT(MessageBatch::split(message.data(), message.size(), messages));
+    const std::vector<std::string> expected =
+    {
+        "textselection: 10, 10, 20, 20",
+        "invalidatetiles: part=0 x=0 y=0 width=100 height=100",
+        "statechanged: .uno:Italic=false",
+        "textselectionstart: 10, 10, 1, 20",
+        "invalidatecursor: 20, 0, 10, 300",
+        "statechanged: .uno:Bold=false",
+        "invalidatetiles: part=0 x=100 y=0 width=100 height=100"
+    };
+    CPPUNIT_ASSERT(expected == messages);
+
+    // A single message goes out as it is.
+    batch.add("statechanged: .uno:Bold=true");
+    CPPUNIT_ASSERT_EQUAL(std::string("statechanged: .uno:Bold=true"), batch.take());
+
+    // Payloads can have newlines, and sizes must add up.
+    const std::string joined = MessageBatch::join({ "commandvalues: {\n}", "a" });
+    CPPUNIT_ASSERT_EQUAL(std::string("batch: sizes=18,1\ncommandvalues: {\n}a"), joined);
+    messages.clear();
+    CPPUNIT_ASSERT(MessageBatch::split(joined.data(), joined.size(), messages));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), messages.size());
+    CPPUNIT_ASSERT(!MessageBatch::split(joined.data(), joined.size() - 1, messages));
+    const std::string trailing = "batch: sizes=1,\na";
+    CPPUNIT_ASSERT(!MessageBatch::split(trailing.data(), trailing.size(), messages));
+}
+
+void WhiteBoxTests::testOutboundQueue()
+{
+    for (const size_t size : { 125, 126, 70000 })
+    {
+        const std::vector<char> payload(size, 'x');
+        const std::vector<char> frame = OutboundQueue::makeFrame(0x82, payload.data(), payload.size());
+        CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(size), WebSocketDecoder::getPayloadLength(frame.data()));
+        CPPUNIT_ASSERT_EQUAL(frame.size() - size, WebSocketDecoder::getHeaderSize(frame.data()));
+    }
+
+    const std::string tile = "tile: part=0 width=256 height=256 tileposx=0 tileposy=3840 tilewidth=3840 tileheight=3840 ver=2\n";
+    const std::string delta = "delta: part=0 width=256 height=256 tileposx=0 tileposy=3840 tilewidth=3840 tileheight=3840 ver=3";
+    const std::string key = OutboundQueue::getTileKey(tile.data(), tile.size());
+    CPPUNIT_ASSERT_EQUAL(std::string("tile: part=0 width=256 height=256 tileposx=0 tileposy=3840 tilewidth=3840 tileheight=3840"), key);
+    CPPUNIT_ASSERT_EQUAL(std::string("delta:") + key.substr(5), OutboundQueue::getTileKey(delta.data(), delta.size()));
+    CPPUNIT_ASSERT(OutboundQueue::getTileKey("status: type=text", 17).empty());
+
+    int fds[2];
+    CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    bool pollWrite = false;
+    const size_t limit = 64 * 1024;
+    OutboundQueue queue(fds[0], limit, OutboundQueue::Policy::Coalesce, [&pollWrite](const bool poll) { pollWrite = poll; });
+
+    // Whatever the socket doesn't take waits for flush().
+    const std::vector<char> payload(16 * 1024, 'x');
+    while (!pollWrite)
+    {
+        CPPUNIT_ASSERT(queue.push(OutboundQueue::makeFrame(0x82, payload.data(), payload.size())));
+    }
+
+    // Past the limit, each rendering of the tile replaces the previous one.
+    std::vector<char> message(tile.begin(), tile.end());
+    message.resize(16 * 1024);
+    for (int i = 0; i < 20; ++i)
+    {
+        CPPUNIT_ASSERT(queue.push(OutboundQueue::makeFrame(0x82, message.data(), message.size()), key));
+    }
+
+    OutboundQueue::Stats stats = queue.getStats();
+    CPPUNIT_ASSERT(stats.coalescedTiles >= 15);
+    CPPUNIT_ASSERT(stats.queuedBytes <= limit + message.size() + 16);
+    CPPUNIT_ASSERT(!stats.overflowed);
+
+    std::vector<char> buffer(64 * 1024);
+    size_t received = 0;
+    while (pollWrite)
+    {
+        const ssize_t size = recv(fds[1], buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if (size > 0)
+            received += size;
+
+        CPPUNIT_ASSERT(queue.flush());
+    }
+
+    while (true)
+    {
+        const ssize_t size = recv(fds[1], buffer.data(), buffer.size(), MSG_DONTWAIT);
+        if (size <= 0)
+            break;
+
+        received += size;
+    }
+
+    stats = queue.getStats();
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), stats.queuedBytes);
+    CPPUNIT_ASSERT_EQUAL(stats.writtenBytes, received);
+    close(fds[0]);
+    close(fds[1]);
+
+    // The other policy gives up on the client right away.
+    CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    pollWrite = false;
+    OutboundQueue strict(fds[0], limit, OutboundQueue::Policy::Disconnect, [&pollWrite](const bool poll) { pollWrite = poll; });
+    while (!pollWrite)
+    {
+        CPPUNIT_ASSERT(strict.push(OutboundQueue::makeFrame(0x82, payload.data(), payload.size())));
+    }
+
+    bool accepted = true;
+    for (int i = 0; i < 8 && accepted; ++i)
+    {
+        accepted = strict.push(OutboundQueue::makeFrame(0x82, message.data(), message.size()), key);
+    }
+
+    CPPUNIT_ASSERT(!accepted);
+    CPPUNIT_ASSERT(strict.getStats().overflowed);
+    CPPUNIT_ASSERT(!strict.push(OutboundQueue::makeFrame(0x81, "a", 1)));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+void WhiteBoxTests::testUnixChannel()
+{
+    const std::string name = "loolwsd-test-" + std::to_string(getpid());
+    const int listenFd = UnixChannel::listen(name);
+    CPPUNIT_ASSERT(listenFd >= 0);
+
+    std::shared_ptr<UnixChannel> kit = UnixChannel::connect(name);
+    CPPUNIT_ASSERT(kit);
+    std::shared_ptr<UnixChannel> master = UnixChannel::accept(listenFd);
+    CPPUNIT_ASSERT(master);
+    close(listenFd);
+    CPPUNIT_ASSERT(!UnixChannel::connect(name));
+
+    // Larger than the socket takes at once, so it is written in parts.
+    std::vector<char> tile(4 * 1024 * 1024);
+    for (size_t i = 0; i < tile.size(); ++i)
+    {
+        tile[i] = static_cast<char>(i * 7);
+    }
+
+    std::thread sender([&]()
+        {
+            const std::string text = "child 0001 42";
+            kit->send(text.data(), text.size(), 0x81);
+            kit->send(tile.data(), tile.size(), 0x82);
+            kit->shutdown();
+        });
+
+    ReceiveBuffer buffer;
+    int flags = 0;
+    CPPUNIT_ASSERT(master->poll(1000));
+    int n = master->receive(buffer, flags);
+    CPPUNIT_ASSERT_EQUAL(std::string("child 0001 42"), std::string(buffer.data(), n));
+    CPPUNIT_ASSERT_EQUAL(0x81, flags);
+
+    n = master->receive(buffer, flags);
+    CPPUNIT_ASSERT_EQUAL(static_cast<int>(tile.size()), n);
+    CPPUNIT_ASSERT_EQUAL(0x82, flags);
+    CPPUNIT_ASSERT(std::memcmp(tile.data(), buffer.data(), n) == 0);
+
+    n = master->receive(buffer, flags);
+    CPPUNIT_ASSERT_EQUAL(0, n);
+    CPPUNIT_ASSERT_EQUAL(UnixChannel::CloseFlags, flags);
+    sender.join();
+
+    // The end of the stream.
+    kit.reset();
+    CPPUNIT_ASSERT_EQUAL(0, master->receive(buffer, flags));
+}
+
+void WhiteBoxTests::testTileRing()
+{
+    const size_t capacity = 64 * 1024;
+    std::unique_ptr<TileRing> kitRing = TileRing::create(capacity);
+    CPPUNIT_ASSERT(kitRing);
+
+    // The master gets the ring with a message.
+    int fds[2];
+    CPPUNIT_ASSERT_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+    UnixChannel kit(fds[0]);
+    UnixChannel master(fds[1]);
+    kit.send(nullptr, 0, TileRing::FrameFlagRing, kitRing->getFd());
+    ReceiveBuffer buffer;
+    int flags = 0;
+    CPPUNIT_ASSERT_EQUAL(0, master.receive(buffer, flags));
+    CPPUNIT_ASSERT_EQUAL(TileRing::FrameFlagRing, flags);
+    std::unique_ptr<TileRing> masterRing = TileRing::map(master.takeReceivedFd());
+    CPPUNIT_ASSERT(masterRing);
+    CPPUNIT_ASSERT_EQUAL(capacity, masterRing->getCapacity());
+    CPPUNIT_ASSERT_EQUAL(-1, master.takeReceivedFd());
+
+    const std::vector<char> tile(20 * 1024, 't');
+    TileRing::Descriptor first;
+    TileRing::Descriptor second;
+    TileRing::Descriptor third;
+    CPPUNIT_ASSERT(kitRing->write(tile.data(), tile.size(), first));
+    CPPUNIT_ASSERT(kitRing->write(tile.data(), tile.size(), second));
+    CPPUNIT_ASSERT(kitRing->write(tile.data(), tile.size(), third));
+
+    // Full until the master is done with the first.
+    TileRing::Descriptor fourth;
+    CPPUNIT_ASSERT(!kitRing->write(tile.data(), tile.size(), fourth));
+    CPPUNIT_ASSERT(std::memcmp(masterRing->read(first), tile.data(), tile.size()) == 0);
+    masterRing->release(first);
+
+    // It doesn't fit at the end, so it starts over at the beginning.
+    const std::vector<char> other(16 * 1024, 'o');
+    CPPUNIT_ASSERT(kitRing->write(other.data(), other.size(), fourth));
+    CPPUNIT_ASSERT_EQUAL(static_cast<uint64_t>(capacity), fourth.position);
+    CPPUNIT_ASSERT(std::memcmp(masterRing->read(fourth), other.data(), other.size()) == 0);
+    CPPUNIT_ASSERT(std::memcmp(masterRing->read(third), tile.data(), tile.size()) == 0);
+
+    TileRing::Descriptor invalid = { capacity - 10, 20 };
+    CPPUNIT_ASSERT(masterRing->read(invalid) == nullptr);
+
+    // Only sealed memory is mapped.
+    const int unsealed = memfd_create("test", MFD_CLOEXEC);
+    CPPUNIT_ASSERT(unsealed >= 0);
+    CPPUNIT_ASSERT_EQUAL(0, ftruncate(unsealed, capacity));
+    CPPUNIT_ASSERT(!TileRing::map(unsealed));
+}
+
+void WhiteBoxTests::testTileHeader()
+{
+    const std::string request = "tile part=2 width=256 height=256 tileposx=0 tileposy=3840 tilewidth=3840 tileheight=3840 id=7 oldver=12";
+    TileHeader tile;
+    CPPUNIT_ASSERT(tile.parse(request.data(), request.size()));
+    CPPUNIT_ASSERT(tile.type == TileHeader::Type::Request);
+    CPPUNIT_ASSERT(tile.isValid());
+    CPPUNIT_ASSERT(tile.hasId());
+    CPPUNIT_ASSERT_EQUAL(2, tile.part);
+    CPPUNIT_ASSERT_EQUAL(3840, tile.tilePosY);
+    CPPUNIT_ASSERT_EQUAL(12, tile.oldVersion);
+    CPPUNIT_ASSERT_EQUAL(std::string("id=7"), std::string(tile.extra, tile.extraSize));
+    CPPUNIT_ASSERT(!TileHeader::isBinary(request.data(), request.size()));
+
+    // The binary form has the same fields, whatever bytes they are made of.
+    tile.tilePosX = 10 * 256 + 10;
+    std::vector<char> binary;
+    tile.writeBinary(binary);
+    CPPUNIT_ASSERT_EQUAL(TileHeader::Size + 4, binary.size());
+    CPPUNIT_ASSERT(TileHeader::isBinary(binary.data(), binary.size()));
+    TileHeader decoded;
+    CPPUNIT_ASSERT(decoded.parse(binary.data(), binary.size()));
+    CPPUNIT_ASSERT(decoded.type == TileHeader::Type::Request);
+    CPPUNIT_ASSERT_EQUAL(tile.tilePosX, decoded.tilePosX);
+    CPPUNIT_ASSERT_EQUAL(12, decoded.oldVersion);
+    CPPUNIT_ASSERT(decoded.hasId());
+    CPPUNIT_ASSERT_EQUAL(binary.size(), decoded.payloadOffset);
+    CPPUNIT_ASSERT(!TileHeader::isBinary(binary.data(), binary.size() - 1));
+
+    // Responses turn back into the text the kit used to send.
+    const std::string delta = "delta: part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840"
+                              " timestamp=5 ver=9 oldver=8 deltax=1 deltay=2 deltawidth=3 deltaheight=4\nPNG";
+    CPPUNIT_ASSERT(tile.parse(delta.data(), delta.size()));
+    CPPUNIT_ASSERT(tile.type == TileHeader::Type::Delta);
+    CPPUNIT_ASSERT(!tile.hasId());
+    CPPUNIT_ASSERT_EQUAL(delta.size() - 3, tile.payloadOffset);
+    binary.clear();
+    tile.writeBinary(binary);
+    binary.insert(binary.end(), delta.end() - 3, delta.end());
+    CPPUNIT_ASSERT(decoded.parse(binary.data(), binary.size()));
+    CPPUNIT_ASSERT_EQUAL(4, decoded.deltaHeight);
+    std::vector<char> text;
+    decoded.writeText(text);
+    text.insert(text.end(), binary.begin() + decoded.payloadOffset, binary.end());
+    CPPUNIT_ASSERT_EQUAL(delta, std::string(text.begin(), text.end()));
+
+    const std::string solid = "solidtile: part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840"
+                              " ver=3 color=ffffff00";
+    CPPUNIT_ASSERT(tile.parse(solid.data(), solid.size()));
+    CPPUNIT_ASSERT_EQUAL(std::string("color=ffffff00"), tile.getColorToken());
+    text.clear();
+    tile.writeText(text);
+    CPPUNIT_ASSERT_EQUAL(solid, std::string(text.begin(), text.end()));
+
+    // Not a tile message, or a malformed one.
+    for (const std::string message : { "tilecombine part=0 width=256 height=256 tileposx=0,256 tileposy=0 tilewidth=3840 tileheight=3840",
+                                       "tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840",
+                                       "tile part=0 width=256 height=256 tileposx=x tileposy=0 tilewidth=3840 tileheight=3840",
+                                       "tile part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=99999999999",
+                                       "tile part=0 height=256 width=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840" })
+    {
+        CPPUNIT_ASSERT(!tile.parse(message.data(), message.size()));
+    }
+
+    const std::string invalid = "tile part=0 width=256 height=256 tileposx=-1 tileposy=0 tilewidth=3840 tileheight=3840";
+    CPPUNIT_ASSERT(tile.parse(invalid.data(), invalid.size()));
+    CPPUNIT_ASSERT(!tile.isValid());
+
+    // Binary tiles are coalesced like text ones.
+    CPPUNIT_ASSERT_EQUAL(std::string("delta: part=0 width=256 height=256 tileposx=0 tileposy=0 tilewidth=3840 tileheight=3840"),
+                         OutboundQueue::getTileKey(binary.data(), binary.size()));
+}
+
+void WhiteBoxTests::testTokenizer()
+{
+    using LOOLProtocol::Command;
+    using LOOLProtocol::Message;
+
+    const std::string message = "  mouse type='move'  x=-12\tcount=2147483648 \r\nPNG";
+    const Tokenizer tokens(message.data(), message.size());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(3), tokens.count());
+    CPPUNIT_ASSERT(tokens[0] == "mouse");
+    CPPUNIT_ASSERT(tokens[2] == "x=-12\tcount=2147483648");
+    CPPUNIT_ASSERT(tokens[3].empty());
+    CPPUNIT_ASSERT_EQUAL(message.size() - 4, tokens.getLine().size());
+
+    static const std::pair<const char*, int> Types[] = { { "down", 1 }, { "move", 2 } };
+    int value = 0;
+    CPPUNIT_ASSERT(Tokenizer::getKeyword(tokens[1], "type", Types, value));
+    CPPUNIT_ASSERT_EQUAL(2, value);
+    CPPUNIT_ASSERT(!Tokenizer::getKeyword(tokens[1], "typ", Types, value));
+    CPPUNIT_ASSERT(!Tokenizer::getInteger(tokens[2], "x", value));
+    CPPUNIT_ASSERT(Tokenizer::parseInteger(StringView("-2147483648", 11), value));
+    CPPUNIT_ASSERT_EQUAL(-2147483647 - 1, value);
+    CPPUNIT_ASSERT(!Tokenizer::parseInteger(StringView("2147483648", 10), value));
+    CPPUNIT_ASSERT(!Tokenizer::parseInteger(StringView("-", 1), value));
+    CPPUNIT_ASSERT(!Tokenizer::getInteger(StringView("x=", 2), "x", value));
+
+    // The last token takes what is left of a long line.
+    std::string line = "uno";
+    for (size_t i = 0; i < Tokenizer::MaxTokens + 2; ++i)
+        line += " a";
+    const Tokenizer many(line.data(), line.size());
+    CPPUNIT_ASSERT_EQUAL(Tokenizer::MaxTokens, many.count());
+    CPPUNIT_ASSERT(many[Tokenizer::MaxTokens - 1] == "a a a a");
+
+    // Every name maps back to its command, and nothing else does.
+    for (int i = static_cast<int>(Command::CANCELTILES); i <= static_cast<int>(Command::UNO); ++i)
+    {
+        const Command command = static_cast<Command>(i);
+        const char* name = LOOLProtocol::getName(command);
+        CPPUNIT_ASSERT(LOOLProtocol::getCommand(StringView(name, std::strlen(name))) == command);
+    }
+
+    for (int i = static_cast<int>(Message::BATCH); i <= static_cast<int>(Message::UNOCOMMANDRESULT); ++i)
+    {
+        const Message kind = static_cast<Message>(i);
+        const char* name = LOOLProtocol::getName(kind);
+        CPPUNIT_ASSERT(LOOLProtocol::getMessage(StringView(name, std::strlen(name))) == kind);
+    }
+
+    CPPUNIT_ASSERT(LOOLProtocol::getCommand(StringView("til", 3)) == Command::UNKNOWN);
+    CPPUNIT_ASSERT(LOOLProtocol::getCommand(StringView("tile:", 5)) == Command::UNKNOWN);
+    CPPUNIT_ASSERT(LOOLProtocol::getCommand(StringView()) == Command::UNKNOWN);
+    CPPUNIT_ASSERT(LOOLProtocol::getMessage(StringView("tile:", 5)) == Message::TILE);
+}
+
+void WhiteBoxTests::testControlChannel()
+{
+    int fds[2];
+    CPPUNIT_ASSERT(ControlChannel::createPair(fds));
+    ControlChannel broker(fds[0]);
+    std::unique_ptr<ControlChannel> kit(new ControlChannel(fds[1]));
+
+    ControlChannel::Message message;
+    CPPUNIT_ASSERT_EQUAL(0, broker.receive(message));
+    CPPUNIT_ASSERT(!broker.poll(0));
+
+    ControlChannel::Message request;
+    request.type = ControlChannel::Type::CreateSession;
+    request.sequence = 7;
+    request.session = "0001";
+    request.url = "file:///tmp/a%20b.odt";
+    CPPUNIT_ASSERT(broker.send(request));
+    request.type = ControlChannel::Type::Down;
+    request.sequence = 8;
+    request.session.clear();
+    request.url.clear();
+    CPPUNIT_ASSERT(broker.send(request));
+
+    // Each message arrives whole, in order.
+    CPPUNIT_ASSERT(kit->poll(1000));
+    CPPUNIT_ASSERT_EQUAL(1, kit->receive(message));
+    CPPUNIT_ASSERT(message.type == ControlChannel::Type::CreateSession);
+    CPPUNIT_ASSERT_EQUAL(7u, message.sequence);
+    CPPUNIT_ASSERT_EQUAL(std::string("0001"), message.session);
+    CPPUNIT_ASSERT_EQUAL(std::string("file:///tmp/a%20b.odt"), message.url);
+    CPPUNIT_ASSERT_EQUAL(1, kit->receive(message));
+    CPPUNIT_ASSERT(message.type == ControlChannel::Type::Down);
+    CPPUNIT_ASSERT_EQUAL(8u, message.sequence);
+    CPPUNIT_ASSERT(message.url.empty());
+    CPPUNIT_ASSERT_EQUAL(0, kit->receive(message));
+
+    // Malformed messages are refused.
+    std::vector<char> encoded;
+    ControlChannel::encode(request, encoded);
+    CPPUNIT_ASSERT(ControlChannel::decode(encoded.data(), encoded.size(), message));
+    CPPUNIT_ASSERT(!ControlChannel::decode(encoded.data(), encoded.size() - 1, message));
+    encoded[4] = 0;
+    CPPUNIT_ASSERT(!ControlChannel::decode(encoded.data(), encoded.size(), message));
+
+    // The other side going away is the end, not a wait.
+    kit.reset();
+    CPPUNIT_ASSERT(broker.poll(0));
+    CPPUNIT_ASSERT_EQUAL(-1, broker.receive(message));
+    CPPUNIT_ASSERT(!broker.send(request));
+}
+
+void WhiteBoxTests::testPrespawnPool()
+{
+    PrespawnPool pool(2, 8, std::chrono::seconds(60));
+    auto now = std::chrono::steady_clock::now();
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), pool.getTarget(now));
+
+    pool.recordSpawn(std::chrono::milliseconds(3000));
+    pool.recordSpawn(std::chrono::milliseconds(1000));
+    CPPUNIT_ASSERT_EQUAL(2500LL, static_cast<long long>(pool.getSpawnTime().count()));
+    pool.recordSpawn(std::chrono::milliseconds(3500));
+    CPPUNIT_ASSERT_EQUAL(2750LL, static_cast<long long>(pool.getSpawnTime().count()));
+
+    // One a second for a while: the pool covers the opens while spawning.
+    for (int i = 0; i < 600; ++i)
+    {
+        now += std::chrono::seconds(1);
+        pool.recordOpen(now, i % 4 != 0);
+    }
+
+    CPPUNIT_ASSERT(std::abs(pool.getRate(now) - 1) < 0.05);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(6), pool.getTarget(now));
+    CPPUNIT_ASSERT_EQUAL(450u, pool.getHits());
+    CPPUNIT_ASSERT_EQUAL(150u, pool.getMisses());
+
+    // Unknown documents only: all generic.
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(6), pool.getTarget(now, DocumentFamily::Type::Generic));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), pool.getTarget(now, DocumentFamily::Type::Text));
+
+    // Back to the minimum when idle.
+    now += std::chrono::minutes(10);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), pool.getTarget(now));
+
+    // The pool is split by the demand, rounded down in favor of generic kits.
+    PrespawnPool families(1, 8, std::chrono::seconds(60));
+    families.recordSpawn(std::chrono::milliseconds(2750));
+    for (int i = 0; i < 600; ++i)
+    {
+        now += std::chrono::seconds(1);
+        families.recordOpen(now, true, i % 4 == 0 ? DocumentFamily::Type::Spreadsheet : DocumentFamily::Type::Text);
+    }
+
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(6), families.getTarget(now));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(4), families.getTarget(now, DocumentFamily::Type::Text));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), families.getTarget(now, DocumentFamily::Type::Spreadsheet));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), families.getTarget(now, DocumentFamily::Type::Drawing));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1), families.getTarget(now, DocumentFamily::Type::Generic));
+
+    // Never over the maximum.
+    for (int i = 0; i < 500; ++i)
+        pool.recordOpen(now, false);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(8), pool.getTarget(now));
+}
+
+void WhiteBoxTests::testDocumentFamily()
+{
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("file:///tmp/hello.odt") == DocumentFamily::Type::Text);
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("http://host/a.b/Sheet.XLSX?access_token=x.y") == DocumentFamily::Type::Spreadsheet);
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("file:///tmp/talk.pptx#slide2") == DocumentFamily::Type::Presentation);
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("file:///tmp/plan.vsd") == DocumentFamily::Type::Drawing);
+
+    // No extension, or none known; nor one found within another.
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("file:///tmp.d/hello") == DocumentFamily::Type::Generic);
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("file:///tmp/hello.") == DocumentFamily::Type::Generic);
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("file:///tmp/hello.pdf") == DocumentFamily::Type::Generic);
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("file:///tmp/hello.dt") == DocumentFamily::Type::Generic);
+    CPPUNIT_ASSERT(DocumentFamily::fromUrl("file:///tmp/hello.od") == DocumentFamily::Type::Generic);
+
+    for (size_t i = 0; i < DocumentFamily::Count; ++i)
+    {
+        const auto type = static_cast<DocumentFamily::Type>(i);
+        CPPUNIT_ASSERT(DocumentFamily::fromName(DocumentFamily::toName(type)) == type);
+        CPPUNIT_ASSERT_EQUAL(type == DocumentFamily::Type::Generic, DocumentFamily::getFactoryUrl(type) == nullptr);
+    }
+
+    CPPUNIT_ASSERT(DocumentFamily::fromName("bogus") == DocumentFamily::Type::Generic);
+}
+
+void WhiteBoxTests::testMemoryGovernor()
+{
+    const std::string psi = "some avg10=12.50 avg60=3.00 avg300=1.00 total=123456\n"
+                            "full avg10=4.00 avg60=1.00 avg300=0.20 total=23456\n";
+    CPPUNIT_ASSERT_EQUAL(12.5, MemoryGovernor::parseStall(psi));
+    CPPUNIT_ASSERT(MemoryGovernor::parseStall("full avg10=4.00\n") < 0);
+    CPPUNIT_ASSERT(MemoryGovernor::parseStall("") < 0);
+
+    CPPUNIT_ASSERT_EQUAL(90.0, MemoryGovernor::parseUsage("900\n", "1000\n"));
+    CPPUNIT_ASSERT(MemoryGovernor::parseUsage("900\n", "max\n") < 0);
+    CPPUNIT_ASSERT(MemoryGovernor::parseUsage("900\n", "9223372036854771712\n") < 0);
+
+    MemoryGovernor governor(20, 90, std::chrono::seconds(10));
+    auto now = std::chrono::steady_clock::now();
+    CPPUNIT_ASSERT(!governor.shouldUnload(now, -1, -1));
+    CPPUNIT_ASSERT(!governor.shouldUnload(now, 10, 80));
+    CPPUNIT_ASSERT(governor.shouldUnload(now, 30, -1));
+
+    // One at a time, for what is freed to show.
+    now += std::chrono::seconds(5);
+    CPPUNIT_ASSERT(!governor.shouldUnload(now, -1, 95));
+    now += std::chrono::seconds(5);
+    CPPUNIT_ASSERT(governor.shouldUnload(now, -1, 95));
+
+    // Disabled.
+    MemoryGovernor off(0, 0);
+    CPPUNIT_ASSERT(!off.shouldUnload(now, 100, 100));
+
+    // A storage and its jailed documents: one linked, one copied, like
+    // those of WOPI.
+    char directory[] = "/tmp/loolunloadXXXXXX";
+    CPPUNIT_ASSERT(mkdtemp(directory) != nullptr);
+    const std::string storage = std::string(directory) + "/storage.odt";
+    const std::string linked = std::string(directory) + "/linked.odt";
+    const std::string copied = std::string(directory) + "/copied.odt";
+    {
+        std::ofstream(storage) << "original";
+        std::ofstream(copied) << "original";
+    }
+    CPPUNIT_ASSERT_EQUAL(0, link(storage.c_str(), linked.c_str()));
+
+    // Saving the modified copy would lose the edits with the jail.
+    {
+        std::ofstream(copied, std::ios::app) << " edited";
+    }
+    CPPUNIT_ASSERT(!MemoryGovernor::canUnload(copied));
+    CPPUNIT_ASSERT(MemoryGovernor::canUnload(linked));
+    CPPUNIT_ASSERT(!MemoryGovernor::canUnload(std::string(directory) + "/gone.odt"));
+
+    unlink(linked.c_str());
+    unlink(copied.c_str());
+    CPPUNIT_ASSERT(!MemoryGovernor::canUnload(storage));
+    unlink(storage.c_str());
+    rmdir(directory);
+}
+
+void WhiteBoxTests::testMemoryCollector()
+{
+    const std::string rollup = "55d0c0a2b000-7ffd5e1f7000 ---p 00000000 00:00 0    [rollup]\n"
+                               "Rss:                1000 kB\n"
+                               "Pss:                 600 kB\n"
+                               "Pss_Anon:            300 kB\n"
+                               "Shared_Clean:        700 kB\n"
+                               "Shared_Dirty:         40 kB\n"
+                               "Private_Clean:        60 kB\n"
+                               "Private_Dirty:       200 kB\n";
+    ProcessMemory memory;
+    CPPUNIT_ASSERT(ProcessMemory::parseSmaps(rollup, memory));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1000), memory.rss);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(600), memory.pss);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(260), memory.uss);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(340), memory.shared);
+
+    // Of each mapping, summed.
+    CPPUNIT_ASSERT(ProcessMemory::parseSmaps(rollup + rollup, memory));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(1200), memory.pss);
+    CPPUNIT_ASSERT(!ProcessMemory::parseSmaps("nothing\n", memory));
+
+    // What a process reports of itself, the same way.
+    const std::string report = ProcessMemory::getReport();
+    pid_t pid = 0;
+    CPPUNIT_ASSERT(ProcessMemory::parseReport(report, pid, memory));
+    CPPUNIT_ASSERT_EQUAL(getpid(), pid);
+    CPPUNIT_ASSERT(memory.pss > 0);
+    CPPUNIT_ASSERT_EQUAL(memory.pss - std::min(memory.uss, memory.pss), memory.shared);
+    CPPUNIT_ASSERT(!ProcessMemory::parseReport("document 1 file:///a.odt", pid, memory));
+
+    // Ourselves, sampled right away, then by the thread.
+    MemoryCollector collector(std::chrono::milliseconds(10));
+    collector.watch(getpid());
+    CPPUNIT_ASSERT(collector.get(getpid()).rss > 0);
+    CPPUNIT_ASSERT(collector.get(getpid()).pss > 0);
+    collector.start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    collector.stop();
+    CPPUNIT_ASSERT(collector.get(getpid()).rss > 0);
+
+    collector.unwatch(getpid());
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), collector.get(getpid()).rss);
+
+    // A process that can't be read keeps what it reported.
+    const pid_t unreadable = 0x7ffffff0;
+    collector.report(unreadable, memory);
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), collector.get(unreadable).pss);
+    collector.watch(unreadable);
+    collector.report(unreadable, memory);
+    collector.collect();
+    CPPUNIT_ASSERT_EQUAL(memory.pss, collector.get(unreadable).pss);
+    CPPUNIT_ASSERT_EQUAL(memory.shared, collector.get(unreadable).shared);
+}
+
+void WhiteBoxTests::testWorkerPool()
+{
+    WorkerPool pool(2, 2, "test");
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool released = false;
+    size_t blocked = 0;
+    size_t served = 0;
+
+    // Documents opening, waiting for kits that take their time.
+    for (int i = 0; i < 4; ++i)
+    {
+        pool.post([&]()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ++blocked;
+                cv.notify_all();
+                cv.wait_for(lock, std::chrono::seconds(10), [&released]() { return released; });
+                --blocked;
+                cv.notify_all();
+            }, true);
+    }
+
+    // The input of the documents already open is still handled.
+    for (int i = 0; i < 20; ++i)
+    {
+        pool.post([&]()
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ++served;
+                cv.notify_all();
+            });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    CPPUNIT_ASSERT(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return served == 20 && blocked == 2; }));
+    CPPUNIT_ASSERT(!released);
+
+    // The blocking tasks take only their own threads.
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(2), pool.getQueuedCount(true));
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(0), pool.getQueuedCount(false));
+
+    released = true;
+    cv.notify_all();
+    CPPUNIT_ASSERT(cv.wait_for(lock, std::chrono::seconds(5), [&]() { return blocked == 0 && pool.getQueuedCount(true) == 0; }));
+    lock.unlock();
+
+    pool.stop();
+    pool.post([&served]() { ++served; });
+    CPPUNIT_ASSERT_EQUAL(static_cast<size_t>(20), served);
+}
+
+CPPUNIT_TEST_SUITE_REGISTRATION(WhiteBoxTests);
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */